@@ -32,6 +32,43 @@
 //	HFS data handler will be writing data from that buffer into a local file. This reading and
 //	writing continues until the file is completely transferred.
 //
+//	We actually use a small ring of buffers (kNumDataBuffers of them), so that the URL data handler
+//	can be filling some buffers while the HFS data handler is emptying others. Each buffer remembers
+//	the file offset of the chunk it holds, so reads and writes for different chunks can overlap.
+//
+//	If the server limits the bandwidth of each connection, you can call QTFileTrans_SetNumSegments to
+//	split the file into several byte ranges, each read in parallel by its own URL data handler; all the
+//	ranges are written, at their own offsets, by the same HFS data handler.
+//
+//	If the same file is on several servers, call QTFileTrans_CopyMirroredFileToLocalFile with all of their URLs:
+//	each mirror then reads a range of its own (we leave out any mirror whose file isn't the same size as the
+//	first one's). We time the reads from each mirror; when a mirror finishes its range, it takes over part of
+//	the range of the one with the most left, in proportion to how much faster it is, and a mirror whose reads
+//	fail passes whatever it hasn't read to the others. QTFileTrans_GetMirrorStats tells you how each one did.
+//
+//	If you call QTFileTrans_SetResumable, an interrupted transfer can later be picked up where it left off:
+//	we keep the local file and a small checkpoint file listing the ranges that have been written, and the
+//	next transfer of the same URL to the same file starts reading at the first missing byte.
+//
+//	If you call QTFileTrans_SetPreallocate, we reserve space for the whole local file (contiguous space,
+//	if we can get it) as soon as we know the size of the remote file, so that writes land in space that's
+//	already allocated.
+//
+//	If you call QTFileTrans_SetWriteCoalescing, we don't write each chunk as soon as it's read; instead, we
+//	copy consecutive chunks into a few larger blocks and write each block once it's full. The blocks end on
+//	multiples of the local volume's allocation block size, so the disk sees a few large, aligned writes no
+//	matter how small the reads are.
+//
+//	To send a local file to an ftp or http server, call QTFileTrans_CopyLocalFileToRemoteFile. An upload runs
+//	through the same buffer ring as a download, with the roles reversed: the HFS data handler reads the local
+//	file and the URL data handler writes it. (In an upload's statistics, the network and disk times therefore
+//	trade places.)
+//
+//	All of the state for a single transfer (the data handlers, the buffer ring, and the byte counts)
+//	lives in a transfer record, which you allocate by calling QTFileTrans_NewTransfer. A pointer to
+//	the buffer record is passed as the reference constant to our completion routines, and each buffer
+//	record points back to the transfer that owns it; so any number of transfers can run at once.
+//
 //	To transfer a remote file to the local machine, call the QTFileTrans_CopyRemoteFileToLocalFile
 //	function defined here. It does all the necessary set-up and schedules the first read request;
 //	all subsequent write and read requests are scheduled by the read and write completion routines.
@@ -39,20 +76,123 @@
 //	calling DataHTask periodically; on the Mac, you can put code like this in your main event loop:
 //
 //		// if we're done, close down the data handlers
-//		if (gDoneTransferring)
-//			QTFileTrans_CloseDownHandlers();
+//		if (QTFileTrans_IsDone(myTransfer))
+//			QTFileTrans_CloseDownHandlers(myTransfer);
 //
 //		// give the data handlers some time, if they are still active
-//		if (gDataReader != NULL)
-//			DataHTask(gDataReader);
-//		
-//		if (gDataWriter != NULL)
-//			DataHTask(gDataWriter);
+//		QTFileTrans_Task(myTransfer);
 //	
 //	On Windows, you could install a timer that calls this code at a specified interval. (On either
 //	platform, you should probably also implement some way of making sure that the user doesn't quit
 //	the application while a transfer is underway.)
 //
+//	To run many transfers side by side, create a transfer manager by calling QTFileTrans_NewManager,
+//	queue transfers with QTFileTrans_ManagerAddTransfer, and call QTFileTrans_ManagerTask periodically
+//	instead of QTFileTrans_Task. The manager keeps at most the specified number of transfers active at
+//	once, and hands back finished transfers through QTFileTrans_ManagerGetFinished.
+//
+//	The data buffers come from a pool shared by all transfers (see QTFileTransferPool.c), so a program that
+//	runs many transfers stops allocating memory for them once it's warmed up. Call QTFileTrans_SetPoolWatermarks
+//	to control how many free buffers the pool hangs on to, and QTFileTrans_GetPoolStats to see how it's doing.
+//
+//	To keep big transfers from crowding out the ones the user is waiting for, you can limit the bandwidth
+//	of each transfer (QTFileTrans_SetRateLimit) and of all of them together (QTFileTrans_SetGlobalRateLimit),
+//	and give each transfer a priority class (QTFileTrans_SetPriority). The limits are token buckets; a buffer
+//	whose next read they don't allow yet waits until QTFileTrans_Idle (or QTFileTrans_Task) can issue it.
+//
+//	A read or write that fails doesn't end the transfer right away: we wait a moment and try the same chunk
+//	again, waiting twice as long after each failure, up to a limit (see QTFileTrans_SetRetryPolicy). Only
+//	errors that retrying can't fix (a full disk, say) or a chunk that keeps failing end the transfer; we
+//	then let the requests still outstanding finish before QTFileTrans_IsDone returns true, and
+//	QTFileTrans_GetStatus returns the error that ended the transfer.
+//
+//	Call QTFileTrans_Cancel to stop a transfer, or QTFileTrans_SetDeadline to have it stop by itself if it isn't
+//	done in time. Either way, we stop issuing reads right away and ask the URL data handlers to cancel the ones
+//	they're working on (with DataHFinishData); once every outstanding request has completed, QTFileTrans_IsDone
+//	returns true, and QTFileTrans_Idle closes the data handlers and gives the buffers back to the pool, so the
+//	bandwidth and memory go to the transfers that are still running. QTFileTrans_CloseDownHandlers itself no
+//	longer closes data handlers out from under their requests: it cancels them and waits for them to drain.
+//
+//	Instead of polling QTFileTrans_IsDone, you can install a done routine with QTFileTrans_SetDoneProc; we call
+//	it (from QTFileTrans_Task or QTFileTrans_Idle, on the thread running the transfer) as soon as the transfer is
+//	done, with its final status. That's the hook to build continuation-style code on: QTFileTransfer.hpp uses it,
+//	together with a callback sink, to let a C++20 coroutine co_await each chunk of the file and the end of the
+//	transfer, without allocating anything per transfer or per chunk.
+//
+//	Call QTFileTrans_GetStats at any time to see how a transfer is doing: how many bytes it has read and
+//	written, its current and average throughput, histograms of how long its reads and writes take, and
+//	how much of its time it has spent waiting on the network, on the disk, and on you (to call DataHTask).
+//	QTFileTrans_ExportStats writes the same information out as JSON.
+//
+//	To see each call behind those numbers, call QTFileTrans_StartTracing: every transfer then records an event
+//	each time it opens its data handlers, asks for the size of the remote file, issues a read or a write, sees
+//	one complete, and closes its data handlers. QTFileTrans_ExportTrace writes the events out as a timeline in
+//	the Chrome trace event format. The tracing code is in QTFileTransferTrace.c.
+//
+//	To transfer a long list of (small) files, create a batch by calling QTFileTrans_NewBatch and call
+//	QTFileTrans_BatchTask periodically. A batch reuses the same data handlers, buffers, and routine
+//	descriptors for every file, and starts opening each file while the one before it finishes writing.
+//
+//	Rather than calling QTFileTrans_Task or QTFileTrans_ManagerTask yourself, you can just call
+//	QTFileTrans_Idle, which services every transfer and every manager there is. It only tasks the data
+//	handlers that have requests outstanding, and it returns the number of ticks you can wait before
+//	calling it again: zero while data is flowing, and longer and longer intervals (up to kMaxIdleTicks)
+//	while nothing is happening. On the Mac, pass that value as the sleep time to WaitNextEvent; on
+//	Windows, use it to set your timer interval. If you install a wake-up routine with
+//	QTFileTrans_SetWakeUpProc, we call it when a completion routine fires while you're waiting, so you
+//	can post an event (or a message) and call QTFileTrans_Idle right away.
+//
+//	On Windows, you can instead hand a transfer to a worker thread of its own by calling
+//	QTFileTrans_StartOnWorkerThread; the worker thread opens, tasks, and closes the data handlers, and
+//	passes progress and completion back to you through a lock-free queue (see QTFileTrans_GetWorkerEvent).
+//
+//	If the URL you pass to QTFileTrans_CopyRemoteFileToLocalFile is a file URL, we don't bother with the
+//	data handlers at all; instead, we copy the file with the fastest means the operating system offers
+//	(see QTFileTrans_CopyFileDirect). Call QTFileTrans_SetDirectCopy to turn this off.
+//
+//	Setting up the buffer ring costs more than copying a file of a few kilobytes, so if DataHGetFileSize says the
+//	remote file is no bigger than kDefaultSmallFileSize, we copy it the simple way NOTE (2) describes: one call to
+//	DataHGetData and one call to DataHPutData, with no completion routines and no calls to DataHTask (see
+//	QTFileTrans_CopySmallFile). Such a copy is synchronous; call QTFileTrans_SetSmallFileSize to change the size
+//	or to turn this off.
+//
+//	Before the first byte moves, a transfer into a local file deletes any file that's already there, creates a new
+//	one, and makes an alias for it; on a network volume, that's enough traffic to notice. Call
+//	QTFileTrans_SetOverwriteMode to have the transfer overwrite an existing file of the right type and creator in
+//	place instead (setting its size once, up front), or to have it write into a temporary file next to the local
+//	file and swap that in only once the transfer is done, so that no one ever opens a partly written file. Either
+//	way, we keep the aliases of the files we've transferred into recently, so transferring into the same file
+//	again doesn't cost a new alias.
+//
+//	When a large remote file changes only here and there between versions, there's no need to read all of it
+//	again. Give the transfer a manifest of the remote file (a digest of each block of it) with
+//	QTFileTrans_SetSyncManifest, and the transfer compares the blocks of the local file you already have with the
+//	manifest, reads just the blocks that differ, and writes them into place; the blocks that match are never
+//	read. QTFileTrans_MakeSyncManifest makes a manifest from a local file, for whoever publishes the remote one.
+//
+//	By default, the data goes into the local file you specify. Call QTFileTrans_SetMemorySink to collect it
+//	in a handle instead (get the handle with QTFileTrans_GetMemorySinkData), or QTFileTrans_SetCallbackSink
+//	to have each chunk passed, in order, to a routine of your own as soon as it arrives; either way, there's
+//	no local file, so you can pass NULL for the file specification.
+//
+//	A routine that consumes the data as it goes (a media parser, say) shouldn't have to wait for each chunk to
+//	be read. Call QTFileTrans_SetReadahead to give the transfer a readahead window: we size the buffer ring so
+//	that up to that many bytes are being read, or are waiting in their buffers, ahead of the chunk the routine
+//	is to get next. The ring is also what bounds the memory: a buffer is only reused once its chunk has been
+//	passed along. So when the routine can't take any more for now, it returns kQTFileTransSinkBusyErr; its
+//	chunk (and all the ones after it) stays in its buffer, the reads stop once the ring is full, and we offer
+//	the routine the same chunk again each time the transfer is tasked, or right away if you call
+//	QTFileTrans_ResumeSink.
+//
+//	If you call QTFileTrans_SetCacheDirectory, the files you download are also kept in a cache on disk, and
+//	the next transfer of the same URL copies the file out of the cache instead of reading it from the server,
+//	as long as the remote file is still the same size and has the same validator (see
+//	QTFileTrans_SetCacheValidator). The cache code is in QTFileTransferCache.c.
+//
+//	Call QTFileTrans_SetDigest to have a CRC-32, MD5, or SHA-256 digest of the data computed while each chunk
+//	is still in its buffer (and, if you like, checked against the digest you expect); get the result with
+//	QTFileTrans_GetDigest once the transfer is done. The digest code is in QTFileTransferDigest.c.
+//
 //	NOTES:
 //
 //	*** (1) ***
@@ -79,23 +219,143 @@
 //	*** (4) ***
 //	In some instances, DataHGetFileSize is not able to determine the size of the file to be downloaded
 //	(for example, an FTP server might not support the SIZE command). A more general strategy therefore
-//	would be to download a file until you get eofErr. Implementing this strategy is left as an exercise
-//	for the reader.
+//	would be to download a file until you get eofErr. We do exactly that if DataHGetFileSize fails, or if
+//	you call QTFileTrans_SetStreaming: we keep reading until the URL data handler reports eofErr, and then
+//	find out from the data handler how much data there actually was. While the size is unknown, we grow
+//	the local file in geometrically larger steps, so the HFS data handler isn't extending it a chunk at a time.
 //
 //////////
 
 
 #include "QTFileTransfer.h"
 
-//global variables
-Ptr								gDataBuffer = NULL;			// buffer that holds data being transferred
-ComponentInstance				gDataReader = NULL;			// the data handler that reads data from the URL
-ComponentInstance				gDataWriter = NULL;			// the data handler that writes data to an HFS file
-DataHCompletionUPP				gReadDataHCompletionUPP = NULL;
-DataHCompletionUPP				gWriteDataHCompletionUPP = NULL;
-long							gBytesToTransfer = 0L;		// the number of bytes to transfer
-long							gBytesTransferred = 0L;		// the number of bytes already transferred
-Boolean							gDoneTransferring = false;	// are we done transferring data?
+#if TARGET_OS_WIN32
+#include <windows.h>
+#endif
+
+// global variables used by the scheduler
+QTFileTransfer					gSchedTransfers = NULL;		// every transfer that's underway
+QTFileTransManager				gSchedManagers = NULL;		// every transfer manager
+QTFileTransBatch				gSchedBatches = NULL;		// every batch
+QTFileTransBucketRecord			gSchedRateLimit;			// the limit on the total bandwidth of the transfers the scheduler knows about
+long							gSchedNumThrottled[kNumPriorities];	// the number of buffers of those transfers waiting for the rate limits, by priority
+long							gSchedIdleTicks = 0L;		// the interval QTFileTrans_Idle last asked for
+long							gSchedNumCompletions = 0L;	// the number of completion routines that have fired since the last idle
+Boolean							gSchedInIdle = false;		// are we inside QTFileTrans_Idle?
+Boolean							gSchedWakeUpSent = false;	// have we called the wake-up routine since the last idle?
+QTFileTransWakeUpProcPtr		gSchedWakeUpProc = NULL;	// the application's wake-up routine
+long							gSchedWakeUpRefCon = 0L;	// the reference constant for the wake-up routine
+
+// global variables used by the alias cache
+QTFileTransAliasRecord			gAliasCache[kAliasCacheSize];	// the aliases of the local files we've transferred into most recently
+unsigned long					gAliasNextStamp = 0L;		// the use stamp of the next lookup
+volatile long					gAliasCacheLock = 0L;		// nonzero while some thread is using the alias cache
+
+
+//////////
+//
+// QTFileTrans_NewTransfer
+// Allocate a new transfer record, which holds all the state for a single file transfer.
+//
+//////////
+
+OSErr QTFileTrans_NewTransfer (QTFileTransfer *theTransfer)
+{
+	QTFileTransfer				myTransfer = NULL;
+	short						myIndex;
+
+	if (theTransfer == NULL)
+		return(paramErr);
+
+	*theTransfer = NULL;
+
+	myTransfer = (QTFileTransfer)NewPtrClear(sizeof(QTFileTransferRecord));
+	if (myTransfer == NULL)
+		return(MemError());
+
+	myTransfer->fTraceID = QTFileTrans_NewTraceID();
+
+	// each buffer in the ring points back to the transfer that owns it, so that our completion
+	// routines can recover the transfer from the buffer record passed as their reference constant
+	for (myIndex = 0; myIndex < kMaxNumDataBuffers; myIndex++)
+		myTransfer->fDataBuffers[myIndex].fTransfer = myTransfer;
+
+	// so do the coalescing blocks
+	for (myIndex = 0; myIndex < kMaxCoalesceBlocks; myIndex++) {
+		myTransfer->fCoalesceBlocks[myIndex].fTransfer = myTransfer;
+		myTransfer->fCoalesceBlocks[myIndex].fIsBlock = true;
+	}
+
+	myTransfer->fNumBuffers = kNumDataBuffers;
+	myTransfer->fRingNumBuffers = kNumDataBuffers;
+	myTransfer->fRingBufferSize = kDataBufferSize;
+	myTransfer->fReadahead = 0L;
+	myTransfer->fMaxNumSegments = 1;
+	myTransfer->fSegmentLimit = 1;
+	myTransfer->fNumMirrors = 0;
+	myTransfer->fMirrorsPending = false;
+
+	myTransfer->fStatus = noErr;
+	myTransfer->fDoneTransferring = false;
+
+	// by default, every read asks for a full buffer's worth of data
+	myTransfer->fAdaptiveChunking = false;
+	myTransfer->fChunkSize = kDataBufferSize;
+	myTransfer->fMinChunkSize = kMinAdaptiveChunkSize;
+	myTransfer->fMaxChunkSize = kMaxAdaptiveChunkSize;
+	myTransfer->fTargetReadTime = kTargetReadMSecs * 1000L;
+
+	// by default, we copy file URLs directly, copy small files synchronously, and use the download cache (if there is one)
+	myTransfer->fDirectCopy = true;
+	myTransfer->fSmallFileSize = kDefaultSmallFileSize;
+	myTransfer->fUseCache = true;
+
+	// by default, a transfer has no bandwidth limit of its own, and normal priority
+	QTFileTrans_InitBucket(&myTransfer->fRateLimit, 0L, 0L);
+	myTransfer->fPriority = kQTFileTransPriorityNormal;
+
+	// by default, we retry a failed chunk a few times, waiting longer each time
+	myTransfer->fMaxRetries = kDefaultMaxRetries;
+	myTransfer->fRetryDelay = kDefaultRetryMSecs * 1000L;
+	myTransfer->fMaxRetryDelay = kMaxRetryMSecs * 1000L;
+
+	// by default, the data goes into a local file (which replaces any file already there), and we don't compute a digest of it
+	myTransfer->fSinkType = kQTFileTransSinkFile;
+	myTransfer->fOverwriteMode = kQTFileTransOverwriteReplace;
+	QTFileTrans_DigestInit(&myTransfer->fDigest, kQTFileTransDigestNone);
+
+	*theTransfer = myTransfer;
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_DisposeTransfer
+// Close down the data handlers for the specified transfer (if they are still open) and dispose of the transfer record.
+//
+//////////
+
+void QTFileTrans_DisposeTransfer (QTFileTransfer theTransfer)
+{
+	if (theTransfer == NULL)
+		return;
+
+	// a worker thread owns the data handlers of its transfer, so let it close them down
+	QTFileTrans_StopWorkerThread(theTransfer);
+	QTFileTrans_CloseDownHandlers(theTransfer);
+
+	if (theTransfer->fURL != NULL)
+		DisposePtr(theTransfer->fURL);
+
+	QTFileTrans_DisposeMirrors(theTransfer);
+
+	// the data collected by a memory sink is ours until someone calls QTFileTrans_GetMemorySinkData
+	if (theTransfer->fSinkHandle != NULL)
+		DisposeHandle(theTransfer->fSinkHandle);
+
+	DisposePtr((Ptr)theTransfer);
+}
 
 
 //////////
@@ -105,24 +365,115 @@ Boolean							gDoneTransferring = false;	// are we done transferring data?
 //
 //////////
 
-OSErr QTFileTrans_CopyRemoteFileToLocalFile (char *theURL, FSSpecPtr theFSSpecPtr)
+OSErr QTFileTrans_CopyRemoteFileToLocalFile (QTFileTransfer theTransfer, char *theURL, FSSpecPtr theFSSpecPtr)
 {
 	Handle						myReaderRef = NULL;			// data reference for the remote file
 	Handle						myWriterRef = NULL;			// data reference for the local file
 	Size						mySize = 0;
+	SInt64						myResumeOffset = 0;			// the offset at which to resume an interrupted transfer
+	SInt64						myCheckpointSize = 0;		// the size of the remote file, according to the checkpoint
+	SInt64						myCacheSize = -1;			// the size of the cache's copy of the file, if we have to check it
+	Boolean						myTruncate = false;
+	Boolean						myReuseFile = false;		// do we overwrite the existing local file in place?
 	ComponentResult				myErr = badComponentType;
 
+	if (theTransfer == NULL)
+		return(paramErr);
+
+	QTFileTrans_ResetStats(theTransfer);
+	theTransfer->fDoneNotified = false;
+
+	// start from the number of segments the application asked for; anything below that lowers the limit
+	// for this transfer only, and leaves the application's setting alone
+	theTransfer->fSegmentLimit = theTransfer->fMaxNumSegments;
+
+	// the mirrors set up by QTFileTrans_CopyMirroredFileToLocalFile are for this transfer only
+	if (!theTransfer->fMirrorsPending)
+		QTFileTrans_DisposeMirrors(theTransfer);
+	theTransfer->fMirrorsPending = false;
+
+	// in atomic mode, everything below goes into a temporary file next to the local file, which we swap in for the
+	// local file once the transfer is done; until then, anyone who opens the local file sees the old one (or none)
+	theTransfer->fTempFilePending = false;
+	if ((theTransfer->fOverwriteMode == kQTFileTransOverwriteAtomic) && (theTransfer->fSinkType == kQTFileTransSinkFile) && (theFSSpecPtr != NULL)) {
+		myErr = QTFileTrans_MakeSuffixedSpec(theFSSpecPtr, kTempFileSuffix, &theTransfer->fTempFileSpec);
+		if (myErr != noErr) {
+			theTransfer->fStatus = (OSErr)myErr;
+			QTFileTrans_ClearRequestSettings(theTransfer);
+			return((OSErr)myErr);
+		}
+
+		theTransfer->fTargetFileSpec = *theFSSpecPtr;
+		theTransfer->fTempFilePending = true;
+		theFSSpecPtr = &theTransfer->fTempFileSpec;
+	}
+
+	//////////
+	//
+	// copy local files directly
+	//
+	//////////
+
+	// if the "remote" file is really a file on a local or LAN volume, there's no need to push every byte
+	// through the data handlers; we let the operating system copy it in the fastest way it knows, and fall
+	// back on the data handlers only if we can't (in which case QTFileTrans_CopyFileDirect returns unimpErr);
+	// the operating system's copy doesn't show us the data, so we don't use it if we're computing a digest
+	if (theTransfer->fDirectCopy && (theTransfer->fSinkType == kQTFileTransSinkFile) &&
+			(theTransfer->fDigest.fType == kQTFileTransDigestNone) && QTFileTrans_IsFileURL(theURL)) {
+		myErr = QTFileTrans_CopyFileDirect(theTransfer, theURL, theFSSpecPtr);
+		if (myErr != unimpErr) {
+			theTransfer->fStats.fBytesRead = theTransfer->fBytesTransferred;
+			theTransfer->fStats.fBytesWritten = theTransfer->fBytesTransferred;
+			theTransfer->fStats.fElapsedTime = QTFileTrans_GetMicroseconds() - theTransfer->fStateTime;
+			theTransfer->fStatus = (OSErr)myErr;
+			theTransfer->fDoneTransferring = (myErr == noErr);
+			myErr = QTFileTrans_FinishTempFile(theTransfer);
+			QTFileTrans_ClearRequestSettings(theTransfer);
+			if (myErr == noErr)
+				QTFileTrans_NoteDone(theTransfer);
+			return((OSErr)myErr);
+		}
+	}
+
+	//////////
+	//
+	// look for the file in the download cache
+	//
+	//////////
+
+	// if the cache has a copy of the file that we checked recently enough, we don't need the network at all;
+	// if it has a copy we have to check first, we decide once we know the size of the remote file
+	theTransfer->fCacheStore = false;
+	if (QTFileTrans_UsesCache(theTransfer, theURL, theFSSpecPtr)) {
+		QTFileTrans_CacheKeyForURL(theURL, theTransfer->fCacheKey);
+
+		// (in atomic mode, the temporary file is gone by the time we add the file to the cache)
+		theTransfer->fCacheFileSpec = theTransfer->fTempFilePending ? theTransfer->fTargetFileSpec : *theFSSpecPtr;
+
+		if (QTFileTrans_ServeFromCache(theTransfer, theFSSpecPtr, -1, &myCacheSize) == noErr) {
+			myErr = QTFileTrans_FinishTempFile(theTransfer);
+			QTFileTrans_ClearRequestSettings(theTransfer);
+			if (myErr == noErr)
+				QTFileTrans_NoteDone(theTransfer);
+			return((OSErr)myErr);
+		}
+
+		theTransfer->fCacheStore = true;
+	}
+
+	QTFileTrans_Trace(theTransfer, kQTFileTransTraceOpenStart, 0, 0, noErr);
+
 	//////////
 	//
 	// create a data reference for the remote file
 	//
 	//////////
-	
+
 	// get the size of the URL, plus the terminating null byte
 	mySize = (Size)strlen(theURL) + 1;
 	if (mySize == 0)
 		goto bail;
-	
+
 	// allocate a new handle
 	myReaderRef = NewHandleClear(mySize);
     if (myReaderRef == NULL)
@@ -136,205 +487,6318 @@ OSErr QTFileTrans_CopyRemoteFileToLocalFile (char *theURL, FSSpecPtr theFSSpecPt
 	// create a data reference for the local file
 	//
 	//////////
-	
-	// delete the target local file, if it already exists;
-	// if it doesn't exist yet, we'll get an error (fnfErr), which we just ignore
-	FSpDelete(theFSSpecPtr);
-	
-	myWriterRef = NewHandleClear(sizeof(Handle));
-    if (myWriterRef == NULL)
-    	goto bail;
 
-	// create the local file
-	myErr = FSpCreate(theFSSpecPtr, kTransFileCreator, kTransFileType, smSystemScript);
-	if (myErr != noErr)
-		goto bail;
+	theTransfer->fNumWrittenRanges = 0;
+	theTransfer->fCheckpointBytes = 0L;
+	theTransfer->fSinkStatus = noErr;
+	theTransfer->fSinkBusy = false;
+	theTransfer->fSinkNextOffset = 0;
+	theTransfer->fSinkDataSize = 0;
+	QTFileTrans_DigestInit(&theTransfer->fDigest, theTransfer->fDigest.fType);
 
-	myErr = QTNewAlias(theFSSpecPtr, (AliasHandle *)&myWriterRef, true);
-	if (myErr != noErr)
-		goto bail;
+	if (theTransfer->fSinkType == kQTFileTransSinkFile) {
+		// in place mode, an existing local file of the right kind is simply overwritten, so we can skip
+		// deleting it and creating it again (which is slow on a network volume)
+		myReuseFile = QTFileTrans_CanOverwriteInPlace(theTransfer, theFSSpecPtr);
+
+		if (theTransfer->fResumable) {
+			// if a checkpoint from an earlier, interrupted transfer is lying around, find out how much of the
+			// file we already have; we keep the local file, so we can pick up where that transfer left off
+			QTFileTrans_MakeCheckpointSpec(theFSSpecPtr, &theTransfer->fCheckpointSpec);
+			myResumeOffset = QTFileTrans_ReadCheckpoint(theTransfer, &myCheckpointSize);
+		} else if (!myReuseFile) {
+			// delete the target local file, if it already exists;
+			// if it doesn't exist yet, we'll get an error (fnfErr), which we just ignore
+			FSpDelete(theFSSpecPtr);
+		}
+
+		// create the local file; if we're resuming, it may already exist
+		if (!myReuseFile) {
+			myErr = FSpCreate(theFSSpecPtr, kTransFileCreator, kTransFileType, smSystemScript);
+			if ((myErr == dupFNErr) && theTransfer->fResumable)
+				myErr = noErr;
+			if (myErr != noErr)
+				goto bail;
+		}
+
+		// the alias of a local file we've transferred into before is still good, so we use the same one again
+		myErr = QTFileTrans_GetLocalAlias(theFSSpecPtr, (AliasHandle *)&myWriterRef);
+		if (myErr != noErr)
+			goto bail;
+
+	} else if (theTransfer->fSinkType == kQTFileTransSinkMemory) {
+		// start with a small handle; it grows as the data arrives (or all at once, if we learn the file's size)
+		if (theTransfer->fSinkHandle == NULL)
+			theTransfer->fSinkHandle = NewHandle(kMinMemorySinkSize);
+		if (theTransfer->fSinkHandle == NULL) {
+			myErr = memFullErr;
+			goto bail;
+		}
+
+	}
+
+	// a callback sink and a digest get the chunks in order, so any chunk that arrives early has to wait in its
+	// buffer; with more than one segment, a later segment could fill every buffer while we wait for an earlier one
+	if (QTFileTrans_NeedsOrderedData(theTransfer))
+		theTransfer->fSegmentLimit = 1;
 
 	//////////
 	//
 	// find and open the Apple URL and HFS data handlers; connect the data references to them
 	//
 	//////////
-	
-	gDataReader = OpenComponent(GetDataHandler(myReaderRef, URLDataHandlerSubType, kDataHCanRead));
-	if (gDataReader == NULL)
-		goto bail;
 
-	gDataWriter = OpenComponent(GetDataHandler(myWriterRef, rAliasType, kDataHCanWrite));
-	if (gDataWriter == NULL)
-		goto bail;
-		
+	// if an earlier transfer left its data handlers open for us, connect them to the new files instead
+	// of finding and opening new ones
+	if (theTransfer->fPooledReader != NULL) {
+		theTransfer->fDataReader = theTransfer->fPooledReader;
+		theTransfer->fPooledReader = NULL;
+	} else {
+		theTransfer->fDataReader = QTFileTrans_OpenReader(theTransfer, myReaderRef);
+		if (theTransfer->fDataReader == NULL)
+			goto bail;
+	}
+
+	if (theTransfer->fSinkType == kQTFileTransSinkFile) {
+		if (theTransfer->fPooledWriter != NULL) {
+			theTransfer->fDataWriter = theTransfer->fPooledWriter;
+			theTransfer->fPooledWriter = NULL;
+		} else {
+			theTransfer->fDataWriter = OpenComponent(GetDataHandler(myWriterRef, rAliasType, kDataHCanWrite));
+			if (theTransfer->fDataWriter == NULL)
+				goto bail;
+		}
+	}
+
 	// set the data reference for the URL data handler
-	myErr = DataHSetDataRef(gDataReader, myReaderRef);
+	myErr = DataHSetDataRef(theTransfer->fDataReader, myReaderRef);
 	if (myErr != noErr)
 		goto bail;
-	
+
 	// set the data reference for the HFS data handler
-	myErr = DataHSetDataRef(gDataWriter, myWriterRef);
-	if (myErr != noErr)
-		goto bail;
-	
+	if (theTransfer->fDataWriter != NULL) {
+		myErr = DataHSetDataRef(theTransfer->fDataWriter, myWriterRef);
+		if (myErr != noErr)
+			goto bail;
+	}
+
 	//////////
 	//
-	// allocate a data buffer; the URL data handler copies data into this buffer,
-	// and the HFS data handler copies data out of it
+	// allocate a ring of data buffers; the URL data handler copies data into these buffers,
+	// and the HFS data handler copies data out of them; while one buffer is being written,
+	// the others can be filled by the URL data handler
 	//
 	//////////
-	
-	gDataBuffer = NewPtrClear(kDataBufferSize);
-	myErr = MemError();
+
+	myErr = QTFileTrans_PrepareBuffers(theTransfer);
 	if (myErr != noErr)
 		goto bail;
-		
+
 	//////////
 	//
 	// connect to the remote and local files
 	//
 	//////////
-	
+
 	// open a read-only path to the remote data reference
-	myErr = DataHOpenForRead(gDataReader);
+	myErr = DataHOpenForRead(theTransfer->fDataReader);
 	if (myErr != noErr)
 		goto bail;
 
-	// get the size of the remote file
-	myErr = DataHGetFileSize(gDataReader, &gBytesToTransfer); 
-	if (myErr != noErr)
-		goto bail;
-	
-	// open a write-only path to the local data reference
-	myErr = DataHOpenForWrite(gDataWriter);
-	if (myErr != noErr)
-		goto bail;
-		
+	// get the size of the remote file; if the data handler can't tell us (or we've been asked not to ask),
+	// we'll just read until we hit the end of the file
+	theTransfer->fSizeKnown = false;
+	theTransfer->fPreextendedSize = 0L;
+	theTransfer->fPreallocated = false;
+
+	if (!theTransfer->fStreaming) {
+		OSErr				mySizeErr;
+
+		mySizeErr = QTFileTrans_GetRemoteFileSize(theTransfer->fDataReader, &theTransfer->fBytesToTransfer);
+		QTFileTrans_Trace(theTransfer, kQTFileTransTraceGetFileSize, 0, (mySizeErr == noErr) ? theTransfer->fBytesToTransfer : -1, mySizeErr);
+		if (mySizeErr == noErr)
+			theTransfer->fSizeKnown = true;
+	}
+
+	if (!theTransfer->fSizeKnown) {
+		theTransfer->fBytesToTransfer = kUnknownFileSize;
+
+		// we can't split a file of unknown size into segments, or tell whether a checkpoint still applies
+		theTransfer->fSegmentLimit = 1;
+		myResumeOffset = 0;
+	}
+
+	// we can resume only if the remote file is the same size it was when we saved the checkpoint
+	if ((myResumeOffset > 0) && ((myCheckpointSize != theTransfer->fBytesToTransfer) || (myResumeOffset > theTransfer->fBytesToTransfer)))
+		myResumeOffset = 0;
+
+	// a copy of the file in the download cache is still good if it's the same size as the remote file;
+	// in that case, we're done already, so we put the data handlers aside without reading anything
+	if ((myCacheSize >= 0) && theTransfer->fSizeKnown) {
+		if (QTFileTrans_ServeFromCache(theTransfer, theFSSpecPtr, theTransfer->fBytesToTransfer, &myCacheSize) == noErr) {
+			QTFileTrans_Trace(theTransfer, kQTFileTransTraceOpenEnd, 0, 0, noErr);
+			QTFileTrans_ReleaseHandlers(theTransfer, true);
+			myErr = noErr;
+			goto bail;
+		}
+	}
+
+	// in sync mode, find out which blocks of the local file differ from the remote file; we read only those
+	if (QTFileTrans_PrepareSync(theTransfer, theFSSpecPtr) == noErr)
+		myResumeOffset = 0;
+
+	// a digest covers the whole file, so digest the part we already have before reading the rest;
+	// if we can't read that part back, we start over
+	if ((myResumeOffset > 0) && (theTransfer->fDigest.fType != kQTFileTransDigestNone)) {
+		if (QTFileTrans_DigestLocalFile(theTransfer, theFSSpecPtr, myResumeOffset) != noErr) {
+			QTFileTrans_DigestInit(&theTransfer->fDigest, theTransfer->fDigest.fType);
+			myResumeOffset = 0;
+		}
+	}
+
+	// the data before the resume offset is already in the local file;
+	// divide the rest of the file into segments, each read by its own URL data handler
+	theTransfer->fBytesTransferred = myResumeOffset;
+	theTransfer->fCheckpointBytes = myResumeOffset;
+	theTransfer->fNumWrittenRanges = 0;
+	QTFileTrans_AddWrittenRange(theTransfer, 0, myResumeOffset);
+	theTransfer->fSinkNextOffset = myResumeOffset;
+	QTFileTrans_OpenSegments(theTransfer, myReaderRef);
+
+	// the blocks that already match are as good as transferred
+	theTransfer->fBytesTransferred += theTransfer->fSyncBytesMatched;
+
+	if (theTransfer->fDataWriter != NULL) {
+		// get the local file ready before the HFS data handler opens it: if we kept an existing local file that
+		// we can't resume, throw away its contents; and reserve space for the whole file, if we've been asked to
+		myTruncate = (theTransfer->fResumable || myReuseFile) && (myResumeOffset == 0);
+		if (QTFileTrans_PrepareLocalFile(theTransfer, theFSSpecPtr, myTruncate) == noErr)
+			myTruncate = false;
+
+		// get the coalescing blocks, if we're collecting chunks into larger writes
+		myErr = QTFileTrans_PrepareCoalescing(theTransfer, theFSSpecPtr);
+		if (myErr != noErr)
+			goto bail;
+
+		// open a write-only path to the local data reference
+		myErr = DataHOpenForWrite(theTransfer->fDataWriter);
+		if (myErr != noErr)
+			goto bail;
+
+		// if we couldn't get at the local file ourselves, ask the HFS data handler to do the same things
+		if (myTruncate) {
+			wide		myZero = {0, 0};
+
+			DataHSetFileSize64(theTransfer->fDataWriter, &myZero);
+		}
+
+		if (theTransfer->fPreallocate && theTransfer->fSizeKnown && !theTransfer->fPreallocated) {
+			wide		myWideToAdd;
+			wide		myWideAdded;
+
+			QTFileTrans_SInt64ToWide(theTransfer->fBytesToTransfer - myResumeOffset, &myWideToAdd);
+			DataHPreextend64(theTransfer->fDataWriter, &myWideToAdd, &myWideAdded);
+		}
+	}
+
+	// if we know how much data is coming, make room for all of it in a memory sink at once
+	if ((theTransfer->fSinkHandle != NULL) && theTransfer->fSizeKnown && (theTransfer->fBytesToTransfer <= kMaxMemorySinkSize))
+		if (theTransfer->fBytesToTransfer > GetHandleSize(theTransfer->fSinkHandle))
+			SetHandleSize(theTransfer->fSinkHandle, (Size)theTransfer->fBytesToTransfer);
+
+	QTFileTrans_Trace(theTransfer, kQTFileTransTraceOpenEnd, 0, 0, noErr);
+
 	//////////
 	//
 	// start reading and writing data
 	//
 	//////////
-	
-	gDoneTransferring = false;
-	gBytesTransferred = 0L;
-	
-	gReadDataHCompletionUPP = NewDataHCompletionUPP(QTFileTrans_ReadDataCompletionProc);
-	gWriteDataHCompletionUPP = NewDataHCompletionUPP(QTFileTrans_WriteDataCompletionProc);
-		
-	// start retrieving the data; we do this by calling our own write completion routine,
-	// pretending that we've just successfully finished writing 0 bytes of data
-	QTFileTrans_WriteDataCompletionProc(gDataBuffer, 0L, noErr);
+
+	// a small file costs less to copy with one synchronous read and one synchronous write than to push through
+	// the buffer ring; if the data handler can't read it that way, we fall back on the ring (which we always
+	// use if there's a readahead window, since the window limits how much of the file we hold at once, and when
+	// we're syncing, since that reads only part of the file)
+	if (theTransfer->fSizeKnown && (myResumeOffset == 0) && (theTransfer->fBytesToTransfer <= theTransfer->fSmallFileSize) &&
+			(theTransfer->fReadahead == 0) && (theTransfer->fSyncBlocks == NULL)) {
+		if (QTFileTrans_CopySmallFile(theTransfer) == noErr) {
+			QTFileTrans_ReleaseHandlers(theTransfer, true);
+			goto bail;
+		}
+	}
+
+	QTFileTrans_StartTransfer(theTransfer);
 
 bail:
 	// if we encountered any error, close the data handler components
-	if (myErr != noErr)
-		QTFileTrans_CloseDownHandlers();
-	
+	if (myErr != noErr) {
+		QTFileTrans_Trace(theTransfer, kQTFileTransTraceOpenEnd, 0, 0, (OSErr)myErr);
+		theTransfer->fStatus = (OSErr)myErr;
+		QTFileTrans_CloseDownHandlers(theTransfer);
+	} else {
+		// the transfer might be done already (if the file came from the cache, say)
+		QTFileTrans_NoteDone(theTransfer);
+	}
+
 	return((OSErr)myErr);
 }
 
 
 //////////
 //
-// QTFileTrans_ReadDataCompletionProc
-// This procedure is called when the data handler has completed a read operation.
+// QTFileTrans_CopyLocalFileToRemoteFile
+// Copy a local file to a remote file (located at the specified URL). This is the same pipeline as a download,
+// with the roles reversed: the HFS data handler reads the local file into the buffer ring with DataHReadAsync,
+// and the URL data handler writes each buffer to the server with DataHWrite.
 //
-// The theRefCon parameter contains the number of bytes just read.
+// URL data handlers send the data as one stream, so an upload passes its chunks to the writer in order and reads
+// the local file in a single segment; for the same reason, a failed write ends the upload instead of being retried.
+// Uploads can't be resumed, and their writes aren't coalesced; everything else (the buffer ring, bandwidth limits,
+// retries of failed reads, digests, and statistics) works just as it does for a download.
 //
 //////////
 
-PASCAL_RTN void QTFileTrans_ReadDataCompletionProc (Ptr theRequest, long theRefCon, OSErr theErr)
+OSErr QTFileTrans_CopyLocalFileToRemoteFile (QTFileTransfer theTransfer, FSSpecPtr theFSSpecPtr, char *theURL)
 {
-#pragma unused(theErr)
+	Handle						myReaderRef = NULL;			// data reference for the local file
+	Handle						myWriterRef = NULL;			// data reference for the remote file
+	Size						mySize = 0;
+	ComponentResult				myErr = badComponentType;
+
+	if ((theTransfer == NULL) || (theFSSpecPtr == NULL) || (theURL == NULL))
+		return(paramErr);
+
+	// the data goes to the URL data handler, so there's no room for any other sink
+	if (theTransfer->fSinkType != kQTFileTransSinkFile)
+		return(paramErr);
+
+	QTFileTrans_ResetStats(theTransfer);
+	theTransfer->fDoneNotified = false;
+	QTFileTrans_DisposeMirrors(theTransfer);
+
+	theTransfer->fUploading = true;
+	theTransfer->fSegmentLimit = 1;
+	theTransfer->fNumWrittenRanges = 0;
+	theTransfer->fCheckpointBytes = 0L;
+	theTransfer->fSinkStatus = noErr;
+	theTransfer->fSinkBusy = false;
+	theTransfer->fSinkNextOffset = 0;
+	QTFileTrans_DigestInit(&theTransfer->fDigest, theTransfer->fDigest.fType);
+
+	QTFileTrans_Trace(theTransfer, kQTFileTransTraceOpenStart, 0, 0, noErr);
+
+	//////////
+	//
+	// create data references for the local and remote files
+	//
+	//////////
+
+	myReaderRef = NewHandleClear(sizeof(Handle));
+	if (myReaderRef == NULL)
+		goto bail;
+
+	myErr = QTNewAlias(theFSSpecPtr, (AliasHandle *)&myReaderRef, true);
+	if (myErr != noErr)
+		goto bail;
+
+	myErr = badComponentType;
+
+	// get the size of the URL, plus the terminating null byte
+	mySize = (Size)strlen(theURL) + 1;
+
+	myWriterRef = NewHandleClear(mySize);
+	if (myWriterRef == NULL)
+		goto bail;
+
+	BlockMove(theURL, *myWriterRef, mySize);
+
+	//////////
+	//
+	// find and open the HFS and Apple URL data handlers; connect the data references to them
+	//
+	//////////
+
+	// the data handlers a download leaves for reuse are the wrong way around for an upload, so we open our own
+	theTransfer->fDataReader = OpenComponent(GetDataHandler(myReaderRef, rAliasType, kDataHCanRead));
+	if (theTransfer->fDataReader == NULL)
+		goto bail;
+
+	theTransfer->fDataWriter = OpenComponent(GetDataHandler(myWriterRef, URLDataHandlerSubType, kDataHCanWrite));
+	if (theTransfer->fDataWriter == NULL)
+		goto bail;
+
+	myErr = DataHSetDataRef(theTransfer->fDataReader, myReaderRef);
+	if (myErr != noErr)
+		goto bail;
+
+	myErr = DataHSetDataRef(theTransfer->fDataWriter, myWriterRef);
+	if (myErr != noErr)
+		goto bail;
+
+	//////////
+	//
+	// allocate a ring of data buffers; the HFS data handler copies data into these buffers,
+	// and the URL data handler copies data out of them
+	//
+	//////////
+
+	myErr = QTFileTrans_PrepareBuffers(theTransfer);
+	if (myErr != noErr)
+		goto bail;
+
+	//////////
+	//
+	// connect to the local and remote files
+	//
+	//////////
+
+	myErr = DataHOpenForRead(theTransfer->fDataReader);
+	if (myErr != noErr)
+		goto bail;
+
+	// DataHWrite takes 32-bit offsets, so that's as big a file as we can upload
+	myErr = QTFileTrans_GetRemoteFileSize(theTransfer->fDataReader, &theTransfer->fBytesToTransfer);
+	QTFileTrans_Trace(theTransfer, kQTFileTransTraceGetFileSize, 0, (myErr == noErr) ? theTransfer->fBytesToTransfer : -1, (OSErr)myErr);
+	if (myErr != noErr)
+		goto bail;
+
+	if (theTransfer->fBytesToTransfer > kMaxUploadSize) {
+		myErr = paramErr;
+		goto bail;
+	}
+
+	theTransfer->fSizeKnown = true;
+	theTransfer->fPreextendedSize = 0L;
+	theTransfer->fPreallocated = false;
+	theTransfer->fBytesTransferred = 0;
+	QTFileTrans_OpenSegments(theTransfer, myReaderRef);
+
+	myErr = DataHOpenForWrite(theTransfer->fDataWriter);
+	if (myErr != noErr)
+		goto bail;
+
+	QTFileTrans_Trace(theTransfer, kQTFileTransTraceOpenEnd, 0, 0, noErr);
+
+	//////////
+	//
+	// start reading and writing data
+	//
+	//////////
 
-	// we just finished reading some data, so schedule a write operation			
-	DataHWrite(	gDataWriter,
-				theRequest,						// the data buffer
-				gBytesTransferred,				// write from the current offset
-				theRefCon,						// the number of bytes to write
-				gWriteDataHCompletionUPP,
-				theRefCon);
+	QTFileTrans_StartTransfer(theTransfer);
+
+bail:
+	// if we encountered any error, close the data handler components
+	if (myErr != noErr) {
+		QTFileTrans_Trace(theTransfer, kQTFileTransTraceOpenEnd, 0, 0, (OSErr)myErr);
+		theTransfer->fStatus = (OSErr)myErr;
+		QTFileTrans_CloseDownHandlers(theTransfer);
+	} else {
+		// an empty local file (or one whose reads and writes all completed synchronously) is uploaded already
+		QTFileTrans_NoteDone(theTransfer);
+	}
+
+	return((OSErr)myErr);
 }
 
 
 //////////
 //
-// QTFileTrans_WriteDataCompletionProc
-// This procedure is called when the data handler has completed a write operation.
-//
-// The theRefCon parameter contains the number of bytes just written.
+// QTFileTrans_CopyMirroredFileToLocalFile
+// Copy a remote file that several servers serve (at the specified URLs) into a local file. This is just like
+// QTFileTrans_CopyRemoteFileToLocalFile, except that we open a URL data handler for each mirror, check that
+// every mirror's file is the same size as the first one's, and read a segment of the file from each of them
+// at once: a mirror that's done with its segment takes over part of a slower mirror's, and a mirror whose
+// reads fail hands what it has left to the others (see QTFileTrans_ChooseSegment and QTFileTrans_FailOverRead).
+// If the first URL can't even start the transfer, we start with the next one instead.
 //
 //////////
 
-PASCAL_RTN void QTFileTrans_WriteDataCompletionProc (Ptr theRequest, long theRefCon, OSErr theErr)
+OSErr QTFileTrans_CopyMirroredFileToLocalFile (QTFileTransfer theTransfer, char **theURLs, short theNumURLs, FSSpecPtr theFSSpecPtr)
 {
-#pragma unused(theErr)
+	short						myNumSegments;
+	short						myFirst;
+	OSErr						myErr = paramErr;
 
-	long		myNumBytesToRead;
-	wide		myWide;
+	if ((theTransfer == NULL) || (theURLs == NULL) || (theNumURLs <= 0) || (theNumURLs > kMaxNumSegments))
+		return(paramErr);
 
-	// increment our tally of the number of bytes written so far
-	gBytesTransferred += theRefCon;
-
-	if (gBytesTransferred < gBytesToTransfer) {
-		// there is still data to read and write, so schedule a read operation
-	
-		// determine how big a chunk to read
-		if (gBytesToTransfer - gBytesTransferred > kDataBufferSize)
-			myNumBytesToRead = kDataBufferSize;
-		else
-			myNumBytesToRead = gBytesToTransfer - gBytesTransferred;
-
-		myWide.lo = gBytesTransferred;			// read from the current offset 
-		myWide.hi = 0;
-		
-		// schedule a read operation
-		DataHReadAsync(gDataReader,
-						theRequest,				// the data buffer
-						myNumBytesToRead,
-						&myWide,
-						gReadDataHCompletionUPP,
-						myNumBytesToRead);
+	if (theNumURLs == 1)
+		return(QTFileTrans_CopyRemoteFileToLocalFile(theTransfer, theURLs[0], theFSSpecPtr));
 
-	} else {
-		// we've transferred all the data, so set a flag to tell us to close down the data handlers
-		gDoneTransferring = true;
+	// we want a segment per mirror, but only for this transfer
+	myNumSegments = theTransfer->fMaxNumSegments;
+
+	for (myFirst = 0; myFirst < theNumURLs; myFirst++) {
+		myErr = QTFileTrans_MakeMirrors(theTransfer, theURLs + myFirst, theNumURLs - myFirst);
+		if (myErr != noErr)
+			break;
+
+		theTransfer->fMirrorsPending = true;
+		theTransfer->fMaxNumSegments = theTransfer->fNumMirrors;
+
+		myErr = QTFileTrans_CopyRemoteFileToLocalFile(theTransfer, theURLs[myFirst], theFSSpecPtr);
+		if (myErr == noErr)
+			break;
 	}
-	
+
+	theTransfer->fMaxNumSegments = myNumSegments;
+	return(myErr);
 }
 
 
 //////////
 //
-// QTFileTrans_CloseDownHandlers
-// Close our read/write access to our data references and then close down the read/write data handlers.
+// QTFileTrans_CopySmallFile
+// Copy the whole of the remote file of the specified transfer, which is small and of known size, with a single
+// synchronous read, and pass it to the transfer's digest and sink all at once; this is NOTE (2) in action. The data
+// handlers must be open already. Return an error only if we can't get the memory for the file or the read fails;
+// we haven't given the sink anything then, so the caller can still send the file through the buffer ring. An error
+// from the sink doesn't make us return an error: it ends the transfer (with the error in its status), just as it
+// would have in the ring, and whatever the sink got before it failed stays there.
 //
 //////////
 
-void QTFileTrans_CloseDownHandlers (void)
+OSErr QTFileTrans_CopySmallFile (QTFileTransfer theTransfer)
 {
-	if (gDataReader != NULL) {
-		DataHCloseForRead(gDataReader);
-		CloseComponent(gDataReader);
-		gDataReader = NULL;
-	}
+	Handle						myData = NULL;
+	long						mySize = (long)theTransfer->fBytesToTransfer;
+	long						myOffset = 0L;
+	unsigned long				myStartTime;
+	OSErr						myErr = noErr;
+
+	myData = NewHandle(mySize);
+	if (myData == NULL)
+		return(memFullErr);
+
+	theTransfer->fDoneTransferring = false;
+	theTransfer->fCancelled = false;
+	theTransfer->fStatus = noErr;
+	theTransfer->fStateTime = QTFileTrans_GetMicroseconds();
+
+	// read the whole file
+	if (mySize > 0) {
+		myStartTime = QTFileTrans_GetMicroseconds();
+		QTFileTrans_Trace(theTransfer, kQTFileTransTraceReadIssue, 0, mySize, noErr);
+		myErr = (OSErr)DataHGetData(theTransfer->fDataReader, myData, 0L, 0L, mySize);
+		QTFileTrans_Trace(theTransfer, kQTFileTransTraceReadComplete, 0, mySize, myErr);
+		if (myErr != noErr)
+			goto bail;
 
-	if (gDataWriter != NULL) {
-		DataHCloseForWrite(gDataWriter);
-		CloseComponent(gDataWriter);
-		gDataWriter = NULL;
+		theTransfer->fLastReadTime = QTFileTrans_GetMicroseconds() - myStartTime;
+		theTransfer->fStats.fNumReads++;
+		theTransfer->fStats.fBytesRead += mySize;
+		theTransfer->fStats.fReadLatency[QTFileTrans_LatencyBucket(theTransfer->fLastReadTime)]++;
 	}
-	
-	// dispose of the data buffer
-	if (gDataBuffer != NULL)
-		DisposePtr(gDataBuffer);
-		
+
+	HLock(myData);
+
+	if (theTransfer->fDigest.fType != kQTFileTransDigestNone)
+		QTFileTrans_DigestUpdate(&theTransfer->fDigest, (const UInt8 *)*myData, mySize);
+
+	// write the whole file
+	myStartTime = QTFileTrans_GetMicroseconds();
+	QTFileTrans_Trace(theTransfer, kQTFileTransTraceWriteIssue, 0, mySize, noErr);
+	switch (theTransfer->fSinkType) {
+		case kQTFileTransSinkMemory:
+			// the handle has already been made big enough for the whole file, if we could get that much memory
+			if (GetHandleSize(theTransfer->fSinkHandle) < mySize) {
+				QTFileTrans_NoteSinkError(theTransfer, memFullErr);
+			} else {
+				BlockMoveData(*myData, *theTransfer->fSinkHandle, mySize);
+				theTransfer->fSinkDataSize = mySize;
+			}
+			break;
+
+		case kQTFileTransSinkCallback:
+			if (mySize > 0)
+				QTFileTrans_NoteSinkError(theTransfer, (*theTransfer->fSinkProc)(*myData, mySize, 0, theTransfer->fSinkRefCon));
+			break;
+
+		case kQTFileTransSinkFile:
+		default:
+			if (mySize > 0)
+				theTransfer->fStatus = (OSErr)DataHPutData(theTransfer->fDataWriter, myData, 0L, &myOffset, mySize);
+			break;
+	}
+	QTFileTrans_Trace(theTransfer, kQTFileTransTraceWriteComplete, 0, mySize, theTransfer->fStatus);
+
+	// the transfer is over, one way or the other
+	if (theTransfer->fStatus == noErr) {
+		if (mySize > 0) {
+			theTransfer->fStats.fWriteLatency[QTFileTrans_LatencyBucket(QTFileTrans_GetMicroseconds() - myStartTime)]++;
+			QTFileTrans_NoteWritten(theTransfer, mySize);
+		}
+
+		theTransfer->fBytesTransferred = mySize;
+		theTransfer->fSinkNextOffset = mySize;
+		QTFileTrans_FinishTransfer(theTransfer);
+	} else {
+		QTFileTrans_NoteStateChange(theTransfer);
+	}
+
+bail:
+	DisposeHandle(myData);
+	return(myErr);
+}
+
+
+//////////
+//
+// QTFileTrans_PrepareBuffers
+// Get the ring of data buffers for the specified transfer ready, keeping any buffers left over from an earlier
+// transfer that are big enough. The reader copies data into these buffers and the writer copies data out of them;
+// while one buffer is being written, the others can be filled.
+//
+//////////
+
+OSErr QTFileTrans_PrepareBuffers (QTFileTransfer theTransfer)
+{
+	short						myIndex;
+	OSErr						myErr = noErr;
+
+	// if we're adapting the chunk size, the buffers must be big enough to hold the largest chunk we might ask for
+	if (theTransfer->fAdaptiveChunking)
+		theTransfer->fBufferSize = theTransfer->fMaxChunkSize;
+	else
+		theTransfer->fBufferSize = theTransfer->fChunkSize;
+
+	// if we might split the file into segments, give each segment at least two buffers,
+	// so that every segment can overlap its reads and writes
+	theTransfer->fNumBuffers = theTransfer->fRingNumBuffers;
+	if (theTransfer->fNumBuffers < 2 * theTransfer->fSegmentLimit)
+		theTransfer->fNumBuffers = 2 * theTransfer->fSegmentLimit;
+	if (theTransfer->fNumBuffers > kMaxNumDataBuffers)
+		theTransfer->fNumBuffers = kMaxNumDataBuffers;
+
+	// a readahead window overrides the number of buffers: we want just enough of them to hold the window; if even
+	// the largest ring can't, we make the buffers (and so the reads) bigger instead, unless the chunk size is adaptive
+	if (theTransfer->fReadahead > 0) {
+		theTransfer->fNumBuffers = (short)((theTransfer->fReadahead + theTransfer->fBufferSize - 1) / theTransfer->fBufferSize);
+		if (theTransfer->fNumBuffers < 2 * theTransfer->fSegmentLimit)
+			theTransfer->fNumBuffers = 2 * theTransfer->fSegmentLimit;
+		if (theTransfer->fNumBuffers > kMaxNumDataBuffers) {
+			theTransfer->fNumBuffers = kMaxNumDataBuffers;
+			if (!theTransfer->fAdaptiveChunking) {
+				theTransfer->fBufferSize = ((theTransfer->fReadahead + kMaxNumDataBuffers - 1) / kMaxNumDataBuffers + 0x03FFL) & ~0x03FFL;
+				theTransfer->fChunkSize = theTransfer->fBufferSize;
+			}
+		}
+	}
+
+	for (myIndex = 0; myIndex < theTransfer->fNumBuffers; myIndex++) {
+		// keep a buffer left over from an earlier transfer, if it's big enough
+		if (theTransfer->fDataBuffers[myIndex].fBuffer != NULL) {
+			if (QTFileTrans_GetBufferSize(theTransfer->fDataBuffers[myIndex].fBuffer) < theTransfer->fBufferSize) {
+				QTFileTrans_ReleaseBuffer(theTransfer->fDataBuffers[myIndex].fBuffer);
+				theTransfer->fDataBuffers[myIndex].fBuffer = NULL;
+			}
+		}
+
+		// otherwise get one from the shared pool; we don't need it cleared, since we read into it
+		// before we write from it
+		if (theTransfer->fDataBuffers[myIndex].fBuffer == NULL) {
+			myErr = QTFileTrans_AllocBuffer(theTransfer->fBufferSize, &theTransfer->fDataBuffers[myIndex].fBuffer);
+			if (myErr != noErr)
+				return(myErr);
+		}
+
+		theTransfer->fDataBuffers[myIndex].fOffset = 0L;
+		theTransfer->fDataBuffers[myIndex].fNumBytes = 0L;
+		theTransfer->fDataBuffers[myIndex].fSegment = NULL;
+		theTransfer->fDataBuffers[myIndex].fSinkHeld = false;
+		theTransfer->fDataBuffers[myIndex].fThrottled = false;
+		theTransfer->fDataBuffers[myIndex].fWriteStartTime = 0L;
+		theTransfer->fDataBuffers[myIndex].fNumRetries = 0;
+		theTransfer->fDataBuffers[myIndex].fRetryTime = 0L;
+		theTransfer->fDataBuffers[myIndex].fCoalesced = false;
+		theTransfer->fDataBuffers[myIndex].fCoalesceWaiting = false;
+		theTransfer->fDataBuffers[myIndex].fNumCoalesced = 0L;
+	}
+
+	theTransfer->fNumRetrying = 0;
+
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_StartTransfer
+// Start the specified transfer, once its data handlers are open and its buffers are ready, by scheduling a read
+// into every buffer in the ring.
+//
+//////////
+
+void QTFileTrans_StartTransfer (QTFileTransfer theTransfer)
+{
+	short						myIndex;
+
+	theTransfer->fDoneTransferring = false;
+	theTransfer->fCancelled = false;
+	theTransfer->fLastReadTime = 0L;
+	theTransfer->fStatus = noErr;
+
+	if (theTransfer->fReadDataHCompletionUPP == NULL)
+		theTransfer->fReadDataHCompletionUPP = NewDataHCompletionUPP(QTFileTrans_ReadDataCompletionProc);
+	if (theTransfer->fWriteDataHCompletionUPP == NULL)
+		theTransfer->fWriteDataHCompletionUPP = NewDataHCompletionUPP(QTFileTrans_WriteDataCompletionProc);
+
+	// start retrieving the data; we do this by calling our own write completion routine once for
+	// each buffer in the ring, pretending that we've just successfully finished writing 0 bytes of data
+	// from that buffer; this schedules a read into every buffer in the ring at once (we count each
+	// pretend write as pending, so that the write completion routine's bookkeeping balances)
+	theTransfer->fNumPendingWrites = 0;
+	QTFileTrans_ScheduleTransfer(theTransfer);
+
+	// start the clocks now; the time it took to open the files isn't charged to the network or the disk
+	theTransfer->fStateTime = QTFileTrans_GetMicroseconds();
+	theTransfer->fSampleTime = theTransfer->fStateTime;
+
+	for (myIndex = 0; myIndex < theTransfer->fNumBuffers; myIndex++) {
+		theTransfer->fNumPendingWrites++;
+		QTFileTrans_WriteDataCompletionProc(theTransfer->fDataBuffers[myIndex].fBuffer, (long)&theTransfer->fDataBuffers[myIndex], noErr);
+	}
+}
+
+
+//////////
+//
+// QTFileTrans_ReadDataCompletionProc
+// This procedure is called when the data handler has completed a read operation.
+//
+// The theRefCon parameter is a pointer to the buffer record that was just filled; that record
+// holds the offset and number of bytes just read, as well as the transfer that owns the buffer.
+//
+//////////
+
+PASCAL_RTN void QTFileTrans_ReadDataCompletionProc (Ptr theRequest, long theRefCon, OSErr theErr)
+{
+	QTFileTransBufferPtr	myBuffer = (QTFileTransBufferPtr)theRefCon;
+	QTFileTransfer			myTransfer = myBuffer->fTransfer;
+
+	QTFileTrans_Trace(myTransfer, kQTFileTransTraceReadComplete, myBuffer->fOffset, myBuffer->fNumBytes, theErr);
+	QTFileTrans_NoteStateChange(myTransfer);
+	myBuffer->fSegment->fNumPendingReads--;
+	QTFileTrans_NoteCompletion(myTransfer);
+
+	// if the read failed, whatever is in the buffer is garbage; read the same range again later (or give up);
+	// once the transfer has failed (or been cancelled), the errors of the reads still draining don't matter
+	if ((theErr != noErr) && (theErr != eofErr)) {
+		if (myTransfer->fStatus == noErr)
+			QTFileTrans_HandleReadError(myBuffer, theErr);
+		return;
+	}
+
+	// once the transfer has failed, we just let the requests still outstanding drain away
+	if (myTransfer->fStatus != noErr)
+		return;
+
+	// if we've run off the end of the file, find out where the end actually is
+	if (theErr == eofErr)
+		QTFileTrans_HandleEndOfFile(myBuffer);
+
+	// time this read, and let that timing steer the size of the reads we schedule next
+	myTransfer->fLastReadTime = QTFileTrans_GetMicroseconds() - myBuffer->fReadStartTime;
+	myTransfer->fStats.fNumReads++;
+	myTransfer->fStats.fBytesRead += myBuffer->fNumBytes;
+	myTransfer->fStats.fReadLatency[QTFileTrans_LatencyBucket(myTransfer->fLastReadTime)]++;
+
+	// credit the read to the mirror it came from, so that we know which mirrors are fastest
+	if (myTransfer->fNumMirrors > 0) {
+		myTransfer->fMirrors[myBuffer->fSegment->fMirror].fBytesRead += myBuffer->fNumBytes;
+		myTransfer->fMirrors[myBuffer->fSegment->fMirror].fReadTime += myTransfer->fLastReadTime;
+	}
+
+	// (the short read at the end of the file doesn't tell us much, so we ignore it)
+	if (myTransfer->fAdaptiveChunking && (myBuffer->fOffset + myBuffer->fNumBytes < myBuffer->fSegment->fEndOffset))
+		QTFileTrans_AdjustChunkSize(myTransfer, myBuffer->fNumBytes, myTransfer->fLastReadTime);
+
+	// if this read was entirely past the end of the file, there's nothing to write
+	if (myBuffer->fNumBytes <= 0) {
+		myTransfer->fNumPendingWrites++;
+		QTFileTrans_WriteDataCompletionProc(theRequest, theRefCon, noErr);
+		return;
+	}
+
+	// we just finished reading some data, so hand it to the sink
+	myTransfer->fNumPendingWrites++;
+	QTFileTrans_WriteToSink(myBuffer);
+}
+
+
+//////////
+//
+// QTFileTrans_WriteDataCompletionProc
+// This procedure is called when the data handler has completed a write operation.
+//
+// The theRefCon parameter is a pointer to the buffer record that was just emptied; that record
+// holds the number of bytes just written, as well as the transfer that owns the buffer.
+//
+//////////
+
+PASCAL_RTN void QTFileTrans_WriteDataCompletionProc (Ptr theRequest, long theRefCon, OSErr theErr)
+{
+#pragma unused(theRequest)
+
+	QTFileTransBufferPtr	myBuffer = (QTFileTransBufferPtr)theRefCon;
+	QTFileTransfer			myTransfer = myBuffer->fTransfer;
+	QTFileTransSegmentPtr	mySegment = NULL;
+
+	// the pretend writes that start a transfer, and the chunks that only went into a coalescing block, weren't traced
+	if ((myBuffer->fWriteStartTime != 0L) && !myBuffer->fCoalesced)
+		QTFileTrans_Trace(myTransfer, kQTFileTransTraceWriteComplete, myBuffer->fOffset, myBuffer->fNumBytes, theErr);
+
+	QTFileTrans_NoteStateChange(myTransfer);
+	myTransfer->fNumPendingWrites--;
+	QTFileTrans_NoteCompletion(myTransfer);
+
+	// if the write failed, the data is still in the buffer, so we can write it again later (or give up)
+	if (theErr != noErr) {
+		myBuffer->fWriteStartTime = 0L;
+		if (myTransfer->fStatus == noErr)
+			QTFileTrans_HandleWriteError(myBuffer, theErr);
+		return;
+	}
+
+	// a chunk that was only copied into the coalescing blocks isn't in the file yet; we count it once its block is written
+	if (myBuffer->fCoalesced) {
+		myBuffer->fCoalesced = false;
+		myBuffer->fWriteStartTime = 0L;
+		myBuffer->fNumBytes = 0L;
+	}
+
+	// increment our tally of the number of bytes written so far
+	myTransfer->fBytesTransferred += myBuffer->fNumBytes;
+
+	// time this write (the pretend writes that start a transfer, and the ones for reads that came up
+	// empty, have no start time, and don't count)
+	if (myBuffer->fWriteStartTime != 0L) {
+		myTransfer->fStats.fWriteLatency[QTFileTrans_LatencyBucket(QTFileTrans_GetMicroseconds() - myBuffer->fWriteStartTime)]++;
+		myBuffer->fWriteStartTime = 0L;
+		QTFileTrans_NoteWritten(myTransfer, myBuffer->fNumBytes);
+	}
+
+	// if the transfer is resumable, remember that this range is safely written, and save a checkpoint now and then
+	if (myTransfer->fResumable && !myTransfer->fUploading && (myBuffer->fNumBytes > 0L)) {
+		QTFileTrans_AddWrittenRange(myTransfer, myBuffer->fOffset, myBuffer->fNumBytes);
+		if (myTransfer->fBytesTransferred - myTransfer->fCheckpointBytes >= kCheckpointInterval)
+			QTFileTrans_WriteCheckpoint(myTransfer);
+	}
+
+	myBuffer->fNumBytes = 0L;
+	myBuffer->fNumRetries = 0;
+	myBuffer->fBlockBusy = false;
+
+	// once the transfer has failed, we just let the requests still outstanding drain away
+	if (myTransfer->fStatus != noErr)
+		return;
+
+	// a coalescing block doesn't read anything; it just makes room for chunks that were waiting for it
+	if (myBuffer->fIsBlock) {
+		QTFileTrans_ResumeCoalescing(myTransfer);
+		if (!myTransfer->fDoneTransferring && (myTransfer->fBytesTransferred >= myTransfer->fBytesToTransfer))
+			QTFileTrans_FinishTransfer(myTransfer);
+		return;
+	}
+
+	mySegment = QTFileTrans_ChooseSegment(myTransfer, myBuffer->fSegment);
+	if (mySegment != NULL) {
+		// there is still data to read, so reuse this buffer for the next read operation (as soon as the
+		// bandwidth limits allow it)
+		QTFileTrans_RequestRead(myBuffer, mySegment);
+
+	} else if (!myTransfer->fDoneTransferring && (myTransfer->fBytesTransferred >= myTransfer->fBytesToTransfer)) {
+		// we've transferred all the data
+		QTFileTrans_FinishTransfer(myTransfer);
+
+	} else if ((myTransfer->fNumCoalesceBlocks > 0) && !QTFileTrans_HasPendingReads(myTransfer) && (myTransfer->fNumRetrying == 0) && (myTransfer->fNumCoalesceWaiting == 0)) {
+		// there's nothing left to read, so the coalescing blocks won't get any fuller; write them out
+		QTFileTrans_FlushCoalesced(myTransfer);
+	}
+
+	// otherwise, there's nothing left to read, but other buffers are still being written
+}
+
+
+//////////
+//
+// QTFileTrans_FinishTransfer
+// Wrap up the specified transfer, once all of its data has been transferred.
+//
+//////////
+
+void QTFileTrans_FinishTransfer (QTFileTransfer theTransfer)
+{
+	// stop the clocks, and set a flag to tell us to close down the data handlers
+	QTFileTrans_NoteStateChange(theTransfer);
+	theTransfer->fDoneTransferring = true;
+
+	// a finished transfer doesn't need its checkpoint any more
+	if (theTransfer->fResumable && !theTransfer->fUploading)
+		FSpDelete(&theTransfer->fCheckpointSpec);
+
+	// every chunk has been digested by now, so the digest is done
+	QTFileTrans_FinishDigest(theTransfer);
+}
+
+
+//////////
+//
+// QTFileTrans_ScheduleRead
+// Schedule an asynchronous read of the next unread chunk of the specified segment into the specified buffer.
+//
+//////////
+
+void QTFileTrans_ScheduleRead (QTFileTransBufferPtr theBuffer, QTFileTransSegmentPtr theSegment)
+{
+	QTFileTransfer	myTransfer = theBuffer->fTransfer;
+	long			myNumBytesToRead;
+
+	// determine how big a chunk to read
+	if (theSegment->fEndOffset - theSegment->fNextReadOffset > myTransfer->fChunkSize)
+		myNumBytesToRead = myTransfer->fChunkSize;
+	else
+		myNumBytesToRead = (long)(theSegment->fEndOffset - theSegment->fNextReadOffset);
+
+	// (and a sync transfer reads no further than the blocks that differ)
+	if (myTransfer->fSyncBlocks != NULL)
+		myNumBytesToRead = QTFileTrans_ClampToChangedBlocks(myTransfer, theSegment->fNextReadOffset, myNumBytesToRead);
+
+	// charge this read against the bandwidth limits
+	QTFileTrans_SpendTokens(myTransfer, myNumBytesToRead);
+
+	// claim this range of the file for this buffer
+	theBuffer->fSegment = theSegment;
+	theBuffer->fOffset = theSegment->fNextReadOffset;
+	theBuffer->fNumBytes = myNumBytesToRead;
+	theSegment->fNextReadOffset += myNumBytesToRead;
+
+	// if we don't know how big the file is, make sure the local file has room for this chunk
+	if (!myTransfer->fSizeKnown && (myTransfer->fDataWriter != NULL))
+		QTFileTrans_PreextendForStreaming(myTransfer, theBuffer->fOffset + myNumBytesToRead);
+
+	QTFileTrans_IssueRead(theBuffer);
+}
+
+
+//////////
+//
+// QTFileTrans_IssueRead
+// Issue an asynchronous read of the range of the file claimed by the specified buffer, from the buffer's segment.
+// If the data handler won't even take the request, we treat that just like a read that failed.
+//
+//////////
+
+void QTFileTrans_IssueRead (QTFileTransBufferPtr theBuffer)
+{
+	QTFileTransfer			myTransfer = theBuffer->fTransfer;
+	QTFileTransSegmentPtr	mySegment = theBuffer->fSegment;
+	wide					myWide;
+	OSErr					myErr = noErr;
+
+	QTFileTrans_SInt64ToWide(theBuffer->fOffset, &myWide);	// read from this buffer's offset
+
+	theBuffer->fReadStartTime = QTFileTrans_GetMicroseconds();
+
+	// schedule a read operation
+	QTFileTrans_Trace(myTransfer, kQTFileTransTraceReadIssue, theBuffer->fOffset, theBuffer->fNumBytes, noErr);
+	QTFileTrans_NoteStateChange(myTransfer);
+	mySegment->fNumPendingReads++;
+	myErr = (OSErr)DataHReadAsync(mySegment->fDataReader,
+					theBuffer->fBuffer,		// the data buffer
+					theBuffer->fNumBytes,
+					&myWide,
+					myTransfer->fReadDataHCompletionUPP,
+					(long)theBuffer);
+
+	if (myErr != noErr) {
+		QTFileTrans_Trace(myTransfer, kQTFileTransTraceReadComplete, theBuffer->fOffset, theBuffer->fNumBytes, myErr);
+		QTFileTrans_NoteStateChange(myTransfer);
+		mySegment->fNumPendingReads--;
+		QTFileTrans_HandleReadError(theBuffer, myErr);
+	}
+}
+
+
+//////////
+//
+// QTFileTrans_ChooseSegment
+// Return the segment that the next read of the specified transfer should come from, or NULL if every
+// segment has been completely read. We stay with the preferred segment while it has data left, so that
+// each URL data handler reads its range in order; once a segment is used up, its buffers move over to
+// help whichever segment has the most data left to read (or, if the file has mirrors, to take part of it over).
+//
+//////////
+
+QTFileTransSegmentPtr QTFileTrans_ChooseSegment (QTFileTransfer theTransfer, QTFileTransSegmentPtr thePreferred)
+{
+	QTFileTransSegmentPtr	mySegment = NULL;
+	SInt64					myMostLeft = 0;
+	short					myIndex;
+
+	// a sync transfer reads only the blocks that differ from the local file
+	if (theTransfer->fSyncBlocks != NULL)
+		for (myIndex = 0; myIndex < theTransfer->fNumSegments; myIndex++)
+			QTFileTrans_SkipUnchangedBlocks(theTransfer, &theTransfer->fSegments[myIndex]);
+
+	if ((thePreferred != NULL) && (thePreferred->fNextReadOffset < thePreferred->fEndOffset))
+		return(thePreferred);
+
+	for (myIndex = 0; myIndex < theTransfer->fNumSegments; myIndex++) {
+		QTFileTransSegmentPtr	myCandidate = &theTransfer->fSegments[myIndex];
+		SInt64					myLeft = myCandidate->fEndOffset - myCandidate->fNextReadOffset;
+
+		if (myLeft > myMostLeft) {
+			myMostLeft = myLeft;
+			mySegment = myCandidate;
+		}
+	}
+
+	// with mirrors, a used-up segment whose mirror is still working takes over part of that segment's range
+	// instead, so that the fast mirrors end up reading more of the file than the slow ones
+	if ((theTransfer->fNumMirrors > 1) && (thePreferred != NULL) && (mySegment != NULL) && (mySegment != thePreferred))
+		if (theTransfer->fMirrors[thePreferred->fMirror].fStatus == noErr)
+			if (QTFileTrans_StealRange(theTransfer, thePreferred, mySegment))
+				return(thePreferred);
+
+	return(mySegment);
+}
+
+
+//////////
+//
+// QTFileTrans_SetNumSegments
+// Set the largest number of byte ranges into which the specified transfer may split the remote file.
+// Each range is read by its own instance of the URL data handler, which helps when the server limits the
+// bandwidth of each connection. This function must be called before QTFileTrans_CopyRemoteFileToLocalFile.
+//
+//////////
+
+OSErr QTFileTrans_SetNumSegments (QTFileTransfer theTransfer, short theNumSegments)
+{
+	if ((theTransfer == NULL) || (theNumSegments <= 0) || (theNumSegments > kMaxNumSegments))
+		return(paramErr);
+
+	// we can't add connections to a transfer that's underway
+	if (theTransfer->fDataReader != NULL)
+		return(paramErr);
+
+	theTransfer->fMaxNumSegments = theNumSegments;
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_OpenSegments
+// Divide the part of the remote file that we still need (from fBytesTransferred on) into segments and
+// open a URL data handler for each segment after the first (the first segment uses the transfer's own
+// reader, which must already be open for reading).
+//
+// We never make segments smaller than kMinSegmentSize, and if we can't open a data handler for a
+// segment, we just make do with the segments we already have; so a failure here isn't fatal.
+//
+// If the file has mirrors, the first segment reads from the first mirror and each segment after it reads from
+// a mirror of its own; a mirror we can't open, or whose file isn't the right size, is just left out.
+//
+//////////
+
+void QTFileTrans_OpenSegments (QTFileTransfer theTransfer, Handle theReaderRef)
+{
+	ComponentInstance		myReader = NULL;
+	short					myNumSegments;
+	SInt64					myStart = theTransfer->fBytesTransferred;
+	SInt64					mySegmentSize;
+	short					myIndex;
+	short					myMirror = 1;
+
+	myNumSegments = theTransfer->fSegmentLimit;
+	if ((theTransfer->fBytesToTransfer - myStart) / kMinSegmentSize < myNumSegments)
+		myNumSegments = (short)((theTransfer->fBytesToTransfer - myStart) / kMinSegmentSize);
+	if (myNumSegments < 1)
+		myNumSegments = 1;
+
+	// the first segment always uses our own reader
+	theTransfer->fSegments[0].fDataReader = theTransfer->fDataReader;
+	theTransfer->fSegments[0].fMirror = 0;
+	theTransfer->fNumSegments = 1;
+
+	for (myIndex = 1; myIndex < myNumSegments; myIndex++) {
+		if (theTransfer->fNumMirrors > 0) {
+			myReader = NULL;
+			while ((myReader == NULL) && (myMirror < theTransfer->fNumMirrors))
+				myReader = QTFileTrans_OpenMirror(theTransfer, myMirror++);
+			if (myReader == NULL)
+				break;
+
+			theTransfer->fSegments[myIndex].fMirror = myMirror - 1;
+		} else {
+			myReader = QTFileTrans_OpenReader(theTransfer, theReaderRef);
+			if (myReader == NULL)
+				break;
+
+			if ((DataHSetDataRef(myReader, theReaderRef) != noErr) || (DataHOpenForRead(myReader) != noErr)) {
+				CloseComponent(myReader);
+				break;
+			}
+
+			theTransfer->fSegments[myIndex].fMirror = 0;
+		}
+
+		theTransfer->fSegments[myIndex].fDataReader = myReader;
+		theTransfer->fNumSegments++;
+	}
+
+	// now divide the file evenly among the segments we managed to open, in multiples of 1K
+	mySegmentSize = ((theTransfer->fBytesToTransfer - myStart) / theTransfer->fNumSegments) & ~((SInt64)0x03FF);
+
+	for (myIndex = 0; myIndex < theTransfer->fNumSegments; myIndex++) {
+		theTransfer->fSegments[myIndex].fNextReadOffset = myStart + myIndex * mySegmentSize;
+		theTransfer->fSegments[myIndex].fEndOffset = myStart + (myIndex + 1) * mySegmentSize;
+	}
+
+	// the last segment picks up whatever is left over
+	theTransfer->fSegments[theTransfer->fNumSegments - 1].fEndOffset = theTransfer->fBytesToTransfer;
+}
+
+
+//////////
+//
+// QTFileTrans_MakeMirrors
+// Make a data reference for each of the specified URLs, all of which serve the same file, and keep them as the
+// mirrors of the specified transfer, in place of any it had.
+//
+//////////
+
+OSErr QTFileTrans_MakeMirrors (QTFileTransfer theTransfer, char **theURLs, short theNumURLs)
+{
+	Handle					myDataRef = NULL;
+	Size					mySize = 0;
+	short					myIndex;
+
+	QTFileTrans_DisposeMirrors(theTransfer);
+
+	for (myIndex = 0; myIndex < theNumURLs; myIndex++) {
+		if (theURLs[myIndex] == NULL) {
+			QTFileTrans_DisposeMirrors(theTransfer);
+			return(paramErr);
+		}
+
+		mySize = (Size)strlen(theURLs[myIndex]) + 1;
+		myDataRef = NewHandleClear(mySize);
+		if (myDataRef == NULL) {
+			QTFileTrans_DisposeMirrors(theTransfer);
+			return(memFullErr);
+		}
+
+		BlockMove(theURLs[myIndex], *myDataRef, mySize);
+
+		theTransfer->fMirrors[myIndex].fDataRef = myDataRef;
+		theTransfer->fMirrors[myIndex].fBytesRead = 0;
+		theTransfer->fMirrors[myIndex].fReadTime = 0;
+		theTransfer->fMirrors[myIndex].fNumErrors = 0L;
+		theTransfer->fMirrors[myIndex].fStatus = noErr;
+		theTransfer->fNumMirrors++;
+	}
+
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_DisposeMirrors
+// Throw away the mirrors of the specified transfer.
+//
+//////////
+
+void QTFileTrans_DisposeMirrors (QTFileTransfer theTransfer)
+{
+	short					myIndex;
+
+	for (myIndex = 0; myIndex < theTransfer->fNumMirrors; myIndex++) {
+		if (theTransfer->fMirrors[myIndex].fDataRef != NULL)
+			DisposeHandle(theTransfer->fMirrors[myIndex].fDataRef);
+		theTransfer->fMirrors[myIndex].fDataRef = NULL;
+	}
+
+	theTransfer->fNumMirrors = 0;
+}
+
+
+//////////
+//
+// QTFileTrans_OpenMirror
+// Open a URL data handler for reading from the specified mirror of the specified transfer, and make sure the
+// mirror's file is the same size as the one the transfer is copying. Return NULL if we can't, in which case
+// we don't use the mirror again.
+//
+//////////
+
+ComponentInstance QTFileTrans_OpenMirror (QTFileTransfer theTransfer, short theMirror)
+{
+	QTFileTransMirrorPtr	myMirror = &theTransfer->fMirrors[theMirror];
+	ComponentInstance		myReader = NULL;
+	SInt64					mySize = 0;
+	OSErr					myErr = noErr;
+
+	if (myMirror->fStatus != noErr)
+		return(NULL);
+
+	myReader = QTFileTrans_OpenReader(theTransfer, myMirror->fDataRef);
+	if (myReader == NULL) {
+		myMirror->fStatus = badComponentType;
+		return(NULL);
+	}
+
+	myErr = (OSErr)DataHSetDataRef(myReader, myMirror->fDataRef);
+	if (myErr == noErr)
+		myErr = (OSErr)DataHOpenForRead(myReader);
+
+	// a mirror whose file is a different size has a different file (an older version, say)
+	if ((myErr == noErr) && theTransfer->fSizeKnown) {
+		myErr = QTFileTrans_GetRemoteFileSize(myReader, &mySize);
+		QTFileTrans_Trace(theTransfer, kQTFileTransTraceGetFileSize, 0, (myErr == noErr) ? mySize : -1, myErr);
+		if ((myErr == noErr) && (mySize != theTransfer->fBytesToTransfer))
+			myErr = kQTFileTransMirrorSizeErr;
+		if (myErr != noErr)
+			DataHCloseForRead(myReader);
+	}
+
+	if (myErr != noErr) {
+		CloseComponent(myReader);
+		myMirror->fStatus = myErr;
+		return(NULL);
+	}
+
+	return(myReader);
+}
+
+
+//////////
+//
+// QTFileTrans_GetMirrorStats
+// Return how the specified mirror of the specified transfer has done so far; the mirrors are numbered in the
+// order of the URLs passed to QTFileTrans_CopyMirroredFileToLocalFile (leaving out any URLs it had to skip
+// because they couldn't start the transfer).
+//
+//////////
+
+OSErr QTFileTrans_GetMirrorStats (QTFileTransfer theTransfer, short theMirror, QTFileTransMirrorStatsPtr theStats)
+{
+	if ((theTransfer == NULL) || (theStats == NULL))
+		return(paramErr);
+
+	if ((theMirror < 0) || (theMirror >= theTransfer->fNumMirrors))
+		return(paramErr);
+
+	theStats->fBytesRead = theTransfer->fMirrors[theMirror].fBytesRead;
+	theStats->fThroughput = QTFileTrans_GetMirrorThroughput(theTransfer, theMirror);
+	theStats->fNumErrors = theTransfer->fMirrors[theMirror].fNumErrors;
+	theStats->fStatus = theTransfer->fMirrors[theMirror].fStatus;
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_GetMirrorThroughput
+// Return the throughput, in bytes per second, of the reads from the specified mirror of the specified transfer,
+// or 0 if none of them has completed yet. Each read is timed from when we issue it, so with several reads
+// outstanding on a connection this understates the actual throughput; but it does so for every mirror alike,
+// which is all we need to compare them.
+//
+//////////
+
+long QTFileTrans_GetMirrorThroughput (QTFileTransfer theTransfer, short theMirror)
+{
+	QTFileTransMirrorPtr	myMirror = &theTransfer->fMirrors[theMirror];
+
+	if (myMirror->fReadTime <= 0)
+		return(0L);
+
+	return((long)(myMirror->fBytesRead * 1000000 / myMirror->fReadTime));
+}
+
+
+//////////
+//
+// QTFileTrans_StealRange
+// Give the specified segment, which has read all of its range, the end of the range left to the specified
+// victim segment, in proportion to how fast the thief's mirror has been compared with the victim's; a victim
+// whose mirror hasn't delivered anything yet loses all of it. Return false if the share would be too small
+// to bother with.
+//
+//////////
+
+Boolean QTFileTrans_StealRange (QTFileTransfer theTransfer, QTFileTransSegmentPtr theThief, QTFileTransSegmentPtr theVictim)
+{
+	SInt64					myLeft = theVictim->fEndOffset - theVictim->fNextReadOffset;
+	SInt64					myShare;
+	long					myThiefRate;
+	long					myVictimRate;
+
+	// the end of a file of unknown size is only a guess
+	if (!theTransfer->fSizeKnown)
+		return(false);
+
+	myThiefRate = QTFileTrans_GetMirrorThroughput(theTransfer, theThief->fMirror);
+	myVictimRate = QTFileTrans_GetMirrorThroughput(theTransfer, theVictim->fMirror);
+
+	if ((myThiefRate > 0) || (myVictimRate > 0))
+		myShare = (SInt64)((double)myLeft * (double)myThiefRate / ((double)myThiefRate + (double)myVictimRate));
+	else
+		myShare = myLeft / 2;
+
+	// (in multiples of 1K, like the segments themselves)
+	myShare &= ~((SInt64)0x03FF);
+	if (myShare < kMinMirrorStealSize)
+		return(false);
+
+	theThief->fEndOffset = theVictim->fEndOffset;
+	theThief->fNextReadOffset = theVictim->fEndOffset - myShare;
+	theVictim->fEndOffset = theThief->fNextReadOffset;
+	return(true);
+}
+
+
+//////////
+//
+// QTFileTrans_FailOverRead
+// Deal with a read from the specified buffer that failed, if the buffer's transfer has another mirror that's
+// still working: we stop using the mirror the read came from, move whatever it had left to read over to the
+// other mirrors, and read the buffer's chunk again from the fastest of them. Return false if there's no other
+// mirror to turn to, in which case the caller retries the same mirror (or gives up).
+//
+//////////
+
+Boolean QTFileTrans_FailOverRead (QTFileTransBufferPtr theBuffer, OSErr theErr)
+{
+	QTFileTransfer			myTransfer = theBuffer->fTransfer;
+	QTFileTransSegmentPtr	mySegment = NULL;
+	QTFileTransSegmentPtr	myTarget = NULL;
+	short					myFailed = theBuffer->fSegment->fMirror;
+	long					myRate;
+	long					myBestRate = -1L;
+	short					myIndex;
+
+	if (myTransfer->fNumMirrors < 2)
+		return(false);
+
+	myTransfer->fMirrors[myFailed].fNumErrors++;
+
+	if (myTransfer->fMirrors[myFailed].fStatus == noErr) {
+		// if this is the last mirror standing, we have to stick with it
+		for (myIndex = 0; myIndex < myTransfer->fNumMirrors; myIndex++)
+			if ((myIndex != myFailed) && (myTransfer->fMirrors[myIndex].fStatus == noErr))
+				break;
+		if (myIndex == myTransfer->fNumMirrors)
+			return(false);
+
+		myTransfer->fMirrors[myFailed].fStatus = theErr;
+
+		// hand the ranges that this mirror hasn't read yet to the others
+		for (myIndex = 0; myIndex < myTransfer->fNumSegments; myIndex++) {
+			mySegment = &myTransfer->fSegments[myIndex];
+			if ((mySegment->fMirror != myFailed) || (mySegment->fNextReadOffset >= mySegment->fEndOffset))
+				continue;
+
+			if (QTFileTrans_AddMirrorSegment(myTransfer, mySegment->fNextReadOffset, mySegment->fEndOffset) != NULL)
+				mySegment->fEndOffset = mySegment->fNextReadOffset;
+		}
+	}
+
+	// read this chunk again from the fastest mirror that's still working
+	for (myIndex = 0; myIndex < myTransfer->fNumSegments; myIndex++) {
+		mySegment = &myTransfer->fSegments[myIndex];
+		if (myTransfer->fMirrors[mySegment->fMirror].fStatus != noErr)
+			continue;
+
+		myRate = QTFileTrans_GetMirrorThroughput(myTransfer, mySegment->fMirror);
+		if (myRate > myBestRate) {
+			myBestRate = myRate;
+			myTarget = mySegment;
+		}
+	}
+
+	if (myTarget == NULL)
+		return(false);
+
+	theBuffer->fSegment = myTarget;
+	QTFileTrans_IssueRead(theBuffer);
+	return(true);
+}
+
+
+//////////
+//
+// QTFileTrans_AddMirrorSegment
+// Find a segment of the specified transfer to read the specified range from one of the transfer's working
+// mirrors: a segment that's read all of its own range, if there is one, or else a new segment, with a new
+// URL data handler, reading from the fastest working mirror. Return NULL if we can't find or open one.
+//
+//////////
+
+QTFileTransSegmentPtr QTFileTrans_AddMirrorSegment (QTFileTransfer theTransfer, SInt64 theStart, SInt64 theEnd)
+{
+	QTFileTransSegmentPtr	mySegment = NULL;
+	ComponentInstance		myReader = NULL;
+	long					myRate;
+	long					myBestRate;
+	short					myBest;
+	short					myIndex;
+
+	// a segment that's used up can just take the range on
+	myBestRate = -1L;
+	for (myIndex = 0; myIndex < theTransfer->fNumSegments; myIndex++) {
+		QTFileTransSegmentPtr	myCandidate = &theTransfer->fSegments[myIndex];
+
+		if ((theTransfer->fMirrors[myCandidate->fMirror].fStatus != noErr) || (myCandidate->fNextReadOffset < myCandidate->fEndOffset))
+			continue;
+
+		myRate = QTFileTrans_GetMirrorThroughput(theTransfer, myCandidate->fMirror);
+		if (myRate > myBestRate) {
+			myBestRate = myRate;
+			mySegment = myCandidate;
+		}
+	}
+
+	// otherwise, open another connection to the fastest mirror that will let us
+	while ((mySegment == NULL) && (theTransfer->fNumSegments < kMaxNumSegments)) {
+		myBest = -1;
+		myBestRate = -1L;
+		for (myIndex = 0; myIndex < theTransfer->fNumMirrors; myIndex++) {
+			if (theTransfer->fMirrors[myIndex].fStatus != noErr)
+				continue;
+
+			myRate = QTFileTrans_GetMirrorThroughput(theTransfer, myIndex);
+			if (myRate > myBestRate) {
+				myBestRate = myRate;
+				myBest = myIndex;
+			}
+		}
+
+		if (myBest < 0)
+			return(NULL);
+
+		// (if we can't open the mirror, it's out of the running, and we try the next best)
+		myReader = QTFileTrans_OpenMirror(theTransfer, myBest);
+		if (myReader != NULL) {
+			mySegment = &theTransfer->fSegments[theTransfer->fNumSegments++];
+			mySegment->fDataReader = myReader;
+			mySegment->fMirror = myBest;
+			mySegment->fNumPendingReads = 0;
+		}
+	}
+
+	if (mySegment == NULL)
+		return(NULL);
+
+	mySegment->fNextReadOffset = theStart;
+	mySegment->fEndOffset = theEnd;
+	return(mySegment);
+}
+
+
+//////////
+//
+// QTFileTrans_Task
+// Give the data handlers for the specified transfer some time, if they have requests outstanding.
+//
+//////////
+
+void QTFileTrans_Task (QTFileTransfer theTransfer)
+{
+	unsigned long	myStartTime;
+	short			myIndex;
+
+	if (theTransfer == NULL)
+		return;
+
+	QTFileTrans_CheckDeadline(theTransfer);
+
+	// keep track of how long requests sit waiting for us to call DataHTask, and how long DataHTask takes
+	myStartTime = QTFileTrans_GetMicroseconds();
+	if ((theTransfer->fLastTaskTime != 0L) && QTFileTrans_HasPendingRequests(theTransfer))
+		theTransfer->fStats.fTaskWaitTime += myStartTime - theTransfer->fLastTaskTime;
+
+	for (myIndex = 0; myIndex < theTransfer->fNumSegments; myIndex++)
+		if ((theTransfer->fSegments[myIndex].fDataReader != NULL) && (theTransfer->fSegments[myIndex].fNumPendingReads > 0))
+			DataHTask(theTransfer->fSegments[myIndex].fDataReader);
+
+	if ((theTransfer->fDataWriter != NULL) && (theTransfer->fNumPendingWrites > 0))
+		DataHTask(theTransfer->fDataWriter);
+
+	theTransfer->fLastTaskTime = QTFileTrans_GetMicroseconds();
+	theTransfer->fStats.fTaskTime += theTransfer->fLastTaskTime - myStartTime;
+	if (theTransfer->fLastTaskTime == 0L)
+		theTransfer->fLastTaskTime = 1L;
+
+	// retry any reads or writes that failed, once they've waited long enough
+	if (theTransfer->fNumRetrying > 0)
+		QTFileTrans_ServiceRetries(theTransfer);
+
+	// issue any reads the bandwidth limits held back, if they'll allow them now; a worker thread
+	// has only its own transfer to look after
+	if (theTransfer->fNumThrottled > 0) {
+		if (theTransfer->fOnWorkerThread)
+			while (QTFileTrans_IssueThrottledRead(theTransfer))
+				;
+		else
+			QTFileTrans_ServiceThrottledReads();
+	}
+
+	// offer a busy sink's routine its chunk again
+	if (theTransfer->fSinkBusy)
+		QTFileTrans_ResumeSink(theTransfer);
+
+	QTFileTrans_NoteDone(theTransfer);
+}
+
+
+//////////
+//
+// QTFileTrans_HasPendingRequests
+// Does the specified transfer have any reads or writes outstanding?
+//
+//////////
+
+Boolean QTFileTrans_HasPendingRequests (QTFileTransfer theTransfer)
+{
+	if (theTransfer->fNumPendingWrites > 0)
+		return(true);
+
+	return(QTFileTrans_HasPendingReads(theTransfer));
+}
+
+
+//////////
+//
+// QTFileTrans_HasPendingReads
+// Does the specified transfer have any reads outstanding?
+//
+//////////
+
+Boolean QTFileTrans_HasPendingReads (QTFileTransfer theTransfer)
+{
+	short		myIndex;
+
+	for (myIndex = 0; myIndex < theTransfer->fNumSegments; myIndex++)
+		if (theTransfer->fSegments[myIndex].fNumPendingReads > 0)
+			return(true);
+
+	return(false);
+}
+
+
+//////////
+//
+// QTFileTrans_IsDone
+// Has the specified transfer finished (either successfully or because of an error)? A transfer that has run
+// into an error isn't finished until the reads and writes it still had outstanding have completed, so that
+// it's safe to close it down as soon as this returns true.
+//
+//////////
+
+Boolean QTFileTrans_IsDone (QTFileTransfer theTransfer)
+{
+	if (theTransfer == NULL)
+		return(true);
+
+	if (theTransfer->fDoneTransferring)
+		return(true);
+
+	return((theTransfer->fStatus != noErr) && !QTFileTrans_HasPendingRequests(theTransfer));
+}
+
+
+//////////
+//
+// QTFileTrans_GetStatus
+// Return the status of the specified transfer; once QTFileTrans_IsDone returns true, this is final: either
+// noErr (every byte was transferred) or the error that ended the transfer.
+//
+//////////
+
+OSErr QTFileTrans_GetStatus (QTFileTransfer theTransfer)
+{
+	if (theTransfer == NULL)
+		return(paramErr);
+
+	return(theTransfer->fStatus);
+}
+
+
+//////////
+//
+// QTFileTrans_SetDoneProc
+// Install a routine that we call once the specified transfer is done, instead of making the application poll
+// QTFileTrans_IsDone. We call it once for each transfer started with QTFileTrans_CopyRemoteFileToLocalFile or
+// QTFileTrans_CopyLocalFileToRemoteFile that returned noErr: from QTFileTrans_Task (or QTFileTrans_Idle) when the
+// last request completes, or before the copy function returns, if the file came from the cache or was copied
+// directly. The routine may close down the data handlers or start the next transfer; it must not dispose of the
+// transfer. Pass NULL to remove the routine.
+//
+// For a transfer started with QTFileTrans_StartOnWorkerThread, we call the routine on the worker thread, not on
+// the application thread; so it mustn't touch anything the application thread uses without a lock, and it
+// shouldn't start another transfer (the worker closes down the data handlers itself, once the routine returns).
+// The application thread can wait for the kQTFileTransEventDone event instead.
+//
+//////////
+
+OSErr QTFileTrans_SetDoneProc (QTFileTransfer theTransfer, QTFileTransDoneProcPtr theProc, long theRefCon)
+{
+	if (theTransfer == NULL)
+		return(paramErr);
+
+	theTransfer->fDoneProc = theProc;
+	theTransfer->fDoneRefCon = theRefCon;
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_NoteDone
+// Call the done routine of the specified transfer, if the transfer is done and we haven't called it yet.
+//
+//////////
+
+void QTFileTrans_NoteDone (QTFileTransfer theTransfer)
+{
+	if (theTransfer->fDoneNotified || !QTFileTrans_IsDone(theTransfer))
+		return;
+
+	// in atomic mode, the local file is in place before anyone hears that the transfer is done; the HFS data
+	// handler has to let go of the temporary file first (a failed transfer's file can wait until we close down)
+	if (theTransfer->fTempFilePending && theTransfer->fDoneTransferring && (theTransfer->fStatus == noErr)) {
+		if (theTransfer->fDataWriter != NULL)
+			QTFileTrans_ReleaseHandlers(theTransfer, true);
+		else
+			QTFileTrans_FinishTempFile(theTransfer);
+	}
+
+	// mark the transfer first, since the routine might start another one
+	theTransfer->fDoneNotified = true;
+	if (theTransfer->fDoneProc != NULL)
+		(*theTransfer->fDoneProc)(theTransfer, theTransfer->fStatus, theTransfer->fDoneRefCon);
+}
+
+
+//////////
+//
+// QTFileTrans_GetProgress
+// Return the number of bytes transferred so far and the total number of bytes to transfer
+// (or -1, if we're reading a file of unknown size and haven't reached its end yet).
+//
+//////////
+
+OSErr QTFileTrans_GetProgress (QTFileTransfer theTransfer, SInt64 *theBytesTransferred, SInt64 *theBytesToTransfer)
+{
+	if (theTransfer == NULL)
+		return(paramErr);
+
+	if (theBytesTransferred != NULL)
+		*theBytesTransferred = theTransfer->fBytesTransferred;
+
+	// if we don't know how big the file is yet, say so
+	if (theBytesToTransfer != NULL)
+		*theBytesToTransfer = theTransfer->fSizeKnown ? theTransfer->fBytesToTransfer : -1;
+
+	return(theTransfer->fStatus);
+}
+
+
+//////////
+//
+// QTFileTrans_SetStreaming
+// Tell the specified transfer to read the remote file until the URL data handler reports eofErr, without
+// asking for the size of the file first. (We do the same thing automatically if DataHGetFileSize fails.)
+// A streaming transfer can't be split into segments or resumed. This function must be called before
+// QTFileTrans_CopyRemoteFileToLocalFile.
+//
+//////////
+
+OSErr QTFileTrans_SetStreaming (QTFileTransfer theTransfer, Boolean theStreaming)
+{
+	if (theTransfer == NULL)
+		return(paramErr);
+
+	if (theTransfer->fDataReader != NULL)
+		return(paramErr);
+
+	theTransfer->fStreaming = theStreaming;
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_HandleEndOfFile
+// The read into the specified buffer ran into the end of the remote file. Find out how big the file actually
+// is (by now, the URL data handler knows), stop every segment at that size, and trim the buffer to the
+// data that's actually in the file.
+//
+// If the data handler still can't tell us the size, we assume the file ends where this read began; in that
+// case we may have lost part of this chunk, so we report eofErr as the transfer's status.
+//
+//////////
+
+void QTFileTrans_HandleEndOfFile (QTFileTransBufferPtr theBuffer)
+{
+	QTFileTransfer			myTransfer = theBuffer->fTransfer;
+	ComponentInstance		myReader = theBuffer->fSegment->fDataReader;
+	SInt64					mySize = 0;
+	wide					myWide;
+	short					myIndex;
+	OSErr					myErr = noErr;
+
+	myErr = QTFileTrans_GetRemoteFileSize(myReader, &mySize);
+	QTFileTrans_Trace(myTransfer, kQTFileTransTraceGetFileSize, 0, (myErr == noErr) ? mySize : -1, myErr);
+	if (myErr != noErr) {
+		if (DataHGetAvailableFileSize64(myReader, &myWide) == noErr) {
+			mySize = QTFileTrans_WideToSInt64(&myWide);
+		} else {
+			mySize = theBuffer->fOffset;
+			myTransfer->fStatus = eofErr;
+		}
+	}
+
+	// an earlier read may already have found the end of the file
+	if (myTransfer->fSizeKnown && (mySize > myTransfer->fBytesToTransfer))
+		mySize = myTransfer->fBytesToTransfer;
+
+	myTransfer->fBytesToTransfer = mySize;
+	myTransfer->fSizeKnown = true;
+
+	// don't read anything more past the end of the file
+	for (myIndex = 0; myIndex < myTransfer->fNumSegments; myIndex++) {
+		if (myTransfer->fSegments[myIndex].fEndOffset > mySize)
+			myTransfer->fSegments[myIndex].fEndOffset = mySize;
+		if (myTransfer->fSegments[myIndex].fNextReadOffset > mySize)
+			myTransfer->fSegments[myIndex].fNextReadOffset = mySize;
+	}
+
+	// trim this buffer to the part that's actually in the file
+	if (theBuffer->fOffset >= mySize)
+		theBuffer->fNumBytes = 0L;
+	else if (theBuffer->fOffset + theBuffer->fNumBytes > mySize)
+		theBuffer->fNumBytes = (long)(mySize - theBuffer->fOffset);
+}
+
+
+//////////
+//
+// QTFileTrans_PreextendForStreaming
+// Make sure that the local file of the specified transfer has room for data up to theEndOffset, by
+// preextending it if necessary. Each time we preextend the file, we add twice as much as the last time
+// (within the bounds kMinStreamingPreextend and kMaxStreamingPreextend), so that the number of times
+// we grow the file is roughly logarithmic in its final size.
+//
+// DataHPreextend allocates space without moving the logical end of the file, so there's nothing to trim
+// once we reach the end of the remote file.
+//
+//////////
+
+void QTFileTrans_PreextendForStreaming (QTFileTransfer theTransfer, SInt64 theEndOffset)
+{
+	SInt64					myNumBytesToAdd;
+	SInt64					myNumBytesAdded = 0;
+	wide					myWideToAdd;
+	wide					myWideAdded = {0, 0};
+
+	if (theEndOffset <= theTransfer->fPreextendedSize)
+		return;
+
+	myNumBytesToAdd = theTransfer->fPreextendedSize;
+	if (myNumBytesToAdd < kMinStreamingPreextend)
+		myNumBytesToAdd = kMinStreamingPreextend;
+	if (myNumBytesToAdd > kMaxStreamingPreextend)
+		myNumBytesToAdd = kMaxStreamingPreextend;
+
+	// make sure we cover at least this chunk
+	if (theTransfer->fPreextendedSize + myNumBytesToAdd < theEndOffset)
+		myNumBytesToAdd = theEndOffset - theTransfer->fPreextendedSize;
+
+	QTFileTrans_SInt64ToWide(myNumBytesToAdd, &myWideToAdd);
+
+	// if the data handler can't preextend the file, we still move our mark along, so we don't keep trying
+	if (DataHPreextend64(theTransfer->fDataWriter, &myWideToAdd, &myWideAdded) == noErr)
+		myNumBytesAdded = QTFileTrans_WideToSInt64(&myWideAdded);
+
+	if (myNumBytesAdded <= 0)
+		myNumBytesAdded = myNumBytesToAdd;
+
+	theTransfer->fPreextendedSize += myNumBytesAdded;
+}
+
+
+//////////
+//
+// QTFileTrans_SetPreallocate
+// Tell the specified transfer whether to reserve disk space for the whole local file before the first
+// write, once it knows the size of the remote file. Preallocating the file keeps the HFS data handler
+// from extending the file on every write, which fragments the file and costs a catalog update per chunk.
+// This function must be called before QTFileTrans_CopyRemoteFileToLocalFile.
+//
+//////////
+
+OSErr QTFileTrans_SetPreallocate (QTFileTransfer theTransfer, Boolean thePreallocate)
+{
+	if (theTransfer == NULL)
+		return(paramErr);
+
+	if (theTransfer->fDataReader != NULL)
+		return(paramErr);
+
+	// only a transfer into a local file can use this
+	if (thePreallocate && (theTransfer->fSinkType != kQTFileTransSinkFile))
+		return(paramErr);
+
+	theTransfer->fPreallocate = thePreallocate;
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_PrepareLocalFile
+// Open the local file of the specified transfer ourselves (before the HFS data handler opens it), truncate
+// it if theTruncate is true, and reserve space for the rest of the remote file if the transfer should
+// be preallocated. We ask for contiguous space first and settle for any space if we can't get that.
+//
+// In place mode, we don't truncate a file whose new size we know; we just set its size, so that the blocks
+// it already has are overwritten instead of being freed and then allocated all over again. A sync transfer
+// does the same, since it keeps the data in those blocks that's still good.
+//
+// AllocContig and Allocate take a 32-bit count, so we leave files over 2GB to DataHPreextend64;
+// the caller falls back on the data handler if fPreallocated isn't set when we return.
+//
+//////////
+
+OSErr QTFileTrans_PrepareLocalFile (QTFileTransfer theTransfer, FSSpecPtr theFSSpecPtr, Boolean theTruncate)
+{
+	short				myRefNum = 0;
+	long				myEOF = 0L;
+	SInt64				myNumBytesNeeded;
+	long				myCount;
+	OSErr				myErr = noErr;
+
+	if (!theTruncate && !(theTransfer->fPreallocate && theTransfer->fSizeKnown))
+		return(noErr);
+
+	myErr = FSpOpenDF(theFSSpecPtr, fsRdWrPerm, &myRefNum);
+	if (myErr != noErr)
+		return(myErr);
+
+	if (theTruncate) {
+		if (((theTransfer->fOverwriteMode == kQTFileTransOverwriteInPlace) || (theTransfer->fSyncBlocks != NULL)) &&
+				theTransfer->fSizeKnown && (theTransfer->fBytesToTransfer <= 0x7FFFFFFFL)) {
+			myErr = SetEOF(myRefNum, (long)theTransfer->fBytesToTransfer);
+			if (myErr != noErr)
+				goto bail;
+
+			// the file has all the space it needs now
+			theTransfer->fPreallocated = theTransfer->fPreallocate;
+		} else {
+			myErr = SetEOF(myRefNum, 0L);
+			if (myErr != noErr)
+				goto bail;
+		}
+	}
+
+	if (theTransfer->fPreallocate && theTransfer->fSizeKnown && !theTransfer->fPreallocated) {
+		GetEOF(myRefNum, &myEOF);
+
+		myNumBytesNeeded = theTransfer->fBytesToTransfer - myEOF;
+		if ((myNumBytesNeeded > 0) && (myNumBytesNeeded <= 0x7FFFFFFFL)) {
+			myCount = (long)myNumBytesNeeded;
+			if (AllocContig(myRefNum, &myCount) != noErr) {
+				myCount = (long)myNumBytesNeeded;
+				if (Allocate(myRefNum, &myCount) != noErr)
+					myCount = 0L;
+			}
+
+			theTransfer->fPreallocated = (myCount >= myNumBytesNeeded);
+		}
+	}
+
+bail:
+	FSClose(myRefNum);
+	return(myErr);
+}
+
+
+//////////
+//
+// QTFileTrans_SetOverwriteMode
+// Tell the specified transfer what to do with a local file that's already there:
+//
+//	kQTFileTransOverwriteReplace	delete it and create a new file (the default)
+//	kQTFileTransOverwriteInPlace	keep it, if it has our file type and creator, and just set its size; this
+//									saves deleting and creating a file, which is slow on a network volume
+//	kQTFileTransOverwriteAtomic		write the data into a temporary file in the same folder (named after the
+//									local file, followed by kTempFileSuffix), and swap it in for the local file
+//									once the transfer is done, so that no one ever sees a partly written file
+//
+// A failed atomic transfer leaves the local file alone and deletes the temporary file (unless the transfer is
+// resumable, in which case it keeps the temporary file, and the next transfer of the same file resumes it).
+//
+// This function must be called before QTFileTrans_CopyRemoteFileToLocalFile, and affects only file sinks.
+//
+//////////
+
+OSErr QTFileTrans_SetOverwriteMode (QTFileTransfer theTransfer, long theMode)
+{
+	if (theTransfer == NULL)
+		return(paramErr);
+
+	if (theTransfer->fDataReader != NULL)
+		return(paramErr);
+
+	if ((theMode != kQTFileTransOverwriteReplace) && (theMode != kQTFileTransOverwriteInPlace) && (theMode != kQTFileTransOverwriteAtomic))
+		return(paramErr);
+
+	theTransfer->fOverwriteMode = theMode;
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_CanOverwriteInPlace
+// Can the specified transfer overwrite the specified local file in place? Only if it's been asked to (or it
+// has a sync manifest, and so wants to keep what it can of the file), and the file is already there, with our
+// file type and creator.
+//
+//////////
+
+Boolean QTFileTrans_CanOverwriteInPlace (QTFileTransfer theTransfer, FSSpecPtr theFSSpecPtr)
+{
+	FInfo				myInfo;
+
+	if ((theTransfer->fOverwriteMode != kQTFileTransOverwriteInPlace) && (theTransfer->fSyncDigests == NULL))
+		return(false);
+
+	if (FSpGetFInfo(theFSSpecPtr, &myInfo) != noErr)
+		return(false);
+
+	return((myInfo.fdType == kTransFileType) && (myInfo.fdCreator == kTransFileCreator));
+}
+
+
+//////////
+//
+// QTFileTrans_GetLocalAlias
+// Return, in theAlias, an alias for the specified local file. We keep the aliases of the last kAliasCacheSize
+// local files (throwing away the least recently used one to make room), so that transferring into the same
+// file again (or into the same few files in a folder, over and over) doesn't cost a call to QTNewAlias each time.
+// That's safe because the aliases are minimal ones, which find the file by folder and name; a file deleted and
+// created again is found just as well.
+//
+// The alias belongs to the cache, so don't dispose of it; the HFS data handler makes its own copy of the data
+// reference we give it, so the alias can go away (or be reused) while the transfer is running.
+//
+//////////
+
+OSErr QTFileTrans_GetLocalAlias (FSSpecPtr theFSSpecPtr, AliasHandle *theAlias)
+{
+	QTFileTransAliasPtr			myEntry = NULL;
+	short						myIndex;
+	OSErr						myErr = noErr;
+
+	*theAlias = NULL;
+
+	QTFileTrans_SpinLock(&gAliasCacheLock);
+
+	for (myIndex = 0; myIndex < kAliasCacheSize; myIndex++) {
+		QTFileTransAliasPtr		myCandidate = &gAliasCache[myIndex];
+
+		if ((myCandidate->fAlias != NULL) && (myCandidate->fFSSpec.vRefNum == theFSSpecPtr->vRefNum) &&
+				(myCandidate->fFSSpec.parID == theFSSpecPtr->parID) && EqualString(myCandidate->fFSSpec.name, theFSSpecPtr->name, false, true)) {
+			myEntry = myCandidate;
+			break;
+		}
+	}
+
+	if (myEntry == NULL) {
+		// use an empty entry, or else the least recently used one
+		myEntry = &gAliasCache[0];
+		for (myIndex = 1; (myIndex < kAliasCacheSize) && (myEntry->fAlias != NULL); myIndex++)
+			if ((gAliasCache[myIndex].fAlias == NULL) || (gAliasCache[myIndex].fUseStamp < myEntry->fUseStamp))
+				myEntry = &gAliasCache[myIndex];
+
+		if (myEntry->fAlias != NULL) {
+			DisposeHandle((Handle)myEntry->fAlias);
+			myEntry->fAlias = NULL;
+		}
+
+		myErr = QTNewAlias(theFSSpecPtr, &myEntry->fAlias, true);
+		if (myErr != noErr) {
+			myEntry->fAlias = NULL;
+			goto bail;
+		}
+
+		myEntry->fFSSpec = *theFSSpecPtr;
+	}
+
+	myEntry->fUseStamp = gAliasNextStamp++;
+	*theAlias = myEntry->fAlias;
+
+bail:
+	QTFileTrans_SpinUnlock(&gAliasCacheLock);
+	return(myErr);
+}
+
+
+//////////
+//
+// QTFileTrans_FlushAliasCache
+// Throw away the aliases we've kept. Call this before quitting, or if a volume we've transferred into goes away.
+//
+//////////
+
+void QTFileTrans_FlushAliasCache (void)
+{
+	short				myIndex;
+
+	QTFileTrans_SpinLock(&gAliasCacheLock);
+
+	for (myIndex = 0; myIndex < kAliasCacheSize; myIndex++) {
+		if (gAliasCache[myIndex].fAlias != NULL)
+			DisposeHandle((Handle)gAliasCache[myIndex].fAlias);
+		gAliasCache[myIndex].fAlias = NULL;
+	}
+
+	QTFileTrans_SpinUnlock(&gAliasCacheLock);
+}
+
+
+//////////
+//
+// QTFileTrans_FinishTempFile
+// If the specified transfer is writing into a temporary file (in atomic mode), we're done with that file: if the
+// transfer succeeded, swap it in for the local file; otherwise, delete it (unless the transfer is resumable).
+// The HFS data handler must have closed the temporary file. Return the status of the transfer.
+//
+// FSpExchangeFiles swaps the contents of the two files and leaves their names and file IDs alone, so the local
+// file changes all at once, and aliases to it keep working. If there's no local file yet, or the file system
+// can't exchange files, we delete the local file (if there is one) and rename the temporary file instead.
+//
+//////////
+
+OSErr QTFileTrans_FinishTempFile (QTFileTransfer theTransfer)
+{
+	OSErr				myErr = noErr;
+
+	if (!theTransfer->fTempFilePending)
+		return(theTransfer->fStatus);
+
+	theTransfer->fTempFilePending = false;
+
+	if (theTransfer->fDoneTransferring && (theTransfer->fStatus == noErr)) {
+		myErr = FSpExchangeFiles(&theTransfer->fTempFileSpec, &theTransfer->fTargetFileSpec);
+		if (myErr == noErr) {
+			FSpDelete(&theTransfer->fTempFileSpec);
+		} else {
+			if (myErr != fnfErr)
+				FSpDelete(&theTransfer->fTargetFileSpec);
+			myErr = FSpRename(&theTransfer->fTempFileSpec, theTransfer->fTargetFileSpec.name);
+		}
+
+		// the data is all there, but not where the application asked for it
+		if (myErr != noErr) {
+			theTransfer->fStatus = myErr;
+			theTransfer->fDoneTransferring = false;
+		}
+	} else if (!theTransfer->fResumable) {
+		FSpDelete(&theTransfer->fTempFileSpec);
+	}
+
+	return(theTransfer->fStatus);
+}
+
+
+//////////
+//
+// QTFileTrans_SetWriteCoalescing
+// Tell the specified transfer to collect the chunks it reads into blocks of about theFlushSize bytes, and to
+// write each block to the local file all at once; pass 0 to write each chunk as soon as it's read (the
+// default). We round theFlushSize up to a multiple of the allocation block size of the local volume, and
+// end each block on a multiple of that size, so that every write but the first and last covers whole
+// allocation blocks. This matters most with small (or adaptive) chunk sizes.
+//
+// This function must be called before QTFileTrans_CopyRemoteFileToLocalFile, and affects only file sinks.
+//
+//////////
+
+OSErr QTFileTrans_SetWriteCoalescing (QTFileTransfer theTransfer, long theFlushSize)
+{
+	if (theTransfer == NULL)
+		return(paramErr);
+
+	if ((theFlushSize < 0) || (theFlushSize > kMaxCoalesceSize))
+		return(paramErr);
+
+	theTransfer->fCoalesceSize = theFlushSize;
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_PrepareCoalescing
+// Get the coalescing blocks of the specified transfer ready, if it's been asked to coalesce its writes to the
+// specified local file. We use two blocks for each segment, so that each segment can be filling one block while
+// its other block is being written.
+//
+//////////
+
+OSErr QTFileTrans_PrepareCoalescing (QTFileTransfer theTransfer, FSSpecPtr theFSSpecPtr)
+{
+	QTFileTransBufferPtr	myBlock = NULL;
+	long					myBlockSize;
+	short					myIndex;
+	OSErr					myErr = noErr;
+
+	theTransfer->fNumCoalesceBlocks = 0;
+	theTransfer->fNumCoalesceWaiting = 0;
+
+	if (theTransfer->fCoalesceSize <= 0)
+		return(noErr);
+
+	// round the flush size up to a whole number of allocation blocks
+	myBlockSize = QTFileTrans_GetVolumeBlockSize(theFSSpecPtr);
+	theTransfer->fCoalesceAlignment = myBlockSize;
+	theTransfer->fCoalesceLimit = ((theTransfer->fCoalesceSize + myBlockSize - 1) / myBlockSize) * myBlockSize;
+	if (theTransfer->fCoalesceLimit > kMaxCoalesceSize)
+		theTransfer->fCoalesceLimit = (kMaxCoalesceSize / myBlockSize) * myBlockSize;
+	if (theTransfer->fCoalesceLimit < myBlockSize)
+		theTransfer->fCoalesceLimit = myBlockSize;
+
+	theTransfer->fNumCoalesceBlocks = theTransfer->fNumSegments * 2;
+	if (theTransfer->fNumCoalesceBlocks > kMaxCoalesceBlocks)
+		theTransfer->fNumCoalesceBlocks = kMaxCoalesceBlocks;
+
+	for (myIndex = 0; myIndex < theTransfer->fNumCoalesceBlocks; myIndex++) {
+		myBlock = &theTransfer->fCoalesceBlocks[myIndex];
+
+		// keep a block left over from an earlier transfer, if it's big enough
+		if ((myBlock->fBuffer != NULL) && (QTFileTrans_GetBufferSize(myBlock->fBuffer) < theTransfer->fCoalesceLimit)) {
+			QTFileTrans_ReleaseBuffer(myBlock->fBuffer);
+			myBlock->fBuffer = NULL;
+		}
+
+		if (myBlock->fBuffer == NULL) {
+			myErr = QTFileTrans_AllocBuffer(theTransfer->fCoalesceLimit, &myBlock->fBuffer);
+			if (myErr != noErr) {
+				theTransfer->fNumCoalesceBlocks = 0;
+				return(myErr);
+			}
+		}
+
+		myBlock->fOffset = 0L;
+		myBlock->fNumBytes = 0L;
+		myBlock->fBlockBusy = false;
+		myBlock->fWriteStartTime = 0L;
+		myBlock->fNumRetries = 0;
+		myBlock->fRetryTime = 0L;
+	}
+
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_GetVolumeBlockSize
+// Return the allocation block size, in bytes, of the volume that holds the specified file (on Windows, the
+// cluster size), or a reasonable guess if we can't find out.
+//
+//////////
+
+long QTFileTrans_GetVolumeBlockSize (FSSpecPtr theFSSpecPtr)
+{
+	long					myBlockSize = kDefaultVolumeBlockSize;
+
+#if !TARGET_OS_WIN32
+	HParamBlockRec			myPB;
+
+	if (theFSSpecPtr != NULL) {
+		memset(&myPB, 0, sizeof(myPB));
+		myPB.volumeParam.ioVRefNum = theFSSpecPtr->vRefNum;
+		myPB.volumeParam.ioVolIndex = 0;
+		myPB.volumeParam.ioNamePtr = NULL;
+
+		if ((PBHGetVInfoSync(&myPB) == noErr) && (myPB.volumeParam.ioVAlBlkSiz > 0))
+			myBlockSize = (long)myPB.volumeParam.ioVAlBlkSiz;
+	}
+#else
+	char					myPath[kMaxNativePathLength];
+	DWORD					mySectorsPerCluster;
+	DWORD					myBytesPerSector;
+	DWORD					myFreeClusters;
+	DWORD					myTotalClusters;
+	long					myLength = 0L;
+	short					mySlashes = 0;
+
+	if ((theFSSpecPtr != NULL) && (FSSpecToNativePathName(theFSSpecPtr, myPath, sizeof(myPath), kFullNativePath) == noErr)) {
+		// GetDiskFreeSpace wants the root of the volume: "C:\" or, on a LAN share, "\\server\share\"
+		if ((myPath[0] != '\0') && (myPath[1] == ':')) {
+			myLength = 2;
+		} else if ((myPath[0] == '\\') && (myPath[1] == '\\')) {
+			for (myLength = 2; (myPath[myLength] != '\0') && (mySlashes < 2); myLength++)
+				if (myPath[myLength] == '\\')
+					mySlashes++;
+			if (mySlashes == 2)
+				myLength--;
+		}
+
+		if (myLength > 0) {
+			myPath[myLength++] = '\\';
+			myPath[myLength] = '\0';
+
+			if (GetDiskFreeSpace(myPath, &mySectorsPerCluster, &myBytesPerSector, &myFreeClusters, &myTotalClusters))
+				if (mySectorsPerCluster * myBytesPerSector > 0)
+					myBlockSize = (long)(mySectorsPerCluster * myBytesPerSector);
+		}
+	}
+#endif
+
+	return(myBlockSize);
+}
+
+
+//////////
+//
+// QTFileTrans_CoalesceChunk
+// Copy the chunk in the specified buffer of the ring into the coalescing blocks of its transfer, writing each
+// block out once it's full; then hand the buffer back for the next read. If no block has room for the rest of
+// the chunk, the buffer waits (its write still counted as pending) until a block has been written.
+//
+//////////
+
+void QTFileTrans_CoalesceChunk (QTFileTransBufferPtr theBuffer)
+{
+	QTFileTransfer			myTransfer = theBuffer->fTransfer;
+	QTFileTransBufferPtr	myBlock = NULL;
+	SInt64					myOffset;
+	long					myNumBytes;
+	long					myCapacity;
+
+	while ((theBuffer->fNumCoalesced < theBuffer->fNumBytes) && (myTransfer->fStatus == noErr)) {
+		myOffset = theBuffer->fOffset + theBuffer->fNumCoalesced;
+
+		myBlock = QTFileTrans_FindBlock(myTransfer, myOffset);
+		if (myBlock == NULL) {
+			theBuffer->fCoalesceWaiting = true;
+			myTransfer->fNumCoalesceWaiting++;
+			return;
+		}
+
+		if (myBlock->fNumBytes == 0L)
+			myBlock->fOffset = myOffset;
+
+		// copy as much of the chunk as the block has room for
+		myCapacity = QTFileTrans_GetBlockCapacity(myTransfer, myBlock->fOffset);
+		myNumBytes = theBuffer->fNumBytes - theBuffer->fNumCoalesced;
+		if (myNumBytes > myCapacity - myBlock->fNumBytes)
+			myNumBytes = myCapacity - myBlock->fNumBytes;
+
+		BlockMoveData(theBuffer->fBuffer + theBuffer->fNumCoalesced, myBlock->fBuffer + myBlock->fNumBytes, myNumBytes);
+		myBlock->fNumBytes += myNumBytes;
+		theBuffer->fNumCoalesced += myNumBytes;
+
+		// write the block once it's full, or once it reaches the end of the file
+		if ((myBlock->fNumBytes >= myCapacity) || (myBlock->fOffset + myBlock->fNumBytes >= myTransfer->fBytesToTransfer))
+			QTFileTrans_FlushBlock(myBlock);
+	}
+
+	// the whole chunk is in the blocks now (or the transfer has failed), so the buffer is free again
+	theBuffer->fNumCoalesced = 0L;
+	theBuffer->fCoalesced = true;
+	QTFileTrans_WriteDataCompletionProc(theBuffer->fBuffer, (long)theBuffer, noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_FindBlock
+// Return the coalescing block of the specified transfer that the data at theOffset should go into: the block
+// that ends right there, or else an empty block. If there's neither, we start writing out the fullest block
+// that isn't already being written, and return NULL; the data has to wait until some block is free.
+//
+//////////
+
+QTFileTransBufferPtr QTFileTrans_FindBlock (QTFileTransfer theTransfer, SInt64 theOffset)
+{
+	QTFileTransBufferPtr	myBlock = NULL;
+	QTFileTransBufferPtr	myEmpty = NULL;
+	QTFileTransBufferPtr	myFullest = NULL;
+	short					myIndex;
+
+	for (myIndex = 0; myIndex < theTransfer->fNumCoalesceBlocks; myIndex++) {
+		myBlock = &theTransfer->fCoalesceBlocks[myIndex];
+		if (myBlock->fBlockBusy)
+			continue;
+
+		if (myBlock->fNumBytes == 0L) {
+			if (myEmpty == NULL)
+				myEmpty = myBlock;
+		} else if (myBlock->fOffset + myBlock->fNumBytes == theOffset) {
+			return(myBlock);
+		} else if ((myFullest == NULL) || (myBlock->fNumBytes > myFullest->fNumBytes)) {
+			myFullest = myBlock;
+		}
+	}
+
+	if ((myEmpty == NULL) && (myFullest != NULL))
+		QTFileTrans_FlushBlock(myFullest);
+
+	return(myEmpty);
+}
+
+
+//////////
+//
+// QTFileTrans_GetBlockCapacity
+// Return the number of bytes a coalescing block of the specified transfer that starts at theOffset should
+// hold: about the flush size, but ending on a multiple of the volume's allocation block size.
+//
+//////////
+
+long QTFileTrans_GetBlockCapacity (QTFileTransfer theTransfer, SInt64 theOffset)
+{
+	SInt64					myEndOffset;
+
+	myEndOffset = theOffset + theTransfer->fCoalesceLimit;
+	myEndOffset -= myEndOffset % theTransfer->fCoalesceAlignment;
+
+	// (the flush size is a multiple of the alignment, so this can shorten a block but never empty it)
+	if (myEndOffset <= theOffset)
+		myEndOffset = theOffset + theTransfer->fCoalesceLimit;
+
+	return((long)(myEndOffset - theOffset));
+}
+
+
+//////////
+//
+// QTFileTrans_FlushBlock
+// Write the data in the specified coalescing block to the local file, unless it's empty or already being written.
+//
+//////////
+
+void QTFileTrans_FlushBlock (QTFileTransBufferPtr theBlock)
+{
+	QTFileTransfer			myTransfer = theBlock->fTransfer;
+
+	if (theBlock->fBlockBusy || (theBlock->fNumBytes <= 0L))
+		return;
+
+	theBlock->fBlockBusy = true;
+
+	QTFileTrans_NoteStateChange(myTransfer);
+	myTransfer->fNumPendingWrites++;
+	QTFileTrans_PassToSink(theBlock);
+}
+
+
+//////////
+//
+// QTFileTrans_FlushCoalesced
+// Write out every coalescing block of the specified transfer that holds data and isn't already being written.
+// We do this once there's nothing left to read, since the last blocks of the file may never fill up.
+//
+//////////
+
+void QTFileTrans_FlushCoalesced (QTFileTransfer theTransfer)
+{
+	short					myIndex;
+
+	for (myIndex = 0; myIndex < theTransfer->fNumCoalesceBlocks; myIndex++)
+		QTFileTrans_FlushBlock(&theTransfer->fCoalesceBlocks[myIndex]);
+}
+
+
+//////////
+//
+// QTFileTrans_ResumeCoalescing
+// Give the buffers of the specified transfer that are waiting for room in the coalescing blocks another try,
+// lowest offset first (so that the blocks fill up in order).
+//
+//////////
+
+void QTFileTrans_ResumeCoalescing (QTFileTransfer theTransfer)
+{
+	QTFileTransBufferPtr	myBuffer = NULL;
+	short					myIndex;
+
+	while ((theTransfer->fNumCoalesceWaiting > 0) && (theTransfer->fStatus == noErr)) {
+		myBuffer = NULL;
+		for (myIndex = 0; myIndex < theTransfer->fNumBuffers; myIndex++)
+			if (theTransfer->fDataBuffers[myIndex].fCoalesceWaiting)
+				if ((myBuffer == NULL) || (theTransfer->fDataBuffers[myIndex].fOffset < myBuffer->fOffset))
+					myBuffer = &theTransfer->fDataBuffers[myIndex];
+
+		if (myBuffer == NULL)
+			break;
+
+		myBuffer->fCoalesceWaiting = false;
+		theTransfer->fNumCoalesceWaiting--;
+		QTFileTrans_CoalesceChunk(myBuffer);
+
+		// if it had to wait again, so will the others
+		if (myBuffer->fCoalesceWaiting)
+			break;
+	}
+}
+
+
+//////////
+//
+// QTFileTrans_ClearCoalescing
+// Forget about the data in the coalescing blocks of the specified transfer, and about any buffers waiting for
+// room in them. The buffers that were waiting don't have writes pending any more.
+//
+//////////
+
+void QTFileTrans_ClearCoalescing (QTFileTransfer theTransfer)
+{
+	short					myIndex;
+
+	for (myIndex = 0; myIndex < kMaxNumDataBuffers; myIndex++) {
+		if (theTransfer->fDataBuffers[myIndex].fCoalesceWaiting) {
+			QTFileTrans_NoteStateChange(theTransfer);
+			theTransfer->fDataBuffers[myIndex].fCoalesceWaiting = false;
+			theTransfer->fNumPendingWrites--;
+		}
+
+		theTransfer->fDataBuffers[myIndex].fNumCoalesced = 0L;
+	}
+
+	theTransfer->fNumCoalesceWaiting = 0;
+
+	for (myIndex = 0; myIndex < kMaxCoalesceBlocks; myIndex++)
+		if (!theTransfer->fCoalesceBlocks[myIndex].fBlockBusy)
+			theTransfer->fCoalesceBlocks[myIndex].fNumBytes = 0L;
+}
+
+
+//////////
+//
+// QTFileTrans_SetDirectCopy
+// Tell the specified transfer whether to copy file URLs directly, with the fastest copy the operating system
+// offers, instead of through the URL and HFS data handlers. This is on by default. Note that a direct copy is
+// synchronous: QTFileTrans_CopyRemoteFileToLocalFile doesn't return until the copy is finished (if you don't
+// want to wait, run the transfer on a worker thread).
+//
+//////////
+
+OSErr QTFileTrans_SetDirectCopy (QTFileTransfer theTransfer, Boolean theDirectCopy)
+{
+	if (theTransfer == NULL)
+		return(paramErr);
+
+	theTransfer->fDirectCopy = theDirectCopy;
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_ClearHeldBuffers
+// Forget about the buffers of the specified transfer that are waiting to be passed to its sink in order (because
+// an earlier chunk isn't in yet, or because the sink's routine is busy); they don't have writes pending any more.
+//
+//////////
+
+void QTFileTrans_ClearHeldBuffers (QTFileTransfer theTransfer)
+{
+	short					myIndex;
+
+	for (myIndex = 0; myIndex < kMaxNumDataBuffers; myIndex++) {
+		if (theTransfer->fDataBuffers[myIndex].fSinkHeld) {
+			QTFileTrans_NoteStateChange(theTransfer);
+			theTransfer->fDataBuffers[myIndex].fSinkHeld = false;
+			theTransfer->fNumPendingWrites--;
+		}
+	}
+
+	theTransfer->fSinkBusy = false;
+}
+
+
+//////////
+//
+// QTFileTrans_SetSmallFileSize
+// Set the size, in bytes, of the largest remote file that the specified transfer copies with a single
+// synchronous read (DataHGetData) and write (DataHPutData), instead of through the buffer ring; pass 0 to
+// send every file through the ring. The default is kDefaultSmallFileSize. We can only do this when the URL
+// data handler tells us the size of the file, and a copy done this way is synchronous, so keep the size small.
+//
+//////////
+
+OSErr QTFileTrans_SetSmallFileSize (QTFileTransfer theTransfer, long theNumBytes)
+{
+	if (theTransfer == NULL)
+		return(paramErr);
+
+	if ((theNumBytes < 0) || (theNumBytes > kMaxSmallFileSize))
+		return(paramErr);
+
+	theTransfer->fSmallFileSize = theNumBytes;
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_SetUseCache
+// Tell the specified transfer whether to look for its file in the download cache (see QTFileTransferCache.c)
+// before reading it from the server, and to add the file to the cache once it's downloaded. This is on by
+// default, but it doesn't do anything until you call QTFileTrans_SetCacheDirectory. Only transfers into a
+// local file use the cache.
+//
+//////////
+
+OSErr QTFileTrans_SetUseCache (QTFileTransfer theTransfer, Boolean theUseCache)
+{
+	if (theTransfer == NULL)
+		return(paramErr);
+
+	theTransfer->fUseCache = theUseCache;
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_SetCacheValidator
+// Give the specified transfer a validator for the remote file it's about to transfer: its ETag, or its
+// modification date, or anything else that changes whenever the file does (the data handlers can't tell us
+// any of these things, but your application might know them). A copy of the file in the download cache
+// whose validator differs is out of date. The validator applies to the next transfer only; pass NULL to
+// go by the size of the remote file alone (the default).
+//
+//////////
+
+OSErr QTFileTrans_SetCacheValidator (QTFileTransfer theTransfer, char *theValidator)
+{
+	if (theTransfer == NULL)
+		return(paramErr);
+
+	if ((theValidator != NULL) && (strlen(theValidator) >= kCacheMaxValidatorSize))
+		return(paramErr);
+
+	theTransfer->fCacheValidator[0] = '\0';
+	if (theValidator != NULL)
+		strcpy(theTransfer->fCacheValidator, theValidator);
+
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_UsesCache
+// Does the specified transfer, of the specified URL into the specified local file, use the download cache?
+//
+//////////
+
+Boolean QTFileTrans_UsesCache (QTFileTransfer theTransfer, char *theURL, FSSpecPtr theFSSpecPtr)
+{
+	// a file URL names a file that's already local, so there's no point in keeping another copy of it
+	return(QTFileTrans_CacheIsEnabled() && theTransfer->fUseCache && (theTransfer->fSinkType == kQTFileTransSinkFile) &&
+			(theFSSpecPtr != NULL) && !QTFileTrans_IsFileURL(theURL));
+}
+
+
+//////////
+//
+// QTFileTrans_ServeFromCache
+// Copy the specified transfer's file out of the download cache into the specified local file, if the cache
+// has a copy that's still current (see QTFileTrans_CacheFetch for what theRemoteSize and theCacheSize mean),
+// and finish the transfer. Return noErr if we did that.
+//
+//////////
+
+OSErr QTFileTrans_ServeFromCache (QTFileTransfer theTransfer, FSSpecPtr theFSSpecPtr, SInt64 theRemoteSize, SInt64 *theCacheSize)
+{
+	FSSpec						myCheckpointSpec;
+	OSErr						myErr = noErr;
+
+	myErr = QTFileTrans_CacheFetch(theTransfer->fCacheKey, theTransfer->fCacheValidator, theRemoteSize, theFSSpecPtr, theCacheSize);
+	if (myErr != noErr)
+		return(myErr);
+
+	theTransfer->fStatus = noErr;
+
+	// a digest covers the whole file, so compute it from the copy; we need a buffer to read the copy into;
+	// if the copy doesn't have the digest we expect, we throw the result away and download the file after all
+	if (theTransfer->fDigest.fType != kQTFileTransDigestNone) {
+		QTFileTrans_DigestInit(&theTransfer->fDigest, theTransfer->fDigest.fType);
+
+		if (theTransfer->fDataBuffers[0].fBuffer == NULL)
+			myErr = QTFileTrans_PrepareBuffers(theTransfer);
+		if (myErr == noErr)
+			myErr = QTFileTrans_DigestLocalFile(theTransfer, theFSSpecPtr, *theCacheSize);
+		if (myErr == noErr) {
+			QTFileTrans_FinishDigest(theTransfer);
+			myErr = theTransfer->fStatus;
+		}
+
+		if (myErr != noErr) {
+			theTransfer->fStatus = noErr;
+			QTFileTrans_DigestInit(&theTransfer->fDigest, theTransfer->fDigest.fType);
+			return(myErr);
+		}
+	}
+
+	// if an earlier, interrupted transfer of this file left a checkpoint, we don't need it any more
+	if (theTransfer->fResumable)
+		if (QTFileTrans_MakeCheckpointSpec(theFSSpecPtr, &myCheckpointSpec) == noErr)
+			FSpDelete(&myCheckpointSpec);
+
+	theTransfer->fCacheStore = false;
+	theTransfer->fBytesToTransfer = theTransfer->fBytesTransferred = *theCacheSize;
+	theTransfer->fSizeKnown = true;
+	theTransfer->fStats.fBytesFromCache = *theCacheSize;
+	theTransfer->fStats.fBytesWritten = *theCacheSize;
+	theTransfer->fStats.fElapsedTime = QTFileTrans_GetMicroseconds() - theTransfer->fStateTime;
+	theTransfer->fDoneTransferring = true;
+
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_SetFileSink
+// Tell the specified transfer to write its data into the local file passed to QTFileTrans_CopyRemoteFileToLocalFile.
+// This is the default. These sink functions must be called before QTFileTrans_CopyRemoteFileToLocalFile.
+//
+//////////
+
+OSErr QTFileTrans_SetFileSink (QTFileTransfer theTransfer)
+{
+	if (theTransfer == NULL)
+		return(paramErr);
+
+	if (theTransfer->fDataReader != NULL)
+		return(paramErr);
+
+	if (theTransfer->fSinkHandle != NULL) {
+		DisposeHandle(theTransfer->fSinkHandle);
+		theTransfer->fSinkHandle = NULL;
+	}
+
+	theTransfer->fSinkType = kQTFileTransSinkFile;
+	theTransfer->fSinkProc = NULL;
+	theTransfer->fSinkRefCon = 0L;
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_SetMemorySink
+// Tell the specified transfer to collect its data in a handle, instead of writing it into a local file.
+// The handle grows as the data arrives (doubling in size each time it fills up), so a memory sink can
+// hold a file of unknown size; but it can't hold more than kMaxMemorySinkSize bytes.
+//
+// A transfer into memory has no local file, so it can't be resumable or preallocated.
+//
+//////////
+
+OSErr QTFileTrans_SetMemorySink (QTFileTransfer theTransfer)
+{
+	OSErr			myErr = noErr;
+
+	myErr = QTFileTrans_SetFileSink(theTransfer);
+	if (myErr != noErr)
+		return(myErr);
+
+	theTransfer->fSinkType = kQTFileTransSinkMemory;
+	theTransfer->fResumable = false;
+	theTransfer->fPreallocate = false;
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_SetCallbackSink
+// Tell the specified transfer to pass its data to the specified routine, instead of writing it into a local
+// file. The routine is called once for each chunk, in order of offset, as soon as the chunk (and every chunk
+// before it) has been read; so you can hash, parse, or forward the data without a round trip to disk.
+//
+// To keep the chunks in order, a transfer to a callback sink reads the file in a single segment.
+// It has no local file, so it can't be resumable or preallocated.
+//
+// If the routine isn't ready for a chunk, it can return kQTFileTransSinkBusyErr; we then keep the chunk, and every
+// chunk after it, in the buffer ring, and offer the routine the same chunk again the next time the transfer is
+// tasked (or when you call QTFileTrans_ResumeSink). Set a readahead window (see QTFileTrans_SetReadahead) to
+// decide how much data can pile up in the meantime.
+//
+//////////
+
+OSErr QTFileTrans_SetCallbackSink (QTFileTransfer theTransfer, QTFileTransSinkProcPtr theProc, long theRefCon)
+{
+	OSErr			myErr = noErr;
+
+	if (theProc == NULL)
+		return(paramErr);
+
+	myErr = QTFileTrans_SetFileSink(theTransfer);
+	if (myErr != noErr)
+		return(myErr);
+
+	theTransfer->fSinkType = kQTFileTransSinkCallback;
+	theTransfer->fSinkProc = theProc;
+	theTransfer->fSinkRefCon = theRefCon;
+	theTransfer->fResumable = false;
+	theTransfer->fPreallocate = false;
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_ResumeSink
+// Offer the routine of the specified transfer's callback sink, which said it was busy, the chunk it turned down
+// (and the ones after it) right away, instead of waiting for the transfer to be tasked. Call this on the
+// thread running the transfer, but not from within the routine itself.
+//
+//////////
+
+OSErr QTFileTrans_ResumeSink (QTFileTransfer theTransfer)
+{
+	if (theTransfer == NULL)
+		return(paramErr);
+
+	if (!theTransfer->fSinkBusy)
+		return(noErr);
+
+	theTransfer->fSinkBusy = false;
+	QTFileTrans_DeliverInOrder(theTransfer);
+
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_GetMemorySinkData
+// Return the handle holding the data collected by the memory sink of the specified transfer, trimmed to the
+// size of that data. The caller owns the handle from now on, and must dispose of it.
+//
+//////////
+
+OSErr QTFileTrans_GetMemorySinkData (QTFileTransfer theTransfer, Handle *theData)
+{
+	if ((theTransfer == NULL) || (theData == NULL))
+		return(paramErr);
+
+	*theData = NULL;
+
+	if ((theTransfer->fSinkType != kQTFileTransSinkMemory) || (theTransfer->fSinkHandle == NULL))
+		return(paramErr);
+
+	// we can't give the handle away while data is still being copied into it
+	if (QTFileTrans_HasPendingRequests(theTransfer))
+		return(paramErr);
+
+	SetHandleSize(theTransfer->fSinkHandle, (Size)theTransfer->fSinkDataSize);
+
+	*theData = theTransfer->fSinkHandle;
+	theTransfer->fSinkHandle = NULL;
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_WriteToSink
+// Hand the data just read into the specified buffer to its transfer's sink. The caller has already counted
+// this as a pending write; the write completion routine is called once the sink is done with the buffer
+// (by the HFS data handler, for a file sink, and by us, for the other sinks).
+//
+//////////
+
+void QTFileTrans_WriteToSink (QTFileTransBufferPtr theBuffer)
+{
+	QTFileTransfer			myTransfer = theBuffer->fTransfer;
+
+	if (QTFileTrans_NeedsOrderedData(myTransfer)) {
+		// hold on to this buffer until every chunk before it has been passed along
+		theBuffer->fSinkHeld = true;
+		QTFileTrans_DeliverInOrder(myTransfer);
+	} else {
+		QTFileTrans_PassToSink(theBuffer);
+	}
+}
+
+
+//////////
+//
+// QTFileTrans_PassToSink
+// Pass the data in the specified buffer to its transfer's sink.
+//
+//////////
+
+void QTFileTrans_PassToSink (QTFileTransBufferPtr theBuffer)
+{
+	QTFileTransfer			myTransfer = theBuffer->fTransfer;
+	wide					myWide;
+	OSErr					myErr = noErr;
+
+	// time the write (or whatever takes its place, for a memory or callback sink); 0 means "not timed"
+	theBuffer->fWriteStartTime = QTFileTrans_GetMicroseconds();
+	if (theBuffer->fWriteStartTime == 0L)
+		theBuffer->fWriteStartTime = 1L;
+
+	switch (myTransfer->fSinkType) {
+		case kQTFileTransSinkMemory:
+			QTFileTrans_Trace(myTransfer, kQTFileTransTraceWriteIssue, theBuffer->fOffset, theBuffer->fNumBytes, noErr);
+
+			// once the handle can't grow any more, we just let the rest of the data go by
+			if (myTransfer->fSinkStatus == noErr) {
+				myErr = QTFileTrans_WriteToMemorySink(theBuffer);
+				QTFileTrans_NoteSinkError(myTransfer, myErr);
+			}
+
+			QTFileTrans_WriteDataCompletionProc(theBuffer->fBuffer, (long)theBuffer, myErr);
+			break;
+
+		case kQTFileTransSinkCallback:
+			QTFileTrans_Trace(myTransfer, kQTFileTransTraceWriteIssue, theBuffer->fOffset, theBuffer->fNumBytes, noErr);
+
+			// once the routine has returned an error, we don't bother it with any more data
+			if (myTransfer->fSinkStatus == noErr) {
+				myErr = (*myTransfer->fSinkProc)(theBuffer->fBuffer, theBuffer->fNumBytes, theBuffer->fOffset, myTransfer->fSinkRefCon);
+
+				// if the routine is busy, hold on to the chunk (undoing what QTFileTrans_DeliverInOrder did) and offer it
+				// again later; the write stays pending, so the buffer isn't reused and no more reads are issued into it
+				if (myErr == kQTFileTransSinkBusyErr) {
+					QTFileTrans_Trace(myTransfer, kQTFileTransTraceWriteComplete, theBuffer->fOffset, theBuffer->fNumBytes, myErr);
+					theBuffer->fWriteStartTime = 0L;
+					theBuffer->fSinkHeld = true;
+					myTransfer->fSinkNextOffset -= theBuffer->fNumBytes;
+					myTransfer->fSinkBusy = true;
+					break;
+				}
+
+				QTFileTrans_NoteSinkError(myTransfer, myErr);
+			}
+
+			QTFileTrans_WriteDataCompletionProc(theBuffer->fBuffer, (long)theBuffer, myErr);
+			break;
+
+		case kQTFileTransSinkFile:
+		default:
+			// if we're coalescing writes, a chunk from the ring just goes into a coalescing block for now
+			if ((myTransfer->fNumCoalesceBlocks > 0) && !theBuffer->fIsBlock) {
+				QTFileTrans_CoalesceChunk(theBuffer);
+				break;
+			}
+
+			QTFileTrans_SInt64ToWide(theBuffer->fOffset, &myWide);
+			QTFileTrans_Trace(myTransfer, kQTFileTransTraceWriteIssue, theBuffer->fOffset, theBuffer->fNumBytes, noErr);
+
+			// the URL data handler we're uploading to has only DataHWrite (we don't upload files too big for it)
+			if (myTransfer->fUploading)
+				myErr = (OSErr)DataHWrite(myTransfer->fDataWriter,
+						theBuffer->fBuffer,				// the data buffer
+						(long)theBuffer->fOffset,		// write at the offset this buffer was read from
+						theBuffer->fNumBytes,			// the number of bytes to write
+						myTransfer->fWriteDataHCompletionUPP,
+						(long)theBuffer);
+			else
+				myErr = (OSErr)DataHWrite64(myTransfer->fDataWriter,
+						theBuffer->fBuffer,				// the data buffer
+						&myWide,						// write at the offset this buffer was read from
+						theBuffer->fNumBytes,			// the number of bytes to write
+						myTransfer->fWriteDataHCompletionUPP,
+						(long)theBuffer);
+
+			// if the data handler won't even take the request, we treat that just like a write that failed
+			if (myErr != noErr)
+				QTFileTrans_WriteDataCompletionProc(theBuffer->fBuffer, (long)theBuffer, myErr);
+			break;
+	}
+}
+
+
+//////////
+//
+// QTFileTrans_NeedsOrderedData
+// Must the specified transfer pass its data along in order of offset? A callback sink expects the chunks
+// in order, and so do a digest and a URL data handler we're uploading to; in any of these cases, the transfer
+// reads the file in a single segment.
+//
+//////////
+
+Boolean QTFileTrans_NeedsOrderedData (QTFileTransfer theTransfer)
+{
+	return((theTransfer->fSinkType == kQTFileTransSinkCallback) || (theTransfer->fDigest.fType != kQTFileTransDigestNone) || theTransfer->fUploading);
+}
+
+
+//////////
+//
+// QTFileTrans_WriteToMemorySink
+// Copy the data in the specified buffer into the handle of its transfer's memory sink, at the offset
+// the data was read from, growing the handle if necessary.
+//
+//////////
+
+OSErr QTFileTrans_WriteToMemorySink (QTFileTransBufferPtr theBuffer)
+{
+	QTFileTransfer			myTransfer = theBuffer->fTransfer;
+	Handle					myHandle = myTransfer->fSinkHandle;
+	SInt64					myEndOffset = theBuffer->fOffset + theBuffer->fNumBytes;
+	SInt64					myNewSize;
+	Size					mySize;
+	OSErr					myErr = noErr;
+
+	if (myHandle == NULL)
+		return(memFullErr);
+
+	if (myEndOffset > kMaxMemorySinkSize)
+		return(memFullErr);
+
+	mySize = GetHandleSize(myHandle);
+	if (myEndOffset > mySize) {
+		// double the size of the handle, so that the number of times we resize it (and perhaps move it)
+		// is logarithmic in the size of the data; if we can't get that much, try for just what we need
+		myNewSize = (SInt64)mySize * 2;
+		if (myNewSize < myEndOffset)
+			myNewSize = myEndOffset;
+		if (myNewSize > kMaxMemorySinkSize)
+			myNewSize = kMaxMemorySinkSize;
+
+		SetHandleSize(myHandle, (Size)myNewSize);
+		myErr = MemError();
+		if (myErr != noErr) {
+			SetHandleSize(myHandle, (Size)myEndOffset);
+			myErr = MemError();
+			if (myErr != noErr)
+				return(myErr);
+		}
+	}
+
+	BlockMoveData(theBuffer->fBuffer, *myHandle + (long)theBuffer->fOffset, theBuffer->fNumBytes);
+
+	if (myEndOffset > myTransfer->fSinkDataSize)
+		myTransfer->fSinkDataSize = myEndOffset;
+
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_DeliverInOrder
+// Pass every held buffer of the specified transfer that's next in line to the transfer's digest (if any)
+// and then to its sink, until the sink's routine says it's busy.
+//
+// A transfer that needs ordered data reads the file in a single segment, so the buffers are filled in order
+// of offset; the chunk at fSinkNextOffset is therefore always either held already or still being read, and
+// any buffer that's held waits only for reads that are already underway.
+//
+//////////
+
+void QTFileTrans_DeliverInOrder (QTFileTransfer theTransfer)
+{
+	QTFileTransBufferPtr	myBuffer = NULL;
+	short					myIndex;
+
+	// a busy routine gets its next chunk when QTFileTrans_ResumeSink says so
+	if (theTransfer->fSinkBusy)
+		return;
+
+	do {
+		myBuffer = NULL;
+		for (myIndex = 0; myIndex < theTransfer->fNumBuffers; myIndex++) {
+			if (theTransfer->fDataBuffers[myIndex].fSinkHeld && (theTransfer->fDataBuffers[myIndex].fOffset == theTransfer->fSinkNextOffset)) {
+				myBuffer = &theTransfer->fDataBuffers[myIndex];
+				break;
+			}
+		}
+
+		if (myBuffer != NULL) {
+			// update our state before passing the buffer along; a memory or callback sink calls the write
+			// completion routine right away, which might lead to this function being called again (if the
+			// next read completes right away)
+			myBuffer->fSinkHeld = false;
+			theTransfer->fSinkNextOffset += myBuffer->fNumBytes;
+
+			// digest the chunk while it's still in the cache; a chunk that a busy routine turned down has already
+			// been digested the first time around
+			if ((theTransfer->fDigest.fType != kQTFileTransDigestNone) && ((SInt64)theTransfer->fDigest.fNumBytes == myBuffer->fOffset))
+				QTFileTrans_DigestUpdate(&theTransfer->fDigest, (const UInt8 *)myBuffer->fBuffer, myBuffer->fNumBytes);
+
+			QTFileTrans_PassToSink(myBuffer);
+		}
+	} while ((myBuffer != NULL) && !theTransfer->fSinkBusy);
+}
+
+
+//////////
+//
+// QTFileTrans_NoteSinkError
+// Remember the first error returned by the sink of the specified transfer; it also becomes the transfer's
+// status, unless the transfer has already run into some other error.
+//
+//////////
+
+void QTFileTrans_NoteSinkError (QTFileTransfer theTransfer, OSErr theErr)
+{
+	if (theErr == noErr)
+		return;
+
+	if (theTransfer->fSinkStatus == noErr)
+		theTransfer->fSinkStatus = theErr;
+
+	QTFileTrans_FailTransfer(theTransfer, theErr);
+}
+
+
+//////////
+//
+// QTFileTrans_SetDigest
+// Tell the specified transfer to compute a digest (a CRC-32, MD5, or SHA-256) of its data as the data goes
+// by, instead of making you read the whole file back once the transfer is done. If theExpected isn't NULL,
+// it points to the digest the data should have (QTFileTrans_DigestSize(theType) bytes, in the usual order);
+// if the data turns out to have some other digest, the transfer's status is kQTFileTransDigestMismatchErr.
+// Pass kQTFileTransDigestNone to stop computing a digest.
+//
+// A transfer that computes a digest reads the file in a single segment, so that the chunks reach the digest
+// in order, and it doesn't copy file URLs directly. If it resumes an interrupted transfer, it first digests
+// the part of the local file it already has. This function must be called before
+// QTFileTrans_CopyRemoteFileToLocalFile.
+//
+//////////
+
+OSErr QTFileTrans_SetDigest (QTFileTransfer theTransfer, long theType, const UInt8 *theExpected)
+{
+	OSErr			myErr = noErr;
+
+	if (theTransfer == NULL)
+		return(paramErr);
+
+	if (theTransfer->fDataReader != NULL)
+		return(paramErr);
+
+	myErr = QTFileTrans_DigestInit(&theTransfer->fDigest, theType);
+	if (myErr != noErr)
+		return(myErr);
+
+	theTransfer->fCheckDigest = (theExpected != NULL) && (theType != kQTFileTransDigestNone);
+	if (theTransfer->fCheckDigest)
+		BlockMoveData(theExpected, theTransfer->fExpectedDigest, QTFileTrans_DigestSize(theType));
+
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_GetDigest
+// Return the digest of the data transferred by the specified transfer. The digest is available only once
+// the transfer is done; theDigest must have room for kMaxDigestSize bytes.
+//
+//////////
+
+OSErr QTFileTrans_GetDigest (QTFileTransfer theTransfer, UInt8 *theDigest, long *theDigestSize)
+{
+	if ((theTransfer == NULL) || (theDigest == NULL) || (theDigestSize == NULL))
+		return(paramErr);
+
+	*theDigestSize = 0L;
+
+	if (theTransfer->fDigest.fResultSize == 0L)
+		return(paramErr);
+
+	BlockMoveData(theTransfer->fDigest.fResult, theDigest, theTransfer->fDigest.fResultSize);
+	*theDigestSize = theTransfer->fDigest.fResultSize;
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_DigestLocalFile
+// Add the first theNumBytes bytes of the specified local file to the digest of the specified transfer,
+// reading them through the transfer's first buffer; we do this when we resume an interrupted transfer.
+//
+//////////
+
+OSErr QTFileTrans_DigestLocalFile (QTFileTransfer theTransfer, FSSpecPtr theFSSpecPtr, SInt64 theNumBytes)
+{
+	Ptr					myBuffer = theTransfer->fDataBuffers[0].fBuffer;
+	short				myRefNum = 0;
+	long				myCount;
+	OSErr				myErr = noErr;
+
+	if (myBuffer == NULL)
+		return(paramErr);
+
+	myErr = FSpOpenDF(theFSSpecPtr, fsRdPerm, &myRefNum);
+	if (myErr != noErr)
+		return(myErr);
+
+	while ((theNumBytes > 0) && (myErr == noErr)) {
+		myCount = theTransfer->fBufferSize;
+		if (myCount > theNumBytes)
+			myCount = (long)theNumBytes;
+
+		myErr = FSRead(myRefNum, &myCount, myBuffer);
+		if ((myErr == eofErr) && (myCount > 0))
+			myErr = noErr;
+		if (myCount <= 0)
+			myErr = eofErr;
+
+		if (myErr == noErr) {
+			QTFileTrans_DigestUpdate(&theTransfer->fDigest, (const UInt8 *)myBuffer, myCount);
+			theNumBytes -= myCount;
+		}
+	}
+
+	FSClose(myRefNum);
+	return(myErr);
+}
+
+
+//////////
+//
+// QTFileTrans_FinishDigest
+// Finish the digest of the specified transfer (if it's computing one), and compare it with the digest
+// we expect (if we were given one).
+//
+//////////
+
+void QTFileTrans_FinishDigest (QTFileTransfer theTransfer)
+{
+	if (theTransfer->fDigest.fType == kQTFileTransDigestNone)
+		return;
+
+	QTFileTrans_DigestFinal(&theTransfer->fDigest);
+
+	if (theTransfer->fCheckDigest)
+		if (memcmp(theTransfer->fDigest.fResult, theTransfer->fExpectedDigest, theTransfer->fDigest.fResultSize) != 0)
+			if (theTransfer->fStatus == noErr)
+				theTransfer->fStatus = kQTFileTransDigestMismatchErr;
+}
+
+
+//////////
+//
+// QTFileTrans_SetSyncManifest
+// Give the specified transfer a manifest of the remote file: its size, and a digest (of the specified type)
+// of each theBlockSize bytes of it, one after another in theDigests (the last block may be shorter). The next
+// transfer then compares the blocks of the existing local file with the manifest, reads only the blocks that
+// differ (or that the local file doesn't have), and writes them into place; the rest of the local file is left
+// just as it is. The manifest is copied, and applies to the next transfer only. Pass NULL for theDigests to
+// throw away a manifest you've set.
+//
+// You get the manifest from the server, however it publishes it: the publisher can make it with
+// QTFileTrans_MakeSyncManifest, and you can fetch it with a transfer into a memory sink. We fall back on
+// reading the whole file if the remote file isn't the size the manifest says, if there's no local file (or it
+// has to be replaced; see QTFileTrans_SetOverwriteMode), if the transfer computes a digest of the data (which
+// needs every byte of it), or if the file is bigger than kMaxSyncFileSize. A sync transfer doesn't resume from
+// a checkpoint, and doesn't need to: the blocks an interrupted sync already wrote match the manifest next time.
+//
+// This function must be called before QTFileTrans_CopyRemoteFileToLocalFile, and affects only file sinks.
+//
+//////////
+
+OSErr QTFileTrans_SetSyncManifest (QTFileTransfer theTransfer, long theDigestType, long theBlockSize, SInt64 theFileSize, const UInt8 *theDigests)
+{
+	long			myDigestSize = QTFileTrans_DigestSize(theDigestType);
+	SInt64			myNumBlocks;
+
+	if (theTransfer == NULL)
+		return(paramErr);
+
+	if (theTransfer->fDataReader != NULL)
+		return(paramErr);
+
+	QTFileTrans_DisposeSync(theTransfer);
+
+	if (theDigests == NULL)
+		return(noErr);
+
+	// only a transfer into a local file can use this
+	if (theTransfer->fSinkType != kQTFileTransSinkFile)
+		return(paramErr);
+
+	if ((myDigestSize <= 0) || (theBlockSize < kMinSyncBlockSize) || (theFileSize < 0) || (theFileSize > kMaxSyncFileSize))
+		return(paramErr);
+
+	myNumBlocks = (theFileSize + theBlockSize - 1) / theBlockSize;
+
+	theTransfer->fSyncDigests = NewPtr((Size)(myNumBlocks * myDigestSize) + 1);
+	if (theTransfer->fSyncDigests == NULL)
+		return(MemError());
+
+	BlockMoveData(theDigests, theTransfer->fSyncDigests, (Size)(myNumBlocks * myDigestSize));
+	theTransfer->fSyncDigestType = theDigestType;
+	theTransfer->fSyncBlockSize = theBlockSize;
+	theTransfer->fSyncFileSize = theFileSize;
+	theTransfer->fSyncNumBlocks = (long)myNumBlocks;
+
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_MakeSyncManifest
+// Compute the manifest of the specified local file, for QTFileTrans_SetSyncManifest: return the size of the file
+// in theFileSize, and, in theDigests, a new pointer holding a digest of the specified type of each theBlockSize
+// bytes of the file. The caller owns the pointer (and should dispose of it with DisposePtr).
+//
+//////////
+
+OSErr QTFileTrans_MakeSyncManifest (FSSpecPtr theFSSpecPtr, long theDigestType, long theBlockSize, SInt64 *theFileSize, Ptr *theDigests)
+{
+	long				myDigestSize = QTFileTrans_DigestSize(theDigestType);
+	Ptr					myBuffer = NULL;
+	Ptr					myDigests = NULL;
+	short				myRefNum = 0;
+	long				myEOF = 0L;
+	long				myNumBlocks;
+	long				myBlock;
+	long				myNumBytes;
+	OSErr				myErr = noErr;
+
+	if ((theFSSpecPtr == NULL) || (theFileSize == NULL) || (theDigests == NULL))
+		return(paramErr);
+
+	*theDigests = NULL;
+	*theFileSize = 0;
+
+	if ((myDigestSize <= 0) || (theBlockSize < kMinSyncBlockSize))
+		return(paramErr);
+
+	myErr = FSpOpenDF(theFSSpecPtr, fsRdPerm, &myRefNum);
+	if (myErr != noErr)
+		return(myErr);
+
+	myErr = GetEOF(myRefNum, &myEOF);
+	if (myErr != noErr)
+		goto bail;
+
+	myNumBlocks = (long)(((SInt64)myEOF + theBlockSize - 1) / theBlockSize);
+
+	myBuffer = NewPtr(theBlockSize);
+	myDigests = NewPtr(myNumBlocks * myDigestSize + 1);
+	if ((myBuffer == NULL) || (myDigests == NULL)) {
+		myErr = memFullErr;
+		goto bail;
+	}
+
+	for (myBlock = 0; (myBlock < myNumBlocks) && (myErr == noErr); myBlock++) {
+		myNumBytes = theBlockSize;
+		if ((SInt64)myBlock * theBlockSize + myNumBytes > myEOF)
+			myNumBytes = myEOF - myBlock * theBlockSize;
+
+		myErr = QTFileTrans_DigestFileBlock(myRefNum, myNumBytes, myBuffer, theBlockSize, theDigestType, (UInt8 *)myDigests + myBlock * myDigestSize);
+	}
+
+bail:
+	FSClose(myRefNum);
+
+	if (myBuffer != NULL)
+		DisposePtr(myBuffer);
+
+	if (myErr == noErr) {
+		*theDigests = myDigests;
+		*theFileSize = myEOF;
+	} else if (myDigests != NULL) {
+		DisposePtr(myDigests);
+	}
+
+	return(myErr);
+}
+
+
+//////////
+//
+// QTFileTrans_PrepareSync
+// Compare the blocks of the specified local file with the manifest of the specified transfer, and note which of
+// them the transfer has to read; the remote file must be open, and its size known. Return noErr if the transfer
+// is to sync the local file (see QTFileTrans_SetSyncManifest for when it doesn't).
+//
+// We read the local file ourselves, a buffer at a time, before the HFS data handler opens it.
+//
+//////////
+
+OSErr QTFileTrans_PrepareSync (QTFileTransfer theTransfer, FSSpecPtr theFSSpecPtr)
+{
+	Ptr					myBuffer = theTransfer->fDataBuffers[0].fBuffer;
+	long				myDigestSize = QTFileTrans_DigestSize(theTransfer->fSyncDigestType);
+	UInt8				myDigest[kMaxDigestSize];
+	short				myRefNum = 0;
+	long				myEOF = 0L;
+	long				myBlock;
+	long				myNumBytes;
+	Boolean				myCanRead = true;
+	OSErr				myErr = noErr;
+
+	theTransfer->fSyncBytesMatched = 0;
+
+	if (theTransfer->fSyncDigests == NULL)
+		return(paramErr);
+
+	// the manifest has to describe the file we're about to read, and nothing may need the blocks we don't read
+	if (!theTransfer->fSizeKnown || (theTransfer->fBytesToTransfer != theTransfer->fSyncFileSize) || (theTransfer->fDataWriter == NULL) ||
+			(theTransfer->fDigest.fType != kQTFileTransDigestNone) || (myBuffer == NULL))
+		return(paramErr);
+
+	myErr = FSpOpenDF(theFSSpecPtr, fsRdPerm, &myRefNum);
+	if (myErr != noErr)
+		return(myErr);
+
+	GetEOF(myRefNum, &myEOF);
+
+	theTransfer->fSyncBlocks = NewPtrClear(theTransfer->fSyncNumBlocks + 1);
+	if (theTransfer->fSyncBlocks == NULL) {
+		myErr = memFullErr;
+		goto bail;
+	}
+
+	// we read the local file in order, so once a read fails (or we run off its end), we read every block after that
+	for (myBlock = 0; myBlock < theTransfer->fSyncNumBlocks; myBlock++) {
+		myNumBytes = theTransfer->fSyncBlockSize;
+		if ((SInt64)myBlock * theTransfer->fSyncBlockSize + myNumBytes > theTransfer->fSyncFileSize)
+			myNumBytes = (long)(theTransfer->fSyncFileSize - (SInt64)myBlock * theTransfer->fSyncBlockSize);
+
+		if ((SInt64)myBlock * theTransfer->fSyncBlockSize + myNumBytes > myEOF)
+			myCanRead = false;
+
+		if (myCanRead)
+			if (QTFileTrans_DigestFileBlock(myRefNum, myNumBytes, myBuffer, theTransfer->fBufferSize, theTransfer->fSyncDigestType, myDigest) != noErr)
+				myCanRead = false;
+
+		if (myCanRead && (memcmp(myDigest, theTransfer->fSyncDigests + myBlock * myDigestSize, myDigestSize) == 0))
+			theTransfer->fSyncBytesMatched += myNumBytes;
+		else
+			theTransfer->fSyncBlocks[myBlock] = true;
+	}
+
+	theTransfer->fStats.fBytesUnchanged = theTransfer->fSyncBytesMatched;
+
+bail:
+	FSClose(myRefNum);
+
+	if (myErr != noErr) {
+		if (theTransfer->fSyncBlocks != NULL)
+			DisposePtr(theTransfer->fSyncBlocks);
+		theTransfer->fSyncBlocks = NULL;
+		theTransfer->fSyncBytesMatched = 0;
+	}
+
+	return(myErr);
+}
+
+
+//////////
+//
+// QTFileTrans_DisposeSync
+// Throw away the sync manifest of the specified transfer, and the list of blocks it has to read.
+//
+//////////
+
+void QTFileTrans_DisposeSync (QTFileTransfer theTransfer)
+{
+	if (theTransfer->fSyncDigests != NULL)
+		DisposePtr(theTransfer->fSyncDigests);
+
+	if (theTransfer->fSyncBlocks != NULL)
+		DisposePtr(theTransfer->fSyncBlocks);
+
+	theTransfer->fSyncDigests = NULL;
+	theTransfer->fSyncBlocks = NULL;
+	theTransfer->fSyncNumBlocks = 0L;
+	theTransfer->fSyncBytesMatched = 0;
+}
+
+
+//////////
+//
+// QTFileTrans_DigestFileBlock
+// Read the next theNumBytes bytes of the open file with the specified reference number, theBufferSize bytes at
+// a time, and return their digest (of the specified type) in theDigest.
+//
+//////////
+
+OSErr QTFileTrans_DigestFileBlock (short theRefNum, long theNumBytes, Ptr theBuffer, long theBufferSize, long theDigestType, UInt8 *theDigest)
+{
+	QTFileTransDigestRecord	myDigest;
+	long					myCount;
+	OSErr					myErr = noErr;
+
+	myErr = QTFileTrans_DigestInit(&myDigest, theDigestType);
+
+	while ((theNumBytes > 0) && (myErr == noErr)) {
+		myCount = theBufferSize;
+		if (myCount > theNumBytes)
+			myCount = theNumBytes;
+
+		myErr = FSRead(theRefNum, &myCount, theBuffer);
+		if ((myErr == eofErr) && (myCount > 0))
+			myErr = noErr;
+		if (myCount <= 0)
+			myErr = eofErr;
+
+		if (myErr == noErr) {
+			QTFileTrans_DigestUpdate(&myDigest, (const UInt8 *)theBuffer, myCount);
+			theNumBytes -= myCount;
+		}
+	}
+
+	if (myErr == noErr) {
+		QTFileTrans_DigestFinal(&myDigest);
+		BlockMoveData(myDigest.fResult, theDigest, myDigest.fResultSize);
+	}
+
+	return(myErr);
+}
+
+
+//////////
+//
+// QTFileTrans_SkipUnchangedBlocks
+// Move the next read of the specified segment past any blocks that a sync transfer doesn't have to read.
+//
+//////////
+
+void QTFileTrans_SkipUnchangedBlocks (QTFileTransfer theTransfer, QTFileTransSegmentPtr theSegment)
+{
+	long				myBlock;
+
+	while (theSegment->fNextReadOffset < theSegment->fEndOffset) {
+		myBlock = (long)(theSegment->fNextReadOffset / theTransfer->fSyncBlockSize);
+		if (theTransfer->fSyncBlocks[myBlock])
+			break;
+
+		theSegment->fNextReadOffset = (SInt64)(myBlock + 1) * theTransfer->fSyncBlockSize;
+	}
+
+	if (theSegment->fNextReadOffset > theSegment->fEndOffset)
+		theSegment->fNextReadOffset = theSegment->fEndOffset;
+}
+
+
+//////////
+//
+// QTFileTrans_ClampToChangedBlocks
+// Return the number of bytes, of the theNumBytes bytes at theOffset, that a sync transfer should read at once:
+// the read stops at the first block after theOffset that the transfer doesn't have to read.
+//
+//////////
+
+long QTFileTrans_ClampToChangedBlocks (QTFileTransfer theTransfer, SInt64 theOffset, long theNumBytes)
+{
+	long				myBlock = (long)(theOffset / theTransfer->fSyncBlockSize) + 1;
+	SInt64				myBlockStart;
+
+	for (; myBlock < theTransfer->fSyncNumBlocks; myBlock++) {
+		myBlockStart = (SInt64)myBlock * theTransfer->fSyncBlockSize;
+		if (myBlockStart >= theOffset + theNumBytes)
+			break;
+
+		if (!theTransfer->fSyncBlocks[myBlock])
+			return((long)(myBlockStart - theOffset));
+	}
+
+	return(theNumBytes);
+}
+
+
+//////////
+//
+// QTFileTrans_IsFileURL
+// Is the specified URL a file URL?
+//
+//////////
+
+Boolean QTFileTrans_IsFileURL (char *theURL)
+{
+	char			*myPrefix = kFileURLPrefix;
+
+	while (*myPrefix != '\0') {
+		char		myChar = *theURL++;
+
+		if ((myChar >= 'A') && (myChar <= 'Z'))
+			myChar += 'a' - 'A';
+
+		if (myChar != *myPrefix++)
+			return(false);
+	}
+
+	return(true);
+}
+
+
+//////////
+//
+// QTFileTrans_FileURLToNativePath
+// Convert the specified file URL into a native pathname: a DOS or UNC pathname on Windows ("file:///C:/dir/file"
+// becomes "C:\dir\file" and "file://server/share/file" becomes "\\server\share\file"), or an HFS pathname on
+// the Mac ("file:///Macintosh%20HD/dir/file" becomes "Macintosh HD:dir:file"). Escaped characters are
+// decoded along the way.
+//
+//////////
+
+OSErr QTFileTrans_FileURLToNativePath (char *theURL, char *thePath, long theMaxLength)
+{
+	char			*mySource = theURL + strlen(kFileURLPrefix);
+	long			myLength = 0L;
+
+	// skip an explicit "localhost" host name; an empty host name means the local machine, too
+	if (strncmp(mySource, "localhost/", 10) == 0)
+		mySource += 9;
+
+#if TARGET_OS_WIN32
+	if (*mySource == '/') {
+		// no host: skip the slash before a drive letter ("/C:/dir" or the older "/C|/dir")
+		mySource++;
+	} else {
+		// a host name: this is a file on a LAN share
+		thePath[myLength++] = '\\';
+		thePath[myLength++] = '\\';
+	}
+#else
+	// no host names on the Mac; the first component of the path is the volume name
+	if (*mySource != '/')
+		return(unimpErr);
+	mySource++;
+#endif
+
+	while (*mySource != '\0') {
+		char		myChar = *mySource++;
+
+		if ((myChar == '%') && (mySource[0] != '\0') && (mySource[1] != '\0')) {
+			char	myDigits[3];
+
+			myDigits[0] = mySource[0];
+			myDigits[1] = mySource[1];
+			myDigits[2] = '\0';
+			myChar = (char)strtol(myDigits, NULL, 16);
+			mySource += 2;
+		}
+#if TARGET_OS_WIN32
+		else if (myChar == '/')
+			myChar = '\\';
+		else if ((myChar == '|') && (myLength == 1))
+			myChar = ':';
+#else
+		else if (myChar == '/')
+			myChar = ':';
+		else if (myChar == ':')
+			myChar = '/';		// a colon can't appear in an HFS pathname component, but a slash can
+#endif
+
+		if (myLength >= theMaxLength - 1)
+			return(bdNamErr);
+
+		thePath[myLength++] = myChar;
+	}
+
+	thePath[myLength] = '\0';
+	return(noErr);
+}
+
+
+#if TARGET_OS_WIN32
+//////////
+//
+// QTFileTrans_CopyProgressRoutine
+// The progress routine for CopyFileEx; it keeps our byte counts up to date and stops the copy if
+// the transfer's worker thread has been told to quit.
+//
+//////////
+
+DWORD CALLBACK QTFileTrans_CopyProgressRoutine (LARGE_INTEGER theTotalFileSize, LARGE_INTEGER theTotalBytesTransferred,
+												LARGE_INTEGER theStreamSize, LARGE_INTEGER theStreamBytesTransferred,
+												DWORD theStreamNumber, DWORD theCallbackReason,
+												HANDLE theSourceFile, HANDLE theDestinationFile, LPVOID theData)
+{
+	QTFileTransfer				myTransfer = (QTFileTransfer)theData;
+
+	myTransfer->fBytesToTransfer = theTotalFileSize.QuadPart;
+	myTransfer->fBytesTransferred = theTotalBytesTransferred.QuadPart;
+	myTransfer->fSizeKnown = true;
+
+	return((myTransfer->fWorkerQuit != 0) ? PROGRESS_CANCEL : PROGRESS_CONTINUE);
+}
+#endif
+
+
+//////////
+//
+// QTFileTrans_CopyFileDirect
+// Copy the local (or LAN) file named by the specified file URL into the specified local file, without using
+// the data handlers. Return unimpErr if we can't do that, so that the caller can use the data handlers instead.
+//
+// On Windows, we use CopyFileEx, which lets the system use its fastest copy (including server-side copies
+// on LAN shares). On the Mac, we use PBHCopyFile if both files are on the same volume and that volume
+// supports it (this makes a file server copy the file without sending it over the network); otherwise (or
+// in place mode, where we keep the existing local file), we copy the data fork ourselves in large blocks.
+//
+//////////
+
+OSErr QTFileTrans_CopyFileDirect (QTFileTransfer theTransfer, char *theURL, FSSpecPtr theFSSpecPtr)
+{
+	OSErr						myErr = noErr;
+
+	theTransfer->fBytesTransferred = 0;
+	theTransfer->fSizeKnown = false;
+
+#if TARGET_OS_WIN32
+	{
+		char					myPath[kMaxNativePathLength];
+		char					myDestPath[kMaxNativePathLength];
+
+		if (QTFileTrans_FileURLToNativePath(theURL, myPath, sizeof(myPath)) != noErr)
+			return(unimpErr);
+
+		if (FSSpecToNativePathName(theFSSpecPtr, myDestPath, sizeof(myDestPath), kFullNativePath) != noErr)
+			return(unimpErr);
+
+		if (!CopyFileEx(myPath, myDestPath, QTFileTrans_CopyProgressRoutine, theTransfer, (LPBOOL)&theTransfer->fWorkerQuit, 0)) {
+			switch (GetLastError()) {
+				case ERROR_FILE_NOT_FOUND:
+				case ERROR_PATH_NOT_FOUND:
+				case ERROR_ACCESS_DENIED:
+					// let the data handlers have a go
+					return(unimpErr);
+				case ERROR_REQUEST_ABORTED:
+					return(userCanceledErr);
+				case ERROR_DISK_FULL:
+					return(dskFulErr);
+				default:
+					return(ioErr);
+			}
+		}
+
+		theTransfer->fBytesToTransfer = theTransfer->fBytesTransferred;
+		theTransfer->fSizeKnown = true;
+	}
+#else
+	{
+		FSSpec					mySourceSpec;
+		short					mySourceRefNum = 0;
+		long					mySize = 0L;
+		Boolean					myReuseFile = false;
+
+#if TARGET_API_MAC_CARBON
+		// under Mac OS X, file URLs hold POSIX pathnames, so let the system resolve the URL
+		CFURLRef				myURL = NULL;
+		FSRef					myRef;
+		Boolean					myGotRef = false;
+
+		myURL = CFURLCreateWithBytes(NULL, (const UInt8 *)theURL, (CFIndex)strlen(theURL), kCFStringEncodingUTF8, NULL);
+		if (myURL != NULL) {
+			myGotRef = CFURLGetFSRef(myURL, &myRef);
+			CFRelease(myURL);
+		}
+
+		if (!myGotRef || (FSGetCatalogInfo(&myRef, kFSCatInfoNone, NULL, NULL, &mySourceSpec, NULL) != noErr))
+			return(unimpErr);
+#else
+		char					myPath[kMaxNativePathLength];
+		Str255					myName;
+
+		if (QTFileTrans_FileURLToNativePath(theURL, myPath, sizeof(myPath)) != noErr)
+			return(unimpErr);
+
+		if (strlen(myPath) > 255)
+			return(unimpErr);
+
+		myName[0] = (unsigned char)strlen(myPath);
+		BlockMove(myPath, &myName[1], myName[0]);
+
+		if (FSMakeFSSpec(0, 0L, myName, &mySourceSpec) != noErr)
+			return(unimpErr);
+#endif
+
+		// make sure we can read the source file before we touch the local file
+		myErr = FSpOpenDF(&mySourceSpec, fsRdPerm, &mySourceRefNum);
+		if (myErr != noErr)
+			return(unimpErr);
+
+		GetEOF(mySourceRefNum, &mySize);
+		theTransfer->fBytesToTransfer = mySize;
+		theTransfer->fSizeKnown = true;
+
+		// in place mode, we write over the existing local file instead of replacing it
+		myReuseFile = QTFileTrans_CanOverwriteInPlace(theTransfer, theFSSpecPtr);
+
+		// if both files are on the same volume and the volume can copy files itself, let it
+		if (!myReuseFile) {
+			FSpDelete(theFSSpecPtr);
+			if (QTFileTrans_VolumeCopyFile(&mySourceSpec, theFSSpecPtr) == noErr) {
+				FSClose(mySourceRefNum);
+				theTransfer->fBytesTransferred = mySize;
+				return(noErr);
+			}
+		}
+
+		// copy the data fork ourselves
+		myErr = QTFileTrans_CopyDataFork(mySourceRefNum, theFSSpecPtr, kTransFileCreator, kTransFileType, myReuseFile, kDirectCopyBufferSize, &theTransfer->fBytesTransferred);
+		FSClose(mySourceRefNum);
+	}
+#endif
+
+	return(myErr);
+}
+
+
+//////////
+//
+// QTFileTrans_SetBufferRing
+// Set the size of each buffer in the specified transfer's buffer ring (which is also the size of each read,
+// unless adaptive chunk sizing is on), and the number of buffers in the ring. Pass 0 for either parameter
+// to use the default value (kDataBufferSize and kNumDataBuffers). This function must be called before
+// QTFileTrans_CopyRemoteFileToLocalFile, since that's where we allocate the buffer ring.
+//
+//////////
+
+OSErr QTFileTrans_SetBufferRing (QTFileTransfer theTransfer, long theBufferSize, short theNumBuffers)
+{
+	if (theTransfer == NULL)
+		return(paramErr);
+
+	// we can't resize the buffers of a transfer that's underway
+	if (theTransfer->fDataReader != NULL)
+		return(paramErr);
+
+	if (theBufferSize <= 0)
+		theBufferSize = kDataBufferSize;
+
+	if (theNumBuffers <= 0)
+		theNumBuffers = kNumDataBuffers;
+
+	// we need at least two buffers to overlap reading and writing
+	if ((theNumBuffers < 2) || (theNumBuffers > kMaxNumDataBuffers))
+		return(paramErr);
+
+	theTransfer->fRingBufferSize = theBufferSize;
+	theTransfer->fRingNumBuffers = theNumBuffers;
+
+	// an adaptive transfer keeps its own chunk size, within its own bounds
+	if (!theTransfer->fAdaptiveChunking)
+		theTransfer->fChunkSize = theBufferSize;
+
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_SetReadahead
+// Set the readahead window of the specified transfer: the most bytes it has being read, or sitting in its buffers,
+// ahead of the next chunk its sink is to get. We give the ring just enough buffers to hold the window (but at
+// least two per segment, and no more than kMaxNumDataBuffers, past which we make the buffers bigger instead).
+// Pass 0 to go back to the ring set by QTFileTrans_SetBufferRing. This function must be called before
+// QTFileTrans_CopyRemoteFileToLocalFile, and a transfer with a readahead window always goes through the ring.
+//
+//////////
+
+OSErr QTFileTrans_SetReadahead (QTFileTransfer theTransfer, long theNumBytes)
+{
+	if (theTransfer == NULL)
+		return(paramErr);
+
+	// we can't resize the buffers of a transfer that's underway
+	if (theTransfer->fDataReader != NULL)
+		return(paramErr);
+
+	if ((theNumBytes < 0) || (theNumBytes > kMaxReadahead))
+		return(paramErr);
+
+	theTransfer->fReadahead = theNumBytes;
+
+	// a big window may have made the reads bigger than the ring asks for
+	if (!theTransfer->fAdaptiveChunking)
+		theTransfer->fChunkSize = theTransfer->fRingBufferSize;
+
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_SetReaderComponent
+// Tell the specified transfer to read its URLs with the specified data handler, instead of the one QuickTime
+// picks for the URL; pass NULL to go back to letting QuickTime pick. This lets you plug in a data handler of
+// your own (the benchmark in QTFileTransferBench.c uses this to substitute a synthetic source). This function
+// must be called before QTFileTrans_CopyRemoteFileToLocalFile.
+//
+//////////
+
+OSErr QTFileTrans_SetReaderComponent (QTFileTransfer theTransfer, Component theComponent)
+{
+	if (theTransfer == NULL)
+		return(paramErr);
+
+	if (theTransfer->fDataReader != NULL)
+		return(paramErr);
+
+	// a reader kept from an earlier transfer may well be the wrong kind now
+	if (theTransfer->fPooledReader != NULL) {
+		CloseComponent(theTransfer->fPooledReader);
+		theTransfer->fPooledReader = NULL;
+	}
+
+	theTransfer->fReaderComponent = theComponent;
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_OpenReader
+// Open a data handler for reading the URL in the specified data reference, for the specified transfer.
+//
+//////////
+
+ComponentInstance QTFileTrans_OpenReader (QTFileTransfer theTransfer, Handle theReaderRef)
+{
+	if (theTransfer->fReaderComponent != NULL)
+		return(OpenComponent(theTransfer->fReaderComponent));
+
+	return(OpenComponent(GetDataHandler(theReaderRef, URLDataHandlerSubType, kDataHCanRead)));
+}
+
+
+//////////
+//
+// QTFileTrans_SetAdaptiveChunking
+// Turn adaptive chunk sizing on or off for the specified transfer. When it's on, we time each read and
+// grow or shrink the size of subsequent reads (within the specified bounds) so that each read takes
+// roughly theTargetMSecs milliseconds. Large reads make better use of fast, high-latency links; small
+// reads keep a slow link responsive.
+//
+// Pass 0 for any of the numeric parameters to use the default value. This function must be called
+// before QTFileTrans_CopyRemoteFileToLocalFile, since that's where we size the buffer ring.
+//
+//////////
+
+OSErr QTFileTrans_SetAdaptiveChunking (QTFileTransfer theTransfer, Boolean theEnable, long theMinChunkSize, long theMaxChunkSize, long theTargetMSecs)
+{
+	if (theTransfer == NULL)
+		return(paramErr);
+
+	// we can't resize the buffers of a transfer that's underway
+	if (theTransfer->fDataReader != NULL)
+		return(paramErr);
+
+	if (theMinChunkSize <= 0)
+		theMinChunkSize = kMinAdaptiveChunkSize;
+
+	if (theMaxChunkSize <= 0)
+		theMaxChunkSize = kMaxAdaptiveChunkSize;
+
+	if (theTargetMSecs <= 0)
+		theTargetMSecs = kTargetReadMSecs;
+
+	if (theMinChunkSize > theMaxChunkSize)
+		return(paramErr);
+
+	theTransfer->fAdaptiveChunking = theEnable;
+	theTransfer->fMinChunkSize = theMinChunkSize;
+	theTransfer->fMaxChunkSize = theMaxChunkSize;
+	theTransfer->fTargetReadTime = (unsigned long)theTargetMSecs * 1000L;
+
+	// start with the usual chunk size, pinned to the new bounds
+	theTransfer->fChunkSize = theTransfer->fRingBufferSize;
+	if (theEnable) {
+		if (theTransfer->fChunkSize < theMinChunkSize)
+			theTransfer->fChunkSize = theMinChunkSize;
+		if (theTransfer->fChunkSize > theMaxChunkSize)
+			theTransfer->fChunkSize = theMaxChunkSize;
+	}
+
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_GetChunkSize
+// Return the number of bytes we're currently asking for in each read of the specified transfer,
+// and the time (in milliseconds) that the most recent read took.
+//
+//////////
+
+OSErr QTFileTrans_GetChunkSize (QTFileTransfer theTransfer, long *theChunkSize, long *theLastReadMSecs)
+{
+	if (theTransfer == NULL)
+		return(paramErr);
+
+	if (theChunkSize != NULL)
+		*theChunkSize = theTransfer->fChunkSize;
+
+	if (theLastReadMSecs != NULL)
+		*theLastReadMSecs = (long)(theTransfer->fLastReadTime / 1000L);
+
+	return(theTransfer->fStatus);
+}
+
+
+//////////
+//
+// QTFileTrans_AdjustChunkSize
+// Pick a new chunk size for the specified transfer, given that a read of theNumBytes bytes just took
+// theElapsedTime microseconds.
+//
+// We scale the chunk size by the ratio of the target time to the measured time, but never by more than
+// a factor of two in either direction at once, so that one unusually fast or slow read doesn't throw us off.
+// Sizes are kept to multiples of 1K. Note that, since several reads are outstanding at once, the measured
+// time includes any time the read spent queued behind the other reads; that's fine, since what we care
+// about is how long it takes to get each chunk back.
+//
+//////////
+
+void QTFileTrans_AdjustChunkSize (QTFileTransfer theTransfer, long theNumBytes, unsigned long theElapsedTime)
+{
+	double			myNewSize;
+
+	if (theNumBytes <= 0)
+		return;
+
+	if (theElapsedTime == 0L)
+		theElapsedTime = 1L;
+
+	myNewSize = (double)theNumBytes * (double)theTransfer->fTargetReadTime / (double)theElapsedTime;
+
+	if (myNewSize > 2.0 * theNumBytes)
+		myNewSize = 2.0 * theNumBytes;
+
+	if (myNewSize < 0.5 * theNumBytes)
+		myNewSize = 0.5 * theNumBytes;
+
+	if (myNewSize > theTransfer->fMaxChunkSize)
+		myNewSize = theTransfer->fMaxChunkSize;
+
+	if (myNewSize < theTransfer->fMinChunkSize)
+		myNewSize = theTransfer->fMinChunkSize;
+
+	theTransfer->fChunkSize = ((long)myNewSize) & ~0x03FFL;
+	if (theTransfer->fChunkSize < theTransfer->fMinChunkSize)
+		theTransfer->fChunkSize = theTransfer->fMinChunkSize;
+}
+
+
+//////////
+//
+// QTFileTrans_GetMicroseconds
+// Return the low 32 bits of the current microsecond count; differences between two values returned by this
+// function are correct as long as the interval is shorter than about 71 minutes.
+//
+//////////
+
+unsigned long QTFileTrans_GetMicroseconds (void)
+{
+	UnsignedWide	myTime;
+
+	Microseconds(&myTime);
+	return(myTime.lo);
+}
+
+
+//////////
+//
+// QTFileTrans_GetMicroseconds64
+// Return the full 64-bit microsecond count, for intervals that can outlast the 32-bit count returned by
+// QTFileTrans_GetMicroseconds.
+//
+//////////
+
+SInt64 QTFileTrans_GetMicroseconds64 (void)
+{
+	UnsignedWide	myTime;
+
+	Microseconds(&myTime);
+	return((((SInt64)myTime.hi) << 32) | (SInt64)myTime.lo);
+}
+
+
+//////////
+//
+// QTFileTrans_SInt64ToWide
+// Convert a 64-bit integer into the wide structure that the data handler routines expect.
+//
+//////////
+
+void QTFileTrans_SInt64ToWide (SInt64 theValue, wide *theWide)
+{
+	theWide->hi = (SInt32)(theValue >> 32);
+	theWide->lo = (UInt32)(theValue & 0xFFFFFFFFUL);
+}
+
+
+//////////
+//
+// QTFileTrans_WideToSInt64
+// Convert a wide structure returned by the data handler routines into a 64-bit integer.
+//
+//////////
+
+SInt64 QTFileTrans_WideToSInt64 (const wide *theWide)
+{
+	return((((SInt64)theWide->hi) << 32) | (SInt64)theWide->lo);
+}
+
+
+//////////
+//
+// QTFileTrans_GetRemoteFileSize
+// Get the size of the file opened by the specified URL data handler. We ask for the 64-bit size first,
+// so that files over 2GB work; older data handlers may only support DataHGetFileSize, so we fall back on that.
+//
+//////////
+
+OSErr QTFileTrans_GetRemoteFileSize (ComponentInstance theReader, SInt64 *theSize)
+{
+	wide				myWide;
+	long				mySize = 0L;
+	OSErr				myErr = noErr;
+
+	myErr = (OSErr)DataHGetFileSize64(theReader, &myWide);
+	if (myErr == noErr) {
+		*theSize = QTFileTrans_WideToSInt64(&myWide);
+		return(noErr);
+	}
+
+	myErr = (OSErr)DataHGetFileSize(theReader, &mySize);
+	if (myErr == noErr)
+		*theSize = mySize;
+
+	return(myErr);
+}
+
+
+//////////
+//
+// QTFileTrans_CloseDownHandlers
+// Close our read/write access to our data references and then close down the read/write data handlers.
+//
+//////////
+
+void QTFileTrans_CloseDownHandlers (QTFileTransfer theTransfer)
+{
+	QTFileTrans_ReleaseHandlers(theTransfer, false);
+}
+
+
+//////////
+//
+// QTFileTrans_ClearRequestSettings
+// Forget the settings that apply to the specified transfer's current request only (the cache validator and
+// the sync manifest), so that they can't leak into its next one. We call it when we release the data handlers, and on the paths
+// that finish a transfer without opening any (before the done routine, which might start the next transfer).
+//
+//////////
+
+void QTFileTrans_ClearRequestSettings (QTFileTransfer theTransfer)
+{
+	theTransfer->fCacheStore = false;
+	theTransfer->fCacheValidator[0] = '\0';
+	QTFileTrans_DisposeSync(theTransfer);
+}
+
+
+//////////
+//
+// QTFileTrans_ReleaseHandlers
+// Close our read/write access to our data references. If theKeepForReuse is true, we keep the main URL
+// and HFS data handlers (closed, but still open as components), the data buffers, and the routine
+// descriptors, so that the next call to QTFileTrans_CopyRemoteFileToLocalFile on this transfer can use
+// them instead of setting up new ones; otherwise, we get rid of all of them.
+//
+//////////
+
+void QTFileTrans_ReleaseHandlers (QTFileTransfer theTransfer, Boolean theKeepForReuse)
+{
+	short		myIndex;
+
+	if (theTransfer == NULL)
+		return;
+
+	// it isn't safe to close a data handler whose completion routines might still fire, so cancel anything
+	// still outstanding and give it a chance to drain first
+	if (QTFileTrans_HasPendingRequests(theTransfer))
+		QTFileTrans_DrainRequests(theTransfer);
+
+	QTFileTrans_ClearThrottledReads(theTransfer);
+	QTFileTrans_ClearRetries(theTransfer);
+	QTFileTrans_UnscheduleTransfer(theTransfer);
+
+	if ((theTransfer->fDataReader != NULL) || (theTransfer->fDataWriter != NULL))
+		QTFileTrans_Trace(theTransfer, kQTFileTransTraceClose, 0, theTransfer->fBytesTransferred, theTransfer->fStatus);
+
+	// if we're abandoning a resumable transfer part way through, save what we've got so far
+	if (theTransfer->fResumable && !theTransfer->fUploading && !theTransfer->fDoneTransferring && (theTransfer->fDataWriter != NULL))
+		QTFileTrans_WriteCheckpoint(theTransfer);
+
+	// close the readers for any segments after the first; the first segment uses our own reader
+	for (myIndex = 1; myIndex < theTransfer->fNumSegments; myIndex++) {
+		if (theTransfer->fSegments[myIndex].fDataReader != NULL) {
+			DataHCloseForRead(theTransfer->fSegments[myIndex].fDataReader);
+			CloseComponent(theTransfer->fSegments[myIndex].fDataReader);
+			theTransfer->fSegments[myIndex].fDataReader = NULL;
+		}
+	}
+
+	theTransfer->fSegments[0].fDataReader = NULL;
+	theTransfer->fNumSegments = 0;
+
+	// closing the data handlers cancels any requests still outstanding
+	QTFileTrans_ClearCoalescing(theTransfer);
+	for (myIndex = 0; myIndex < kMaxCoalesceBlocks; myIndex++) {
+		theTransfer->fCoalesceBlocks[myIndex].fBlockBusy = false;
+		theTransfer->fCoalesceBlocks[myIndex].fNumBytes = 0L;
+	}
+
+	theTransfer->fNumCoalesceBlocks = 0;
+	theTransfer->fNumPendingWrites = 0;
+	theTransfer->fCancelled = false;
+	theTransfer->fDeadline = 0L;
+
+	if (theTransfer->fDataReader != NULL) {
+		DataHCloseForRead(theTransfer->fDataReader);
+		if (theKeepForReuse && !theTransfer->fUploading && (theTransfer->fPooledReader == NULL))
+			theTransfer->fPooledReader = theTransfer->fDataReader;
+		else
+			CloseComponent(theTransfer->fDataReader);
+		theTransfer->fDataReader = NULL;
+	}
+
+	if (theTransfer->fDataWriter != NULL) {
+		DataHCloseForWrite(theTransfer->fDataWriter);
+		if (theKeepForReuse && !theTransfer->fUploading && (theTransfer->fPooledWriter == NULL))
+			theTransfer->fPooledWriter = theTransfer->fDataWriter;
+		else
+			CloseComponent(theTransfer->fDataWriter);
+		theTransfer->fDataWriter = NULL;
+	}
+
+	// in atomic mode, swap the temporary file in for the local file now that it's closed (or throw it away)
+	QTFileTrans_FinishTempFile(theTransfer);
+
+	// (an upload's data handlers are the wrong way around for a download, so we never keep them)
+	theTransfer->fUploading = false;
+
+	// now that the local file is closed, add it to the download cache, if we downloaded all of it
+	if (theTransfer->fCacheStore && theTransfer->fDoneTransferring && (theTransfer->fStatus == noErr))
+		QTFileTrans_CacheStore(theTransfer->fCacheKey, theTransfer->fCacheValidator, &theTransfer->fCacheFileSpec, theTransfer->fBytesTransferred);
+
+	// the validator (and the sync manifest) belong to the URL we just transferred
+	QTFileTrans_ClearRequestSettings(theTransfer);
+
+	if (theKeepForReuse)
+		return;
+
+	if (theTransfer->fPooledReader != NULL) {
+		CloseComponent(theTransfer->fPooledReader);
+		theTransfer->fPooledReader = NULL;
+	}
+
+	if (theTransfer->fPooledWriter != NULL) {
+		CloseComponent(theTransfer->fPooledWriter);
+		theTransfer->fPooledWriter = NULL;
+	}
+
+	// give the data buffers (and the coalescing blocks) back to the pool
+	for (myIndex = 0; myIndex < kMaxNumDataBuffers; myIndex++) {
+		if (theTransfer->fDataBuffers[myIndex].fBuffer != NULL) {
+			QTFileTrans_ReleaseBuffer(theTransfer->fDataBuffers[myIndex].fBuffer);
+			theTransfer->fDataBuffers[myIndex].fBuffer = NULL;
+		}
+	}
+
+	for (myIndex = 0; myIndex < kMaxCoalesceBlocks; myIndex++) {
+		if (theTransfer->fCoalesceBlocks[myIndex].fBuffer != NULL) {
+			QTFileTrans_ReleaseBuffer(theTransfer->fCoalesceBlocks[myIndex].fBuffer);
+			theTransfer->fCoalesceBlocks[myIndex].fBuffer = NULL;
+		}
+	}
+
 	// dispose of the routine descriptors
-	if (gReadDataHCompletionUPP != NULL)
-		DisposeDataHCompletionUPP(gReadDataHCompletionUPP);
-		
-	if (gWriteDataHCompletionUPP != NULL)
-		DisposeDataHCompletionUPP(gWriteDataHCompletionUPP);
-}
\ No newline at end of file
+	if (theTransfer->fReadDataHCompletionUPP != NULL) {
+		DisposeDataHCompletionUPP(theTransfer->fReadDataHCompletionUPP);
+		theTransfer->fReadDataHCompletionUPP = NULL;
+	}
+
+	if (theTransfer->fWriteDataHCompletionUPP != NULL) {
+		DisposeDataHCompletionUPP(theTransfer->fWriteDataHCompletionUPP);
+		theTransfer->fWriteDataHCompletionUPP = NULL;
+	}
+}
+
+
+//////////
+//
+// QTFileTrans_SetResumable
+// Make the specified transfer resumable (or not). A resumable transfer doesn't delete an existing local
+// file; instead, it keeps a small checkpoint file next to the local file that records which parts of the
+// local file have been written. If the transfer is interrupted, transferring the same URL to the same file
+// again picks up at the first byte missing from the local file, provided that the remote file is still
+// the same size. The checkpoint file is deleted once the transfer finishes.
+//
+// This function must be called before QTFileTrans_CopyRemoteFileToLocalFile.
+//
+//////////
+
+OSErr QTFileTrans_SetResumable (QTFileTransfer theTransfer, Boolean theResumable)
+{
+	if (theTransfer == NULL)
+		return(paramErr);
+
+	if (theTransfer->fDataReader != NULL)
+		return(paramErr);
+
+	// only a transfer into a local file can use this
+	if (theResumable && (theTransfer->fSinkType != kQTFileTransSinkFile))
+		return(paramErr);
+
+	theTransfer->fResumable = theResumable;
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_MakeCheckpointSpec
+// Return, in theCheckpointSpecPtr, a file specification for the checkpoint file that belongs to the
+// specified local file; the checkpoint file is in the same folder, and its name is the local file's name
+// (shortened, if necessary) followed by kCheckpointSuffix.
+//
+//////////
+
+OSErr QTFileTrans_MakeCheckpointSpec (FSSpecPtr theFSSpecPtr, FSSpecPtr theCheckpointSpecPtr)
+{
+	return(QTFileTrans_MakeSuffixedSpec(theFSSpecPtr, kCheckpointSuffix, theCheckpointSpecPtr));
+}
+
+
+//////////
+//
+// QTFileTrans_MakeSuffixedSpec
+// Return, in theSuffixedSpecPtr, a file specification for a file in the same folder as the specified file,
+// whose name is that file's name (shortened, if necessary) followed by theSuffix.
+//
+//////////
+
+OSErr QTFileTrans_MakeSuffixedSpec (FSSpecPtr theFSSpecPtr, char *theSuffix, FSSpecPtr theSuffixedSpecPtr)
+{
+	Str63				myName;
+	short				myNameLen = theFSSpecPtr->name[0];
+	short				mySuffixLen = (short)strlen(theSuffix);
+	OSErr				myErr = noErr;
+
+	// keep the name within the 31-character limit of HFS file names
+	if (myNameLen + mySuffixLen > 31)
+		myNameLen = 31 - mySuffixLen;
+
+	BlockMove(&theFSSpecPtr->name[1], &myName[1], myNameLen);
+	BlockMove(theSuffix, &myName[myNameLen + 1], mySuffixLen);
+	myName[0] = (unsigned char)(myNameLen + mySuffixLen);
+
+	// FSMakeFSSpec returns fnfErr if the file doesn't exist yet, but the specification is still valid
+	myErr = FSMakeFSSpec(theFSSpecPtr->vRefNum, theFSSpecPtr->parID, myName, theSuffixedSpecPtr);
+	if (myErr == fnfErr)
+		myErr = noErr;
+
+	return(myErr);
+}
+
+
+//////////
+//
+// QTFileTrans_ReadCheckpoint
+// Read the checkpoint file of the specified transfer, if there is one. Return the offset of the first byte
+// that's missing from the local file (or 0, if there is no usable checkpoint); also return, in
+// theRemoteFileSize, the size of the remote file when the checkpoint was saved.
+//
+//////////
+
+SInt64 QTFileTrans_ReadCheckpoint (QTFileTransfer theTransfer, SInt64 *theRemoteFileSize)
+{
+	QTFileTransCheckpointHeader	myHeader;
+	QTFileTransRangeRecord		myRange;
+	short						myRefNum = 0;
+	long						myCount;
+	SInt64						myResumeOffset = 0;
+	OSErr						myErr = noErr;
+
+	*theRemoteFileSize = 0;
+
+	myErr = FSpOpenDF(&theTransfer->fCheckpointSpec, fsRdPerm, &myRefNum);
+	if (myErr != noErr)
+		return(0);
+
+	myCount = sizeof(myHeader);
+	myErr = FSRead(myRefNum, &myCount, &myHeader);
+	if ((myErr != noErr) || (myHeader.fSignature != kCheckpointSignature) || (myHeader.fVersion != kCheckpointVersion))
+		goto bail;
+
+	// the ranges are stored in order and never touch, so the first missing byte is the end of the first range,
+	// provided that range starts at the beginning of the file; we fetch everything after that again
+	if (myHeader.fNumRanges > 0) {
+		myCount = sizeof(myRange);
+		myErr = FSRead(myRefNum, &myCount, &myRange);
+		if ((myErr == noErr) && (myRange.fStart == 0) && (myRange.fEnd > 0))
+			myResumeOffset = myRange.fEnd;
+	}
+
+	*theRemoteFileSize = myHeader.fRemoteFileSize;
+
+bail:
+	FSClose(myRefNum);
+	return(myResumeOffset);
+}
+
+
+//////////
+//
+// QTFileTrans_WriteCheckpoint
+// Save the list of written ranges of the specified transfer to its checkpoint file.
+//
+// Our completion routines are never called at interrupt time (see NOTE (3)), so it's safe to call this
+// function from the write completion routine.
+//
+//////////
+
+OSErr QTFileTrans_WriteCheckpoint (QTFileTransfer theTransfer)
+{
+	QTFileTransCheckpointHeader	myHeader;
+	short						myRefNum = 0;
+	long						myCount;
+	OSErr						myErr = noErr;
+
+	myErr = FSpCreate(&theTransfer->fCheckpointSpec, kTransFileCreator, kCheckpointFileType, smSystemScript);
+	if ((myErr != noErr) && (myErr != dupFNErr))
+		return(myErr);
+
+	myErr = FSpOpenDF(&theTransfer->fCheckpointSpec, fsRdWrPerm, &myRefNum);
+	if (myErr != noErr)
+		return(myErr);
+
+	myHeader.fSignature = kCheckpointSignature;
+	myHeader.fVersion = kCheckpointVersion;
+	myHeader.fRemoteFileSize = theTransfer->fBytesToTransfer;
+	myHeader.fNumRanges = theTransfer->fNumWrittenRanges;
+
+	myCount = sizeof(myHeader);
+	myErr = FSWrite(myRefNum, &myCount, &myHeader);
+	if (myErr != noErr)
+		goto bail;
+
+	myCount = theTransfer->fNumWrittenRanges * sizeof(QTFileTransRangeRecord);
+	myErr = FSWrite(myRefNum, &myCount, theTransfer->fWrittenRanges);
+	if (myErr != noErr)
+		goto bail;
+
+	myErr = SetEOF(myRefNum, sizeof(myHeader) + theTransfer->fNumWrittenRanges * sizeof(QTFileTransRangeRecord));
+
+bail:
+	FSClose(myRefNum);
+
+	if (myErr == noErr)
+		theTransfer->fCheckpointBytes = theTransfer->fBytesTransferred;
+
+	return(myErr);
+}
+
+
+//////////
+//
+// QTFileTrans_AddWrittenRange
+// Add the specified range to the list of written ranges of the specified transfer, merging it with any
+// ranges it touches. The list is kept in order.
+//
+// If the list is full, we just forget about the new range; that's safe, since the only cost is that
+// a resumed transfer fetches that range again.
+//
+//////////
+
+void QTFileTrans_AddWrittenRange (QTFileTransfer theTransfer, SInt64 theOffset, SInt64 theNumBytes)
+{
+	QTFileTransRangePtr		myRanges = theTransfer->fWrittenRanges;
+	SInt64					myEnd = theOffset + theNumBytes;
+	short					myIndex;
+	short					myLast;
+
+	if (theNumBytes <= 0L)
+		return;
+
+	// find the first range that ends at or after the new range's start
+	for (myIndex = 0; myIndex < theTransfer->fNumWrittenRanges; myIndex++)
+		if (myRanges[myIndex].fEnd >= theOffset)
+			break;
+
+	if ((myIndex < theTransfer->fNumWrittenRanges) && (myRanges[myIndex].fStart <= myEnd)) {
+		// the new range touches this range, so grow this range to cover both
+		if (theOffset < myRanges[myIndex].fStart)
+			myRanges[myIndex].fStart = theOffset;
+		if (myEnd > myRanges[myIndex].fEnd)
+			myRanges[myIndex].fEnd = myEnd;
+
+		// and swallow any following ranges that the grown range now touches
+		myLast = myIndex + 1;
+		while ((myLast < theTransfer->fNumWrittenRanges) && (myRanges[myLast].fStart <= myRanges[myIndex].fEnd)) {
+			if (myRanges[myLast].fEnd > myRanges[myIndex].fEnd)
+				myRanges[myIndex].fEnd = myRanges[myLast].fEnd;
+			myLast++;
+		}
+
+		if (myLast > myIndex + 1) {
+			BlockMove(&myRanges[myLast], &myRanges[myIndex + 1], (theTransfer->fNumWrittenRanges - myLast) * sizeof(QTFileTransRangeRecord));
+			theTransfer->fNumWrittenRanges -= (myLast - myIndex - 1);
+		}
+		return;
+	}
+
+	// the new range doesn't touch any existing range, so insert it here, if there's room
+	if (theTransfer->fNumWrittenRanges >= kMaxCheckpointRanges)
+		return;
+
+	BlockMove(&myRanges[myIndex], &myRanges[myIndex + 1], (theTransfer->fNumWrittenRanges - myIndex) * sizeof(QTFileTransRangeRecord));
+	myRanges[myIndex].fStart = theOffset;
+	myRanges[myIndex].fEnd = myEnd;
+	theTransfer->fNumWrittenRanges++;
+}
+
+
+//////////
+//
+// QTFileTrans_SetRequest
+// Save copies of the specified URL and file specification in the specified transfer, for a transfer
+// that's started later (by a transfer manager) or elsewhere (on a worker thread).
+//
+//////////
+
+OSErr QTFileTrans_SetRequest (QTFileTransfer theTransfer, char *theURL, FSSpecPtr theFSSpecPtr)
+{
+	Size						mySize = 0;
+
+	if (theTransfer->fURL != NULL) {
+		DisposePtr(theTransfer->fURL);
+		theTransfer->fURL = NULL;
+	}
+
+	mySize = (Size)strlen(theURL) + 1;
+	theTransfer->fURL = NewPtrClear(mySize);
+	if (theTransfer->fURL == NULL)
+		return(MemError());
+
+	BlockMove(theURL, theTransfer->fURL, mySize);
+
+	// a transfer into memory or to a callback doesn't need a file
+	if (theFSSpecPtr != NULL)
+		theTransfer->fFileSpec = *theFSSpecPtr;
+
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_StartOnWorkerThread
+// Start transferring the remote file at the specified URL into the specified local file, on a background
+// thread of its own. The worker thread opens the data handlers, gives them time, and closes them down;
+// the application thread never calls DataHTask for this transfer, so it isn't on the transfer's critical
+// path. Instead, the application calls QTFileTrans_GetWorkerEvent now and then to pick up progress and
+// completion events, which the worker thread passes back through a lock-free, single-producer,
+// single-consumer queue. Once the application has received the kQTFileTransEventDone event, it can
+// dispose of the transfer; disposing of the transfer sooner stops the worker thread first.
+//
+// While a worker thread is running the transfer, the application thread must not call any of our other
+// functions on it (except QTFileTrans_GetWorkerEvent and QTFileTrans_DisposeTransfer).
+//
+// Worker threads are supported only on Windows, where QuickTime lets a thread other than the main one call
+// it once it has called EnterMoviesOnThread; elsewhere, this function returns unimpErr.
+//
+//////////
+
+#if TARGET_OS_WIN32
+DWORD WINAPI QTFileTrans_WorkerThreadProc (LPVOID theParam);
+#endif
+
+OSErr QTFileTrans_StartOnWorkerThread (QTFileTransfer theTransfer, char *theURL, FSSpecPtr theFSSpecPtr)
+{
+#if TARGET_OS_WIN32
+	DWORD						myThreadID;
+	OSErr						myErr = noErr;
+
+	if ((theTransfer == NULL) || (theURL == NULL) || (theFSSpecPtr == NULL))
+		return(paramErr);
+
+	// the transfer can't already be underway
+	if ((theTransfer->fDataReader != NULL) || (theTransfer->fWorkerThread != NULL))
+		return(paramErr);
+
+	myErr = QTFileTrans_SetRequest(theTransfer, theURL, theFSSpecPtr);
+	if (myErr != noErr)
+		return(myErr);
+
+	theTransfer->fOnWorkerThread = true;
+	theTransfer->fWorkerQuit = 0;
+	theTransfer->fWorkerExit = 0;
+	theTransfer->fEventHead = 0;
+	theTransfer->fEventTail = 0;
+
+	theTransfer->fWorkerThread = CreateThread(NULL, 0, QTFileTrans_WorkerThreadProc, theTransfer, 0, &myThreadID);
+	if (theTransfer->fWorkerThread == NULL) {
+		theTransfer->fOnWorkerThread = false;
+		return(memFullErr);
+	}
+
+	return(noErr);
+#else
+#pragma unused(theTransfer, theURL, theFSSpecPtr)
+	return(unimpErr);
+#endif
+}
+
+
+#if TARGET_OS_WIN32
+//////////
+//
+// QTFileTrans_WorkerThreadProc
+// The body of a worker thread: run the transfer passed in theParam from start to finish.
+//
+// The worker sleeps only when a pass over the data handlers didn't fire any completion routines;
+// the sleep doubles each time (up to kMaxWorkerSleepMSecs), like the scheduler's idle interval.
+//
+//////////
+
+DWORD WINAPI QTFileTrans_WorkerThreadProc (LPVOID theParam)
+{
+	QTFileTransfer				myTransfer = (QTFileTransfer)theParam;
+	SInt64						myLastBytes = -1;
+	long						myLastCompletions = 0L;
+	DWORD						mySleep = 0;
+	OSErr						myErr = noErr;
+
+	// before a thread other than the main thread can call QuickTime, it must say so; the URL and HFS data
+	// handlers don't declare themselves thread-safe, so we also let this thread open any component
+	myErr = EnterMoviesOnThread(0);
+	if (myErr == noErr) {
+		CSSetComponentsThreadMode(kCSAcceptAllComponentsMode);
+
+		myErr = QTFileTrans_CopyRemoteFileToLocalFile(myTransfer, myTransfer->fURL, &myTransfer->fFileSpec);
+		if (myErr == noErr) {
+			while (!QTFileTrans_IsDone(myTransfer) && (myTransfer->fWorkerQuit == 0)) {
+				myLastCompletions = myTransfer->fNumCompletions;
+				QTFileTrans_Task(myTransfer);
+
+				// tell the application thread about any progress; if the queue is full, we just skip this event
+				if (myTransfer->fBytesTransferred != myLastBytes)
+					if (QTFileTrans_PostWorkerEvent(myTransfer, kQTFileTransEventProgress))
+						myLastBytes = myTransfer->fBytesTransferred;
+
+				if (myTransfer->fNumCompletions != myLastCompletions) {
+					mySleep = 0;
+				} else {
+					mySleep = (mySleep == 0) ? 1 : mySleep * 2;
+					if (mySleep > kMaxWorkerSleepMSecs)
+						mySleep = kMaxWorkerSleepMSecs;
+					Sleep(mySleep);
+				}
+			}
+
+			if (!QTFileTrans_IsDone(myTransfer))
+				myTransfer->fStatus = userCanceledErr;
+		}
+
+		// the data handlers were opened on this thread, so they must be closed on this thread
+		QTFileTrans_CloseDownHandlers(myTransfer);
+		ExitMoviesOnThread();
+	}
+
+	if ((myErr != noErr) && (myTransfer->fStatus == noErr))
+		myTransfer->fStatus = myErr;
+
+	// the done event must get through (even if the transfer was cancelled), so wait for room in the queue,
+	// unless the thread is being torn down, in which case nobody is waiting for the event
+	while (!QTFileTrans_PostWorkerEvent(myTransfer, kQTFileTransEventDone) && (myTransfer->fWorkerExit == 0))
+		Sleep(kMaxWorkerSleepMSecs);
+
+	return(0);
+}
+#endif
+
+
+//////////
+//
+// QTFileTrans_PostWorkerEvent
+// Add an event of the specified type, describing the current state of the specified transfer, to the
+// transfer's event queue. Return false if the queue is full. Only the worker thread calls this function.
+//
+// Only the worker thread writes fEventHead and only the application thread writes fEventTail, so the
+// queue needs no lock; we just make sure the event is filled in before we publish the new head.
+//
+//////////
+
+Boolean QTFileTrans_PostWorkerEvent (QTFileTransfer theTransfer, long theType)
+{
+	long						myHead = theTransfer->fEventHead;
+	QTFileTransEventPtr			myEvent = NULL;
+
+	if (myHead - theTransfer->fEventTail >= kWorkerQueueSize)
+		return(false);
+
+	myEvent = &theTransfer->fEvents[myHead % kWorkerQueueSize];
+	myEvent->fType = theType;
+	myEvent->fBytesTransferred = theTransfer->fBytesTransferred;
+	myEvent->fBytesToTransfer = theTransfer->fSizeKnown ? theTransfer->fBytesToTransfer : -1;
+	myEvent->fStatus = theTransfer->fStatus;
+
+#if TARGET_OS_WIN32
+	InterlockedExchange((LONG volatile *)&theTransfer->fEventHead, myHead + 1);
+#else
+	theTransfer->fEventHead = myHead + 1;
+#endif
+
+	return(true);
+}
+
+
+//////////
+//
+// QTFileTrans_GetWorkerEvent
+// Remove the oldest event from the event queue of the specified transfer, which is running on a worker
+// thread, and return it in theEvent. Return false if there are no events waiting.
+//
+//////////
+
+Boolean QTFileTrans_GetWorkerEvent (QTFileTransfer theTransfer, QTFileTransEventPtr theEvent)
+{
+	long						myTail;
+
+	if ((theTransfer == NULL) || (theEvent == NULL))
+		return(false);
+
+	myTail = theTransfer->fEventTail;
+	if (myTail == theTransfer->fEventHead)
+		return(false);
+
+	*theEvent = theTransfer->fEvents[myTail % kWorkerQueueSize];
+
+#if TARGET_OS_WIN32
+	InterlockedExchange((LONG volatile *)&theTransfer->fEventTail, myTail + 1);
+#else
+	theTransfer->fEventTail = myTail + 1;
+#endif
+
+	return(true);
+}
+
+
+//////////
+//
+// QTFileTrans_StopWorkerThread
+// If a worker thread is running the specified transfer, ask it to stop and wait until it has.
+//
+//////////
+
+void QTFileTrans_StopWorkerThread (QTFileTransfer theTransfer)
+{
+#if TARGET_OS_WIN32
+	if (theTransfer->fWorkerThread == NULL)
+		return;
+
+	InterlockedExchange((LONG volatile *)&theTransfer->fWorkerExit, 1);
+	InterlockedExchange((LONG volatile *)&theTransfer->fWorkerQuit, 1);
+	WaitForSingleObject((HANDLE)theTransfer->fWorkerThread, INFINITE);
+	CloseHandle((HANDLE)theTransfer->fWorkerThread);
+
+	theTransfer->fWorkerThread = NULL;
+	theTransfer->fOnWorkerThread = false;
+#else
+#pragma unused(theTransfer)
+#endif
+}
+
+
+//////////
+//
+// QTFileTrans_NewManager
+// Allocate a new transfer manager, which runs up to theMaxActive transfers side by side;
+// any additional transfers are queued until one of the active transfers finishes.
+//
+//////////
+
+OSErr QTFileTrans_NewManager (short theMaxActive, QTFileTransManager *theManager)
+{
+	QTFileTransManager			myManager = NULL;
+
+	if ((theManager == NULL) || (theMaxActive <= 0))
+		return(paramErr);
+
+	*theManager = NULL;
+
+	myManager = (QTFileTransManager)NewPtrClear(sizeof(QTFileTransManagerRecord));
+	if (myManager == NULL)
+		return(MemError());
+
+	myManager->fMaxActive = theMaxActive;
+
+	// let the scheduler know about the new manager
+	myManager->fSchedNext = gSchedManagers;
+	gSchedManagers = myManager;
+
+	*theManager = myManager;
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_DisposeManager
+// Dispose of the specified transfer manager and of all the transfers it still owns.
+//
+//////////
+
+void QTFileTrans_DisposeManager (QTFileTransManager theManager)
+{
+	QTFileTransfer				myTransfer = NULL;
+	QTFileTransManager			*myLink = &gSchedManagers;
+
+	if (theManager == NULL)
+		return;
+
+	// remove the manager from the scheduler's list
+	while (*myLink != NULL) {
+		if (*myLink == theManager) {
+			*myLink = theManager->fSchedNext;
+			break;
+		}
+		myLink = &(*myLink)->fSchedNext;
+	}
+
+	while (theManager->fActive != NULL) {
+		myTransfer = theManager->fActive;
+		theManager->fActive = myTransfer->fNext;
+		QTFileTrans_DisposeTransfer(myTransfer);
+	}
+
+	while (theManager->fPending != NULL) {
+		myTransfer = theManager->fPending;
+		theManager->fPending = myTransfer->fNext;
+		QTFileTrans_DisposeTransfer(myTransfer);
+	}
+
+	while (theManager->fFinished != NULL) {
+		myTransfer = theManager->fFinished;
+		theManager->fFinished = myTransfer->fNext;
+		QTFileTrans_DisposeTransfer(myTransfer);
+	}
+
+	DisposePtr((Ptr)theManager);
+}
+
+
+//////////
+//
+// QTFileTrans_SetMaxActive
+// Set the maximum number of transfers that the specified manager runs at once.
+//
+//////////
+
+OSErr QTFileTrans_SetMaxActive (QTFileTransManager theManager, short theMaxActive)
+{
+	if ((theManager == NULL) || (theMaxActive <= 0))
+		return(paramErr);
+
+	// if we lower the limit below the number of active transfers, the extra transfers just keep running;
+	// no new transfers are started until the number of active transfers drops below the new limit
+	theManager->fMaxActive = theMaxActive;
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_ManagerAddTransfer
+// Queue a transfer of the remote file at the specified URL into the specified local file.
+// The transfer is started by QTFileTrans_ManagerTask, once there is room for it.
+//
+// If theTransfer is not NULL, it is set to the new transfer, so that the caller can track it.
+//
+//////////
+
+OSErr QTFileTrans_ManagerAddTransfer (QTFileTransManager theManager, char *theURL, FSSpecPtr theFSSpecPtr, QTFileTransfer *theTransfer)
+{
+	QTFileTransfer				myTransfer = NULL;
+	OSErr						myErr = noErr;
+
+	if (theTransfer != NULL)
+		*theTransfer = NULL;
+
+	if ((theManager == NULL) || (theURL == NULL) || (theFSSpecPtr == NULL))
+		return(paramErr);
+
+	myErr = QTFileTrans_NewTransfer(&myTransfer);
+	if (myErr != noErr)
+		return(myErr);
+
+	// keep our own copies of the URL and the file specification, since the transfer may not start right away
+	myErr = QTFileTrans_SetRequest(myTransfer, theURL, theFSSpecPtr);
+	if (myErr != noErr) {
+		QTFileTrans_DisposeTransfer(myTransfer);
+		return(myErr);
+	}
+
+	// append the new transfer to the end of the pending queue
+	QTFileTrans_AppendToList(&theManager->fPending, myTransfer);
+
+	if (theTransfer != NULL)
+		*theTransfer = myTransfer;
+
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_ManagerTask
+// Give time to all of the active transfers owned by the specified manager, retire any transfers
+// that have finished, and start as many pending transfers as the concurrency limit allows.
+//
+// Call this function periodically (from your main event loop or from a timer) for as long as
+// QTFileTrans_ManagerIsIdle returns false.
+//
+//////////
+
+void QTFileTrans_ManagerTask (QTFileTransManager theManager)
+{
+	QTFileTransfer				myTransfer = NULL;
+
+	if (theManager == NULL)
+		return;
+
+	// give time to the active transfers
+	for (myTransfer = theManager->fActive; myTransfer != NULL; myTransfer = myTransfer->fNext)
+		if (!QTFileTrans_IsDone(myTransfer))
+			QTFileTrans_Task(myTransfer);
+
+	QTFileTrans_ManagerUpdate(theManager);
+}
+
+
+//////////
+//
+// QTFileTrans_ManagerUpdate
+// Retire any transfers owned by the specified manager that have finished, and start as many pending
+// transfers as the concurrency limit allows. This function doesn't give time to the data handlers.
+//
+//////////
+
+void QTFileTrans_ManagerUpdate (QTFileTransManager theManager)
+{
+	QTFileTransfer				myTransfer = NULL;
+	QTFileTransfer				myNext = NULL;
+	QTFileTransfer				myPrev = NULL;
+
+	// move any active transfers that are done to the finished list
+	myTransfer = theManager->fActive;
+	while (myTransfer != NULL) {
+		myNext = myTransfer->fNext;
+
+		if (QTFileTrans_IsDone(myTransfer)) {
+			// unlink this transfer from the active list
+			if (myPrev == NULL)
+				theManager->fActive = myNext;
+			else
+				myPrev->fNext = myNext;
+
+			theManager->fNumActive--;
+
+			// release the data handlers and buffers right away, so they're available to the next transfer
+			QTFileTrans_CloseDownHandlers(myTransfer);
+			QTFileTrans_AppendToList(&theManager->fFinished, myTransfer);
+		} else {
+			myPrev = myTransfer;
+		}
+
+		myTransfer = myNext;
+	}
+
+	// start pending transfers, as long as we have room for them
+	while ((theManager->fPending != NULL) && (theManager->fNumActive < theManager->fMaxActive)) {
+		myTransfer = theManager->fPending;
+		theManager->fPending = myTransfer->fNext;
+		myTransfer->fNext = NULL;
+
+		if (QTFileTrans_CopyRemoteFileToLocalFile(myTransfer, myTransfer->fURL, &myTransfer->fFileSpec) == noErr) {
+			QTFileTrans_AppendToList(&theManager->fActive, myTransfer);
+			theManager->fNumActive++;
+		} else {
+			// the transfer failed to start; its status holds the error
+			QTFileTrans_AppendToList(&theManager->fFinished, myTransfer);
+		}
+	}
+}
+
+
+//////////
+//
+// QTFileTrans_ManagerGetFinished
+// Remove the oldest finished transfer from the specified manager and return it in theTransfer
+// (or NULL, if no transfers have finished). The caller owns the returned transfer; call
+// QTFileTrans_GetProgress to get its final status and QTFileTrans_DisposeTransfer to dispose of it.
+//
+//////////
+
+OSErr QTFileTrans_ManagerGetFinished (QTFileTransManager theManager, QTFileTransfer *theTransfer)
+{
+	QTFileTransfer				myTransfer = NULL;
+
+	if ((theManager == NULL) || (theTransfer == NULL))
+		return(paramErr);
+
+	myTransfer = theManager->fFinished;
+	if (myTransfer != NULL) {
+		theManager->fFinished = myTransfer->fNext;
+		myTransfer->fNext = NULL;
+	}
+
+	*theTransfer = myTransfer;
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_ManagerIsIdle
+// Does the specified manager have no active or pending transfers?
+//
+//////////
+
+Boolean QTFileTrans_ManagerIsIdle (QTFileTransManager theManager)
+{
+	if (theManager == NULL)
+		return(true);
+
+	return((theManager->fActive == NULL) && (theManager->fPending == NULL));
+}
+
+
+//////////
+//
+// QTFileTrans_AppendToList
+// Append the specified transfer to the end of the specified linked list of transfers.
+//
+//////////
+
+void QTFileTrans_AppendToList (QTFileTransfer *theList, QTFileTransfer theTransfer)
+{
+	theTransfer->fNext = NULL;
+
+	while (*theList != NULL)
+		theList = &(*theList)->fNext;
+
+	*theList = theTransfer;
+}
+
+
+//////////
+//
+// QTFileTrans_NewBatch
+// Create a batch that transfers each of the theNumItems remote files in theURLs into the corresponding
+// local file in theFSSpecs. A batch is meant for lots of small files, where opening the data handlers and
+// allocating the buffers for each file would take longer than transferring the file: it runs every file
+// on one of a couple of transfers that keep their URL and HFS data handlers, buffers, and routine
+// descriptors from one file to the next, and it starts opening the next file as soon as the current file
+// has been read, while its last writes are still going on.
+//
+// The batch doesn't start until you call QTFileTrans_BatchTask (or QTFileTrans_Idle).
+//
+//////////
+
+OSErr QTFileTrans_NewBatch (char **theURLs, FSSpecPtr theFSSpecs, long theNumItems, QTFileTransBatch *theBatch)
+{
+	QTFileTransBatch			myBatch = NULL;
+	Size						mySize = 0;
+	long						myIndex;
+	OSErr						myErr = noErr;
+
+	if ((theBatch == NULL) || (theURLs == NULL) || (theFSSpecs == NULL) || (theNumItems <= 0))
+		return(paramErr);
+
+	*theBatch = NULL;
+
+	myBatch = (QTFileTransBatch)NewPtrClear(sizeof(QTFileTransBatchRecord));
+	if (myBatch == NULL)
+		return(MemError());
+
+	myBatch->fItems = (QTFileTransBatchItemPtr)NewPtrClear(theNumItems * sizeof(QTFileTransBatchItemRecord));
+	if (myBatch->fItems == NULL) {
+		myErr = MemError();
+		goto bail;
+	}
+
+	myBatch->fNumItems = theNumItems;
+
+	// keep our own copies of the URLs and the file specifications
+	for (myIndex = 0; myIndex < theNumItems; myIndex++) {
+		mySize = (Size)strlen(theURLs[myIndex]) + 1;
+		myBatch->fItems[myIndex].fURL = NewPtrClear(mySize);
+		if (myBatch->fItems[myIndex].fURL == NULL) {
+			myErr = MemError();
+			goto bail;
+		}
+
+		BlockMove(theURLs[myIndex], myBatch->fItems[myIndex].fURL, mySize);
+		myBatch->fItems[myIndex].fFileSpec = theFSSpecs[myIndex];
+	}
+
+	for (myIndex = 0; myIndex < kNumBatchSlots; myIndex++) {
+		myErr = QTFileTrans_NewTransfer(&myBatch->fSlots[myIndex]);
+		if (myErr != noErr)
+			goto bail;
+
+		myBatch->fSlotItems[myIndex] = -1;
+	}
+
+	// let the scheduler know about the new batch
+	myBatch->fSchedNext = gSchedBatches;
+	gSchedBatches = myBatch;
+
+	*theBatch = myBatch;
+
+bail:
+	if (myErr != noErr)
+		QTFileTrans_DisposeBatch(myBatch);
+
+	return(myErr);
+}
+
+
+//////////
+//
+// QTFileTrans_DisposeBatch
+// Dispose of the specified batch, stopping any transfers it still has underway.
+//
+//////////
+
+void QTFileTrans_DisposeBatch (QTFileTransBatch theBatch)
+{
+	QTFileTransBatch			*myLink = &gSchedBatches;
+	long						myIndex;
+
+	if (theBatch == NULL)
+		return;
+
+	// remove the batch from the scheduler's list
+	while (*myLink != NULL) {
+		if (*myLink == theBatch) {
+			*myLink = theBatch->fSchedNext;
+			break;
+		}
+		myLink = &(*myLink)->fSchedNext;
+	}
+
+	for (myIndex = 0; myIndex < kNumBatchSlots; myIndex++)
+		if (theBatch->fSlots[myIndex] != NULL)
+			QTFileTrans_DisposeTransfer(theBatch->fSlots[myIndex]);
+
+	if (theBatch->fItems != NULL) {
+		for (myIndex = 0; myIndex < theBatch->fNumItems; myIndex++)
+			if (theBatch->fItems[myIndex].fURL != NULL)
+				DisposePtr(theBatch->fItems[myIndex].fURL);
+
+		DisposePtr((Ptr)theBatch->fItems);
+	}
+
+	DisposePtr((Ptr)theBatch);
+}
+
+
+//////////
+//
+// QTFileTrans_BatchTask
+// Give time to the transfers of the specified batch, and move on to the next files as the current ones
+// finish. Call this function periodically for as long as QTFileTrans_BatchIsDone returns false.
+//
+//////////
+
+void QTFileTrans_BatchTask (QTFileTransBatch theBatch)
+{
+	long						myIndex;
+
+	if (theBatch == NULL)
+		return;
+
+	for (myIndex = 0; myIndex < kNumBatchSlots; myIndex++)
+		if (theBatch->fSlotItems[myIndex] >= 0)
+			QTFileTrans_Task(theBatch->fSlots[myIndex]);
+
+	QTFileTrans_BatchUpdate(theBatch);
+}
+
+
+//////////
+//
+// QTFileTrans_BatchUpdate
+// Retire the files of the specified batch that have finished, and start the next file whenever no slot
+// is still reading; this lets the next file be opened (which, for a remote file, means waiting for the
+// server) while the file before it drains into the local disk.
+//
+//////////
+
+void QTFileTrans_BatchUpdate (QTFileTransBatch theBatch)
+{
+	QTFileTransfer				mySlot = NULL;
+	QTFileTransBatchItemPtr		myItem = NULL;
+	Boolean						myIsReading = false;
+	long						myIndex;
+	long						myOther;
+
+	// retire any files that are done, keeping their data handlers and buffers for the next file
+	for (myIndex = 0; myIndex < kNumBatchSlots; myIndex++) {
+		mySlot = theBatch->fSlots[myIndex];
+		if ((theBatch->fSlotItems[myIndex] >= 0) && QTFileTrans_IsDone(mySlot)) {
+			myItem = &theBatch->fItems[theBatch->fSlotItems[myIndex]];
+			myItem->fDone = true;
+			myItem->fStatus = mySlot->fStatus;
+			myItem->fBytesTransferred = mySlot->fBytesTransferred;
+			theBatch->fNumFinished++;
+
+			QTFileTrans_ReleaseHandlers(mySlot, true);
+			theBatch->fSlotItems[myIndex] = -1;
+		}
+	}
+
+	// start the next files in any free slots, as long as no other slot is still reading
+	for (myIndex = 0; (myIndex < kNumBatchSlots) && (theBatch->fNextItem < theBatch->fNumItems); myIndex++) {
+		if (theBatch->fSlotItems[myIndex] >= 0)
+			continue;
+
+		myIsReading = false;
+		for (myOther = 0; myOther < kNumBatchSlots; myOther++)
+			if (theBatch->fSlotItems[myOther] >= 0)
+				if (!QTFileTrans_IsDone(theBatch->fSlots[myOther]) && !QTFileTrans_IsDraining(theBatch->fSlots[myOther]))
+					myIsReading = true;
+
+		if (myIsReading)
+			break;
+
+		mySlot = theBatch->fSlots[myIndex];
+		myItem = &theBatch->fItems[theBatch->fNextItem];
+
+		if (QTFileTrans_CopyRemoteFileToLocalFile(mySlot, myItem->fURL, &myItem->fFileSpec) == noErr) {
+			theBatch->fSlotItems[myIndex] = theBatch->fNextItem;
+		} else {
+			// the file failed to start; its transfer's status holds the error, and we try the next file in this slot
+			myItem->fDone = true;
+			myItem->fStatus = mySlot->fStatus;
+			theBatch->fNumFinished++;
+			myIndex--;
+		}
+
+		theBatch->fNextItem++;
+	}
+}
+
+
+//////////
+//
+// QTFileTrans_BatchIsDone
+// Have all the files of the specified batch finished transferring (successfully or not)?
+//
+//////////
+
+Boolean QTFileTrans_BatchIsDone (QTFileTransBatch theBatch)
+{
+	if (theBatch == NULL)
+		return(true);
+
+	return(theBatch->fNumFinished >= theBatch->fNumItems);
+}
+
+
+//////////
+//
+// QTFileTrans_BatchGetItemStatus
+// Return whether the file at the specified index of the specified batch has finished transferring and,
+// if so, its final status.
+//
+//////////
+
+OSErr QTFileTrans_BatchGetItemStatus (QTFileTransBatch theBatch, long theIndex, Boolean *theDone, OSErr *theStatus)
+{
+	if ((theBatch == NULL) || (theIndex < 0) || (theIndex >= theBatch->fNumItems))
+		return(paramErr);
+
+	if (theDone != NULL)
+		*theDone = theBatch->fItems[theIndex].fDone;
+
+	if (theStatus != NULL)
+		*theStatus = theBatch->fItems[theIndex].fStatus;
+
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_IsDraining
+// Has the specified transfer read all of its data, so that it's just waiting for the last writes to finish?
+//
+//////////
+
+Boolean QTFileTrans_IsDraining (QTFileTransfer theTransfer)
+{
+	if ((theTransfer == NULL) || (theTransfer->fDataReader == NULL) || theTransfer->fDoneTransferring)
+		return(false);
+
+	return(QTFileTrans_ChooseSegment(theTransfer, NULL) == NULL);
+}
+
+
+//////////
+//
+// QTFileTrans_SetGlobalRateLimit
+// Limit the total bandwidth of all the transfers running on the application thread to theBytesPerSecond
+// (pass 0 to remove the limit). Reads can go ahead in bursts of up to theBurstBytes (pass 0 for one
+// second's worth). Transfers running on worker threads are subject only to their own limits.
+//
+// The limits are applied where a buffer's next read is issued: a buffer that finds no tokens in its
+// transfer's bucket (or in the global bucket) waits until there are, and the waiting buffers are given
+// their reads in priority order (see QTFileTrans_SetPriority).
+//
+//////////
+
+OSErr QTFileTrans_SetGlobalRateLimit (long theBytesPerSecond, long theBurstBytes)
+{
+	if ((theBytesPerSecond < 0) || (theBurstBytes < 0))
+		return(paramErr);
+
+	QTFileTrans_InitBucket(&gSchedRateLimit, theBytesPerSecond, theBurstBytes);
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_SetRateLimit
+// Limit the bandwidth of the specified transfer to theBytesPerSecond (pass 0 to remove the limit),
+// in bursts of up to theBurstBytes (pass 0 for one second's worth). You can change the limit at any time.
+//
+//////////
+
+OSErr QTFileTrans_SetRateLimit (QTFileTransfer theTransfer, long theBytesPerSecond, long theBurstBytes)
+{
+	if ((theTransfer == NULL) || (theBytesPerSecond < 0) || (theBurstBytes < 0))
+		return(paramErr);
+
+	QTFileTrans_InitBucket(&theTransfer->fRateLimit, theBytesPerSecond, theBurstBytes);
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_SetPriority
+// Set the priority class of the specified transfer. When the global bandwidth limit holds reads back,
+// the waiting transfers of a higher priority get their reads first, and a transfer doesn't issue a read
+// while a transfer of higher priority is waiting for one; transfers of the same priority take turns.
+// You can change the priority at any time.
+//
+//////////
+
+OSErr QTFileTrans_SetPriority (QTFileTransfer theTransfer, short thePriority)
+{
+	if ((theTransfer == NULL) || (thePriority < 0) || (thePriority >= kNumPriorities))
+		return(paramErr);
+
+	// move any waiting buffers over to the new priority class
+	if (!theTransfer->fOnWorkerThread) {
+		gSchedNumThrottled[theTransfer->fPriority] -= theTransfer->fNumThrottled;
+		gSchedNumThrottled[thePriority] += theTransfer->fNumThrottled;
+	}
+
+	theTransfer->fPriority = thePriority;
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_InitBucket
+// Set up the specified token bucket to allow theBytesPerSecond, in bursts of up to theBurstBytes.
+// The bucket starts out full.
+//
+//////////
+
+void QTFileTrans_InitBucket (QTFileTransBucketPtr theBucket, long theBytesPerSecond, long theBurstBytes)
+{
+	theBucket->fRate = theBytesPerSecond;
+	theBucket->fBurst = (theBurstBytes > 0) ? theBurstBytes : theBytesPerSecond;
+	theBucket->fTokens = theBucket->fBurst;
+	theBucket->fLastRefill = QTFileTrans_GetMicroseconds();
+}
+
+
+//////////
+//
+// QTFileTrans_BucketHasTokens
+// Add the tokens that have accrued in the specified bucket since we last looked, and return whether
+// a read may go ahead. A bucket with no limit always has tokens.
+//
+// A read may go ahead whenever the bucket holds any tokens at all, even if the read is bigger than
+// that; the bucket then goes into debt, which the next reads have to wait out. That way the limit
+// holds on average, whatever the chunk size and the burst size.
+//
+//////////
+
+Boolean QTFileTrans_BucketHasTokens (QTFileTransBucketPtr theBucket)
+{
+	unsigned long			myNow;
+	unsigned long			myElapsed;
+	SInt64					myNumToAdd;
+
+	if (theBucket->fRate <= 0L)
+		return(true);
+
+	if (theBucket->fTokens <= 0) {
+		myNow = QTFileTrans_GetMicroseconds();
+		myElapsed = myNow - theBucket->fLastRefill;
+
+		if (myElapsed >= kMaxRefillMicroseconds) {
+			theBucket->fTokens = theBucket->fBurst;
+			theBucket->fLastRefill = myNow;
+		} else {
+			// we move the refill time along only when we actually add tokens, so that slow
+			// rates don't lose the fractions of a byte that accrue between calls
+			myNumToAdd = ((SInt64)theBucket->fRate * myElapsed) / 1000000L;
+			if (myNumToAdd > 0) {
+				theBucket->fTokens += myNumToAdd;
+				if (theBucket->fTokens > theBucket->fBurst)
+					theBucket->fTokens = theBucket->fBurst;
+				theBucket->fLastRefill = myNow;
+			}
+		}
+	}
+
+	return(theBucket->fTokens > 0);
+}
+
+
+//////////
+//
+// QTFileTrans_SpendTokens
+// Charge a read of theNumBytes, by the specified transfer, against the bandwidth limits that apply to it.
+//
+//////////
+
+void QTFileTrans_SpendTokens (QTFileTransfer theTransfer, long theNumBytes)
+{
+	if (theTransfer->fRateLimit.fRate > 0L)
+		theTransfer->fRateLimit.fTokens -= theNumBytes;
+
+	if (!theTransfer->fOnWorkerThread && (gSchedRateLimit.fRate > 0L))
+		gSchedRateLimit.fTokens -= theNumBytes;
+}
+
+
+//////////
+//
+// QTFileTrans_HasTokens
+// Do the bandwidth limits that apply to the specified transfer allow it to issue a read right now?
+//
+//////////
+
+Boolean QTFileTrans_HasTokens (QTFileTransfer theTransfer)
+{
+	if (!QTFileTrans_BucketHasTokens(&theTransfer->fRateLimit))
+		return(false);
+
+	if (!theTransfer->fOnWorkerThread && !QTFileTrans_BucketHasTokens(&gSchedRateLimit))
+		return(false);
+
+	return(true);
+}
+
+
+//////////
+//
+// QTFileTrans_RequestRead
+// Schedule the next read into the specified buffer, from the specified segment, if the bandwidth limits
+// allow it; otherwise, set the buffer aside until QTFileTrans_IssueThrottledRead can issue the read.
+//
+//////////
+
+void QTFileTrans_RequestRead (QTFileTransBufferPtr theBuffer, QTFileTransSegmentPtr theSegment)
+{
+	QTFileTransfer			myTransfer = theBuffer->fTransfer;
+	Boolean					myMayRead = true;
+	short					myPriority;
+
+	// a transfer that already has buffers waiting lets them go first
+	if (myTransfer->fNumThrottled > 0)
+		myMayRead = false;
+
+	// so does a transfer that a transfer of higher priority is waiting for
+	if (myMayRead && !myTransfer->fOnWorkerThread)
+		for (myPriority = 0; myPriority < myTransfer->fPriority; myPriority++)
+			if (gSchedNumThrottled[myPriority] > 0)
+				myMayRead = false;
+
+	if (myMayRead && QTFileTrans_HasTokens(myTransfer)) {
+		QTFileTrans_ScheduleRead(theBuffer, theSegment);
+		return;
+	}
+
+	// remember the segment, so that the read can pick up where it would have
+	theBuffer->fSegment = theSegment;
+	theBuffer->fThrottled = true;
+	myTransfer->fNumThrottled++;
+	if (!myTransfer->fOnWorkerThread)
+		gSchedNumThrottled[myTransfer->fPriority]++;
+}
+
+
+//////////
+//
+// QTFileTrans_IssueThrottledRead
+// Issue the read for one of the buffers of the specified transfer that are waiting for the bandwidth
+// limits, if the limits allow it now. Return true if we took a buffer off the waiting list.
+//
+//////////
+
+Boolean QTFileTrans_IssueThrottledRead (QTFileTransfer theTransfer)
+{
+	QTFileTransBufferPtr	myBuffer = NULL;
+	QTFileTransSegmentPtr	mySegment = NULL;
+	short					myIndex;
+
+	if ((theTransfer->fNumThrottled <= 0) || !QTFileTrans_HasTokens(theTransfer))
+		return(false);
+
+	for (myIndex = 0; myIndex < theTransfer->fNumBuffers; myIndex++) {
+		if (theTransfer->fDataBuffers[myIndex].fThrottled) {
+			myBuffer = &theTransfer->fDataBuffers[myIndex];
+			break;
+		}
+	}
+
+	if (myBuffer == NULL)
+		return(false);
+
+	myBuffer->fThrottled = false;
+	theTransfer->fNumThrottled--;
+	if (!theTransfer->fOnWorkerThread)
+		gSchedNumThrottled[theTransfer->fPriority]--;
+
+	// the file may have turned out to be shorter while we were waiting
+	mySegment = QTFileTrans_ChooseSegment(theTransfer, myBuffer->fSegment);
+	if (mySegment != NULL)
+		QTFileTrans_ScheduleRead(myBuffer, mySegment);
+	else if ((theTransfer->fBytesTransferred >= theTransfer->fBytesToTransfer) && !QTFileTrans_HasPendingRequests(theTransfer))
+		QTFileTrans_FinishTransfer(theTransfer);
+
+	return(true);
+}
+
+
+//////////
+//
+// QTFileTrans_ServiceThrottledReads
+// Issue as many of the reads held back by the bandwidth limits as the limits allow, for all the transfers
+// the scheduler knows about. We go through the priority classes from the highest down; within a class,
+// each transfer gets one read per pass, so that transfers of the same priority share the bandwidth evenly.
+// Lower classes get nothing while a higher class still has buffers waiting.
+//
+//////////
+
+void QTFileTrans_ServiceThrottledReads (void)
+{
+	QTFileTransfer				myTransfer = NULL;
+	QTFileTransfer				myNext = NULL;
+	Boolean						myIssued = false;
+	short						myPriority;
+
+	for (myPriority = 0; myPriority < kNumPriorities; myPriority++) {
+		if (gSchedNumThrottled[myPriority] <= 0)
+			continue;
+
+		do {
+			myIssued = false;
+			for (myTransfer = gSchedTransfers; myTransfer != NULL; myTransfer = myNext) {
+				myNext = myTransfer->fSchedNext;
+				if ((myTransfer->fPriority == myPriority) && QTFileTrans_IssueThrottledRead(myTransfer))
+					myIssued = true;
+			}
+		} while (myIssued);
+
+		if (gSchedNumThrottled[myPriority] > 0)
+			break;
+	}
+}
+
+
+//////////
+//
+// QTFileTrans_ClearThrottledReads
+// Forget about any buffers of the specified transfer that are waiting for the bandwidth limits.
+//
+//////////
+
+void QTFileTrans_ClearThrottledReads (QTFileTransfer theTransfer)
+{
+	short					myIndex;
+
+	for (myIndex = 0; myIndex < kMaxNumDataBuffers; myIndex++)
+		theTransfer->fDataBuffers[myIndex].fThrottled = false;
+
+	if (!theTransfer->fOnWorkerThread)
+		gSchedNumThrottled[theTransfer->fPriority] -= theTransfer->fNumThrottled;
+
+	theTransfer->fNumThrottled = 0;
+}
+
+
+//////////
+//
+// QTFileTrans_Cancel
+// Stop the specified transfer: we issue no more reads or writes, and ask the data handlers to cancel the ones
+// still outstanding. The transfer's status becomes userCanceledErr; QTFileTrans_IsDone returns true once the
+// outstanding requests have completed, and then QTFileTrans_Idle closes the transfer's data handlers for you.
+//
+// It's safe to call this from a completion routine (a callback sink, say), or on a transfer that has already
+// finished (in which case it does nothing).
+//
+//////////
+
+OSErr QTFileTrans_Cancel (QTFileTransfer theTransfer)
+{
+	if (theTransfer == NULL)
+		return(paramErr);
+
+	if (theTransfer->fDoneTransferring)
+		return(noErr);
+
+#if TARGET_OS_WIN32
+	// a worker thread cancels its own transfer, once it notices that we've asked it to quit
+	if (theTransfer->fOnWorkerThread) {
+		InterlockedExchange((LONG volatile *)&theTransfer->fWorkerQuit, 1);
+		return(noErr);
+	}
+#endif
+
+	QTFileTrans_AbortTransfer(theTransfer, userCanceledErr);
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_SetDeadline
+// Give the specified transfer theSeconds seconds, from now, to finish; if it isn't done by then, we cancel it,
+// and its status becomes kQTFileTransDeadlineErr. Pass 0 to remove the deadline. A deadline set before the
+// transfer starts applies to that transfer (so the time it takes to open the data handlers counts).
+//
+//////////
+
+OSErr QTFileTrans_SetDeadline (QTFileTransfer theTransfer, long theSeconds)
+{
+	if (theTransfer == NULL)
+		return(paramErr);
+
+	if (theSeconds < 0)
+		return(paramErr);
+
+	if (theSeconds == 0) {
+		theTransfer->fDeadline = 0L;
+		return(noErr);
+	}
+
+	theTransfer->fDeadline = TickCount() + (unsigned long)theSeconds * 60L;
+	if (theTransfer->fDeadline == 0L)
+		theTransfer->fDeadline = 1L;
+
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_CheckDeadline
+// Cancel the specified transfer if it has run past its deadline.
+//
+//////////
+
+void QTFileTrans_CheckDeadline (QTFileTransfer theTransfer)
+{
+	if ((theTransfer->fDeadline == 0L) || theTransfer->fDoneTransferring || (theTransfer->fStatus != noErr))
+		return;
+
+	// (we compare the times this way so that the tick count can wrap around)
+	if ((long)(TickCount() - theTransfer->fDeadline) < 0)
+		return;
+
+	theTransfer->fDeadline = 0L;
+	QTFileTrans_AbortTransfer(theTransfer, kQTFileTransDeadlineErr);
+}
+
+
+//////////
+//
+// QTFileTrans_AbortTransfer
+// End the specified transfer with the specified error, and ask its URL data handlers to cancel the reads they
+// haven't finished. The completion routines of those reads still fire (with an error); they just do their
+// bookkeeping, so that we know when it's safe to close the data handlers. Writes to the local file finish
+// quickly, so we let them complete.
+//
+//////////
+
+void QTFileTrans_AbortTransfer (QTFileTransfer theTransfer, OSErr theErr)
+{
+	short					myIndex;
+
+	QTFileTrans_FailTransfer(theTransfer, theErr);
+	theTransfer->fCancelled = true;
+
+	for (myIndex = 0; myIndex < theTransfer->fNumSegments; myIndex++)
+		if ((theTransfer->fSegments[myIndex].fDataReader != NULL) && (theTransfer->fSegments[myIndex].fNumPendingReads > 0))
+			DataHFinishData(theTransfer->fSegments[myIndex].fDataReader, NULL, true);
+}
+
+
+//////////
+//
+// QTFileTrans_DrainRequests
+// Cancel the reads and writes the specified transfer still has outstanding, and give the data handlers time
+// until their completion routines have fired (or kMaxDrainTicks have gone by, in case a data handler never
+// calls them; closing that data handler then cancels whatever is left).
+//
+//////////
+
+void QTFileTrans_DrainRequests (QTFileTransfer theTransfer)
+{
+	unsigned long			myStartTicks = TickCount();
+
+	// the application is closing the transfer down itself, so there's no need to tell it when it's done
+	theTransfer->fDoneNotified = true;
+
+	if (!theTransfer->fCancelled)
+		QTFileTrans_AbortTransfer(theTransfer, (theTransfer->fStatus != noErr) ? theTransfer->fStatus : userCanceledErr);
+
+	while (QTFileTrans_HasPendingRequests(theTransfer) && (TickCount() - myStartTicks < kMaxDrainTicks))
+		QTFileTrans_Task(theTransfer);
+}
+
+
+//////////
+//
+// QTFileTrans_SetRetryPolicy
+// Set how the specified transfer handles a read or write that fails: we try the same chunk again up to
+// theMaxRetries times (0 means don't retry), waiting theRetryMSecs milliseconds before the first retry and
+// twice as long before each retry after that, but never longer than theMaxRetryMSecs milliseconds.
+//
+//////////
+
+OSErr QTFileTrans_SetRetryPolicy (QTFileTransfer theTransfer, short theMaxRetries, long theRetryMSecs, long theMaxRetryMSecs)
+{
+	if (theTransfer == NULL)
+		return(paramErr);
+
+	if ((theMaxRetries < 0) || (theRetryMSecs < 0) || (theMaxRetryMSecs < theRetryMSecs))
+		return(paramErr);
+
+	// we keep the delays in microseconds
+	if (theMaxRetryMSecs > 0x7FFFFFFF / 1000L)
+		return(paramErr);
+
+	theTransfer->fMaxRetries = theMaxRetries;
+	theTransfer->fRetryDelay = theRetryMSecs * 1000L;
+	theTransfer->fMaxRetryDelay = theMaxRetryMSecs * 1000L;
+
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_HandleReadError
+// Deal with a read into the specified buffer that failed: read the same range from another mirror, if there
+// is one; or read it again later, or (if the error isn't one that retrying can fix, or we've already retried
+// this chunk too often) end the transfer.
+//
+//////////
+
+void QTFileTrans_HandleReadError (QTFileTransBufferPtr theBuffer, OSErr theErr)
+{
+	QTFileTransfer			myTransfer = theBuffer->fTransfer;
+
+	myTransfer->fStats.fNumReadErrors++;
+
+	// another mirror might well have the chunk, where this one has trouble
+	if (QTFileTrans_FailOverRead(theBuffer, theErr))
+		return;
+
+	if (QTFileTrans_IsRetryableError(theErr))
+		if (QTFileTrans_ScheduleRetry(theBuffer, false))
+			return;
+
+	QTFileTrans_FailTransfer(myTransfer, theErr);
+}
+
+
+//////////
+//
+// QTFileTrans_HandleWriteError
+// Deal with a write from the specified buffer that failed. The data is still in the buffer, so we can
+// write it again later; but we can't take back data we've already handed to a memory or callback sink,
+// so an error from one of those ends the transfer. So does an error writing to a URL data handler, when
+// we're uploading: it sends the data as one stream, and later chunks may already be on their way.
+//
+//////////
+
+void QTFileTrans_HandleWriteError (QTFileTransBufferPtr theBuffer, OSErr theErr)
+{
+	QTFileTransfer			myTransfer = theBuffer->fTransfer;
+
+	myTransfer->fStats.fNumWriteErrors++;
+
+	if ((myTransfer->fSinkType == kQTFileTransSinkFile) && !myTransfer->fUploading && QTFileTrans_IsRetryableError(theErr))
+		if (QTFileTrans_ScheduleRetry(theBuffer, true))
+			return;
+
+	QTFileTrans_FailTransfer(myTransfer, theErr);
+}
+
+
+//////////
+//
+// QTFileTrans_IsRetryableError
+// Might the read or write that failed with the specified error succeed if we tried it again? Network
+// errors and most disk errors might go away; these won't.
+//
+//////////
+
+Boolean QTFileTrans_IsRetryableError (OSErr theErr)
+{
+	switch (theErr) {
+		case paramErr:
+		case memFullErr:
+		case dskFulErr:
+		case fnfErr:
+		case wPrErr:
+		case vLckdErr:
+		case permErr:
+		case wrPermErr:
+		case userCanceledErr:
+		case kQTFileTransDigestMismatchErr:
+			return(false);
+
+		default:
+			return(true);
+	}
+}
+
+
+//////////
+//
+// QTFileTrans_ScheduleRetry
+// Set the specified buffer aside to retry its read (or, if theRetryWrite is true, its write) once it has
+// waited long enough; each retry of the same chunk waits twice as long as the one before. Return false
+// if the chunk has already been retried as often as the transfer allows, or the transfer has already failed.
+//
+//////////
+
+Boolean QTFileTrans_ScheduleRetry (QTFileTransBufferPtr theBuffer, Boolean theRetryWrite)
+{
+	QTFileTransfer			myTransfer = theBuffer->fTransfer;
+	unsigned long			myDelay;
+	short					myShift;
+
+	if (myTransfer->fStatus != noErr)
+		return(false);
+
+	if (theBuffer->fNumRetries >= myTransfer->fMaxRetries)
+		return(false);
+
+	// double the delay for each retry (without letting it overflow) up to the limit
+	myDelay = myTransfer->fRetryDelay;
+	for (myShift = 0; (myShift < theBuffer->fNumRetries) && (myDelay < myTransfer->fMaxRetryDelay); myShift++)
+		myDelay *= 2;
+	if (myDelay > myTransfer->fMaxRetryDelay)
+		myDelay = myTransfer->fMaxRetryDelay;
+
+	theBuffer->fNumRetries++;
+	theBuffer->fRetryWrite = theRetryWrite;
+	theBuffer->fRetryTime = QTFileTrans_GetMicroseconds() + myDelay;
+	if (theBuffer->fRetryTime == 0L)
+		theBuffer->fRetryTime = 1L;
+
+	myTransfer->fNumRetrying++;
+	return(true);
+}
+
+
+//////////
+//
+// QTFileTrans_ServiceRetries
+// Retry the reads and writes of the specified transfer that have waited long enough since they failed.
+// A retried read re-reads just the range that failed; a retried write writes the data that's still in
+// the buffer. Neither is charged against the bandwidth limits a second time.
+//
+//////////
+
+void QTFileTrans_ServiceRetries (QTFileTransfer theTransfer)
+{
+	QTFileTransBufferPtr	myBuffer = NULL;
+	unsigned long			myNow = QTFileTrans_GetMicroseconds();
+	short					myIndex;
+
+	for (myIndex = 0; myIndex < theTransfer->fNumBuffers + theTransfer->fNumCoalesceBlocks; myIndex++) {
+		if (myIndex < theTransfer->fNumBuffers)
+			myBuffer = &theTransfer->fDataBuffers[myIndex];
+		else
+			myBuffer = &theTransfer->fCoalesceBlocks[myIndex - theTransfer->fNumBuffers];
+
+		// (we compare the times this way so that the microsecond clock can wrap around)
+		if ((myBuffer->fRetryTime == 0L) || ((long)(myNow - myBuffer->fRetryTime) < 0))
+			continue;
+
+		myBuffer->fRetryTime = 0L;
+		theTransfer->fNumRetrying--;
+		theTransfer->fStats.fNumRetries++;
+
+		if (myBuffer->fRetryWrite) {
+			theTransfer->fNumPendingWrites++;
+			QTFileTrans_PassToSink(myBuffer);
+		} else {
+			QTFileTrans_IssueRead(myBuffer);
+		}
+
+		// a retry can fail right away, and that might be the last straw
+		if (theTransfer->fStatus != noErr)
+			break;
+	}
+}
+
+
+//////////
+//
+// QTFileTrans_ClearRetries
+// Forget about any buffers of the specified transfer that are waiting to retry a read or write.
+//
+//////////
+
+void QTFileTrans_ClearRetries (QTFileTransfer theTransfer)
+{
+	short					myIndex;
+
+	for (myIndex = 0; myIndex < kMaxNumDataBuffers; myIndex++)
+		theTransfer->fDataBuffers[myIndex].fRetryTime = 0L;
+
+	for (myIndex = 0; myIndex < kMaxCoalesceBlocks; myIndex++)
+		theTransfer->fCoalesceBlocks[myIndex].fRetryTime = 0L;
+
+	theTransfer->fNumRetrying = 0;
+}
+
+
+//////////
+//
+// QTFileTrans_FailTransfer
+// End the specified transfer because of the specified error (unless it has already failed, in which case
+// its first error stands). We don't issue any more reads or writes; the ones still outstanding just drain
+// away, and then QTFileTrans_IsDone returns true.
+//
+//////////
+
+void QTFileTrans_FailTransfer (QTFileTransfer theTransfer, OSErr theErr)
+{
+	if (theTransfer->fStatus == noErr)
+		theTransfer->fStatus = theErr;
+
+	QTFileTrans_ClearRetries(theTransfer);
+	QTFileTrans_ClearThrottledReads(theTransfer);
+	QTFileTrans_ClearCoalescing(theTransfer);
+	QTFileTrans_ClearHeldBuffers(theTransfer);
+}
+
+
+//////////
+//
+// QTFileTrans_ResetStats
+// Clear the statistics for the specified transfer and start its clocks.
+//
+//////////
+
+void QTFileTrans_ResetStats (QTFileTransfer theTransfer)
+{
+	memset(&theTransfer->fStats, 0, sizeof(QTFileTransStatsRecord));
+
+	theTransfer->fStateTime = QTFileTrans_GetMicroseconds();
+	theTransfer->fSampleTime = theTransfer->fStateTime;
+	theTransfer->fSampleBytes = 0;
+	theTransfer->fLastTaskTime = 0L;
+}
+
+
+//////////
+//
+// QTFileTrans_GetStats
+// Return the statistics gathered so far for the specified transfer. This is cheap enough to call as often
+// as you like: we just copy the statistics and bring their times up to the present. (For a transfer on a
+// worker thread, the numbers may be a moment out of date, and not quite consistent with one another.)
+//
+//////////
+
+OSErr QTFileTrans_GetStats (QTFileTransfer theTransfer, QTFileTransStatsPtr theStats)
+{
+	if ((theTransfer == NULL) || (theStats == NULL))
+		return(paramErr);
+
+	*theStats = theTransfer->fStats;
+
+	// charge the time since the last change of state, without disturbing the transfer's own bookkeeping
+	if (!theTransfer->fDoneTransferring && (theTransfer->fDataReader != NULL))
+		QTFileTrans_ChargeTime(theTransfer, theStats, QTFileTrans_GetMicroseconds());
+
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_ExportStats
+// Write the statistics gathered so far for the specified transfer into theText, as a null-terminated JSON
+// object, so that they can be logged or sent off for analysis. A buffer of kStatsExportSize bytes is big
+// enough; if theText is too small, we return paramErr (but still fill it with as much as fits).
+//
+//////////
+
+OSErr QTFileTrans_ExportStats (QTFileTransfer theTransfer, char *theText, long theTextSize)
+{
+	QTFileTransStatsRecord		myStats;
+	long						myLength = 0L;
+	OSErr						myErr = noErr;
+
+	if ((theText == NULL) || (theTextSize <= 0L))
+		return(paramErr);
+
+	theText[0] = '\0';
+
+	myErr = QTFileTrans_GetStats(theTransfer, &myStats);
+	if (myErr != noErr)
+		return(myErr);
+
+	QTFileTrans_AppendText(theText, theTextSize, &myLength, "{");
+	QTFileTrans_AppendNumber(theText, theTextSize, &myLength, "bytesRead", myStats.fBytesRead);
+	QTFileTrans_AppendNumber(theText, theTextSize, &myLength, "bytesWritten", myStats.fBytesWritten);
+	QTFileTrans_AppendNumber(theText, theTextSize, &myLength, "bytesToTransfer", theTransfer->fSizeKnown ? theTransfer->fBytesToTransfer : -1);
+	QTFileTrans_AppendNumber(theText, theTextSize, &myLength, "numReads", myStats.fNumReads);
+	QTFileTrans_AppendNumber(theText, theTextSize, &myLength, "numWrites", myStats.fNumWrites);
+	QTFileTrans_AppendNumber(theText, theTextSize, &myLength, "instantThroughput", myStats.fInstantThroughput);
+	QTFileTrans_AppendNumber(theText, theTextSize, &myLength, "averageThroughput", myStats.fAverageThroughput);
+	QTFileTrans_AppendNumber(theText, theTextSize, &myLength, "elapsedTime", myStats.fElapsedTime);
+	QTFileTrans_AppendNumber(theText, theTextSize, &myLength, "networkTime", myStats.fNetworkTime);
+	QTFileTrans_AppendNumber(theText, theTextSize, &myLength, "diskTime", myStats.fDiskTime);
+	QTFileTrans_AppendNumber(theText, theTextSize, &myLength, "overlapTime", myStats.fOverlapTime);
+	QTFileTrans_AppendNumber(theText, theTextSize, &myLength, "stalledTime", myStats.fStalledTime);
+	QTFileTrans_AppendNumber(theText, theTextSize, &myLength, "taskTime", myStats.fTaskTime);
+	QTFileTrans_AppendNumber(theText, theTextSize, &myLength, "taskWaitTime", myStats.fTaskWaitTime);
+	QTFileTrans_AppendNumber(theText, theTextSize, &myLength, "numReadErrors", myStats.fNumReadErrors);
+	QTFileTrans_AppendNumber(theText, theTextSize, &myLength, "numWriteErrors", myStats.fNumWriteErrors);
+	QTFileTrans_AppendNumber(theText, theTextSize, &myLength, "numRetries", myStats.fNumRetries);
+	QTFileTrans_AppendNumber(theText, theTextSize, &myLength, "bytesFromCache", myStats.fBytesFromCache);
+	QTFileTrans_AppendNumber(theText, theTextSize, &myLength, "bytesUnchanged", myStats.fBytesUnchanged);
+	QTFileTrans_AppendNumber(theText, theTextSize, &myLength, "status", theTransfer->fStatus);
+	QTFileTrans_AppendHistogram(theText, theTextSize, &myLength, "readLatency", myStats.fReadLatency);
+	QTFileTrans_AppendHistogram(theText, theTextSize, &myLength, "writeLatency", myStats.fWriteLatency);
+
+	// replace the comma after the last field with the closing brace
+	if ((myLength > 0) && (theText[myLength - 1] == ','))
+		theText[--myLength] = '\0';
+	QTFileTrans_AppendText(theText, theTextSize, &myLength, "}");
+
+	// if the text got cut off, there was no room for the closing brace
+	if ((myLength == 0) || (theText[myLength - 1] != '}'))
+		return(paramErr);
+
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_ChargeTime
+// Charge the time from the specified transfer's last change of state up to theNow to the appropriate
+// statistic in theStats, according to which requests the transfer has outstanding: if only reads are
+// outstanding, we're waiting on the network; if only writes are, we're waiting on the disk (or the sink);
+// if nothing is, we're waiting for the bandwidth limits to let us issue another read.
+//
+//////////
+
+void QTFileTrans_ChargeTime (QTFileTransfer theTransfer, QTFileTransStatsPtr theStats, unsigned long theNow)
+{
+	unsigned long			myElapsed = theNow - theTransfer->fStateTime;
+	Boolean					myReading = false;
+	short					myIndex;
+
+	for (myIndex = 0; myIndex < theTransfer->fNumSegments; myIndex++)
+		if (theTransfer->fSegments[myIndex].fNumPendingReads > 0)
+			myReading = true;
+
+	theStats->fElapsedTime += myElapsed;
+
+	if (myReading && (theTransfer->fNumPendingWrites > 0))
+		theStats->fOverlapTime += myElapsed;
+	else if (myReading)
+		theStats->fNetworkTime += myElapsed;
+	else if (theTransfer->fNumPendingWrites > 0)
+		theStats->fDiskTime += myElapsed;
+	else
+		theStats->fStalledTime += myElapsed;
+}
+
+
+//////////
+//
+// QTFileTrans_NoteStateChange
+// Charge the time since the specified transfer's last change of state to its statistics; we call this
+// just before the number of outstanding reads or writes changes.
+//
+//////////
+
+void QTFileTrans_NoteStateChange (QTFileTransfer theTransfer)
+{
+	unsigned long			myNow;
+
+	if (theTransfer->fDoneTransferring)
+		return;
+
+	myNow = QTFileTrans_GetMicroseconds();
+	QTFileTrans_ChargeTime(theTransfer, &theTransfer->fStats, myNow);
+	theTransfer->fStateTime = myNow;
+}
+
+
+//////////
+//
+// QTFileTrans_NoteWritten
+// Count a write of theNumBytes by the specified transfer, and update its throughput once the current
+// sample interval is over.
+//
+//////////
+
+void QTFileTrans_NoteWritten (QTFileTransfer theTransfer, long theNumBytes)
+{
+	QTFileTransStatsPtr		myStats = &theTransfer->fStats;
+	unsigned long			myNow = QTFileTrans_GetMicroseconds();
+	unsigned long			myElapsed = myNow - theTransfer->fSampleTime;
+
+	myStats->fNumWrites++;
+	myStats->fBytesWritten += theNumBytes;
+	theTransfer->fSampleBytes += theNumBytes;
+
+	if (myElapsed < kThroughputSampleMSecs * 1000L)
+		return;
+
+	myStats->fInstantThroughput = (long)((theTransfer->fSampleBytes * 1000000L) / myElapsed);
+
+	// the first sample is the whole average; after that, each sample moves the average part of the way
+	if (myStats->fAverageThroughput == 0L)
+		myStats->fAverageThroughput = myStats->fInstantThroughput;
+	else
+		myStats->fAverageThroughput += (myStats->fInstantThroughput - myStats->fAverageThroughput) / (1L << kThroughputEWMAShift);
+
+	theTransfer->fSampleTime = myNow;
+	theTransfer->fSampleBytes = 0;
+}
+
+
+//////////
+//
+// QTFileTrans_LatencyBucket
+// Return the bucket of a latency histogram that the specified time (in microseconds) falls in: bucket 0
+// holds times under a millisecond, bucket n holds times from 2^(n-1) up to 2^n milliseconds, and the last
+// bucket also holds everything longer than that.
+//
+//////////
+
+short QTFileTrans_LatencyBucket (unsigned long theElapsedTime)
+{
+	unsigned long			myMSecs = theElapsedTime / 1000L;
+	short					myBucket = 0;
+
+	while ((myMSecs > 0L) && (myBucket < kNumLatencyBuckets - 1)) {
+		myMSecs >>= 1;
+		myBucket++;
+	}
+
+	return(myBucket);
+}
+
+
+//////////
+//
+// QTFileTrans_AppendText
+// Append as much of the specified string as fits to theText (which holds theTextSize bytes, of which
+// *theLength are in use), keeping theText null-terminated.
+//
+//////////
+
+void QTFileTrans_AppendText (char *theText, long theTextSize, long *theLength, char *theString)
+{
+	while ((*theString != '\0') && (*theLength < theTextSize - 1))
+		theText[(*theLength)++] = *theString++;
+
+	theText[*theLength] = '\0';
+}
+
+
+//////////
+//
+// QTFileTrans_AppendNumber
+// Append a JSON field with the specified name (or, if theName is NULL, just the value) and a comma to theText.
+// We format the number ourselves, since not every C library's sprintf knows about 64-bit integers.
+//
+//////////
+
+void QTFileTrans_AppendNumber (char *theText, long theTextSize, long *theLength, char *theName, SInt64 theNumber)
+{
+	char					myDigits[24];
+	short					myIndex = sizeof(myDigits) - 1;
+	UInt64					myValue = (theNumber < 0) ? (UInt64)(-theNumber) : (UInt64)theNumber;
+
+	myDigits[myIndex] = '\0';
+	do {
+		myDigits[--myIndex] = (char)('0' + (myValue % 10));
+		myValue /= 10;
+	} while (myValue != 0);
+
+	if (theNumber < 0)
+		myDigits[--myIndex] = '-';
+
+	if (theName != NULL) {
+		QTFileTrans_AppendText(theText, theTextSize, theLength, "\"");
+		QTFileTrans_AppendText(theText, theTextSize, theLength, theName);
+		QTFileTrans_AppendText(theText, theTextSize, theLength, "\":");
+	}
+
+	QTFileTrans_AppendText(theText, theTextSize, theLength, &myDigits[myIndex]);
+	QTFileTrans_AppendText(theText, theTextSize, theLength, ",");
+}
+
+
+//////////
+//
+// QTFileTrans_AppendHistogram
+// Append a JSON field with the specified name, holding the specified latency histogram as an array, to theText.
+//
+//////////
+
+void QTFileTrans_AppendHistogram (char *theText, long theTextSize, long *theLength, char *theName, long *theBuckets)
+{
+	short					myIndex;
+
+	QTFileTrans_AppendText(theText, theTextSize, theLength, "\"");
+	QTFileTrans_AppendText(theText, theTextSize, theLength, theName);
+	QTFileTrans_AppendText(theText, theTextSize, theLength, "\":[");
+
+	for (myIndex = 0; myIndex < kNumLatencyBuckets; myIndex++)
+		QTFileTrans_AppendNumber(theText, theTextSize, theLength, NULL, theBuckets[myIndex]);
+
+	// replace the comma after the last bucket with the closing bracket
+	if (theText[*theLength - 1] == ',')
+		theText[--(*theLength)] = '\0';
+	QTFileTrans_AppendText(theText, theTextSize, theLength, "],");
+}
+
+
+//////////
+//
+// QTFileTrans_Idle
+// Service every transfer that's underway and every transfer manager; return the number of ticks the
+// caller can wait before calling us again.
+//
+// We only give time to data handlers that have requests outstanding. If any completion routine fired
+// since the last call, data is flowing and we ask to be called again right away; otherwise we double
+// the interval each time, up to kMaxIdleTicks, so that a stalled transfer doesn't burn CPU time.
+//
+//////////
+
+long QTFileTrans_Idle (void)
+{
+	QTFileTransfer				myTransfer = NULL;
+	QTFileTransfer				myNext = NULL;
+	QTFileTransManager			myManager = NULL;
+	QTFileTransBatch			myBatch = NULL;
+	Boolean						myIsBusy = false;
+	short						myPriority;
+
+	gSchedInIdle = true;
+
+	// first issue any reads the bandwidth limits held back, if they'll allow them now
+	QTFileTrans_ServiceThrottledReads();
+
+	for (myTransfer = gSchedTransfers; myTransfer != NULL; myTransfer = myNext) {
+		// a completion routine might finish the transfer, so get the next one first
+		myNext = myTransfer->fSchedNext;
+
+		// a transfer that's waiting only on the bandwidth limits still has its deadline to watch
+		QTFileTrans_CheckDeadline(myTransfer);
+
+		// a cancelled transfer gives back its data handlers and buffers as soon as its requests have drained
+		if (myTransfer->fCancelled && !QTFileTrans_HasPendingRequests(myTransfer)) {
+			QTFileTrans_NoteDone(myTransfer);
+			if (myTransfer->fCancelled)
+				QTFileTrans_CloseDownHandlers(myTransfer);
+			continue;
+		}
+
+		if (!QTFileTrans_IsDone(myTransfer) && (QTFileTrans_HasPendingRequests(myTransfer) || (myTransfer->fNumRetrying > 0)))
+			QTFileTrans_Task(myTransfer);
+	}
+
+	for (myManager = gSchedManagers; myManager != NULL; myManager = myManager->fSchedNext) {
+		QTFileTrans_ManagerUpdate(myManager);
+		if (myManager->fPending != NULL)
+			myIsBusy = true;
+	}
+
+	for (myBatch = gSchedBatches; myBatch != NULL; myBatch = myBatch->fSchedNext) {
+		QTFileTrans_BatchUpdate(myBatch);
+		if (!QTFileTrans_BatchIsDone(myBatch))
+			myIsBusy = true;
+	}
+
+	for (myTransfer = gSchedTransfers; myTransfer != NULL; myTransfer = myTransfer->fSchedNext)
+		if (!QTFileTrans_IsDone(myTransfer))
+			myIsBusy = true;
+
+	if (gSchedNumCompletions > 0) {
+		// data is flowing (or a transfer has just finished), so come right back
+		gSchedIdleTicks = 0L;
+	} else if (!myIsBusy) {
+		// there's nothing going on, so there's no need to call us until the application starts a transfer
+		gSchedIdleTicks = kNoTransfersIdleTicks;
+	} else if (gSchedIdleTicks <= 0L || gSchedIdleTicks == kNoTransfersIdleTicks) {
+		gSchedIdleTicks = 1L;
+	} else {
+		gSchedIdleTicks *= 2;
+		if (gSchedIdleTicks > kMaxIdleTicks)
+			gSchedIdleTicks = kMaxIdleTicks;
+	}
+
+	// reads held back by the bandwidth limits are issued only from here, so come back soon while there are any
+	for (myPriority = 0; myPriority < kNumPriorities; myPriority++)
+		if ((gSchedNumThrottled[myPriority] > 0) && (gSchedIdleTicks > 1L))
+			gSchedIdleTicks = 1L;
+
+	gSchedNumCompletions = 0L;
+	gSchedWakeUpSent = false;
+	gSchedInIdle = false;
+
+	return(gSchedIdleTicks);
+}
+
+
+//////////
+//
+// QTFileTrans_SetWakeUpProc
+// Install a routine that we call when a completion routine fires outside of QTFileTrans_Idle while the
+// application is waiting to call QTFileTrans_Idle again. The routine should arrange for QTFileTrans_Idle
+// to be called soon (for instance, by posting an event or a window message); it should not call
+// QTFileTrans_Idle itself. Pass NULL to remove the wake-up routine.
+//
+//////////
+
+void QTFileTrans_SetWakeUpProc (QTFileTransWakeUpProcPtr theProc, long theRefCon)
+{
+	gSchedWakeUpProc = theProc;
+	gSchedWakeUpRefCon = theRefCon;
+}
+
+
+//////////
+//
+// QTFileTrans_NoteCompletion
+// Record that a completion routine for the specified transfer has fired; if the application is sleeping,
+// wake it up (once).
+//
+//////////
+
+void QTFileTrans_NoteCompletion (QTFileTransfer theTransfer)
+{
+	theTransfer->fNumCompletions++;
+
+	// a transfer on a worker thread doesn't involve the scheduler at all
+	if (theTransfer->fOnWorkerThread)
+		return;
+
+	gSchedNumCompletions++;
+
+	if (!gSchedInIdle && !gSchedWakeUpSent && (gSchedIdleTicks > 0L) && (gSchedWakeUpProc != NULL)) {
+		gSchedWakeUpSent = true;
+		(*gSchedWakeUpProc)(gSchedWakeUpRefCon);
+	}
+}
+
+
+//////////
+//
+// QTFileTrans_ScheduleTransfer
+// Add the specified transfer to the scheduler's list of transfers that are underway.
+//
+//////////
+
+void QTFileTrans_ScheduleTransfer (QTFileTransfer theTransfer)
+{
+	// a worker thread services its own transfer; the scheduler belongs to the application thread
+	if (theTransfer->fScheduled || theTransfer->fOnWorkerThread)
+		return;
+
+	theTransfer->fSchedNext = gSchedTransfers;
+	gSchedTransfers = theTransfer;
+	theTransfer->fScheduled = true;
+
+	// a new transfer has work to do, so make sure the next idle interval is short
+	if (gSchedIdleTicks > 0L)
+		gSchedIdleTicks = 0L;
+}
+
+
+//////////
+//
+// QTFileTrans_UnscheduleTransfer
+// Remove the specified transfer from the scheduler's list of transfers that are underway.
+//
+//////////
+
+void QTFileTrans_UnscheduleTransfer (QTFileTransfer theTransfer)
+{
+	QTFileTransfer				*myLink = &gSchedTransfers;
+
+	if (!theTransfer->fScheduled)
+		return;
+
+	while (*myLink != NULL) {
+		if (*myLink == theTransfer) {
+			*myLink = theTransfer->fSchedNext;
+			break;
+		}
+		myLink = &(*myLink)->fSchedNext;
+	}
+
+	theTransfer->fSchedNext = NULL;
+	theTransfer->fScheduled = false;
+}
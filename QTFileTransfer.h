@@ -18,11 +18,23 @@
 #include <Movies.h>
 #include <QuickTimeComponents.h>
 #include <Script.h>
+#include <Timer.h>
 
+#include <stdlib.h>
 #include <string.h>
 
+#include "QTFileTransferDigest.h"
+#include "QTFileTransferPool.h"
+#include "QTFileTransferCache.h"
+#include "QTFileTransferTrace.h"
+
 #define TESTING_FTP_TRANSFER	1			// compiler flag for our test shell
 
+// we keep all file sizes and offsets in 64-bit integers, so we need a compiler that supports them
+#if !TYPE_LONGLONG
+	#error "QTFileTransfer requires a compiler with 64-bit integer support (TYPE_LONGLONG)"
+#endif
+
 
 //////////
 //
@@ -30,12 +42,423 @@
 //
 //////////
 
-#define kDataBufferSize			1024*10		// the size, in bytes, of our data buffer
+#define kDataBufferSize			1024*10		// the size, in bytes, of each of our data buffers
+#define kNumDataBuffers			4			// the number of data buffers in our buffer ring
+#define kMaxNumDataBuffers		16			// the most data buffers a ring can hold
+
+// limits for parallel ranged transfers
+#define kMaxNumSegments			8			// the most URL data handlers we'll open for one transfer
+#define kMinSegmentSize			1024*256	// we don't split a file into segments smaller than this
+
+// mirrors
+#define kMinMirrorStealSize		1024*64		// the smallest range a segment takes over from a slower mirror's segment
+#define kQTFileTransMirrorSizeErr	-32003	// why we stop using a mirror whose file isn't the same size as the first mirror's
+
+// small files
+#define kDefaultSmallFileSize	1024*64		// by default, we copy files this small with a single synchronous read and write
+#define kMaxSmallFileSize		1024*1024	// the largest file, in bytes, we'll copy that way (it has to fit in memory)
+
+// readahead
+#define kMaxReadahead			1024*1024*16	// the largest readahead window, in bytes, a transfer can have
+#define kQTFileTransSinkBusyErr	-32002		// what a callback sink's routine returns to have a chunk passed to it again later
+
+// uploads
+#define kMaxUploadSize			0x7FFFFFFFL	// the largest file, in bytes, we can upload (DataHWrite takes 32-bit offsets)
+
+// write coalescing
+#define kMaxCoalesceBlocks		(kMaxNumSegments * 2)	// the most coalescing blocks a transfer uses
+#define kMaxCoalesceSize		1024*1024	// the largest flush size, in bytes, we allow for write coalescing
+#define kDefaultVolumeBlockSize	4096		// the allocation block size we assume when we can't ask the volume
+
+// transfers of unknown size
+#define kUnknownFileSize		((((SInt64)0x7FFFFFFFL) << 32) | 0xFFFFFFFFUL)	// the file size we assume until we reach the end of a file of unknown size
+#define kMinStreamingPreextend	1024*256	// the first amount, in bytes, by which we preextend the local file
+#define kMaxStreamingPreextend	1024*1024*16	// the most, in bytes, by which we preextend the local file at once
+
+// scheduling
+#define kMaxIdleTicks			30			// the longest, in ticks, that QTFileTrans_Idle asks to be left alone while transfers are underway
+#define kNoTransfersIdleTicks	0x7FFFFFFFL	// what QTFileTrans_Idle returns when there's nothing to do at all
+
+// cancellation
+#define kQTFileTransDeadlineErr	-32001		// the error a transfer reports when it doesn't finish before its deadline
+#define kMaxDrainTicks			120			// the longest, in ticks, we wait for a cancelled transfer's requests to drain before closing its data handlers
+
+// worker threads
+#define kWorkerQueueSize		32			// the number of events the queue from a worker thread can hold
+#define kMaxWorkerSleepMSecs	16			// the longest, in milliseconds, a worker thread sleeps while its transfer is stalled
+
+// batches
+#define kNumBatchSlots			2			// the number of transfers a batch reuses, so that one can start while another finishes writing
+
+// bandwidth limits and priorities
+enum {
+	kQTFileTransPriorityInteractive	= 0,	// transfers the user is waiting for; they get bandwidth first
+	kQTFileTransPriorityNormal		= 1,	// the default
+	kQTFileTransPriorityBackground	= 2		// transfers that get only the bandwidth nobody else wants
+};
+
+#define kNumPriorities			3			// the number of priority classes
+#define kMaxRefillMicroseconds	10000000L	// after this long without a refill, a token bucket is simply full again
+
+// retries
+#define kDefaultMaxRetries		5			// the number of times we retry a failed read or write of a chunk, by default
+#define kDefaultRetryMSecs		250			// the time, in milliseconds, we wait before the first retry of a chunk, by default
+#define kMaxRetryMSecs			8000		// the longest, in milliseconds, we wait before retrying a chunk, by default
+
+// statistics
+#define kNumLatencyBuckets		16			// the number of buckets in a latency histogram (see QTFileTrans_LatencyBucket)
+#define kThroughputSampleMSecs	250			// the interval, in milliseconds, over which we measure instantaneous throughput
+#define kThroughputEWMAShift	3			// each new throughput sample moves the running average 1/(2^this) of the way
+#define kStatsExportSize		2048		// the size, in bytes, of a buffer big enough for QTFileTrans_ExportStats
+
+// direct copies of local files
+#define kFileURLPrefix			"file://"	// the prefix of a URL that names a local (or LAN) file
+#define kDirectCopyBufferSize	1024*1024	// the size, in bytes, of the buffer we use to copy a local file ourselves
+#define kMaxNativePathLength	1024		// the longest native pathname we'll build from a file URL
+
+// sinks: where a transfer puts the data it reads
+enum {
+	kQTFileTransSinkFile		= 0,		// write the data into the local file, through the HFS data handler (the default)
+	kQTFileTransSinkMemory		= 1,		// collect the data in a handle that grows as needed
+	kQTFileTransSinkCallback	= 2			// pass each chunk, in order, to a routine supplied by the application
+};
+
+#define kMinMemorySinkSize		1024*64		// the size, in bytes, the handle of a memory sink starts out at
+#define kMaxMemorySinkSize		0x7FFFFFFFL	// the most data, in bytes, a memory sink can hold
+
+// the kinds of events a worker thread sends back to the application thread
+enum {
+	kQTFileTransEventProgress	= 1,		// more data has been transferred
+	kQTFileTransEventDone		= 2			// the transfer has finished (successfully or not); this is always the last event
+};
+
+// default bounds and target for adaptive chunk sizing
+#define kMinAdaptiveChunkSize	1024*4		// the smallest read, in bytes, we'll ask for
+#define kMaxAdaptiveChunkSize	1024*256	// the largest read, in bytes, we'll ask for
+#define kTargetReadMSecs		250			// the time, in milliseconds, we'd like each read to take
 
 // type and creator for the transferred file
 #define kTransFileType			FOUR_CHAR_CODE('TEXT')
 #define kTransFileCreator		FOUR_CHAR_CODE('CWIE')
 
+// what we do with a local file that's already there
+enum {
+	kQTFileTransOverwriteReplace	= 0,	// delete the local file and create a new one (the default)
+	kQTFileTransOverwriteInPlace	= 1,	// reuse the local file, if it has our type and creator, and just set its size
+	kQTFileTransOverwriteAtomic		= 2		// write a temporary file next to the local file, and swap it in once the transfer is done
+};
+
+#define kTempFileSuffix			".qtmp"		// appended to the local file's name to get the temporary file's name, in atomic mode
+#define kAliasCacheSize			16			// the number of local files whose aliases we keep
+
+// sync transfers
+#define kMinSyncBlockSize		1024		// the smallest block a sync manifest may describe
+#define kMaxSyncFileSize		0x7FFFFFFFL	// the largest file we sync (we read the local file with 32-bit offsets)
+
+// resumable transfers
+#define kCheckpointFileType		FOUR_CHAR_CODE('QTck')	// the file type of a checkpoint file
+#define kCheckpointSignature	FOUR_CHAR_CODE('QTFT')	// the signature at the start of a checkpoint file
+#define kCheckpointVersion		2						// the format version of a checkpoint file
+#define kCheckpointSuffix		".qtck"					// appended to the local file's name to get the checkpoint file's name
+#define kCheckpointInterval		1024*1024				// save a checkpoint after this many more bytes have been written
+#define kMaxCheckpointRanges	32						// the most distinct written ranges we keep track of
+
+
+//////////
+//
+// data types
+//
+//////////
+
+typedef struct QTFileTransferRecord			QTFileTransferRecord, *QTFileTransferPtr;
+typedef QTFileTransferPtr						QTFileTransfer;
+
+// a routine we call once a transfer is done (with noErr, or with the error that ended it)
+typedef void (*QTFileTransDoneProcPtr) (QTFileTransfer theTransfer, OSErr theStatus, long theRefCon);
+
+// a byte range of the remote file, read in sequence by its own instance of the URL data handler
+typedef struct QTFileTransSegmentRecord {
+	ComponentInstance			fDataReader;				// the data handler that reads this range
+	SInt64						fNextReadOffset;			// the offset of the next read to schedule in this range
+	SInt64						fEndOffset;					// the offset just past the end of this range
+	short						fNumPendingReads;			// the number of reads issued to fDataReader that haven't completed
+	short						fMirror;					// the index of the mirror fDataReader reads from (0 if there are no mirrors)
+} QTFileTransSegmentRecord, *QTFileTransSegmentPtr;
+
+// one of several URLs that serve the same file
+typedef struct QTFileTransMirrorRecord {
+	Handle						fDataRef;					// the data reference for the URL
+	SInt64						fBytesRead;					// the number of bytes read from the mirror so far
+	SInt64						fReadTime;					// the total time (in microseconds) those reads took
+	long						fNumErrors;					// the number of reads from the mirror that failed
+	OSErr						fStatus;					// the error that made us stop using the mirror, or noErr
+} QTFileTransMirrorRecord, *QTFileTransMirrorPtr;
+
+// how a mirror has done, as QTFileTrans_GetMirrorStats reports it
+typedef struct QTFileTransMirrorStatsRecord {
+	SInt64						fBytesRead;					// the number of bytes read from the mirror
+	long						fThroughput;				// the mirror's throughput, in bytes per second, or 0 if we can't tell yet
+	long						fNumErrors;					// the number of reads from the mirror that failed
+	OSErr						fStatus;					// the error that made us stop using the mirror, or noErr if it's still in use
+} QTFileTransMirrorStatsRecord, *QTFileTransMirrorStatsPtr;
+
+// the alias of a local file, kept so that the next transfer into the same file doesn't have to make a new one
+typedef struct QTFileTransAliasRecord {
+	FSSpec						fFSSpec;					// the local file
+	AliasHandle					fAlias;						// its alias (a minimal one, so it finds a new file of the same name), or NULL
+	unsigned long				fUseStamp;					// when the alias was last used, as a count of lookups (for LRU replacement)
+} QTFileTransAliasRecord, *QTFileTransAliasPtr;
+
+// a range of the local file that we know has been written
+typedef struct QTFileTransRangeRecord {
+	SInt64						fStart;						// the offset of the first byte in the range
+	SInt64						fEnd;						// the offset just past the last byte in the range
+} QTFileTransRangeRecord, *QTFileTransRangePtr;
+
+// the header of a checkpoint file; it's followed by fNumRanges range records
+typedef struct QTFileTransCheckpointHeader {
+	OSType						fSignature;					// kCheckpointSignature
+	long						fVersion;					// kCheckpointVersion
+	SInt64						fRemoteFileSize;			// the size of the remote file when the checkpoint was saved
+	long						fNumRanges;					// the number of written ranges that follow
+} QTFileTransCheckpointHeader;
+
+// a token bucket, which limits the rate at which a transfer (or all transfers) may issue reads
+typedef struct QTFileTransBucketRecord {
+	long						fRate;						// the rate, in bytes per second, at which tokens accrue (0 means no limit)
+	long						fBurst;						// the most tokens the bucket can hold
+	SInt64						fTokens;					// the number of bytes we may read right now (negative, if we've read ahead)
+	unsigned long				fLastRefill;				// the time (in microseconds) at which we last added tokens
+} QTFileTransBucketRecord, *QTFileTransBucketPtr;
+
+// statistics about a transfer; all times are in microseconds, and all throughputs in bytes per second
+typedef struct QTFileTransStatsRecord {
+	SInt64						fBytesRead;					// the number of bytes read from the remote file
+	SInt64						fBytesWritten;				// the number of bytes handed on to the sink (and written, for a file sink)
+	long						fNumReads;					// the number of reads that have completed
+	long						fNumWrites;					// the number of writes that have completed
+	long						fInstantThroughput;			// the write throughput over the most recent sample interval
+	long						fAverageThroughput;			// an exponentially weighted moving average of fInstantThroughput
+	long						fReadLatency[kNumLatencyBuckets];	// a histogram of the times reads took
+	long						fWriteLatency[kNumLatencyBuckets];	// a histogram of the times writes took
+	SInt64						fElapsedTime;				// the total time the transfer has been underway
+	SInt64						fNetworkTime;				// the time during which only reads were outstanding (we were waiting on the network)
+	SInt64						fDiskTime;					// the time during which only writes were outstanding (we were waiting on the disk or the sink)
+	SInt64						fOverlapTime;				// the time during which both reads and writes were outstanding
+	SInt64						fStalledTime;				// the time during which nothing was outstanding (we were waiting on the bandwidth limits)
+	SInt64						fTaskTime;					// the time spent inside DataHTask
+	SInt64						fTaskWaitTime;				// the time requests sat outstanding between our calls to DataHTask
+	long						fNumReadErrors;				// the number of reads that failed
+	long						fNumWriteErrors;			// the number of writes that failed
+	long						fNumRetries;				// the number of reads and writes we retried
+	SInt64						fBytesFromCache;			// the number of bytes copied out of the download cache instead of read
+	SInt64						fBytesUnchanged;			// the number of bytes a sync transfer found already in the local file, and didn't read
+} QTFileTransStatsRecord, *QTFileTransStatsPtr;
+
+// a buffer in our buffer ring; a pointer to one of these records is passed as the reference constant
+// to our read and write completion routines, so that each buffer keeps track of its own place in the file
+typedef struct QTFileTransBufferRecord {
+	Ptr							fBuffer;					// the data buffer
+	SInt64						fOffset;					// the file offset of the data in the buffer
+	long						fNumBytes;					// the number of bytes being read into or written from the buffer
+	unsigned long				fReadStartTime;				// the time (in microseconds) at which the current read was issued
+	unsigned long				fWriteStartTime;			// the time (in microseconds) at which the current write was issued, or 0
+	QTFileTransfer				fTransfer;					// the transfer that owns this buffer
+	QTFileTransSegmentPtr		fSegment;					// the segment the buffer was most recently read from
+	Boolean						fSinkHeld;					// is the buffer waiting for earlier chunks to be passed along?
+	Boolean						fThrottled;					// is the buffer waiting for the rate limits to allow its next read?
+	short						fNumRetries;				// the number of times we've retried the chunk in the buffer
+	unsigned long				fRetryTime;					// the time (in microseconds) at which to retry the failed read or write, or 0
+	Boolean						fRetryWrite;				// is it the write (not the read) of the chunk that we need to retry?
+	Boolean						fIsBlock;					// is this a coalescing block, rather than a buffer in the ring?
+	Boolean						fBlockBusy;					// is this coalescing block being written (or waiting to retry its write)?
+	Boolean						fCoalesced;					// has the chunk in this buffer been copied into the coalescing blocks?
+	Boolean						fCoalesceWaiting;			// is the buffer waiting for room in the coalescing blocks?
+	long						fNumCoalesced;				// the number of bytes of the chunk already copied into the coalescing blocks
+} QTFileTransBufferRecord, *QTFileTransBufferPtr;
+
+// an event sent from a worker thread to the application thread
+typedef struct QTFileTransEventRecord {
+	long						fType;						// kQTFileTransEventProgress or kQTFileTransEventDone
+	SInt64						fBytesTransferred;			// the number of bytes transferred so far
+	SInt64						fBytesToTransfer;			// the number of bytes to transfer (or -1, if not known yet)
+	OSErr						fStatus;					// the status of the transfer
+} QTFileTransEventRecord, *QTFileTransEventPtr;
+
+// a routine a callback sink passes each chunk of data to; chunks arrive in order, and theData is valid only
+// during the call; returning an error stops further chunks from reaching the routine (except kQTFileTransSinkBusyErr,
+// which asks for the same chunk again later)
+typedef OSErr (*QTFileTransSinkProcPtr) (Ptr theData, long theNumBytes, SInt64 theOffset, long theRefCon);
+
+// the state for a single file transfer
+struct QTFileTransferRecord {
+	ComponentInstance			fDataReader;				// the data handler that reads data from the URL (also used by segment 0)
+	ComponentInstance			fDataWriter;				// the data handler that writes data to an HFS file (used only by a file sink)
+	ComponentInstance			fPooledReader;				// a URL data handler kept (closed) from an earlier transfer, for the next one
+	ComponentInstance			fPooledWriter;				// an HFS data handler kept (closed) from an earlier transfer, for the next one
+	Component					fReaderComponent;			// the data handler to read the URL with, or NULL to let QuickTime choose
+	DataHCompletionUPP			fReadDataHCompletionUPP;
+	DataHCompletionUPP			fWriteDataHCompletionUPP;
+	QTFileTransBufferRecord		fDataBuffers[kMaxNumDataBuffers];	// ring of buffers that hold data being transferred
+	short						fNumBuffers;				// the number of buffers in use in fDataBuffers
+	short						fRingNumBuffers;			// the number of buffers we'd like in the ring
+	long						fRingBufferSize;			// the size, in bytes, we'd like each buffer in the ring to be
+	long						fReadahead;					// the most bytes we read ahead of the sink, or 0 to let the ring decide
+	QTFileTransSegmentRecord	fSegments[kMaxNumSegments];	// the byte ranges being read in parallel
+	short						fNumSegments;				// the number of segments in use in fSegments
+	short						fMaxNumSegments;			// the most segments we'd like to split the file into
+	short						fSegmentLimit;				// the most segments the current transfer may use (fMaxNumSegments, or fewer)
+	QTFileTransMirrorRecord		fMirrors[kMaxNumSegments];	// the URLs the file is read from, the first being the one the transfer started with
+	short						fNumMirrors;				// the number of mirrors in fMirrors, or 0 if the file has just the one URL
+	Boolean						fMirrorsPending;			// has QTFileTrans_CopyMirroredFileToLocalFile set up the mirrors of the next transfer?
+	SInt64						fBytesToTransfer;			// the number of bytes to transfer
+	SInt64						fBytesTransferred;			// the number of bytes already transferred
+	long						fChunkSize;					// the number of bytes to ask for in each read
+	long						fBufferSize;				// the size, in bytes, of each buffer in the ring
+	Boolean						fAdaptiveChunking;			// do we adjust fChunkSize from measured read times?
+	long						fMinChunkSize;				// the smallest adaptive chunk size
+	long						fMaxChunkSize;				// the largest adaptive chunk size
+	unsigned long				fTargetReadTime;			// the time (in microseconds) we'd like each read to take
+	unsigned long				fLastReadTime;				// the time (in microseconds) the most recent read took
+	Boolean						fDoneTransferring;			// are we done transferring data?
+	Boolean						fStreaming;					// do we read until eofErr, instead of relying on DataHGetFileSize?
+	Boolean						fSizeKnown;					// is fBytesToTransfer the actual size of the remote file?
+	SInt64						fPreextendedSize;			// the size to which we've preextended the local file, when streaming
+	Boolean						fPreallocate;				// do we reserve space for the whole local file before the first write?
+	Boolean						fPreallocated;				// did we manage to reserve that space through the File Manager?
+	Boolean						fDirectCopy;				// do we copy file URLs directly, bypassing the data handlers?
+	long						fSmallFileSize;				// the largest file we copy with one synchronous read and write, or 0
+
+	// the download cache
+	Boolean						fUseCache;					// do we look for the file in the download cache (and keep it there)?
+	Boolean						fCacheStore;				// do we add the local file to the cache once the transfer is done?
+	UInt8						fCacheKey[kCacheKeySize];	// the key of the current URL in the cache
+	char						fCacheValidator[kCacheMaxValidatorSize];	// the validator (ETag or date) of the remote file, or ""
+	FSSpec						fCacheFileSpec;				// the local file to add to the cache
+	Boolean						fResumable;					// do we keep a checkpoint so that an interrupted transfer can be resumed?
+	Boolean						fUploading;					// is this an upload (fDataReader reads a local file, fDataWriter writes a URL)?
+	FSSpec						fCheckpointSpec;			// the checkpoint file for a resumable transfer
+	long						fOverwriteMode;				// what we do with an existing local file (kQTFileTransOverwriteReplace, and so on)
+	Boolean						fTempFilePending;			// is the data going into a temporary file that we haven't swapped in yet?
+	FSSpec						fTempFileSpec;				// that temporary file
+	FSSpec						fTargetFileSpec;			// the local file it replaces
+	QTFileTransRangeRecord		fWrittenRanges[kMaxCheckpointRanges];	// the ranges of the local file written so far, in order
+	short						fNumWrittenRanges;			// the number of ranges in fWrittenRanges
+	SInt64						fCheckpointBytes;			// the value of fBytesTransferred when we last saved a checkpoint
+	long						fSinkType;					// where the data goes (kQTFileTransSinkFile, and so on)
+	Handle						fSinkHandle;				// the handle that collects the data, for a memory sink
+	SInt64						fSinkDataSize;				// the number of bytes of data in fSinkHandle
+	QTFileTransSinkProcPtr		fSinkProc;					// the routine that receives the data, for a callback sink
+	long						fSinkRefCon;				// the reference constant passed to fSinkProc
+	SInt64						fSinkNextOffset;			// the offset of the next chunk to pass along, when the data must be in order
+	OSErr						fSinkStatus;				// the first error returned by the sink, or noErr
+	Boolean						fSinkBusy;					// did the sink's routine turn down the chunk at fSinkNextOffset?
+	QTFileTransDigestRecord		fDigest;					// the digest of the data passed along so far (fDigest.fType is kQTFileTransDigestNone if there isn't one)
+	Boolean						fCheckDigest;				// do we compare the finished digest with fExpectedDigest?
+	UInt8						fExpectedDigest[kMaxDigestSize];	// the digest we expect the data to have
+	long						fSyncDigestType;			// the kind of digest in the sync manifest (kQTFileTransDigestCRC32, and so on)
+	long						fSyncBlockSize;				// the size, in bytes, of the blocks the manifest describes
+	SInt64						fSyncFileSize;				// the size of the remote file the manifest describes
+	long						fSyncNumBlocks;				// the number of blocks (and of digests in the manifest)
+	Ptr							fSyncDigests;				// the digests of the blocks of the remote file, one after another, or NULL
+	Ptr							fSyncBlocks;				// for each block, do we have to read it? (NULL unless we're syncing)
+	SInt64						fSyncBytesMatched;			// the number of bytes of the local file that already match the manifest
+	OSErr						fStatus;					// the first error encountered by this transfer, or noErr
+	
+	short						fNumPendingWrites;			// the number of writes issued to fDataWriter that haven't completed
+	QTFileTransfer				fSchedNext;					// the next transfer known to the scheduler
+	Boolean						fScheduled;					// is this transfer in the scheduler's list?
+	long						fNumCompletions;			// the number of times our completion routines have fired
+	QTFileTransBucketRecord		fRateLimit;					// the limit on this transfer's own bandwidth
+	short						fPriority;					// the priority class of this transfer (kQTFileTransPriorityNormal, and so on)
+	short						fNumThrottled;				// the number of buffers waiting for the rate limits
+
+	// retries
+	short						fMaxRetries;				// the number of times we retry a failed read or write of a chunk
+	unsigned long				fRetryDelay;				// the time (in microseconds) we wait before the first retry of a chunk
+	unsigned long				fMaxRetryDelay;				// the longest time (in microseconds) we wait before retrying a chunk
+	short						fNumRetrying;				// the number of buffers waiting to retry a failed read or write
+
+	// cancellation
+	Boolean						fCancelled;					// has the transfer been cancelled (or run past its deadline)?
+	unsigned long				fDeadline;					// the time (in ticks) by which the transfer must be done, or 0
+
+	// completion notification
+	QTFileTransDoneProcPtr		fDoneProc;					// the routine to call once the transfer is done, or NULL
+	long						fDoneRefCon;				// the reference constant to pass to that routine
+	Boolean						fDoneNotified;				// have we called that routine for the current transfer?
+
+	// tracing
+	long						fTraceID;					// the number that identifies this transfer in the trace
+
+	// write coalescing
+	long						fCoalesceSize;				// the flush size asked for, in bytes, or 0 to write each chunk as it's read
+	long						fCoalesceLimit;				// the flush size we're using (a whole number of allocation blocks)
+	long						fCoalesceAlignment;			// the allocation block size of the local volume
+	QTFileTransBufferRecord		fCoalesceBlocks[kMaxCoalesceBlocks];	// the blocks that collect chunks for writing
+	short						fNumCoalesceBlocks;			// the number of blocks in use in fCoalesceBlocks (0 if we're not coalescing)
+	short						fNumCoalesceWaiting;		// the number of buffers waiting for room in the blocks
+
+	// statistics
+	QTFileTransStatsRecord		fStats;						// the statistics gathered so far
+	unsigned long				fStateTime;					// the time (in microseconds) at which we last charged time to fStats
+	unsigned long				fSampleTime;				// the time (in microseconds) at which the current throughput sample began
+	SInt64						fSampleBytes;				// the number of bytes written during the current throughput sample
+	unsigned long				fLastTaskTime;				// the time (in microseconds) at which QTFileTrans_Task last returned, or 0
+
+	// used when the transfer runs on a worker thread
+	Boolean						fOnWorkerThread;			// is a worker thread running this transfer?
+	void						*fWorkerThread;				// the worker thread (a HANDLE, on Windows)
+	volatile long				fWorkerQuit;				// set by the application thread to ask the worker to stop
+	volatile long				fWorkerExit;				// set by QTFileTrans_StopWorkerThread, which doesn't wait for the done event
+	QTFileTransEventRecord		fEvents[kWorkerQueueSize];	// events from the worker thread to the application thread
+	volatile long				fEventHead;					// the number of events the worker has added to fEvents (written only by the worker)
+	volatile long				fEventTail;					// the number of events the application has removed (written only by the application)
+
+	// used by the transfer manager
+	Ptr							fURL;						// our copy of the URL to transfer from
+	FSSpec						fFileSpec;					// the local file to transfer to
+	QTFileTransfer				fNext;						// the next transfer in the manager's list
+};
+
+// a transfer manager, which runs several transfers side by side
+typedef struct QTFileTransManagerRecord {
+	QTFileTransfer				fPending;					// transfers waiting to start, oldest first
+	QTFileTransfer				fActive;					// transfers currently underway
+	QTFileTransfer				fFinished;					// transfers that have finished, oldest first
+	short						fNumActive;					// the number of transfers in the active list
+	short						fMaxActive;					// the maximum number of transfers to run at once
+	struct QTFileTransManagerRecord	*fSchedNext;			// the next manager known to the scheduler
+} QTFileTransManagerRecord, *QTFileTransManagerPtr;
+
+typedef QTFileTransManagerPtr					QTFileTransManager;
+
+// one file in a batch
+typedef struct QTFileTransBatchItemRecord {
+	Ptr							fURL;						// our copy of the URL to transfer from
+	FSSpec						fFileSpec;					// the local file to transfer to
+	Boolean						fDone;						// has this file finished transferring (successfully or not)?
+	OSErr						fStatus;					// the final status of the transfer of this file
+	SInt64						fBytesTransferred;			// the number of bytes transferred
+} QTFileTransBatchItemRecord, *QTFileTransBatchItemPtr;
+
+// a batch, which transfers a list of files one after another, reusing the same data handlers, buffers,
+// and routine descriptors for all of them
+typedef struct QTFileTransBatchRecord {
+	QTFileTransBatchItemPtr		fItems;						// the files to transfer
+	long						fNumItems;					// the number of records in fItems
+	long						fNextItem;					// the index of the next file to start
+	long						fNumFinished;				// the number of files that have finished
+	QTFileTransfer				fSlots[kNumBatchSlots];		// the transfers we run the files on
+	long						fSlotItems[kNumBatchSlots];	// the index of the file each slot is running, or -1
+	struct QTFileTransBatchRecord	*fSchedNext;			// the next batch known to the scheduler
+} QTFileTransBatchRecord, *QTFileTransBatchPtr;
+
+typedef QTFileTransBatchPtr						QTFileTransBatch;
+
+// a routine the scheduler calls when a completion routine fires while the application is waiting to call QTFileTrans_Idle
+typedef void (*QTFileTransWakeUpProcPtr) (long theRefCon);
+
 
 //////////
 //
@@ -43,7 +466,174 @@
 //
 //////////
 
-OSErr							QTFileTrans_CopyRemoteFileToLocalFile (char *theURL, FSSpecPtr theFSSpecPtr);
+OSErr							QTFileTrans_NewTransfer (QTFileTransfer *theTransfer);
+void							QTFileTrans_DisposeTransfer (QTFileTransfer theTransfer);
+OSErr							QTFileTrans_CopyRemoteFileToLocalFile (QTFileTransfer theTransfer, char *theURL, FSSpecPtr theFSSpecPtr);
+OSErr							QTFileTrans_CopyLocalFileToRemoteFile (QTFileTransfer theTransfer, FSSpecPtr theFSSpecPtr, char *theURL);
+OSErr							QTFileTrans_CopyMirroredFileToLocalFile (QTFileTransfer theTransfer, char **theURLs, short theNumURLs, FSSpecPtr theFSSpecPtr);
+OSErr							QTFileTrans_PrepareBuffers (QTFileTransfer theTransfer);
+void							QTFileTrans_StartTransfer (QTFileTransfer theTransfer);
 PASCAL_RTN void					QTFileTrans_ReadDataCompletionProc (Ptr theRequest, long theRefCon, OSErr theErr);
 PASCAL_RTN void					QTFileTrans_WriteDataCompletionProc (Ptr theRequest, long theRefCon, OSErr theErr);
-void							QTFileTrans_CloseDownHandlers (void);
+void							QTFileTrans_ScheduleRead (QTFileTransBufferPtr theBuffer, QTFileTransSegmentPtr theSegment);
+QTFileTransSegmentPtr			QTFileTrans_ChooseSegment (QTFileTransfer theTransfer, QTFileTransSegmentPtr thePreferred);
+OSErr							QTFileTrans_SetNumSegments (QTFileTransfer theTransfer, short theNumSegments);
+void							QTFileTrans_OpenSegments (QTFileTransfer theTransfer, Handle theReaderRef);
+OSErr							QTFileTrans_MakeMirrors (QTFileTransfer theTransfer, char **theURLs, short theNumURLs);
+void							QTFileTrans_DisposeMirrors (QTFileTransfer theTransfer);
+ComponentInstance				QTFileTrans_OpenMirror (QTFileTransfer theTransfer, short theMirror);
+OSErr							QTFileTrans_GetMirrorStats (QTFileTransfer theTransfer, short theMirror, QTFileTransMirrorStatsPtr theStats);
+long							QTFileTrans_GetMirrorThroughput (QTFileTransfer theTransfer, short theMirror);
+Boolean							QTFileTrans_StealRange (QTFileTransfer theTransfer, QTFileTransSegmentPtr theThief, QTFileTransSegmentPtr theVictim);
+Boolean							QTFileTrans_FailOverRead (QTFileTransBufferPtr theBuffer, OSErr theErr);
+QTFileTransSegmentPtr			QTFileTrans_AddMirrorSegment (QTFileTransfer theTransfer, SInt64 theStart, SInt64 theEnd);
+void							QTFileTrans_Task (QTFileTransfer theTransfer);
+Boolean							QTFileTrans_HasPendingReads (QTFileTransfer theTransfer);
+Boolean							QTFileTrans_IsDone (QTFileTransfer theTransfer);
+OSErr							QTFileTrans_GetStatus (QTFileTransfer theTransfer);
+OSErr							QTFileTrans_SetDoneProc (QTFileTransfer theTransfer, QTFileTransDoneProcPtr theProc, long theRefCon);
+void							QTFileTrans_NoteDone (QTFileTransfer theTransfer);
+OSErr							QTFileTrans_Cancel (QTFileTransfer theTransfer);
+OSErr							QTFileTrans_SetDeadline (QTFileTransfer theTransfer, long theSeconds);
+void							QTFileTrans_CheckDeadline (QTFileTransfer theTransfer);
+void							QTFileTrans_AbortTransfer (QTFileTransfer theTransfer, OSErr theErr);
+void							QTFileTrans_DrainRequests (QTFileTransfer theTransfer);
+OSErr							QTFileTrans_SetRetryPolicy (QTFileTransfer theTransfer, short theMaxRetries, long theRetryMSecs, long theMaxRetryMSecs);
+void							QTFileTrans_IssueRead (QTFileTransBufferPtr theBuffer);
+void							QTFileTrans_HandleReadError (QTFileTransBufferPtr theBuffer, OSErr theErr);
+void							QTFileTrans_HandleWriteError (QTFileTransBufferPtr theBuffer, OSErr theErr);
+Boolean							QTFileTrans_IsRetryableError (OSErr theErr);
+Boolean							QTFileTrans_ScheduleRetry (QTFileTransBufferPtr theBuffer, Boolean theRetryWrite);
+void							QTFileTrans_ServiceRetries (QTFileTransfer theTransfer);
+void							QTFileTrans_ClearRetries (QTFileTransfer theTransfer);
+void							QTFileTrans_FailTransfer (QTFileTransfer theTransfer, OSErr theErr);
+OSErr							QTFileTrans_GetProgress (QTFileTransfer theTransfer, SInt64 *theBytesTransferred, SInt64 *theBytesToTransfer);
+OSErr							QTFileTrans_SetStreaming (QTFileTransfer theTransfer, Boolean theStreaming);
+void							QTFileTrans_HandleEndOfFile (QTFileTransBufferPtr theBuffer);
+void							QTFileTrans_PreextendForStreaming (QTFileTransfer theTransfer, SInt64 theEndOffset);
+OSErr							QTFileTrans_SetPreallocate (QTFileTransfer theTransfer, Boolean thePreallocate);
+OSErr							QTFileTrans_SetWriteCoalescing (QTFileTransfer theTransfer, long theFlushSize);
+OSErr							QTFileTrans_PrepareCoalescing (QTFileTransfer theTransfer, FSSpecPtr theFSSpecPtr);
+long							QTFileTrans_GetVolumeBlockSize (FSSpecPtr theFSSpecPtr);
+void							QTFileTrans_CoalesceChunk (QTFileTransBufferPtr theBuffer);
+QTFileTransBufferPtr			QTFileTrans_FindBlock (QTFileTransfer theTransfer, SInt64 theOffset);
+long							QTFileTrans_GetBlockCapacity (QTFileTransfer theTransfer, SInt64 theOffset);
+void							QTFileTrans_FlushBlock (QTFileTransBufferPtr theBlock);
+void							QTFileTrans_FlushCoalesced (QTFileTransfer theTransfer);
+void							QTFileTrans_ResumeCoalescing (QTFileTransfer theTransfer);
+void							QTFileTrans_ClearCoalescing (QTFileTransfer theTransfer);
+void							QTFileTrans_ClearHeldBuffers (QTFileTransfer theTransfer);
+OSErr							QTFileTrans_PrepareLocalFile (QTFileTransfer theTransfer, FSSpecPtr theFSSpecPtr, Boolean theTruncate);
+OSErr							QTFileTrans_SetOverwriteMode (QTFileTransfer theTransfer, long theMode);
+Boolean							QTFileTrans_CanOverwriteInPlace (QTFileTransfer theTransfer, FSSpecPtr theFSSpecPtr);
+OSErr							QTFileTrans_GetLocalAlias (FSSpecPtr theFSSpecPtr, AliasHandle *theAlias);
+void							QTFileTrans_FlushAliasCache (void);
+OSErr							QTFileTrans_FinishTempFile (QTFileTransfer theTransfer);
+OSErr							QTFileTrans_SetDirectCopy (QTFileTransfer theTransfer, Boolean theDirectCopy);
+OSErr							QTFileTrans_SetUseCache (QTFileTransfer theTransfer, Boolean theUseCache);
+OSErr							QTFileTrans_SetCacheValidator (QTFileTransfer theTransfer, char *theValidator);
+Boolean							QTFileTrans_UsesCache (QTFileTransfer theTransfer, char *theURL, FSSpecPtr theFSSpecPtr);
+OSErr							QTFileTrans_ServeFromCache (QTFileTransfer theTransfer, FSSpecPtr theFSSpecPtr, SInt64 theRemoteSize, SInt64 *theCacheSize);
+Boolean							QTFileTrans_IsFileURL (char *theURL);
+OSErr							QTFileTrans_FileURLToNativePath (char *theURL, char *thePath, long theMaxLength);
+OSErr							QTFileTrans_CopyFileDirect (QTFileTransfer theTransfer, char *theURL, FSSpecPtr theFSSpecPtr);
+OSErr							QTFileTrans_SetSmallFileSize (QTFileTransfer theTransfer, long theNumBytes);
+OSErr							QTFileTrans_CopySmallFile (QTFileTransfer theTransfer);
+OSErr							QTFileTrans_SetFileSink (QTFileTransfer theTransfer);
+OSErr							QTFileTrans_SetMemorySink (QTFileTransfer theTransfer);
+OSErr							QTFileTrans_SetCallbackSink (QTFileTransfer theTransfer, QTFileTransSinkProcPtr theProc, long theRefCon);
+OSErr							QTFileTrans_ResumeSink (QTFileTransfer theTransfer);
+OSErr							QTFileTrans_GetMemorySinkData (QTFileTransfer theTransfer, Handle *theData);
+void							QTFileTrans_WriteToSink (QTFileTransBufferPtr theBuffer);
+OSErr							QTFileTrans_WriteToMemorySink (QTFileTransBufferPtr theBuffer);
+void							QTFileTrans_PassToSink (QTFileTransBufferPtr theBuffer);
+Boolean							QTFileTrans_NeedsOrderedData (QTFileTransfer theTransfer);
+void							QTFileTrans_DeliverInOrder (QTFileTransfer theTransfer);
+void							QTFileTrans_NoteSinkError (QTFileTransfer theTransfer, OSErr theErr);
+OSErr							QTFileTrans_SetDigest (QTFileTransfer theTransfer, long theType, const UInt8 *theExpected);
+OSErr							QTFileTrans_GetDigest (QTFileTransfer theTransfer, UInt8 *theDigest, long *theDigestSize);
+OSErr							QTFileTrans_DigestLocalFile (QTFileTransfer theTransfer, FSSpecPtr theFSSpecPtr, SInt64 theNumBytes);
+void							QTFileTrans_FinishDigest (QTFileTransfer theTransfer);
+OSErr							QTFileTrans_SetSyncManifest (QTFileTransfer theTransfer, long theDigestType, long theBlockSize, SInt64 theFileSize, const UInt8 *theDigests);
+OSErr							QTFileTrans_MakeSyncManifest (FSSpecPtr theFSSpecPtr, long theDigestType, long theBlockSize, SInt64 *theFileSize, Ptr *theDigests);
+OSErr							QTFileTrans_PrepareSync (QTFileTransfer theTransfer, FSSpecPtr theFSSpecPtr);
+void							QTFileTrans_DisposeSync (QTFileTransfer theTransfer);
+OSErr							QTFileTrans_DigestFileBlock (short theRefNum, long theNumBytes, Ptr theBuffer, long theBufferSize, long theDigestType, UInt8 *theDigest);
+void							QTFileTrans_SkipUnchangedBlocks (QTFileTransfer theTransfer, QTFileTransSegmentPtr theSegment);
+long							QTFileTrans_ClampToChangedBlocks (QTFileTransfer theTransfer, SInt64 theOffset, long theNumBytes);
+OSErr							QTFileTrans_SetBufferRing (QTFileTransfer theTransfer, long theBufferSize, short theNumBuffers);
+OSErr							QTFileTrans_SetReadahead (QTFileTransfer theTransfer, long theNumBytes);
+OSErr							QTFileTrans_SetReaderComponent (QTFileTransfer theTransfer, Component theComponent);
+ComponentInstance				QTFileTrans_OpenReader (QTFileTransfer theTransfer, Handle theReaderRef);
+OSErr							QTFileTrans_SetAdaptiveChunking (QTFileTransfer theTransfer, Boolean theEnable, long theMinChunkSize, long theMaxChunkSize, long theTargetMSecs);
+OSErr							QTFileTrans_GetChunkSize (QTFileTransfer theTransfer, long *theChunkSize, long *theLastReadMSecs);
+void							QTFileTrans_AdjustChunkSize (QTFileTransfer theTransfer, long theNumBytes, unsigned long theElapsedTime);
+unsigned long					QTFileTrans_GetMicroseconds (void);
+SInt64							QTFileTrans_GetMicroseconds64 (void);
+void							QTFileTrans_SInt64ToWide (SInt64 theValue, wide *theWide);
+SInt64							QTFileTrans_WideToSInt64 (const wide *theWide);
+OSErr							QTFileTrans_GetRemoteFileSize (ComponentInstance theReader, SInt64 *theSize);
+void							QTFileTrans_CloseDownHandlers (QTFileTransfer theTransfer);
+void							QTFileTrans_ClearRequestSettings (QTFileTransfer theTransfer);
+void							QTFileTrans_ReleaseHandlers (QTFileTransfer theTransfer, Boolean theKeepForReuse);
+
+OSErr							QTFileTrans_SetResumable (QTFileTransfer theTransfer, Boolean theResumable);
+OSErr							QTFileTrans_MakeCheckpointSpec (FSSpecPtr theFSSpecPtr, FSSpecPtr theCheckpointSpecPtr);
+OSErr							QTFileTrans_MakeSuffixedSpec (FSSpecPtr theFSSpecPtr, char *theSuffix, FSSpecPtr theSuffixedSpecPtr);
+SInt64							QTFileTrans_ReadCheckpoint (QTFileTransfer theTransfer, SInt64 *theRemoteFileSize);
+OSErr							QTFileTrans_WriteCheckpoint (QTFileTransfer theTransfer);
+void							QTFileTrans_AddWrittenRange (QTFileTransfer theTransfer, SInt64 theOffset, SInt64 theNumBytes);
+
+OSErr							QTFileTrans_SetRequest (QTFileTransfer theTransfer, char *theURL, FSSpecPtr theFSSpecPtr);
+OSErr							QTFileTrans_StartOnWorkerThread (QTFileTransfer theTransfer, char *theURL, FSSpecPtr theFSSpecPtr);
+Boolean							QTFileTrans_GetWorkerEvent (QTFileTransfer theTransfer, QTFileTransEventPtr theEvent);
+Boolean							QTFileTrans_PostWorkerEvent (QTFileTransfer theTransfer, long theType);
+void							QTFileTrans_StopWorkerThread (QTFileTransfer theTransfer);
+
+OSErr							QTFileTrans_NewManager (short theMaxActive, QTFileTransManager *theManager);
+void							QTFileTrans_DisposeManager (QTFileTransManager theManager);
+OSErr							QTFileTrans_SetMaxActive (QTFileTransManager theManager, short theMaxActive);
+OSErr							QTFileTrans_ManagerAddTransfer (QTFileTransManager theManager, char *theURL, FSSpecPtr theFSSpecPtr, QTFileTransfer *theTransfer);
+void							QTFileTrans_ManagerTask (QTFileTransManager theManager);
+OSErr							QTFileTrans_ManagerGetFinished (QTFileTransManager theManager, QTFileTransfer *theTransfer);
+Boolean							QTFileTrans_ManagerIsIdle (QTFileTransManager theManager);
+void							QTFileTrans_ManagerUpdate (QTFileTransManager theManager);
+void							QTFileTrans_AppendToList (QTFileTransfer *theList, QTFileTransfer theTransfer);
+
+OSErr							QTFileTrans_NewBatch (char **theURLs, FSSpecPtr theFSSpecs, long theNumItems, QTFileTransBatch *theBatch);
+void							QTFileTrans_DisposeBatch (QTFileTransBatch theBatch);
+void							QTFileTrans_BatchTask (QTFileTransBatch theBatch);
+void							QTFileTrans_BatchUpdate (QTFileTransBatch theBatch);
+Boolean							QTFileTrans_BatchIsDone (QTFileTransBatch theBatch);
+OSErr							QTFileTrans_BatchGetItemStatus (QTFileTransBatch theBatch, long theIndex, Boolean *theDone, OSErr *theStatus);
+Boolean							QTFileTrans_IsDraining (QTFileTransfer theTransfer);
+
+OSErr							QTFileTrans_SetGlobalRateLimit (long theBytesPerSecond, long theBurstBytes);
+OSErr							QTFileTrans_SetRateLimit (QTFileTransfer theTransfer, long theBytesPerSecond, long theBurstBytes);
+OSErr							QTFileTrans_SetPriority (QTFileTransfer theTransfer, short thePriority);
+void							QTFileTrans_InitBucket (QTFileTransBucketPtr theBucket, long theBytesPerSecond, long theBurstBytes);
+Boolean							QTFileTrans_BucketHasTokens (QTFileTransBucketPtr theBucket);
+void							QTFileTrans_SpendTokens (QTFileTransfer theTransfer, long theNumBytes);
+Boolean							QTFileTrans_HasTokens (QTFileTransfer theTransfer);
+void							QTFileTrans_RequestRead (QTFileTransBufferPtr theBuffer, QTFileTransSegmentPtr theSegment);
+Boolean							QTFileTrans_IssueThrottledRead (QTFileTransfer theTransfer);
+void							QTFileTrans_ServiceThrottledReads (void);
+void							QTFileTrans_ClearThrottledReads (QTFileTransfer theTransfer);
+void							QTFileTrans_FinishTransfer (QTFileTransfer theTransfer);
+
+void							QTFileTrans_ResetStats (QTFileTransfer theTransfer);
+OSErr							QTFileTrans_GetStats (QTFileTransfer theTransfer, QTFileTransStatsPtr theStats);
+OSErr							QTFileTrans_ExportStats (QTFileTransfer theTransfer, char *theText, long theTextSize);
+void							QTFileTrans_ChargeTime (QTFileTransfer theTransfer, QTFileTransStatsPtr theStats, unsigned long theNow);
+void							QTFileTrans_NoteStateChange (QTFileTransfer theTransfer);
+void							QTFileTrans_NoteWritten (QTFileTransfer theTransfer, long theNumBytes);
+short							QTFileTrans_LatencyBucket (unsigned long theElapsedTime);
+void							QTFileTrans_AppendText (char *theText, long theTextSize, long *theLength, char *theString);
+void							QTFileTrans_AppendNumber (char *theText, long theTextSize, long *theLength, char *theName, SInt64 theNumber);
+void							QTFileTrans_AppendHistogram (char *theText, long theTextSize, long *theLength, char *theName, long *theBuckets);
+long							QTFileTrans_Idle (void);
+void							QTFileTrans_SetWakeUpProc (QTFileTransWakeUpProcPtr theProc, long theRefCon);
+void							QTFileTrans_NoteCompletion (QTFileTransfer theTransfer);
+void							QTFileTrans_ScheduleTransfer (QTFileTransfer theTransfer);
+void							QTFileTrans_UnscheduleTransfer (QTFileTransfer theTransfer);
+Boolean							QTFileTrans_HasPendingRequests (QTFileTransfer theTransfer);
@@ -0,0 +1,436 @@
+//////////
+//
+//	File:		QTFileTransfer.hpp
+//
+//	Contains:	C++20 awaitables for file transfers, for use with co_await.
+//
+//	Written by:	Tim Monroe
+//
+//	Copyright:	 1998 by Apple Computer, Inc., all rights reserved.
+//
+//	Change History (most recent first):
+//
+//	   <1>	 	11/11/98	rtm		first file
+//
+//////////
+
+//////////
+//
+// A QTFileTransAwaitable lets a C++20 coroutine wait for a transfer with co_await, instead of installing routines
+// or polling QTFileTrans_IsDone. Attach it to a transfer before you start the transfer:
+//
+//		QTFileTransAwaitable	myAwaitable;
+//
+//		myErr = myAwaitable.Attach(myTransfer, true);
+//		if (myErr == noErr)
+//			myErr = QTFileTrans_CopyRemoteFileToLocalFile(myTransfer, myURL, NULL);
+//		...
+//		while ((myNumBytes = co_await myAwaitable.read(myChunk, sizeof(myChunk))) > 0)
+//			...;
+//		myErr = co_await myAwaitable.done();
+//
+// read waits for the next bytes of the remote file and copies up to theBufferSize of them into theBuffer; it
+// returns the number of bytes copied, or 0 once the transfer is done (call done to find out how it ended). To
+// read the file this way, pass true for theReadChunks; the awaitable then installs a callback sink, so the data
+// comes to you instead of going into a local file. A chunk nobody is waiting for stays in the transfer's buffer
+// ring, so a coroutine that reads slowly slows the transfer down instead of piling up data (set a readahead
+// window with QTFileTrans_SetReadahead to decide how much can wait). done waits for the transfer to be done and
+// returns its final status; it works with any sink.
+//
+// Nothing here allocates memory: each awaiter lives in the frame of the coroutine that awaits it, and the
+// awaitable passes itself to the done routine and to the callback sink's routine as their reference constant.
+//
+// The coroutine resumes on the thread running the transfer, from within QTFileTrans_Task (or QTFileTrans_Idle,
+// or QTFileTrans_ResumeSink), so until it next suspends the rules for the done routine apply: it mustn't dispose
+// of the transfer or of the awaitable. To go on running somewhere else (on your own executor, say), have the
+// coroutine switch to it right after each co_await. The awaitable must outlive the transfer it's attached to,
+// and only one coroutine at a time should wait on each of read and done.
+//
+//////////
+
+#ifndef __QTFILETRANSFER_HPP__
+#define __QTFILETRANSFER_HPP__
+
+#if defined(__cplusplus) && (__cplusplus >= 202002L)
+
+#include <coroutine>
+
+// the C library headers have to come in before we switch to C linkage below
+#include <stdlib.h>
+#include <string.h>
+
+extern "C" {
+#include "QTFileTransfer.h"
+}
+
+
+//////////
+//
+// class declarations
+//
+//////////
+
+class QTFileTransAwaitable {
+public:
+	class ReadAwaiter;
+	class DoneAwaiter;
+
+								QTFileTransAwaitable (void);
+								~QTFileTransAwaitable (void);
+
+	OSErr						Attach (QTFileTransfer theTransfer, Boolean theReadChunks);
+	ReadAwaiter					read (void *theBuffer, long theBufferSize);
+	DoneAwaiter					done (void);
+
+	// what co_await read(...) waits on
+	class ReadAwaiter {
+	public:
+								ReadAwaiter (QTFileTransAwaitable *theOwner, void *theBuffer, long theBufferSize);
+
+		bool					await_ready (void);
+		bool					await_suspend (std::coroutine_handle<> theHandle);
+		long					await_resume (void);
+
+	private:
+		friend class QTFileTransAwaitable;
+
+		QTFileTransAwaitable	*fOwner;					// the awaitable this read belongs to
+		char					*fBuffer;					// the buffer to copy the data into
+		long					fBufferSize;				// the size, in bytes, of that buffer
+		long					fNumBytes;					// the number of bytes copied into it
+		Boolean					fSuspending;				// are we still in await_suspend?
+		std::coroutine_handle<>	fHandle;					// the coroutine waiting for the data
+	};
+
+	// what co_await done() waits on
+	class DoneAwaiter {
+	public:
+								DoneAwaiter (QTFileTransAwaitable *theOwner);
+
+		bool					await_ready (void);
+		void					await_suspend (std::coroutine_handle<> theHandle);
+		OSErr					await_resume (void);
+
+	private:
+		QTFileTransAwaitable	*fOwner;					// the awaitable this wait belongs to
+	};
+
+private:
+	static OSErr				SinkProc (Ptr theData, long theNumBytes, SInt64 theOffset, long theRefCon);
+	static void					DoneProc (QTFileTransfer theTransfer, OSErr theStatus, long theRefCon);
+	static void					WakeReader (ReadAwaiter *theReader);
+
+	QTFileTransfer				fTransfer;					// the transfer we're attached to, or NULL
+	Boolean						fReadChunks;				// did we install a callback sink?
+	Boolean						fDone;						// is the transfer done?
+	OSErr						fStatus;					// the final status of the transfer, once it's done
+	Boolean						fInSinkProc;				// are we in the callback sink's routine?
+	long						fChunkUsed;					// the number of bytes of the current chunk already read
+	ReadAwaiter					*fReader;					// the read waiting for data, or NULL
+	std::coroutine_handle<>		fDoneHandle;				// the coroutine waiting for the transfer to be done, or none
+};
+
+
+//////////
+//
+// QTFileTransAwaitable::QTFileTransAwaitable
+//
+//////////
+
+inline QTFileTransAwaitable::QTFileTransAwaitable (void)
+	: fTransfer(NULL), fReadChunks(false), fDone(false), fStatus(noErr), fInSinkProc(false), fChunkUsed(0L), fReader(NULL)
+{
+}
+
+
+//////////
+//
+// QTFileTransAwaitable::~QTFileTransAwaitable
+// Remove our routines from the transfer we're attached to, so that it doesn't call into an awaitable that's gone.
+//
+//////////
+
+inline QTFileTransAwaitable::~QTFileTransAwaitable (void)
+{
+	if (fTransfer == NULL)
+		return;
+
+	QTFileTrans_SetDoneProc(fTransfer, NULL, 0L);
+	if (fReadChunks)
+		QTFileTrans_SetFileSink(fTransfer);
+}
+
+
+//////////
+//
+// QTFileTransAwaitable::Attach
+// Attach this awaitable to the specified transfer, which mustn't be running; if theReadChunks is true, the data
+// goes to read instead of into a local file. Call this again before each transfer you want to wait on.
+//
+// A small file would otherwise be copied with one synchronous read and handed to the sink all at once, before any
+// coroutine has had a chance to wait for it (see QTFileTrans_CopySmallFile), so we send every file through the
+// buffer ring, where a chunk can wait for its read.
+//
+//////////
+
+inline OSErr QTFileTransAwaitable::Attach (QTFileTransfer theTransfer, Boolean theReadChunks)
+{
+	OSErr			myErr = noErr;
+
+	if (theTransfer == NULL)
+		return(paramErr);
+
+	if (theReadChunks) {
+		myErr = QTFileTrans_SetCallbackSink(theTransfer, SinkProc, (long)this);
+		if (myErr != noErr)
+			return(myErr);
+
+		myErr = QTFileTrans_SetSmallFileSize(theTransfer, 0L);
+		if (myErr != noErr)
+			return(myErr);
+	}
+
+	myErr = QTFileTrans_SetDoneProc(theTransfer, DoneProc, (long)this);
+	if (myErr != noErr)
+		return(myErr);
+
+	fTransfer = theTransfer;
+	fReadChunks = theReadChunks;
+	fDone = false;
+	fStatus = noErr;
+	fChunkUsed = 0L;
+	fReader = NULL;
+	fDoneHandle = std::coroutine_handle<>();
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTransAwaitable::read
+// Return an awaiter for the next (at most) theBufferSize bytes of the remote file.
+//
+//////////
+
+inline QTFileTransAwaitable::ReadAwaiter QTFileTransAwaitable::read (void *theBuffer, long theBufferSize)
+{
+	return(ReadAwaiter(this, theBuffer, theBufferSize));
+}
+
+
+//////////
+//
+// QTFileTransAwaitable::done
+// Return an awaiter for the end of the transfer.
+//
+//////////
+
+inline QTFileTransAwaitable::DoneAwaiter QTFileTransAwaitable::done (void)
+{
+	return(DoneAwaiter(this));
+}
+
+
+//////////
+//
+// QTFileTransAwaitable::SinkProc
+// Copy the chunk just read into the buffers of the reads waiting for it. A read can take less than the whole
+// chunk; if nobody is waiting for the rest, we say we're busy, and the transfer offers us the same chunk again
+// later (we remember how much of it we've already copied).
+//
+//////////
+
+inline OSErr QTFileTransAwaitable::SinkProc (Ptr theData, long theNumBytes, SInt64 theOffset, long theRefCon)
+{
+#pragma unused(theOffset)
+
+	QTFileTransAwaitable	*myOwner = (QTFileTransAwaitable *)theRefCon;
+	ReadAwaiter				*myReader = NULL;
+	Boolean					myInSinkProc = myOwner->fInSinkProc;
+	long					myNumBytes = 0L;
+
+	// a coroutine we resume here can read again right away; it then suspends, and this loop fills the new read
+	myOwner->fInSinkProc = true;
+	while ((myOwner->fReader != NULL) && (myOwner->fChunkUsed < theNumBytes)) {
+		myReader = myOwner->fReader;
+		myNumBytes = theNumBytes - myOwner->fChunkUsed;
+		if (myNumBytes > myReader->fBufferSize)
+			myNumBytes = myReader->fBufferSize;
+
+		BlockMoveData(theData + myOwner->fChunkUsed, myReader->fBuffer, myNumBytes);
+		myOwner->fChunkUsed += myNumBytes;
+		myReader->fNumBytes = myNumBytes;
+
+		myOwner->fReader = NULL;
+		WakeReader(myReader);
+	}
+	myOwner->fInSinkProc = myInSinkProc;
+
+	if (myOwner->fChunkUsed < theNumBytes)
+		return(kQTFileTransSinkBusyErr);
+
+	myOwner->fChunkUsed = 0L;
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTransAwaitable::DoneProc
+// Note that the transfer is done, and resume the coroutines waiting on it; a read still waiting gets no data.
+//
+//////////
+
+inline void QTFileTransAwaitable::DoneProc (QTFileTransfer theTransfer, OSErr theStatus, long theRefCon)
+{
+#pragma unused(theTransfer)
+
+	QTFileTransAwaitable	*myOwner = (QTFileTransAwaitable *)theRefCon;
+	ReadAwaiter				*myReader = myOwner->fReader;
+	std::coroutine_handle<>	myDoneHandle = myOwner->fDoneHandle;
+
+	// a coroutine we resume might dispose of this awaitable, so we're done with it before we resume anything
+	myOwner->fDone = true;
+	myOwner->fStatus = theStatus;
+	myOwner->fReader = NULL;
+	myOwner->fDoneHandle = std::coroutine_handle<>();
+
+	if (myReader != NULL) {
+		myReader->fNumBytes = 0L;
+		WakeReader(myReader);
+	}
+
+	if (myDoneHandle)
+		myDoneHandle.resume();
+}
+
+
+//////////
+//
+// QTFileTransAwaitable::WakeReader
+// Resume the coroutine waiting on the specified read, unless it hasn't actually suspended yet (in which case
+// ReadAwaiter::await_suspend sees that the read was filled, and doesn't suspend).
+//
+//////////
+
+inline void QTFileTransAwaitable::WakeReader (ReadAwaiter *theReader)
+{
+	if (!theReader->fSuspending)
+		theReader->fHandle.resume();
+}
+
+
+//////////
+//
+// QTFileTransAwaitable::ReadAwaiter::ReadAwaiter
+//
+//////////
+
+inline QTFileTransAwaitable::ReadAwaiter::ReadAwaiter (QTFileTransAwaitable *theOwner, void *theBuffer, long theBufferSize)
+	: fOwner(theOwner), fBuffer((char *)theBuffer), fBufferSize(theBufferSize), fNumBytes(0L), fSuspending(false)
+{
+}
+
+
+//////////
+//
+// QTFileTransAwaitable::ReadAwaiter::await_ready
+// Once the transfer is done, there's nothing left to read.
+//
+//////////
+
+inline bool QTFileTransAwaitable::ReadAwaiter::await_ready (void)
+{
+	return(fOwner->fDone || !fOwner->fReadChunks || (fBuffer == NULL) || (fBufferSize <= 0L));
+}
+
+
+//////////
+//
+// QTFileTransAwaitable::ReadAwaiter::await_suspend
+// Wait for the next chunk. If the callback sink's routine turned a chunk down earlier, we ask to have it offered
+// again right away; if that fills this read (or ends the transfer), the coroutine doesn't suspend at all.
+//
+//////////
+
+inline bool QTFileTransAwaitable::ReadAwaiter::await_suspend (std::coroutine_handle<> theHandle)
+{
+	fHandle = theHandle;
+	fOwner->fReader = this;
+
+	// we can't ask for the chunk again from within the routine itself; it fills this read once we suspend
+	if (fOwner->fInSinkProc)
+		return(true);
+
+	fSuspending = true;
+	QTFileTrans_ResumeSink(fOwner->fTransfer);
+	fSuspending = false;
+
+	return(fOwner->fReader == this);
+}
+
+
+//////////
+//
+// QTFileTransAwaitable::ReadAwaiter::await_resume
+// Return the number of bytes copied into the buffer (0 once the transfer is done).
+//
+//////////
+
+inline long QTFileTransAwaitable::ReadAwaiter::await_resume (void)
+{
+	return(fNumBytes);
+}
+
+
+//////////
+//
+// QTFileTransAwaitable::DoneAwaiter::DoneAwaiter
+//
+//////////
+
+inline QTFileTransAwaitable::DoneAwaiter::DoneAwaiter (QTFileTransAwaitable *theOwner)
+	: fOwner(theOwner)
+{
+}
+
+
+//////////
+//
+// QTFileTransAwaitable::DoneAwaiter::await_ready
+//
+//////////
+
+inline bool QTFileTransAwaitable::DoneAwaiter::await_ready (void)
+{
+	return(fOwner->fDone);
+}
+
+
+//////////
+//
+// QTFileTransAwaitable::DoneAwaiter::await_suspend
+//
+//////////
+
+inline void QTFileTransAwaitable::DoneAwaiter::await_suspend (std::coroutine_handle<> theHandle)
+{
+	fOwner->fDoneHandle = theHandle;
+}
+
+
+//////////
+//
+// QTFileTransAwaitable::DoneAwaiter::await_resume
+// Return the final status of the transfer.
+//
+//////////
+
+inline OSErr QTFileTransAwaitable::DoneAwaiter::await_resume (void)
+{
+	return(fOwner->fStatus);
+}
+
+#endif // __cplusplus >= 202002L
+
+#endif // __QTFILETRANSFER_HPP__
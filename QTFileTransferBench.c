@@ -0,0 +1,918 @@
+//////////
+//
+//	File:		QTFileTransferBench.c
+//
+//	Contains:	A benchmark for the file transfer pipeline, with a synthetic data source.
+//
+//	Written by:	Tim Monroe
+//
+//	Copyright:	 1998 by Apple Computer, Inc., all rights reserved.
+//
+//	Change History (most recent first):
+//
+//	   <1>	 	11/11/98	rtm		first file
+//
+//	This file contains a benchmark for QTFileTrans_CopyRemoteFileToLocalFile, so that we can see how the buffer
+//	size, the number of buffers in the ring, and the number of simultaneous transfers affect throughput, and
+//	notice when a change to the pipeline makes things slower. QTFileTransBench_Run runs every combination of
+//	the values listed in a configuration record and reports, for each run, the throughput, the processor time
+//	used per kilobyte, and the median and 99th-percentile time a read took. QTFileTransBench_ExportResult
+//	writes a result out as JSON, one line per run, which is easy to compare from one build to the next.
+//
+//	A benchmark can fetch a real URL (from an HTTP or FTP server), but the numbers you get then depend on the
+//	server and the network. So this file also contains a synthetic data source: a tiny data handler, which we
+//	register with the Component Manager and plug into each transfer with QTFileTrans_SetReaderComponent. It
+//	serves a file of any size you like, and models a connection with a fixed latency (the time between issuing
+//	a read and the first byte arriving) and a fixed bandwidth (which all the reads outstanding on a connection
+//	share). Each instance of the data handler is a separate connection: a transfer split into segments opens
+//	one instance per segment, just as it would open one connection per segment to a real server. It also answers
+//	DataHGetData, over the same model of the connection, so that small files can take the synchronous path.
+//
+//	The data from each run is either written into the local files listed in the configuration record or, if
+//	there are none, thrown away as it arrives (by a callback sink), so that you can measure the pipeline with
+//	or without the disk.
+//
+//	The processor time comes from GetProcessTimes on Windows and from clock elsewhere. Between calls to
+//	QTFileTrans_Idle we wait as the operating system allows: on Windows we sleep for a millisecond, but on the
+//	Mac OS there's no waiting for less than a tick, so we just call QTFileTrans_Idle again; the processor
+//	times you get on the Mac OS therefore include the time we spend polling, and are useful only for comparing
+//	one run with another.
+//
+//////////
+
+#include "QTFileTransferBench.h"
+
+#include <time.h>
+
+#if TARGET_OS_WIN32
+#include <windows.h>
+#endif
+
+
+//////////
+//
+// global variables
+//
+//////////
+
+Component						gBenchSourceComponent = NULL;	// our synthetic data handler, once it's registered
+ComponentRoutineUPP				gBenchSourceUPP = NULL;			// the dispatch routine of that data handler
+QTFileTransBenchSourceRecord	gBenchSource = {1024L * 1024L * 8, 20000L, 1024L * 1024L};	// the behavior of that data handler
+
+
+//////////
+//
+// QTFileTransBench_RegisterSource
+// Register our synthetic data handler with the Component Manager, so that the benchmark can read from it.
+//
+//////////
+
+OSErr QTFileTransBench_RegisterSource (void)
+{
+	ComponentDescription		myDescription;
+
+	if (gBenchSourceComponent != NULL)
+		return(noErr);
+
+	myDescription.componentType = dataHandlerType;
+	myDescription.componentSubType = kBenchSourceSubType;
+	myDescription.componentManufacturer = kBenchSourceSubType;
+	myDescription.componentFlags = kDataHCanRead;
+	myDescription.componentFlagsMask = 0L;
+
+	gBenchSourceUPP = NewComponentRoutineUPP(QTFileTransBench_SourceDispatch);
+	if (gBenchSourceUPP == NULL)
+		return(memFullErr);
+
+	// register the data handler for this application only
+	gBenchSourceComponent = RegisterComponent(&myDescription, gBenchSourceUPP, 0, NULL, NULL, NULL);
+	if (gBenchSourceComponent == NULL) {
+		DisposeComponentRoutineUPP(gBenchSourceUPP);
+		gBenchSourceUPP = NULL;
+		return(invalidComponentID);
+	}
+
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTransBench_UnregisterSource
+// Unregister our synthetic data handler. Don't call this while any transfer is reading from it.
+//
+//////////
+
+void QTFileTransBench_UnregisterSource (void)
+{
+	if (gBenchSourceComponent != NULL) {
+		UnregisterComponent(gBenchSourceComponent);
+		gBenchSourceComponent = NULL;
+	}
+
+	if (gBenchSourceUPP != NULL) {
+		DisposeComponentRoutineUPP(gBenchSourceUPP);
+		gBenchSourceUPP = NULL;
+	}
+}
+
+
+//////////
+//
+// QTFileTransBench_SetSource
+// Set the behavior of our synthetic data handler; this affects connections opened after the call.
+//
+//////////
+
+void QTFileTransBench_SetSource (QTFileTransBenchSourcePtr theSource)
+{
+	if (theSource != NULL)
+		gBenchSource = *theSource;
+}
+
+
+//////////
+//
+// QTFileTransBench_Run
+// Run the benchmark described by theConfig: one run (or theConfig->fNumRepeats runs) for every combination
+// of session count, buffer count, and buffer size, in that order. We put the results into theResults, which
+// has room for theMaxResults of them, and return the number of results in *theNumResults. A run that fails
+// still gets a result, with the error in its fStatus field.
+//
+//////////
+
+OSErr QTFileTransBench_Run (QTFileTransBenchConfigPtr theConfig, QTFileTransBenchResultPtr theResults, long theMaxResults, long *theNumResults)
+{
+	short						mySessionIndex;
+	short						myCountIndex;
+	short						mySizeIndex;
+	short						myRepeat;
+	short						myNumRepeats;
+
+	if ((theConfig == NULL) || (theResults == NULL) || (theNumResults == NULL))
+		return(paramErr);
+
+	*theNumResults = 0L;
+
+	myNumRepeats = (theConfig->fNumRepeats > 0) ? theConfig->fNumRepeats : 1;
+
+	for (mySessionIndex = 0; mySessionIndex < theConfig->fNumSessionCounts; mySessionIndex++)
+		for (myCountIndex = 0; myCountIndex < theConfig->fNumBufferCounts; myCountIndex++)
+			for (mySizeIndex = 0; mySizeIndex < theConfig->fNumBufferSizes; mySizeIndex++)
+				for (myRepeat = 0; myRepeat < myNumRepeats; myRepeat++) {
+					if (*theNumResults >= theMaxResults)
+						return(noErr);
+
+					QTFileTransBench_RunOnce(theConfig,
+											theConfig->fBufferSizes[mySizeIndex],
+											theConfig->fBufferCounts[myCountIndex],
+											theConfig->fSessionCounts[mySessionIndex],
+											&theResults[*theNumResults]);
+					(*theNumResults)++;
+				}
+
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTransBench_RunOnce
+// Run theNumSessions transfers at once, each with a ring of theNumBuffers buffers of theBufferSize bytes,
+// and wait for them all to finish; then fill in theResult with what we measured.
+//
+//////////
+
+OSErr QTFileTransBench_RunOnce (QTFileTransBenchConfigPtr theConfig, long theBufferSize, short theNumBuffers, short theNumSessions, QTFileTransBenchResultPtr theResult)
+{
+	QTFileTransfer				myTransfers[kBenchMaxSessions];
+	QTFileTransStatsRecord		myStats;
+	char						*myURL = theConfig->fURL;
+	unsigned long				myStartTime;
+	SInt64						myStartCPUTime;
+	SInt64						myBytesTransferred;
+	SInt64						myBytesToTransfer;
+	Boolean						myIsDone;
+	short						myIndex;
+	short						myBucket;
+	OSErr						myErr = noErr;
+
+	if ((theResult == NULL) || (theNumSessions < 1) || (theNumSessions > kBenchMaxSessions))
+		return(paramErr);
+
+	memset(theResult, 0, sizeof(QTFileTransBenchResultRecord));
+	theResult->fBufferSize = theBufferSize;
+	theResult->fNumBuffers = theNumBuffers;
+	theResult->fNumSessions = theNumSessions;
+
+	for (myIndex = 0; myIndex < kBenchMaxSessions; myIndex++)
+		myTransfers[myIndex] = NULL;
+
+	// with no URL, we read from the synthetic source
+	if (myURL == NULL) {
+		myErr = QTFileTransBench_RegisterSource();
+		if (myErr != noErr)
+			goto bail;
+
+		QTFileTransBench_SetSource(&theConfig->fSource);
+		myURL = kBenchSourceURL;
+	}
+
+	myStartTime = QTFileTrans_GetMicroseconds();
+	myStartCPUTime = QTFileTransBench_GetCPUTime();
+
+	//////////
+	//
+	// start the transfers
+	//
+	//////////
+
+	for (myIndex = 0; myIndex < theNumSessions; myIndex++) {
+		myErr = QTFileTrans_NewTransfer(&myTransfers[myIndex]);
+		if (myErr != noErr)
+			goto bail;
+
+		myErr = QTFileTrans_SetBufferRing(myTransfers[myIndex], theBufferSize, theNumBuffers);
+		if (myErr != noErr)
+			goto bail;
+
+		if (theConfig->fURL == NULL) {
+			myErr = QTFileTrans_SetReaderComponent(myTransfers[myIndex], gBenchSourceComponent);
+			if (myErr != noErr)
+				goto bail;
+		}
+
+		if (theConfig->fFSSpecs == NULL) {
+			myErr = QTFileTrans_SetCallbackSink(myTransfers[myIndex], QTFileTransBench_DiscardProc, 0L);
+			if (myErr != noErr)
+				goto bail;
+		}
+
+		myErr = QTFileTrans_CopyRemoteFileToLocalFile(myTransfers[myIndex], myURL, (theConfig->fFSSpecs != NULL) ? &theConfig->fFSSpecs[myIndex] : NULL);
+		if (myErr != noErr)
+			goto bail;
+	}
+
+	//////////
+	//
+	// wait for them all to finish
+	//
+	//////////
+
+	for (;;) {
+		myIsDone = true;
+		for (myIndex = 0; myIndex < theNumSessions; myIndex++)
+			if (!QTFileTrans_IsDone(myTransfers[myIndex]))
+				myIsDone = false;
+
+		if (myIsDone)
+			break;
+
+		if ((theConfig->fTimeLimit > 0L) && (QTFileTrans_GetMicroseconds() - myStartTime >= (unsigned long)theConfig->fTimeLimit * 1000000L)) {
+			myErr = timeoutErr;
+			break;
+		}
+
+		// if nothing happened this time around, give the data a moment to arrive
+		if (QTFileTrans_Idle() > 0L)
+			QTFileTransBench_Yield(kBenchMaxYieldMicroseconds);
+	}
+
+	theResult->fElapsedTime = QTFileTrans_GetMicroseconds() - myStartTime;
+	theResult->fCPUTime = QTFileTransBench_GetCPUTime() - myStartCPUTime;
+
+	//////////
+	//
+	// collect the results
+	//
+	//////////
+
+	for (myIndex = 0; myIndex < theNumSessions; myIndex++) {
+		if (QTFileTrans_GetProgress(myTransfers[myIndex], &myBytesTransferred, &myBytesToTransfer) == noErr)
+			theResult->fBytesTransferred += myBytesTransferred;
+
+		if (QTFileTrans_GetStats(myTransfers[myIndex], &myStats) == noErr)
+			for (myBucket = 0; myBucket < kNumLatencyBuckets; myBucket++)
+				theResult->fReadLatency[myBucket] += myStats.fReadLatency[myBucket];
+
+		if ((myErr == noErr) && (myTransfers[myIndex]->fStatus != noErr))
+			myErr = myTransfers[myIndex]->fStatus;
+	}
+
+	if (theResult->fElapsedTime > 0)
+		theResult->fThroughput = (long)((theResult->fBytesTransferred * 1000000L) / theResult->fElapsedTime);
+
+	if (theResult->fBytesTransferred > 0)
+		theResult->fCPUNanosPerKB = (long)((theResult->fCPUTime * 1000L * 1024L) / theResult->fBytesTransferred);
+
+	theResult->fChunkTime50 = QTFileTransBench_Percentile(theResult->fReadLatency, 50L);
+	theResult->fChunkTime99 = QTFileTransBench_Percentile(theResult->fReadLatency, 99L);
+
+bail:
+	for (myIndex = 0; myIndex < kBenchMaxSessions; myIndex++)
+		if (myTransfers[myIndex] != NULL)
+			QTFileTrans_DisposeTransfer(myTransfers[myIndex]);
+
+	theResult->fStatus = myErr;
+	return(myErr);
+}
+
+
+//////////
+//
+// QTFileTransBench_ExportResult
+// Write the specified result into theText, as a null-terminated JSON object on a single line. A buffer of
+// kBenchResultTextSize bytes is big enough; if theText is too small, we return paramErr.
+//
+//////////
+
+OSErr QTFileTransBench_ExportResult (QTFileTransBenchResultPtr theResult, char *theText, long theTextSize)
+{
+	long						myLength = 0L;
+	char						myFraction[4];
+	long						myHundredths;
+
+	if ((theResult == NULL) || (theText == NULL) || (theTextSize <= 0L))
+		return(paramErr);
+
+	// the throughput in megabytes per second, to two decimal places
+	myHundredths = (long)((theResult->fThroughput * (SInt64)100) / (1024L * 1024L));
+	myFraction[0] = '.';
+	myFraction[1] = (char)('0' + (myHundredths % 100) / 10);
+	myFraction[2] = (char)('0' + myHundredths % 10);
+	myFraction[3] = '\0';
+
+	QTFileTrans_AppendText(theText, theTextSize, &myLength, "{");
+	QTFileTrans_AppendNumber(theText, theTextSize, &myLength, "bufferSize", theResult->fBufferSize);
+	QTFileTrans_AppendNumber(theText, theTextSize, &myLength, "numBuffers", theResult->fNumBuffers);
+	QTFileTrans_AppendNumber(theText, theTextSize, &myLength, "numSessions", theResult->fNumSessions);
+	QTFileTrans_AppendNumber(theText, theTextSize, &myLength, "status", theResult->fStatus);
+	QTFileTrans_AppendNumber(theText, theTextSize, &myLength, "bytesTransferred", theResult->fBytesTransferred);
+	QTFileTrans_AppendNumber(theText, theTextSize, &myLength, "elapsedTime", theResult->fElapsedTime);
+	QTFileTrans_AppendNumber(theText, theTextSize, &myLength, "cpuTime", theResult->fCPUTime);
+	QTFileTrans_AppendNumber(theText, theTextSize, &myLength, "cpuNanosPerKB", theResult->fCPUNanosPerKB);
+	QTFileTrans_AppendNumber(theText, theTextSize, &myLength, "chunkTime50", theResult->fChunkTime50);
+	QTFileTrans_AppendNumber(theText, theTextSize, &myLength, "chunkTime99", theResult->fChunkTime99);
+
+	// QTFileTrans_AppendNumber ends each field with a comma, so we append the fraction in front of the last one
+	QTFileTrans_AppendNumber(theText, theTextSize, &myLength, "megabytesPerSecond", myHundredths / 100);
+	if ((myLength > 0) && (theText[myLength - 1] == ','))
+		theText[--myLength] = '\0';
+	QTFileTrans_AppendText(theText, theTextSize, &myLength, myFraction);
+	QTFileTrans_AppendText(theText, theTextSize, &myLength, "}");
+
+	// if the text got cut off, there was no room for the closing brace
+	if ((myLength == 0) || (theText[myLength - 1] != '}'))
+		return(paramErr);
+
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTransBench_Percentile
+// Estimate the specified percentile (in microseconds) of the times recorded in the specified latency histogram.
+// We find the bucket the percentile falls in, and assume the times in that bucket are spread evenly across it.
+//
+//////////
+
+unsigned long QTFileTransBench_Percentile (long *theBuckets, long thePercent)
+{
+	SInt64						myTotal = 0;
+	SInt64						myRank;
+	SInt64						mySoFar = 0;
+	unsigned long				myLow;
+	unsigned long				myHigh;
+	short						myBucket;
+
+	for (myBucket = 0; myBucket < kNumLatencyBuckets; myBucket++)
+		myTotal += theBuckets[myBucket];
+
+	if (myTotal == 0)
+		return(0L);
+
+	// the rank of the time we want, counting from 1
+	myRank = (myTotal * thePercent + 99) / 100;
+	if (myRank < 1)
+		myRank = 1;
+
+	for (myBucket = 0; myBucket < kNumLatencyBuckets; myBucket++) {
+		if (mySoFar + theBuckets[myBucket] >= myRank)
+			break;
+		mySoFar += theBuckets[myBucket];
+	}
+
+	if (myBucket >= kNumLatencyBuckets)
+		myBucket = kNumLatencyBuckets - 1;
+
+	// bucket 0 holds times under a millisecond; bucket n holds times from 2^(n-1) up to 2^n milliseconds
+	myLow = (myBucket == 0) ? 0L : (1000L << (myBucket - 1));
+	myHigh = 1000L << myBucket;
+
+	return(myLow + (unsigned long)(((SInt64)(myHigh - myLow) * (myRank - mySoFar)) / theBuckets[myBucket]));
+}
+
+
+//////////
+//
+// QTFileTransBench_GetCPUTime
+// Return the processor time (in microseconds) this process has used so far.
+//
+//////////
+
+SInt64 QTFileTransBench_GetCPUTime (void)
+{
+#if TARGET_OS_WIN32
+	FILETIME					myCreationTime;
+	FILETIME					myExitTime;
+	FILETIME					myKernelTime;
+	FILETIME					myUserTime;
+	SInt64						myTime;
+
+	if (!GetProcessTimes(GetCurrentProcess(), &myCreationTime, &myExitTime, &myKernelTime, &myUserTime))
+		return(0);
+
+	// these times are in units of 100 nanoseconds
+	myTime = ((SInt64)myKernelTime.dwHighDateTime << 32) + myKernelTime.dwLowDateTime;
+	myTime += ((SInt64)myUserTime.dwHighDateTime << 32) + myUserTime.dwLowDateTime;
+	return(myTime / 10);
+#else
+	return(((SInt64)clock() * 1000000L) / CLOCKS_PER_SEC);
+#endif
+}
+
+
+//////////
+//
+// QTFileTransBench_Yield
+// Give up the processor for (about) the specified number of microseconds.
+//
+//////////
+
+void QTFileTransBench_Yield (unsigned long theMicroseconds)
+{
+#if TARGET_OS_WIN32
+	Sleep((theMicroseconds + 999L) / 1000L);
+#else
+	unsigned long				myFinalTicks;
+
+	// the Mac OS can only wait in ticks; rather than wait far longer than we were asked to, we don't wait at all
+	if (theMicroseconds >= 1000000L / 60)
+		Delay(theMicroseconds / (1000000L / 60), &myFinalTicks);
+#endif
+}
+
+
+//////////
+//
+// QTFileTransBench_DiscardProc
+// A sink procedure that throws the data away, so that we can measure the pipeline without the disk.
+//
+//////////
+
+OSErr QTFileTransBench_DiscardProc (Ptr theData, long theNumBytes, SInt64 theOffset, long theRefCon)
+{
+#pragma unused(theData, theNumBytes, theOffset, theRefCon)
+
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTransBench_SourceDispatch
+// The dispatch routine of our synthetic data handler. We support only the calls the transfer pipeline makes
+// on a data handler it reads from.
+//
+//////////
+
+PASCAL_RTN ComponentResult QTFileTransBench_SourceDispatch (ComponentParameters *theParams, Handle theStorage)
+{
+	ProcPtr						myProc = NULL;
+	long						myProcInfo = 0L;
+
+	switch (theParams->what) {
+		case kComponentOpenSelect:
+			myProc = (ProcPtr)QTFileTransBench_SourceOpen;
+			myProcInfo = uppCallComponentOpenProcInfo;
+			break;
+
+		case kComponentCloseSelect:
+			myProc = (ProcPtr)QTFileTransBench_SourceClose;
+			myProcInfo = uppCallComponentCloseProcInfo;
+			break;
+
+		case kComponentCanDoSelect:
+			myProc = (ProcPtr)QTFileTransBench_SourceCanDo;
+			myProcInfo = uppCallComponentCanDoProcInfo;
+			break;
+
+		case kComponentVersionSelect:
+			myProc = (ProcPtr)QTFileTransBench_SourceVersion;
+			myProcInfo = uppCallComponentVersionProcInfo;
+			break;
+
+		case kDataHSetDataRefSelect:
+			myProc = (ProcPtr)QTFileTransBench_SourceSetDataRef;
+			myProcInfo = uppDataHSetDataRefProcInfo;
+			break;
+
+		case kDataHOpenForReadSelect:
+			myProc = (ProcPtr)QTFileTransBench_SourceOpenForRead;
+			myProcInfo = uppDataHOpenForReadProcInfo;
+			break;
+
+		case kDataHCloseForReadSelect:
+			myProc = (ProcPtr)QTFileTransBench_SourceCloseForRead;
+			myProcInfo = uppDataHCloseForReadProcInfo;
+			break;
+
+		case kDataHGetFileSizeSelect:
+			myProc = (ProcPtr)QTFileTransBench_SourceGetFileSize;
+			myProcInfo = uppDataHGetFileSizeProcInfo;
+			break;
+
+		case kDataHGetFileSize64Select:
+			myProc = (ProcPtr)QTFileTransBench_SourceGetFileSize64;
+			myProcInfo = uppDataHGetFileSize64ProcInfo;
+			break;
+
+		case kDataHReadAsyncSelect:
+			myProc = (ProcPtr)QTFileTransBench_SourceReadAsync;
+			myProcInfo = uppDataHReadAsyncProcInfo;
+			break;
+
+		case kDataHTaskSelect:
+			myProc = (ProcPtr)QTFileTransBench_SourceTask;
+			myProcInfo = uppDataHTaskProcInfo;
+			break;
+
+		case kDataHFinishDataSelect:
+			myProc = (ProcPtr)QTFileTransBench_SourceFinishData;
+			myProcInfo = uppDataHFinishDataProcInfo;
+			break;
+
+		case kDataHGetDataSelect:
+			myProc = (ProcPtr)QTFileTransBench_SourceGetData;
+			myProcInfo = uppDataHGetDataProcInfo;
+			break;
+
+		default:
+			return(badComponentSelector);
+	}
+
+	return(CallComponentFunctionWithStorageProcInfo(theStorage, theParams, myProc, myProcInfo));
+}
+
+
+//////////
+//
+// QTFileTransBench_SourceOpen
+// Open an instance of our synthetic data handler.
+//
+//////////
+
+PASCAL_RTN ComponentResult QTFileTransBench_SourceOpen (QTFileTransBenchGlobalsHdl theGlobals, ComponentInstance theSelf)
+{
+#pragma unused(theGlobals)
+
+	QTFileTransBenchGlobalsHdl	myGlobals = NULL;
+
+	myGlobals = (QTFileTransBenchGlobalsHdl)NewHandleClear(sizeof(QTFileTransBenchGlobalsRecord));
+	if (myGlobals == NULL)
+		return(memFullErr);
+
+	// our requests point into our storage while they're outstanding, so it mustn't move
+	HLock((Handle)myGlobals);
+	(**myGlobals).fSelf = theSelf;
+
+	SetComponentInstanceStorage(theSelf, (Handle)myGlobals);
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTransBench_SourceClose
+// Close an instance of our synthetic data handler; any reads still outstanding are simply forgotten.
+//
+//////////
+
+PASCAL_RTN ComponentResult QTFileTransBench_SourceClose (QTFileTransBenchGlobalsHdl theGlobals, ComponentInstance theSelf)
+{
+#pragma unused(theSelf)
+
+	if (theGlobals != NULL)
+		DisposeHandle((Handle)theGlobals);
+
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTransBench_SourceCanDo
+// Tell the caller whether our synthetic data handler supports the specified call.
+//
+//////////
+
+PASCAL_RTN ComponentResult QTFileTransBench_SourceCanDo (QTFileTransBenchGlobalsHdl theGlobals, short theSelector)
+{
+#pragma unused(theGlobals)
+
+	switch (theSelector) {
+		case kComponentOpenSelect:
+		case kComponentCloseSelect:
+		case kComponentCanDoSelect:
+		case kComponentVersionSelect:
+		case kDataHSetDataRefSelect:
+		case kDataHOpenForReadSelect:
+		case kDataHCloseForReadSelect:
+		case kDataHGetFileSizeSelect:
+		case kDataHGetFileSize64Select:
+		case kDataHReadAsyncSelect:
+		case kDataHTaskSelect:
+		case kDataHFinishDataSelect:
+		case kDataHGetDataSelect:
+			return(true);
+
+		default:
+			return(false);
+	}
+}
+
+
+//////////
+//
+// QTFileTransBench_SourceVersion
+// Return the version of our synthetic data handler.
+//
+//////////
+
+PASCAL_RTN ComponentResult QTFileTransBench_SourceVersion (QTFileTransBenchGlobalsHdl theGlobals)
+{
+#pragma unused(theGlobals)
+
+	return(0x00010000);
+}
+
+
+//////////
+//
+// QTFileTransBench_SourceSetDataRef
+// Set the data reference of an instance of our synthetic data handler. Every URL gets the same synthetic file,
+// so we don't even look at the data reference.
+//
+//////////
+
+PASCAL_RTN ComponentResult QTFileTransBench_SourceSetDataRef (QTFileTransBenchGlobalsHdl theGlobals, Handle theDataRef)
+{
+#pragma unused(theGlobals, theDataRef)
+
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTransBench_SourceOpenForRead
+// Open the synthetic file for reading; this is where our connection to the "server" is made.
+//
+//////////
+
+PASCAL_RTN ComponentResult QTFileTransBench_SourceOpenForRead (QTFileTransBenchGlobalsHdl theGlobals)
+{
+	(**theGlobals).fOpen = true;
+	(**theGlobals).fFirstRequest = 0;
+	(**theGlobals).fNumRequests = 0;
+	(**theGlobals).fLinkFreeTime = QTFileTrans_GetMicroseconds();
+
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTransBench_SourceCloseForRead
+// Close the synthetic file; any reads still outstanding are simply forgotten.
+//
+//////////
+
+PASCAL_RTN ComponentResult QTFileTransBench_SourceCloseForRead (QTFileTransBenchGlobalsHdl theGlobals)
+{
+	(**theGlobals).fOpen = false;
+	(**theGlobals).fNumRequests = 0;
+
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTransBench_SourceGetFileSize
+// Return the size of the synthetic file, if it fits in a long.
+//
+//////////
+
+PASCAL_RTN ComponentResult QTFileTransBench_SourceGetFileSize (QTFileTransBenchGlobalsHdl theGlobals, long *theFileSize)
+{
+#pragma unused(theGlobals)
+
+	if (gBenchSource.fFileSize > 0x7FFFFFFFL)
+		return(paramErr);
+
+	*theFileSize = (long)gBenchSource.fFileSize;
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTransBench_SourceGetFileSize64
+// Return the size of the synthetic file.
+//
+//////////
+
+PASCAL_RTN ComponentResult QTFileTransBench_SourceGetFileSize64 (QTFileTransBenchGlobalsHdl theGlobals, wide *theFileSize)
+{
+#pragma unused(theGlobals)
+
+	QTFileTrans_SInt64ToWide(gBenchSource.fFileSize, theFileSize);
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTransBench_SourceReadAsync
+// Start reading data from the synthetic file. The data "arrives" after the connection's latency, and after
+// the connection has had time (at its bandwidth) to send this data and all the data asked for before it;
+// we call the completion routine from QTFileTransBench_SourceTask once it has arrived.
+//
+//////////
+
+PASCAL_RTN ComponentResult QTFileTransBench_SourceReadAsync (QTFileTransBenchGlobalsHdl theGlobals, Ptr theData, UInt32 theDataSize, const wide *theDataOffset, DataHCompletionUPP theCompletion, long theRefCon)
+{
+	QTFileTransBenchGlobalsPtr	myGlobals = *theGlobals;
+	QTFileTransBenchRequestPtr	myRequest = NULL;
+	unsigned long				myReadyTime;
+
+	if (!myGlobals->fOpen || (myGlobals->fNumRequests >= kBenchMaxRequests))
+		return(paramErr);
+
+	myReadyTime = QTFileTransBench_SourceReadyTime(myGlobals, (long)theDataSize);
+
+	myRequest = &myGlobals->fRequests[(myGlobals->fFirstRequest + myGlobals->fNumRequests) % kBenchMaxRequests];
+	myRequest->fData = theData;
+	myRequest->fNumBytes = (long)theDataSize;
+	myRequest->fOffset = QTFileTrans_WideToSInt64(theDataOffset);
+	myRequest->fCompletion = theCompletion;
+	myRequest->fRefCon = theRefCon;
+	myRequest->fReadyTime = myReadyTime;
+	myGlobals->fNumRequests++;
+
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTransBench_SourceGetData
+// Read data synchronously from our synthetic data handler: we wait until the data would have arrived over the
+// connection, just as an asynchronous read would, and then fill the handle with the same pattern.
+//
+//////////
+
+PASCAL_RTN ComponentResult QTFileTransBench_SourceGetData (QTFileTransBenchGlobalsHdl theGlobals, Handle theHandle, long theHandleOffset, long theFileOffset, long theSize)
+{
+	QTFileTransBenchGlobalsPtr	myGlobals = *theGlobals;
+	unsigned long				myReadyTime;
+	unsigned long				myNow;
+	UInt8						*myByte;
+	long						myIndex;
+
+	if (!myGlobals->fOpen || (myGlobals->fNumRequests > 0))
+		return(paramErr);
+
+	// unlike an asynchronous read, a synchronous read gets nothing at all if it runs off the end of the file
+	if ((SInt64)theFileOffset + theSize > gBenchSource.fFileSize)
+		return(eofErr);
+
+	myReadyTime = QTFileTransBench_SourceReadyTime(myGlobals, theSize);
+	for (myNow = QTFileTrans_GetMicroseconds(); (long)(myReadyTime - myNow) > 0L; myNow = QTFileTrans_GetMicroseconds())
+		QTFileTransBench_Yield(myReadyTime - myNow);
+
+	myByte = (UInt8 *)*theHandle + theHandleOffset;
+	for (myIndex = 0; myIndex < theSize; myIndex++)
+		*myByte++ = (UInt8)(theFileOffset + myIndex);
+
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTransBench_SourceReadyTime
+// Return the time (in microseconds) at which a read of theNumBytes, issued now, will have "arrived": the first
+// byte arrives after the latency, but not before the connection has sent what it already owes.
+//
+//////////
+
+unsigned long QTFileTransBench_SourceReadyTime (QTFileTransBenchGlobalsPtr theGlobals, long theNumBytes)
+{
+	unsigned long				myReadyTime;
+
+	myReadyTime = QTFileTrans_GetMicroseconds() + gBenchSource.fLatency;
+	if (gBenchSource.fBandwidth > 0L) {
+		if ((long)(theGlobals->fLinkFreeTime - myReadyTime) > 0L)
+			myReadyTime = theGlobals->fLinkFreeTime;
+
+		myReadyTime += (unsigned long)(((SInt64)theNumBytes * 1000000L) / gBenchSource.fBandwidth);
+		theGlobals->fLinkFreeTime = myReadyTime;
+	}
+
+	return(myReadyTime);
+}
+
+
+//////////
+//
+// QTFileTransBench_SourceTask
+// Complete every outstanding read whose data has arrived. The reads on a connection arrive in the order they
+// were issued, so we only need to look at the oldest one.
+//
+//////////
+
+PASCAL_RTN ComponentResult QTFileTransBench_SourceTask (QTFileTransBenchGlobalsHdl theGlobals)
+{
+	QTFileTransBenchGlobalsPtr	myGlobals = *theGlobals;
+	QTFileTransBenchRequestRecord	myRequest;
+	unsigned long				myNow = QTFileTrans_GetMicroseconds();
+	UInt8						*myByte;
+	long						myIndex;
+	OSErr						myErr;
+
+	while (myGlobals->fNumRequests > 0) {
+		if ((long)(myNow - myGlobals->fRequests[myGlobals->fFirstRequest].fReadyTime) < 0L)
+			break;
+
+		// take the request off the queue first; its completion routine will most likely issue another read
+		myRequest = myGlobals->fRequests[myGlobals->fFirstRequest];
+		myGlobals->fFirstRequest = (myGlobals->fFirstRequest + 1) % kBenchMaxRequests;
+		myGlobals->fNumRequests--;
+
+		// a read that runs off the end of the file gets what's there, and eofErr
+		myErr = noErr;
+		if (myRequest.fOffset + myRequest.fNumBytes > gBenchSource.fFileSize) {
+			myRequest.fNumBytes = (myRequest.fOffset < gBenchSource.fFileSize) ? (long)(gBenchSource.fFileSize - myRequest.fOffset) : 0L;
+			myErr = eofErr;
+		}
+
+		// fill the buffer with a pattern that depends on the offset, so that the data can be checked
+		myByte = (UInt8 *)myRequest.fData;
+		for (myIndex = 0; myIndex < myRequest.fNumBytes; myIndex++)
+			*myByte++ = (UInt8)(myRequest.fOffset + myIndex);
+
+		InvokeDataHCompletionUPP(myRequest.fData, myRequest.fRefCon, myErr, myRequest.fCompletion);
+	}
+
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTransBench_SourceFinishData
+// Finish every read outstanding on our synthetic data handler. If theCancel is true, we cancel them instead:
+// each one's completion routine is called right away, with userCanceledErr, and without any data. Otherwise,
+// we just wait for the data to "arrive", as DataHTask would.
+//
+//////////
+
+PASCAL_RTN ComponentResult QTFileTransBench_SourceFinishData (QTFileTransBenchGlobalsHdl theGlobals, Ptr thePlaceToPutDataPtr, Boolean theCancel)
+{
+#pragma unused(thePlaceToPutDataPtr)
+
+	QTFileTransBenchGlobalsPtr	myGlobals = *theGlobals;
+	QTFileTransBenchRequestRecord	myRequest;
+
+	if (!theCancel) {
+		while (myGlobals->fNumRequests > 0)
+			QTFileTransBench_SourceTask(theGlobals);
+		return(noErr);
+	}
+
+	while (myGlobals->fNumRequests > 0) {
+		myRequest = myGlobals->fRequests[myGlobals->fFirstRequest];
+		myGlobals->fFirstRequest = (myGlobals->fFirstRequest + 1) % kBenchMaxRequests;
+		myGlobals->fNumRequests--;
+
+		InvokeDataHCompletionUPP(myRequest.fData, myRequest.fRefCon, userCanceledErr, myRequest.fCompletion);
+	}
+
+	// the connection is free as soon as nothing more is being sent over it
+	myGlobals->fLinkFreeTime = QTFileTrans_GetMicroseconds();
+
+	return(noErr);
+}
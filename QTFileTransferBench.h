@@ -0,0 +1,135 @@
+//////////
+//
+//	File:		QTFileTransferBench.h
+//
+//	Contains:	A benchmark for the file transfer pipeline, with a synthetic data source.
+//
+//	Written by:	Tim Monroe
+//
+//	Copyright:	 1998 by Apple Computer, Inc., all rights reserved.
+//
+//	Change History (most recent first):
+//
+//	   <1>	 	11/11/98	rtm		first file
+//
+//////////
+
+#ifndef __QTFILETRANSFERBENCH__
+#define __QTFILETRANSFERBENCH__
+
+#include "QTFileTransfer.h"
+
+
+//////////
+//
+// constants
+//
+//////////
+
+#define kBenchSourceSubType		FOUR_CHAR_CODE('bnch')	// the subtype of our synthetic data handler
+#define kBenchSourceURL			"bench:///synthetic"	// the URL we pass to transfers that read from the synthetic source
+#define kBenchMaxRequests		32			// the most reads a synthetic source instance can have outstanding
+#define kBenchMaxSessions		16			// the most transfers a benchmark run can have going at once
+#define kBenchMaxYieldMicroseconds	1000L	// the longest we wait, between calls to QTFileTrans_Idle, when nothing's happening
+#define kBenchResultTextSize	512			// the size, in bytes, of a buffer big enough for QTFileTransBench_ExportResult
+
+
+//////////
+//
+// data types
+//
+//////////
+
+// the behavior of the synthetic source
+typedef struct QTFileTransBenchSourceRecord {
+	SInt64						fFileSize;					// the size, in bytes, of the file the source pretends to serve
+	unsigned long				fLatency;					// the time (in microseconds) between issuing a read and its first byte arriving
+	long						fBandwidth;					// the bandwidth, in bytes per second, of each connection (0 means unlimited)
+} QTFileTransBenchSourceRecord, *QTFileTransBenchSourcePtr;
+
+// a read outstanding on a synthetic source instance
+typedef struct QTFileTransBenchRequestRecord {
+	Ptr							fData;						// where to put the data
+	long						fNumBytes;					// the number of bytes asked for
+	SInt64						fOffset;					// the offset in the file of the first byte asked for
+	DataHCompletionUPP			fCompletion;				// the routine to call when the read is done
+	long						fRefCon;					// the reference constant to pass to that routine
+	unsigned long				fReadyTime;					// the time (in microseconds) at which the data will have "arrived"
+} QTFileTransBenchRequestRecord, *QTFileTransBenchRequestPtr;
+
+// the storage of a synthetic source instance; each instance models one connection to the server
+typedef struct QTFileTransBenchGlobalsRecord {
+	ComponentInstance			fSelf;						// the instance itself
+	Boolean						fOpen;						// have we been opened for reading?
+	QTFileTransBenchRequestRecord	fRequests[kBenchMaxRequests];	// the outstanding reads, oldest first (a ring)
+	short						fFirstRequest;				// the index in fRequests of the oldest outstanding read
+	short						fNumRequests;				// the number of outstanding reads
+	unsigned long				fLinkFreeTime;				// the time (in microseconds) at which the connection finishes sending what it's been asked for
+} QTFileTransBenchGlobalsRecord, *QTFileTransBenchGlobalsPtr, **QTFileTransBenchGlobalsHdl;
+
+// what to measure; the benchmark runs every combination of buffer size, buffer count, and session count
+typedef struct QTFileTransBenchConfigRecord {
+	char						*fURL;						// the URL to fetch, or NULL to use the synthetic source
+	QTFileTransBenchSourceRecord	fSource;				// the behavior of the synthetic source
+	FSSpecPtr					fFSSpecs;					// one local file per session, or NULL to throw the data away as it arrives
+	long						*fBufferSizes;				// the buffer sizes to try
+	short						fNumBufferSizes;
+	short						*fBufferCounts;				// the numbers of buffers in the ring to try
+	short						fNumBufferCounts;
+	short						*fSessionCounts;			// the numbers of simultaneous transfers to try
+	short						fNumSessionCounts;
+	short						fNumRepeats;				// the number of times to run each combination
+	long						fTimeLimit;					// the longest (in seconds) a run may take, or 0 for no limit
+} QTFileTransBenchConfigRecord, *QTFileTransBenchConfigPtr;
+
+// what we measured in one run
+typedef struct QTFileTransBenchResultRecord {
+	long						fBufferSize;				// the buffer size used
+	short						fNumBuffers;				// the number of buffers in each ring
+	short						fNumSessions;				// the number of simultaneous transfers
+	OSErr						fStatus;					// the first error any of the transfers reported
+	SInt64						fBytesTransferred;			// the total number of bytes transferred by all the transfers
+	SInt64						fElapsedTime;				// the time (in microseconds) the run took
+	SInt64						fCPUTime;					// the processor time (in microseconds) we used during the run
+	long						fThroughput;				// the total throughput, in bytes per second
+	long						fCPUNanosPerKB;				// the processor time (in nanoseconds) used per kilobyte transferred
+	unsigned long				fChunkTime50;				// the median time (in microseconds) a read took
+	unsigned long				fChunkTime99;				// the 99th-percentile time (in microseconds) a read took
+	long						fReadLatency[kNumLatencyBuckets];	// the read latency histograms of all the transfers, added together
+} QTFileTransBenchResultRecord, *QTFileTransBenchResultPtr;
+
+
+//////////
+//
+// function prototypes
+//
+//////////
+
+OSErr							QTFileTransBench_RegisterSource (void);
+void							QTFileTransBench_UnregisterSource (void);
+void							QTFileTransBench_SetSource (QTFileTransBenchSourcePtr theSource);
+OSErr							QTFileTransBench_Run (QTFileTransBenchConfigPtr theConfig, QTFileTransBenchResultPtr theResults, long theMaxResults, long *theNumResults);
+OSErr							QTFileTransBench_RunOnce (QTFileTransBenchConfigPtr theConfig, long theBufferSize, short theNumBuffers, short theNumSessions, QTFileTransBenchResultPtr theResult);
+OSErr							QTFileTransBench_ExportResult (QTFileTransBenchResultPtr theResult, char *theText, long theTextSize);
+unsigned long					QTFileTransBench_Percentile (long *theBuckets, long thePercent);
+SInt64							QTFileTransBench_GetCPUTime (void);
+void							QTFileTransBench_Yield (unsigned long theMicroseconds);
+unsigned long					QTFileTransBench_SourceReadyTime (QTFileTransBenchGlobalsPtr theGlobals, long theNumBytes);
+OSErr							QTFileTransBench_DiscardProc (Ptr theData, long theNumBytes, SInt64 theOffset, long theRefCon);
+
+PASCAL_RTN ComponentResult		QTFileTransBench_SourceDispatch (ComponentParameters *theParams, Handle theStorage);
+PASCAL_RTN ComponentResult		QTFileTransBench_SourceOpen (QTFileTransBenchGlobalsHdl theGlobals, ComponentInstance theSelf);
+PASCAL_RTN ComponentResult		QTFileTransBench_SourceClose (QTFileTransBenchGlobalsHdl theGlobals, ComponentInstance theSelf);
+PASCAL_RTN ComponentResult		QTFileTransBench_SourceCanDo (QTFileTransBenchGlobalsHdl theGlobals, short theSelector);
+PASCAL_RTN ComponentResult		QTFileTransBench_SourceVersion (QTFileTransBenchGlobalsHdl theGlobals);
+PASCAL_RTN ComponentResult		QTFileTransBench_SourceSetDataRef (QTFileTransBenchGlobalsHdl theGlobals, Handle theDataRef);
+PASCAL_RTN ComponentResult		QTFileTransBench_SourceOpenForRead (QTFileTransBenchGlobalsHdl theGlobals);
+PASCAL_RTN ComponentResult		QTFileTransBench_SourceCloseForRead (QTFileTransBenchGlobalsHdl theGlobals);
+PASCAL_RTN ComponentResult		QTFileTransBench_SourceGetFileSize (QTFileTransBenchGlobalsHdl theGlobals, long *theFileSize);
+PASCAL_RTN ComponentResult		QTFileTransBench_SourceGetFileSize64 (QTFileTransBenchGlobalsHdl theGlobals, wide *theFileSize);
+PASCAL_RTN ComponentResult		QTFileTransBench_SourceReadAsync (QTFileTransBenchGlobalsHdl theGlobals, Ptr theData, UInt32 theDataSize, const wide *theDataOffset, DataHCompletionUPP theCompletion, long theRefCon);
+PASCAL_RTN ComponentResult		QTFileTransBench_SourceTask (QTFileTransBenchGlobalsHdl theGlobals);
+PASCAL_RTN ComponentResult		QTFileTransBench_SourceFinishData (QTFileTransBenchGlobalsHdl theGlobals, Ptr thePlaceToPutDataPtr, Boolean theCancel);
+PASCAL_RTN ComponentResult		QTFileTransBench_SourceGetData (QTFileTransBenchGlobalsHdl theGlobals, Handle theHandle, long theHandleOffset, long theFileOffset, long theSize);
+
+#endif // __QTFILETRANSFERBENCH__
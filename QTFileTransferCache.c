@@ -0,0 +1,916 @@
+//////////
+//
+//	File:		QTFileTransferCache.c
+//
+//	Contains:	An on-disk cache of downloaded files, shared by all transfers.
+//
+//	Written by:	Tim Monroe
+//
+//	Copyright:	 1998 by Apple Computer, Inc., all rights reserved.
+//
+//	Change History (most recent first):
+//
+//	   <1>	 	11/11/98	rtm		first file
+//
+//	A program that downloads the same URLs again and again (every time a job runs, say) would otherwise
+//	fetch every byte of every file from the server every time. Once you've called QTFileTrans_SetCacheDirectory,
+//	each file a transfer downloads successfully is also kept in a directory of your choosing, and the next
+//	transfer of the same URL copies the file out of that directory instead of reading it over the network.
+//
+//	Each file in the cache is named by (part of) the SHA-256 digest of its URL, and the cache remembers, for
+//	each file, its size, the validator (an ETag or a modification date) the application supplied when it was
+//	downloaded, and when we last knew it to be current. The data handlers don't tell us when a remote file
+//	was last modified, so we can only check that the remote file is still the size it was (and, if the
+//	application supplies one, that its validator hasn't changed); an entry that fails either check is thrown
+//	away, and the file is downloaded again. If you call QTFileTrans_SetCacheLifetime, an entry checked less
+//	than that long ago is served without asking the server anything at all.
+//
+//	The cache holds at most the number of bytes you specify (and at most kCacheMaxEntries files); when a new
+//	file doesn't fit, we throw away the files that have gone unused the longest. The list of files lives in
+//	an index file in the cache directory, so the cache survives from one run of your program to the next.
+//
+//	Copying a file out of (or into) the cache is as cheap as we can make it: on Windows, we use CopyFile; on the
+//	Mac, we use PBHCopyFile if the volume supports it, and otherwise copy the data fork in large blocks. We don't
+//	make hard links, even though they would copy no data at all: a transfer that later overwrites its local file
+//	in place (or patches it, or resumes into it) would then be writing into the cache entry, too. For the same
+//	reason, we check that an entry's file is still the size we stored before we serve it.
+//
+//	Worker threads use the same cache, so the cache has a lock (see QTFileTrans_SpinLock). Copying a big file
+//	can take seconds, so we never copy a file while holding the lock: we decide whether it's a hit or a miss,
+//	and reserve the entry, under the lock, and then copy the file with the lock released. An entry being copied can't be thrown away
+//	or replaced in the meantime (a transfer that tries to store a file under its key simply doesn't store it).
+//
+//////////
+
+#include "QTFileTransferCache.h"
+
+#include <string.h>
+
+#if TARGET_OS_WIN32
+#include <windows.h>
+#endif
+
+
+//////////
+//
+// global variables
+//
+//////////
+
+Boolean							gCacheEnabled = false;		// have we been given a cache directory?
+short							gCacheVRefNum = 0;			// the volume the cache directory is on
+long							gCacheDirID = 0L;			// the directory ID of the cache directory
+SInt64							gCacheMaxBytes = 0;			// the most the files in the cache may add up to
+long							gCacheLifetime = kCacheDefaultLifetime;	// how long (in seconds) we trust an entry without checking it
+unsigned long					gCacheNextStamp = 1L;		// the use stamp of the next cache operation
+QTFileTransCacheEntryRecord		gCacheEntries[kCacheMaxEntries];	// the files in the cache
+QTFileTransCacheStatsRecord		gCacheStats;				// statistics about the cache
+short							gCacheNumCopies[kCacheMaxEntries];	// the number of threads copying each entry's file into or out of the cache
+volatile long					gCacheLock = 0L;			// nonzero while some thread is using the cache
+
+
+//////////
+//
+// QTFileTrans_SetCacheDirectory
+// Keep downloaded files in the directory specified by theDirSpecPtr (which we create, if it doesn't exist yet),
+// up to a total of theMaxBytes bytes. If the directory holds a cache from an earlier run, we pick that cache up
+// (throwing away its least recently used files, if it's bigger than theMaxBytes). Pass NULL to stop using a cache.
+//
+//////////
+
+OSErr QTFileTrans_SetCacheDirectory (FSSpecPtr theDirSpecPtr, SInt64 theMaxBytes)
+{
+	CInfoPBRec					myPB;
+	long						myDirID = 0L;
+	OSErr						myErr = noErr;
+
+	if (theDirSpecPtr == NULL) {
+		QTFileTrans_SpinLock(&gCacheLock);
+		gCacheEnabled = false;
+		QTFileTrans_SpinUnlock(&gCacheLock);
+		return(noErr);
+	}
+
+	if (theMaxBytes <= 0)
+		return(paramErr);
+
+	// find the directory, or create it
+	myPB.dirInfo.ioNamePtr = theDirSpecPtr->name;
+	myPB.dirInfo.ioVRefNum = theDirSpecPtr->vRefNum;
+	myPB.dirInfo.ioFDirIndex = 0;
+	myPB.dirInfo.ioDrDirID = theDirSpecPtr->parID;
+
+	myErr = PBGetCatInfoSync(&myPB);
+	if (myErr == fnfErr) {
+		myErr = FSpDirCreate(theDirSpecPtr, smSystemScript, &myDirID);
+	} else if (myErr == noErr) {
+		if ((myPB.dirInfo.ioFlAttrib & ioDirMask) == 0)
+			myErr = dupFNErr;
+		myDirID = myPB.dirInfo.ioDrDirID;
+	}
+
+	if (myErr != noErr)
+		return(myErr);
+
+	QTFileTrans_SpinLock(&gCacheLock);
+
+	gCacheVRefNum = theDirSpecPtr->vRefNum;
+	gCacheDirID = myDirID;
+	gCacheMaxBytes = theMaxBytes;
+	gCacheEnabled = true;
+
+	// pick up whatever an earlier run left in the directory; an index we can't read just means an empty cache
+	QTFileTrans_CacheLoadIndex();
+	QTFileTrans_CacheMakeRoom(gCacheMaxBytes, 0);
+	QTFileTrans_CacheSaveIndex();
+
+	QTFileTrans_SpinUnlock(&gCacheLock);
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_SetCacheLifetime
+// Serve a file from the cache without asking the server whether it's changed, as long as we last checked
+// it less than theSeconds seconds ago. Pass 0 (the default) to check every file every time.
+//
+//////////
+
+OSErr QTFileTrans_SetCacheLifetime (long theSeconds)
+{
+	if (theSeconds < 0)
+		return(paramErr);
+
+	QTFileTrans_SpinLock(&gCacheLock);
+	gCacheLifetime = theSeconds;
+	QTFileTrans_SpinUnlock(&gCacheLock);
+
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_GetCacheStats
+// Return the current statistics for the cache.
+//
+//////////
+
+void QTFileTrans_GetCacheStats (QTFileTransCacheStatsPtr theStats)
+{
+	if (theStats == NULL)
+		return;
+
+	QTFileTrans_SpinLock(&gCacheLock);
+	*theStats = gCacheStats;
+	theStats->fMaxBytes = gCacheMaxBytes;
+	QTFileTrans_SpinUnlock(&gCacheLock);
+}
+
+
+//////////
+//
+// QTFileTrans_TrimCache
+// Throw away the least recently used files in the cache until the rest add up to no more than theMaxBytes;
+// pass 0 to empty the cache. (This doesn't change the most the cache may hold.)
+//
+//////////
+
+void QTFileTrans_TrimCache (SInt64 theMaxBytes)
+{
+	QTFileTrans_SpinLock(&gCacheLock);
+
+	if (gCacheEnabled) {
+		QTFileTrans_CacheMakeRoom(theMaxBytes, 0);
+		QTFileTrans_CacheSaveIndex();
+	}
+
+	QTFileTrans_SpinUnlock(&gCacheLock);
+}
+
+
+//////////
+//
+// QTFileTrans_CacheIsEnabled
+// Are we keeping downloaded files in a cache?
+//
+//////////
+
+Boolean QTFileTrans_CacheIsEnabled (void)
+{
+	return(gCacheEnabled);
+}
+
+
+//////////
+//
+// QTFileTrans_CacheKeyForURL
+// Compute the key of the cache entry for the specified URL: the SHA-256 digest of the URL.
+//
+//////////
+
+void QTFileTrans_CacheKeyForURL (char *theURL, UInt8 *theKey)
+{
+	QTFileTransDigestRecord		myDigest;
+
+	QTFileTrans_DigestInit(&myDigest, kQTFileTransDigestSHA256);
+	QTFileTrans_DigestUpdate(&myDigest, (const UInt8 *)theURL, (long)strlen(theURL));
+	QTFileTrans_DigestFinal(&myDigest);
+
+	BlockMove(myDigest.fResult, theKey, kCacheKeySize);
+}
+
+
+//////////
+//
+// QTFileTrans_CacheFetch
+// Copy the file with the specified key out of the cache into the specified local file, if the cache has it
+// and it's still current; return noErr (and the size of the file, in theSize) if we did that.
+//
+// Pass -1 for theRemoteSize if you haven't asked the server anything yet; we then serve the file only if we
+// checked it recently enough (see QTFileTrans_SetCacheLifetime). If we don't, but there's a file that could
+// still be current, we return fnfErr and, in theSize, the size that file has; call us again, with the size
+// of the remote file, once you've opened it. If there's no file at all, we return fnfErr and -1 in theSize.
+//
+//////////
+
+OSErr QTFileTrans_CacheFetch (const UInt8 *theKey, char *theValidator, SInt64 theRemoteSize, FSSpecPtr theFSSpecPtr, SInt64 *theSize)
+{
+	QTFileTransCacheEntryPtr	myEntry = NULL;
+	FSSpec						myEntrySpec;
+	SInt64						mySize = 0;
+	unsigned long				myNow;
+	short						myIndex;
+	OSErr						myErr = fnfErr;
+
+	*theSize = -1;
+
+	if (!gCacheEnabled)
+		return(fnfErr);
+
+	GetDateTime(&myNow);
+
+	QTFileTrans_SpinLock(&gCacheLock);
+
+	if (theRemoteSize < 0)
+		gCacheStats.fNumLookups++;
+
+	// (an entry whose file is still being copied into the cache isn't there yet)
+	myIndex = QTFileTrans_CacheFindEntry(theKey);
+	if ((myIndex == kCacheNoEntry) || !gCacheEntries[myIndex].fInUse) {
+		gCacheStats.fNumMisses++;
+		goto bail;
+	}
+
+	myEntry = &gCacheEntries[myIndex];
+
+	// a file whose validator has changed (or whose size has, once we know it) is out of date; if another thread
+	// is copying it out right now, we leave it for the next lookup to throw away
+	if (!QTFileTrans_CacheValidatorMatches(myEntry, theValidator) || ((theRemoteSize >= 0) && (theRemoteSize != myEntry->fSize))) {
+		if (gCacheNumCopies[myIndex] == 0) {
+			QTFileTrans_CacheRemoveEntry(myIndex);
+			QTFileTrans_CacheSaveIndex();
+			gCacheStats.fNumStale++;
+		}
+		gCacheStats.fNumMisses++;
+		goto bail;
+	}
+
+	// if we haven't asked the server, the file has to have been checked recently
+	if ((theRemoteSize < 0) && ((gCacheLifetime == 0L) || (myNow - myEntry->fCheckTime >= (unsigned long)gCacheLifetime))) {
+		*theSize = myEntry->fSize;
+		goto bail;
+	}
+
+	myErr = QTFileTrans_CacheEntrySpec(myEntry, &myEntrySpec);
+	if (myErr != noErr) {
+		gCacheStats.fNumMisses++;
+		goto bail;
+	}
+
+	// copying a big file takes a while, so we don't hold the lock while we do it; the entry can't be thrown
+	// away (or replaced) while we're copying its file
+	gCacheNumCopies[myIndex]++;
+	QTFileTrans_SpinUnlock(&gCacheLock);
+
+	// an entry's file that isn't the size we stored has been changed behind our back
+	myErr = QTFileTrans_CacheFileSize(&myEntrySpec, &mySize);
+	if ((myErr == noErr) && (mySize != myEntry->fSize))
+		myErr = fnfErr;
+	if (myErr == noErr)
+		myErr = QTFileTrans_CacheCopyFile(&myEntrySpec, theFSSpecPtr);
+
+	QTFileTrans_SpinLock(&gCacheLock);
+	gCacheNumCopies[myIndex]--;
+
+	if (myErr != noErr) {
+		// if the entry's file has gone missing (or been changed), forget about it
+		if ((myErr == fnfErr) && (gCacheNumCopies[myIndex] == 0)) {
+			QTFileTrans_CacheRemoveEntry(myIndex);
+			QTFileTrans_CacheSaveIndex();
+		}
+		gCacheStats.fNumMisses++;
+		goto bail;
+	}
+
+	myEntry->fUseStamp = gCacheNextStamp++;
+	if (theRemoteSize >= 0)
+		myEntry->fCheckTime = myNow;
+	else
+		gCacheStats.fNumFreshHits++;
+
+	gCacheStats.fNumHits++;
+	gCacheStats.fBytesServed += myEntry->fSize;
+	*theSize = myEntry->fSize;
+
+	QTFileTrans_CacheSaveIndex();
+
+bail:
+	QTFileTrans_SpinUnlock(&gCacheLock);
+	return(myErr);
+}
+
+
+//////////
+//
+// QTFileTrans_CacheStore
+// Add the specified local file, theSize bytes long, to the cache, under the specified key (replacing any file
+// already stored under that key). We throw away the least recently used files, if need be, to make room.
+// If another thread is copying a file into or out of the cache under the same key, we return fBsyErr.
+//
+//////////
+
+OSErr QTFileTrans_CacheStore (const UInt8 *theKey, char *theValidator, FSSpecPtr theFSSpecPtr, SInt64 theSize)
+{
+	QTFileTransCacheEntryPtr	myEntry = NULL;
+	FSSpec						myEntrySpec;
+	short						myIndex;
+	OSErr						myErr = noErr;
+
+	if (!gCacheEnabled)
+		return(unimpErr);
+
+	if ((theSize < 0) || (theSize > gCacheMaxBytes))
+		return(paramErr);
+
+	QTFileTrans_SpinLock(&gCacheLock);
+
+	myIndex = QTFileTrans_CacheFindEntry(theKey);
+	if (myIndex != kCacheNoEntry) {
+		if (gCacheNumCopies[myIndex] > 0) {
+			myErr = fBsyErr;
+			goto bail;
+		}
+		QTFileTrans_CacheRemoveEntry(myIndex);
+	}
+
+	QTFileTrans_CacheMakeRoom(gCacheMaxBytes - theSize, 1);
+
+	// (every free entry record might be reserved by other threads' copies)
+	for (myIndex = 0; myIndex < kCacheMaxEntries; myIndex++)
+		if (!gCacheEntries[myIndex].fInUse && (gCacheNumCopies[myIndex] == 0))
+			break;
+
+	if (myIndex == kCacheMaxEntries) {
+		myErr = fBsyErr;
+		goto bail;
+	}
+
+	myEntry = &gCacheEntries[myIndex];
+	BlockMove(theKey, myEntry->fKey, kCacheKeySize);
+	myEntry->fSize = theSize;
+	GetDateTime(&myEntry->fCheckTime);
+	myEntry->fUseStamp = gCacheNextStamp++;
+	myEntry->fValidator[0] = '\0';
+	if (theValidator != NULL)
+		strncat(myEntry->fValidator, theValidator, kCacheMaxValidatorSize - 1);
+
+	myErr = QTFileTrans_CacheEntrySpec(myEntry, &myEntrySpec);
+	if (myErr == fnfErr)
+		myErr = noErr;
+	if (myErr != noErr)
+		goto bail;
+
+	// reserve the entry record, and the room for the file, then copy the file without holding the lock
+	gCacheNumCopies[myIndex]++;
+	gCacheStats.fBytesInCache += theSize;
+	QTFileTrans_SpinUnlock(&gCacheLock);
+
+	myErr = QTFileTrans_CacheCopyFile(theFSSpecPtr, &myEntrySpec);
+
+	QTFileTrans_SpinLock(&gCacheLock);
+	gCacheNumCopies[myIndex]--;
+
+	if (myErr != noErr) {
+		FSpDelete(&myEntrySpec);
+		gCacheStats.fBytesInCache -= theSize;
+		goto bail;
+	}
+
+	myEntry->fInUse = true;
+	gCacheStats.fNumStores++;
+	gCacheStats.fNumEntries++;
+
+bail:
+	QTFileTrans_CacheSaveIndex();
+	QTFileTrans_SpinUnlock(&gCacheLock);
+	return(myErr);
+}
+
+
+//////////
+//
+// QTFileTrans_CacheFindEntry
+// Return the index of the cache entry with the specified key, or kCacheNoEntry if there isn't one; the entry
+// might be one whose file is still being copied into the cache (that is, not in use yet). The caller must
+// have locked the cache.
+//
+//////////
+
+short QTFileTrans_CacheFindEntry (const UInt8 *theKey)
+{
+	short						myIndex;
+
+	for (myIndex = 0; myIndex < kCacheMaxEntries; myIndex++)
+		if ((gCacheEntries[myIndex].fInUse || (gCacheNumCopies[myIndex] > 0)) && (memcmp(gCacheEntries[myIndex].fKey, theKey, kCacheKeySize) == 0))
+			return(myIndex);
+
+	return(kCacheNoEntry);
+}
+
+
+//////////
+//
+// QTFileTrans_CacheMakeSpec
+// Make a file system specification for the file with the specified name in the cache directory. As with
+// FSMakeFSSpec, we return fnfErr if the file doesn't exist (but the specification is still valid).
+//
+//////////
+
+OSErr QTFileTrans_CacheMakeSpec (char *theName, FSSpecPtr theFSSpecPtr)
+{
+	Str63						myName;
+
+	myName[0] = (unsigned char)strlen(theName);
+	BlockMove(theName, &myName[1], myName[0]);
+
+	return(FSMakeFSSpec(gCacheVRefNum, gCacheDirID, myName, theFSSpecPtr));
+}
+
+
+//////////
+//
+// QTFileTrans_CacheEntrySpec
+// Make a file system specification for the file of the specified cache entry; its name is kCacheNamePrefix
+// followed by the first kCacheNameKeyBytes bytes of the entry's key, in hexadecimal (which keeps the name
+// within the 31-character limit of HFS file names).
+//
+//////////
+
+OSErr QTFileTrans_CacheEntrySpec (QTFileTransCacheEntryPtr theEntry, FSSpecPtr theFSSpecPtr)
+{
+	char						myName[32];
+	char						*myDigits = "0123456789abcdef";
+	long						myLength;
+	short						myIndex;
+
+	strcpy(myName, kCacheNamePrefix);
+	myLength = (long)strlen(myName);
+
+	for (myIndex = 0; myIndex < kCacheNameKeyBytes; myIndex++) {
+		myName[myLength++] = myDigits[theEntry->fKey[myIndex] >> 4];
+		myName[myLength++] = myDigits[theEntry->fKey[myIndex] & 0x0F];
+	}
+
+	myName[myLength] = '\0';
+	return(QTFileTrans_CacheMakeSpec(myName, theFSSpecPtr));
+}
+
+
+//////////
+//
+// QTFileTrans_CacheValidatorMatches
+// Does the specified validator match the one stored with the specified cache entry? If the application doesn't
+// give us a validator, we have nothing to compare, so any entry matches.
+//
+//////////
+
+Boolean QTFileTrans_CacheValidatorMatches (QTFileTransCacheEntryPtr theEntry, char *theValidator)
+{
+	if ((theValidator == NULL) || (*theValidator == '\0'))
+		return(true);
+
+	return(strncmp(theEntry->fValidator, theValidator, kCacheMaxValidatorSize - 1) == 0);
+}
+
+
+//////////
+//
+// QTFileTrans_CacheRemoveEntry
+// Throw away the specified cache entry, and its file, unless another thread is copying that file. The caller
+// must have locked the cache.
+//
+//////////
+
+void QTFileTrans_CacheRemoveEntry (short theIndex)
+{
+	QTFileTransCacheEntryPtr	myEntry = &gCacheEntries[theIndex];
+	FSSpec						myEntrySpec;
+
+	if (!myEntry->fInUse || (gCacheNumCopies[theIndex] > 0))
+		return;
+
+	if (QTFileTrans_CacheEntrySpec(myEntry, &myEntrySpec) == noErr)
+		FSpDelete(&myEntrySpec);
+
+	myEntry->fInUse = false;
+	gCacheStats.fNumEntries--;
+	gCacheStats.fBytesInCache -= myEntry->fSize;
+}
+
+
+//////////
+//
+// QTFileTrans_CacheMakeRoom
+// Throw away the least recently used cache entries until the rest add up to no more than theMaxBytes and
+// at least theFreeEntries entry records are free (or until every entry left is being copied by another thread).
+// The caller must have locked the cache.
+//
+//////////
+
+void QTFileTrans_CacheMakeRoom (SInt64 theMaxBytes, short theFreeEntries)
+{
+	short						myIndex;
+	short						myOldest;
+
+	while ((gCacheStats.fNumEntries > 0) && ((gCacheStats.fBytesInCache > theMaxBytes) || (kCacheMaxEntries - gCacheStats.fNumEntries < theFreeEntries))) {
+		myOldest = kCacheNoEntry;
+		for (myIndex = 0; myIndex < kCacheMaxEntries; myIndex++)
+			if (gCacheEntries[myIndex].fInUse && (gCacheNumCopies[myIndex] == 0))
+				if ((myOldest == kCacheNoEntry) || (gCacheEntries[myIndex].fUseStamp < gCacheEntries[myOldest].fUseStamp))
+					myOldest = myIndex;
+
+		if (myOldest == kCacheNoEntry)
+			break;
+
+		QTFileTrans_CacheRemoveEntry(myOldest);
+		gCacheStats.fNumEvictions++;
+	}
+}
+
+
+//////////
+//
+// QTFileTrans_CacheLoadIndex
+// Read the list of cache entries from the index file in the cache directory, skipping any entry whose file
+// has gone missing. The caller must have locked the cache.
+//
+//////////
+
+OSErr QTFileTrans_CacheLoadIndex (void)
+{
+	QTFileTransCacheIndexHeader	myHeader;
+	QTFileTransCacheEntryPtr	myEntry = NULL;
+	FSSpec						myIndexSpec;
+	FSSpec						myEntrySpec;
+	short						myRefNum = 0;
+	long						myCount;
+	long						myIndex;
+	short						myNumEntries = 0;
+	OSErr						myErr = noErr;
+
+	for (myIndex = 0; myIndex < kCacheMaxEntries; myIndex++)
+		gCacheEntries[myIndex].fInUse = false;
+
+	gCacheStats.fNumEntries = 0;
+	gCacheStats.fBytesInCache = 0;
+	gCacheNextStamp = 1L;
+
+	myErr = QTFileTrans_CacheMakeSpec(kCacheIndexName, &myIndexSpec);
+	if (myErr != noErr)
+		return(myErr);
+
+	myErr = FSpOpenDF(&myIndexSpec, fsRdPerm, &myRefNum);
+	if (myErr != noErr)
+		return(myErr);
+
+	myCount = sizeof(myHeader);
+	myErr = FSRead(myRefNum, &myCount, &myHeader);
+	if ((myErr != noErr) || (myHeader.fSignature != kCacheIndexSignature) || (myHeader.fVersion != kCacheIndexVersion)) {
+		myErr = paramErr;
+		goto bail;
+	}
+
+	for (myIndex = 0; (myIndex < myHeader.fNumEntries) && (myNumEntries < kCacheMaxEntries); myIndex++) {
+		myEntry = &gCacheEntries[myNumEntries];
+
+		myCount = sizeof(QTFileTransCacheEntryRecord);
+		myErr = FSRead(myRefNum, &myCount, myEntry);
+		if (myErr != noErr)
+			break;
+
+		if (!myEntry->fInUse || (QTFileTrans_CacheEntrySpec(myEntry, &myEntrySpec) != noErr)) {
+			myEntry->fInUse = false;
+			continue;
+		}
+
+		myNumEntries++;
+		gCacheStats.fNumEntries++;
+		gCacheStats.fBytesInCache += myEntry->fSize;
+	}
+
+	gCacheNextStamp = myHeader.fNextStamp;
+
+bail:
+	FSClose(myRefNum);
+	return(myErr);
+}
+
+
+//////////
+//
+// QTFileTrans_CacheSaveIndex
+// Write the list of cache entries to the index file in the cache directory. The caller must have locked the cache.
+//
+//////////
+
+OSErr QTFileTrans_CacheSaveIndex (void)
+{
+	QTFileTransCacheIndexHeader	myHeader;
+	FSSpec						myIndexSpec;
+	short						myRefNum = 0;
+	long						myCount;
+	long						mySize;
+	short						myIndex;
+	OSErr						myErr = noErr;
+
+	myErr = QTFileTrans_CacheMakeSpec(kCacheIndexName, &myIndexSpec);
+	if (myErr == fnfErr)
+		myErr = FSpCreate(&myIndexSpec, kCacheFileCreator, kCacheIndexFileType, smSystemScript);
+	if (myErr != noErr)
+		return(myErr);
+
+	myErr = FSpOpenDF(&myIndexSpec, fsRdWrPerm, &myRefNum);
+	if (myErr != noErr)
+		return(myErr);
+
+	myHeader.fSignature = kCacheIndexSignature;
+	myHeader.fVersion = kCacheIndexVersion;
+	myHeader.fNumEntries = gCacheStats.fNumEntries;
+	myHeader.fNextStamp = gCacheNextStamp;
+
+	myCount = sizeof(myHeader);
+	myErr = FSWrite(myRefNum, &myCount, &myHeader);
+	mySize = myCount;
+
+	for (myIndex = 0; (myIndex < kCacheMaxEntries) && (myErr == noErr); myIndex++) {
+		if (gCacheEntries[myIndex].fInUse) {
+			myCount = sizeof(QTFileTransCacheEntryRecord);
+			myErr = FSWrite(myRefNum, &myCount, &gCacheEntries[myIndex]);
+			mySize += myCount;
+		}
+	}
+
+	if (myErr == noErr)
+		myErr = SetEOF(myRefNum, mySize);
+
+	FSClose(myRefNum);
+	return(myErr);
+}
+
+
+//////////
+//
+// QTFileTrans_CacheFileSize
+// Return, in theSize, the size of the data fork of the specified file.
+//
+//////////
+
+OSErr QTFileTrans_CacheFileSize (FSSpecPtr theFSSpecPtr, SInt64 *theSize)
+{
+#if TARGET_OS_WIN32
+	WIN32_FILE_ATTRIBUTE_DATA	myData;
+	char						myPath[kCacheMaxPathLength];
+	OSErr						myErr = noErr;
+
+	myErr = FSSpecToNativePathName(theFSSpecPtr, myPath, sizeof(myPath), kFullNativePath);
+	if (myErr != noErr)
+		return(myErr);
+
+	// GetEOF can't tell us the size of a file bigger than 2GB
+	if (!GetFileAttributesEx(myPath, GetFileExInfoStandard, &myData))
+		return(fnfErr);
+
+	*theSize = ((SInt64)myData.nFileSizeHigh << 32) | (SInt64)myData.nFileSizeLow;
+	return(noErr);
+#else
+	short						myRefNum = 0;
+	long						mySize = 0L;
+	OSErr						myErr = noErr;
+
+	myErr = FSpOpenDF(theFSSpecPtr, fsRdPerm, &myRefNum);
+	if (myErr != noErr)
+		return(myErr);
+
+	myErr = GetEOF(myRefNum, &mySize);
+	FSClose(myRefNum);
+
+	*theSize = mySize;
+	return(myErr);
+#endif
+}
+
+
+//////////
+//
+// QTFileTrans_CacheCopyFile
+// Copy the specified source file into the specified destination file (replacing the destination file, if it
+// exists), as cheaply as we can. The copy gets the source file's creator and file type; since the files in the
+// cache are copies of downloaded files, a file served from the cache looks just like a downloaded one.
+//
+// On Windows, we use CopyFile. On the Mac, we use PBHCopyFile if both files are on the same volume and that
+// volume supports it; otherwise, we copy the data fork ourselves.
+//
+//////////
+
+OSErr QTFileTrans_CacheCopyFile (FSSpecPtr theSourceSpecPtr, FSSpecPtr theDestSpecPtr)
+{
+	OSErr						myErr = noErr;
+
+	FSpDelete(theDestSpecPtr);
+
+#if TARGET_OS_WIN32
+	{
+		char					mySourcePath[kCacheMaxPathLength];
+		char					myDestPath[kCacheMaxPathLength];
+
+		myErr = FSSpecToNativePathName(theSourceSpecPtr, mySourcePath, sizeof(mySourcePath), kFullNativePath);
+		if (myErr == noErr)
+			myErr = FSSpecToNativePathName(theDestSpecPtr, myDestPath, sizeof(myDestPath), kFullNativePath);
+		if (myErr != noErr)
+			return(myErr);
+
+		if (!CopyFile(mySourcePath, myDestPath, TRUE)) {
+			switch (GetLastError()) {
+				case ERROR_FILE_NOT_FOUND:
+					return(fnfErr);
+				case ERROR_DISK_FULL:
+					return(dskFulErr);
+				default:
+					return(ioErr);
+			}
+		}
+	}
+#else
+	{
+		FInfo					myInfo;
+		short					mySourceRefNum = 0;
+		SInt64					myCopied = 0;
+
+		// if both files are on the same volume and the volume can copy files itself, let it
+		if (QTFileTrans_VolumeCopyFile(theSourceSpecPtr, theDestSpecPtr) == noErr)
+			return(noErr);
+
+		// copy the data fork ourselves
+		myErr = FSpGetFInfo(theSourceSpecPtr, &myInfo);
+		if (myErr == noErr)
+			myErr = FSpOpenDF(theSourceSpecPtr, fsRdPerm, &mySourceRefNum);
+		if (myErr != noErr)
+			return(myErr);
+
+		myErr = QTFileTrans_CopyDataFork(mySourceRefNum, theDestSpecPtr, myInfo.fdCreator, myInfo.fdType, false, kCacheCopyBufferSize, &myCopied);
+		FSClose(mySourceRefNum);
+	}
+#endif
+
+	return(myErr);
+}
+
+
+#if !TARGET_OS_WIN32
+//////////
+//
+// QTFileTrans_VolumeCopyFile
+// Have the volume copy the specified source file into the specified destination file (which mustn't exist),
+// if both files are on the same volume and that volume supports PBHCopyFile; a file server then copies the
+// file without sending it over the network. Return noErr if the volume did that.
+//
+//////////
+
+OSErr QTFileTrans_VolumeCopyFile (FSSpecPtr theSourceSpecPtr, FSSpecPtr theDestSpecPtr)
+{
+	HParamBlockRec				myPB;
+	GetVolParmsInfoBuffer		myVolParms;
+
+	if (theSourceSpecPtr->vRefNum != theDestSpecPtr->vRefNum)
+		return(unimpErr);
+
+	myPB.ioParam.ioNamePtr = NULL;
+	myPB.ioParam.ioVRefNum = theSourceSpecPtr->vRefNum;
+	myPB.ioParam.ioBuffer = (Ptr)&myVolParms;
+	myPB.ioParam.ioReqCount = sizeof(myVolParms);
+
+	if ((PBHGetVolParmsSync(&myPB) != noErr) || !(myVolParms.vMAttrib & (1L << bHasCopyFile)))
+		return(unimpErr);
+
+	myPB.copyParam.ioVRefNum = theSourceSpecPtr->vRefNum;
+	myPB.copyParam.ioDirID = theSourceSpecPtr->parID;
+	myPB.copyParam.ioNamePtr = theSourceSpecPtr->name;
+	myPB.copyParam.ioDstVRefNum = theDestSpecPtr->vRefNum;
+	myPB.copyParam.ioNewDirID = theDestSpecPtr->parID;
+	myPB.copyParam.ioNewName = NULL;
+	myPB.copyParam.ioCopyName = theDestSpecPtr->name;
+
+	return(PBHCopyFileSync(&myPB));
+}
+
+
+//////////
+//
+// QTFileTrans_CopyDataFork
+// Copy the data fork of the source file open at theSourceRefNum into the specified destination file, in blocks
+// of theBufferSize bytes, keeping the number of bytes copied so far in theBytesCopied. Unless theReuseFile is
+// true, we replace the destination file with a new one, with the specified creator and file type; if it is,
+// we overwrite the existing destination file in place. If the copy fails (or the source file turns out to be
+// shorter than its EOF said), we delete the destination file, so that nobody mistakes half a file for a whole one.
+//
+//////////
+
+OSErr QTFileTrans_CopyDataFork (short theSourceRefNum, FSSpecPtr theDestSpecPtr, OSType theCreator, OSType theType, Boolean theReuseFile, long theBufferSize, SInt64 *theBytesCopied)
+{
+	short						myDestRefNum = 0;
+	long						mySize = 0L;
+	long						myCount;
+	Ptr							myBuffer = NULL;
+	OSErr						myErr = noErr;
+
+	*theBytesCopied = 0;
+
+	myErr = GetEOF(theSourceRefNum, &mySize);
+	if (myErr != noErr)
+		return(myErr);
+
+	if (!theReuseFile) {
+		FSpDelete(theDestSpecPtr);
+		myErr = FSpCreate(theDestSpecPtr, theCreator, theType, smSystemScript);
+		if (myErr != noErr)
+			return(myErr);
+	}
+
+	myErr = FSpOpenDF(theDestSpecPtr, fsRdWrPerm, &myDestRefNum);
+	if (myErr != noErr)
+		goto bail;
+
+	// reserve all the space we need up front
+	if (theReuseFile) {
+		myErr = SetEOF(myDestRefNum, mySize);
+		if (myErr != noErr)
+			goto bail;
+	} else {
+		myCount = mySize;
+		if (AllocContig(myDestRefNum, &myCount) != noErr) {
+			myCount = mySize;
+			Allocate(myDestRefNum, &myCount);
+		}
+	}
+
+	// we don't need the buffer to be cleared, since we read into it before we write from it
+	myErr = QTFileTrans_AllocBuffer(theBufferSize, &myBuffer);
+	if (myErr != noErr)
+		goto bail;
+
+	while (*theBytesCopied < mySize) {
+		myCount = theBufferSize;
+		if (mySize - *theBytesCopied < myCount)
+			myCount = (long)(mySize - *theBytesCopied);
+
+		myErr = FSRead(theSourceRefNum, &myCount, myBuffer);
+		if ((myErr != noErr) && (myErr != eofErr))
+			break;
+
+		// a copy cut short by the end of the source file is no copy at all
+		if (myCount == 0L) {
+			myErr = eofErr;
+			break;
+		}
+
+		myErr = FSWrite(myDestRefNum, &myCount, myBuffer);
+		if (myErr != noErr)
+			break;
+
+		*theBytesCopied += myCount;
+	}
+
+bail:
+	if (myBuffer != NULL)
+		QTFileTrans_ReleaseBuffer(myBuffer);
+	if (myDestRefNum != 0)
+		FSClose(myDestRefNum);
+
+	if (myErr != noErr)
+		FSpDelete(theDestSpecPtr);
+
+	return(myErr);
+}
+#endif
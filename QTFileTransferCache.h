@@ -0,0 +1,117 @@
+//////////
+//
+//	File:		QTFileTransferCache.h
+//
+//	Contains:	An on-disk cache of downloaded files, shared by all transfers.
+//
+//	Written by:	Tim Monroe
+//
+//	Copyright:	 1998 by Apple Computer, Inc., all rights reserved.
+//
+//	Change History (most recent first):
+//
+//	   <1>	 	11/11/98	rtm		first file
+//
+//////////
+
+#ifndef __QTFILETRANSFERCACHE__
+#define __QTFILETRANSFERCACHE__
+
+#include <Movies.h>
+
+#include "QTFileTransferDigest.h"
+#include "QTFileTransferPool.h"
+
+
+//////////
+//
+// constants
+//
+//////////
+
+#define kCacheKeySize			32			// the size, in bytes, of the key of a cache entry (the SHA-256 digest of its URL)
+#define kCacheNameKeyBytes		12			// the number of bytes of the key that go into the name of an entry's file
+#define kCacheNamePrefix		"QTc"		// the start of the name of every entry's file
+#define kCacheMaxEntries		256			// the most files the cache holds
+#define kCacheMaxValidatorSize	64			// the size, in bytes, of the longest validator we keep (including the terminating null byte)
+#define kCacheCopyBufferSize	1024*1024	// the size, in bytes, of the buffer we use to copy files into and out of the cache
+#define kCacheMaxPathLength		1024		// the longest native pathname of a file in the cache
+#define kCacheDefaultLifetime	0L			// the time (in seconds) we serve an entry without asking the server whether it's changed
+
+#define kCacheIndexName			"QTFileTrans Cache Index"	// the name of the file that lists the entries
+#define kCacheIndexSignature	FOUR_CHAR_CODE('QTCI')	// the signature at the start of the index file
+#define kCacheIndexVersion		1						// the format version of the index file
+#define kCacheFileCreator		FOUR_CHAR_CODE('CWIE')	// the creator of the index file
+#define kCacheIndexFileType		FOUR_CHAR_CODE('QTci')	// the file type of the index file
+
+#define kCacheNoEntry			-1			// the "index" of an entry we don't have
+
+
+//////////
+//
+// data types
+//
+//////////
+
+// a file in the cache
+typedef struct QTFileTransCacheEntryRecord {
+	UInt8						fKey[kCacheKeySize];		// the SHA-256 digest of the URL the file came from
+	SInt64						fSize;						// the size, in bytes, of the file
+	unsigned long				fCheckTime;					// the time (in seconds) we last knew the file matched the remote file
+	unsigned long				fUseStamp;					// when the file was last used, as a count of cache operations (for LRU eviction)
+	char						fValidator[kCacheMaxValidatorSize];	// the validator (ETag or date) the application gave us, or ""
+	Boolean						fInUse;						// does this record describe a file?
+} QTFileTransCacheEntryRecord, *QTFileTransCacheEntryPtr;
+
+// the header of the index file; it's followed by fNumEntries entry records
+typedef struct QTFileTransCacheIndexHeader {
+	OSType						fSignature;					// kCacheIndexSignature
+	long						fVersion;					// kCacheIndexVersion
+	long						fNumEntries;				// the number of entry records that follow
+	unsigned long				fNextStamp;					// the use stamp of the next cache operation
+} QTFileTransCacheIndexHeader;
+
+// statistics about the cache
+typedef struct QTFileTransCacheStatsRecord {
+	long						fNumLookups;				// the number of transfers that looked for their URL in the cache
+	long						fNumHits;					// the number of those we served from the cache
+	long						fNumFreshHits;				// the number of those hits we served without asking the server anything
+	long						fNumMisses;					// the number of lookups that found nothing usable
+	long						fNumStale;					// the number of entries we threw away because the remote file had changed
+	long						fNumStores;					// the number of files we added to the cache
+	long						fNumEvictions;				// the number of entries we threw away to make room
+	long						fNumEntries;				// the number of files in the cache
+	SInt64						fBytesInCache;				// the total size of those files
+	SInt64						fMaxBytes;					// the most the cache may hold
+	SInt64						fBytesServed;				// the total size of the hits
+} QTFileTransCacheStatsRecord, *QTFileTransCacheStatsPtr;
+
+
+//////////
+//
+// function prototypes
+//
+//////////
+
+OSErr							QTFileTrans_SetCacheDirectory (FSSpecPtr theDirSpecPtr, SInt64 theMaxBytes);
+OSErr							QTFileTrans_SetCacheLifetime (long theSeconds);
+void							QTFileTrans_GetCacheStats (QTFileTransCacheStatsPtr theStats);
+void							QTFileTrans_TrimCache (SInt64 theMaxBytes);
+Boolean							QTFileTrans_CacheIsEnabled (void);
+void							QTFileTrans_CacheKeyForURL (char *theURL, UInt8 *theKey);
+OSErr							QTFileTrans_CacheFetch (const UInt8 *theKey, char *theValidator, SInt64 theRemoteSize, FSSpecPtr theFSSpecPtr, SInt64 *theSize);
+OSErr							QTFileTrans_CacheStore (const UInt8 *theKey, char *theValidator, FSSpecPtr theFSSpecPtr, SInt64 theSize);
+short							QTFileTrans_CacheFindEntry (const UInt8 *theKey);
+OSErr							QTFileTrans_CacheMakeSpec (char *theName, FSSpecPtr theFSSpecPtr);
+OSErr							QTFileTrans_CacheEntrySpec (QTFileTransCacheEntryPtr theEntry, FSSpecPtr theFSSpecPtr);
+Boolean							QTFileTrans_CacheValidatorMatches (QTFileTransCacheEntryPtr theEntry, char *theValidator);
+void							QTFileTrans_CacheRemoveEntry (short theIndex);
+void							QTFileTrans_CacheMakeRoom (SInt64 theMaxBytes, short theFreeEntries);
+OSErr							QTFileTrans_CacheLoadIndex (void);
+OSErr							QTFileTrans_CacheSaveIndex (void);
+OSErr							QTFileTrans_CacheFileSize (FSSpecPtr theFSSpecPtr, SInt64 *theSize);
+OSErr							QTFileTrans_CacheCopyFile (FSSpecPtr theSourceSpecPtr, FSSpecPtr theDestSpecPtr);
+OSErr							QTFileTrans_VolumeCopyFile (FSSpecPtr theSourceSpecPtr, FSSpecPtr theDestSpecPtr);
+OSErr							QTFileTrans_CopyDataFork (short theSourceRefNum, FSSpecPtr theDestSpecPtr, OSType theCreator, OSType theType, Boolean theReuseFile, long theBufferSize, SInt64 *theBytesCopied);
+
+#endif // __QTFILETRANSFERCACHE__
@@ -0,0 +1,450 @@
+//////////
+//
+//	File:		QTFileTransferDigest.c
+//
+//	Contains:	Checksums and message digests computed on the data of a transfer as it goes by.
+//
+//	Written by:	Tim Monroe
+//
+//	Copyright:	 1998 by Apple Computer, Inc., all rights reserved.
+//
+//	Change History (most recent first):
+//
+//	   <1>	 	11/11/98	rtm		first file
+//
+//	These functions compute a CRC-32, MD5, or SHA-256 digest of a stream of data that arrives in
+//	pieces of any size. A transfer that's been asked for a digest (see QTFileTrans_SetDigest) feeds
+//	each chunk to QTFileTrans_DigestUpdate while the chunk is still in its buffer, so checking a
+//	downloaded file no longer means reading the whole file back from disk.
+//
+//	The CRC-32 is computed four bytes at a time with four lookup tables ("slicing by 4"), which is
+//	several times faster than the usual byte-at-a-time loop and needs nothing from the processor
+//	beyond 32-bit integer arithmetic. MD5 and SHA-256 work on 64-byte blocks; whole blocks are
+//	digested straight out of the caller's buffer, and only the pieces left over at either end of a
+//	call are copied into the digest record.
+//
+//////////
+
+#include "QTFileTransferDigest.h"
+
+
+//////////
+//
+// constants
+//
+//////////
+
+#define kCRC32Polynomial			0xEDB88320UL		// the CRC-32 polynomial, in reversed bit order
+
+#define kDigestRotateLeft(x, n)		(((x) << (n)) | ((x) >> (32 - (n))))
+#define kDigestRotateRight(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+
+// the round constants for SHA-256
+static const UInt32 kSHA256Constants[64] = {
+	0x428A2F98UL, 0x71374491UL, 0xB5C0FBCFUL, 0xE9B5DBA5UL, 0x3956C25BUL, 0x59F111F1UL, 0x923F82A4UL, 0xAB1C5ED5UL,
+	0xD807AA98UL, 0x12835B01UL, 0x243185BEUL, 0x550C7DC3UL, 0x72BE5D74UL, 0x80DEB1FEUL, 0x9BDC06A7UL, 0xC19BF174UL,
+	0xE49B69C1UL, 0xEFBE4786UL, 0x0FC19DC6UL, 0x240CA1CCUL, 0x2DE92C6FUL, 0x4A7484AAUL, 0x5CB0A9DCUL, 0x76F988DAUL,
+	0x983E5152UL, 0xA831C66DUL, 0xB00327C8UL, 0xBF597FC7UL, 0xC6E00BF3UL, 0xD5A79147UL, 0x06CA6351UL, 0x14292967UL,
+	0x27B70A85UL, 0x2E1B2138UL, 0x4D2C6DFCUL, 0x53380D13UL, 0x650A7354UL, 0x766A0ABBUL, 0x81C2C92EUL, 0x92722C85UL,
+	0xA2BFE8A1UL, 0xA81A664BUL, 0xC24B8B70UL, 0xC76C51A3UL, 0xD192E819UL, 0xD6990624UL, 0xF40E3585UL, 0x106AA070UL,
+	0x19A4C116UL, 0x1E376C08UL, 0x2748774CUL, 0x34B0BCB5UL, 0x391C0CB3UL, 0x4ED8AA4AUL, 0x5B9CCA4FUL, 0x682E6FF3UL,
+	0x748F82EEUL, 0x78A5636FUL, 0x84C87814UL, 0x8CC70208UL, 0x90BEFFFAUL, 0xA4506CEBUL, 0xBEF9A3F7UL, 0xC67178F2UL
+};
+
+// the per-round shift amounts and sine-derived constants for MD5
+static const UInt8 kMD5Shifts[64] = {
+	7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+	5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+	4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+	6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+static const UInt32 kMD5Constants[64] = {
+	0xD76AA478UL, 0xE8C7B756UL, 0x242070DBUL, 0xC1BDCEEEUL, 0xF57C0FAFUL, 0x4787C62AUL, 0xA8304613UL, 0xFD469501UL,
+	0x698098D8UL, 0x8B44F7AFUL, 0xFFFF5BB1UL, 0x895CD7BEUL, 0x6B901122UL, 0xFD987193UL, 0xA679438EUL, 0x49B40821UL,
+	0xF61E2562UL, 0xC040B340UL, 0x265E5A51UL, 0xE9B6C7AAUL, 0xD62F105DUL, 0x02441453UL, 0xD8A1E681UL, 0xE7D3FBC8UL,
+	0x21E1CDE6UL, 0xC33707D6UL, 0xF4D50D87UL, 0x455A14EDUL, 0xA9E3E905UL, 0xFCEFA3F8UL, 0x676F02D9UL, 0x8D2A4C8AUL,
+	0xFFFA3942UL, 0x8771F681UL, 0x6D9D6122UL, 0xFDE5380CUL, 0xA4BEEA44UL, 0x4BDECFA9UL, 0xF6BB4B60UL, 0xBEBFBC70UL,
+	0x289B7EC6UL, 0xEAA127FAUL, 0xD4EF3085UL, 0x04881D05UL, 0xD9D4D039UL, 0xE6DB99E5UL, 0x1FA27CF8UL, 0xC4AC5665UL,
+	0xF4292244UL, 0x432AFF97UL, 0xAB9423A7UL, 0xFC93A039UL, 0x655B59C3UL, 0x8F0CCC92UL, 0xFFEFF47DUL, 0x85845DD1UL,
+	0x6FA87E4FUL, 0xFE2CE6E0UL, 0xA3014314UL, 0x4E0811A1UL, 0xF7537E82UL, 0xBD3AF235UL, 0x2AD7D2BBUL, 0xEB86D391UL
+};
+
+
+//////////
+//
+// global variables
+//
+//////////
+
+UInt32							gCRC32Tables[4][256];		// the lookup tables for slicing-by-4 CRC-32
+Boolean							gCRC32TablesBuilt = false;	// have we filled in gCRC32Tables yet?
+
+
+//////////
+//
+// QTFileTrans_DigestSize
+// Return the size, in bytes, of a digest of the specified kind, or 0 if we don't know that kind.
+//
+//////////
+
+long QTFileTrans_DigestSize (long theType)
+{
+	switch (theType) {
+		case kQTFileTransDigestCRC32:		return(4);
+		case kQTFileTransDigestMD5:			return(16);
+		case kQTFileTransDigestSHA256:		return(32);
+		default:							return(0);
+	}
+}
+
+
+//////////
+//
+// QTFileTrans_DigestInit
+// Get the specified digest record ready to digest a new stream of data.
+//
+//////////
+
+OSErr QTFileTrans_DigestInit (QTFileTransDigestPtr theDigest, long theType)
+{
+	short			myIndex;
+	short			myBit;
+	UInt32			myValue;
+
+	if (theDigest == NULL)
+		return(paramErr);
+
+	if ((theType != kQTFileTransDigestNone) && (QTFileTrans_DigestSize(theType) == 0))
+		return(paramErr);
+
+	theDigest->fType = theType;
+	theDigest->fNumBytes = 0;
+	theDigest->fBlockUsed = 0L;
+	theDigest->fResultSize = 0L;
+
+	switch (theType) {
+		case kQTFileTransDigestCRC32:
+			// build the lookup tables the first time anyone asks for a CRC-32; every thread that might get here
+			// at the same time fills in exactly the same values, so we don't bother with a lock
+			if (!gCRC32TablesBuilt) {
+				for (myIndex = 0; myIndex < 256; myIndex++) {
+					myValue = (UInt32)myIndex;
+					for (myBit = 0; myBit < 8; myBit++)
+						myValue = (myValue & 1) ? ((myValue >> 1) ^ kCRC32Polynomial) : (myValue >> 1);
+					gCRC32Tables[0][myIndex] = myValue;
+				}
+
+				for (myIndex = 0; myIndex < 256; myIndex++) {
+					gCRC32Tables[1][myIndex] = (gCRC32Tables[0][myIndex] >> 8) ^ gCRC32Tables[0][gCRC32Tables[0][myIndex] & 0xFF];
+					gCRC32Tables[2][myIndex] = (gCRC32Tables[1][myIndex] >> 8) ^ gCRC32Tables[0][gCRC32Tables[1][myIndex] & 0xFF];
+					gCRC32Tables[3][myIndex] = (gCRC32Tables[2][myIndex] >> 8) ^ gCRC32Tables[0][gCRC32Tables[2][myIndex] & 0xFF];
+				}
+
+				gCRC32TablesBuilt = true;
+			}
+
+			theDigest->fState[0] = 0xFFFFFFFFUL;
+			break;
+
+		case kQTFileTransDigestMD5:
+			theDigest->fState[0] = 0x67452301UL;
+			theDigest->fState[1] = 0xEFCDAB89UL;
+			theDigest->fState[2] = 0x98BADCFEUL;
+			theDigest->fState[3] = 0x10325476UL;
+			break;
+
+		case kQTFileTransDigestSHA256:
+			theDigest->fState[0] = 0x6A09E667UL;
+			theDigest->fState[1] = 0xBB67AE85UL;
+			theDigest->fState[2] = 0x3C6EF372UL;
+			theDigest->fState[3] = 0xA54FF53AUL;
+			theDigest->fState[4] = 0x510E527FUL;
+			theDigest->fState[5] = 0x9B05688CUL;
+			theDigest->fState[6] = 0x1F83D9ABUL;
+			theDigest->fState[7] = 0x5BE0CD19UL;
+			break;
+
+		default:
+			break;
+	}
+
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_DigestUpdate
+// Add the specified data to the specified digest.
+//
+//////////
+
+void QTFileTrans_DigestUpdate (QTFileTransDigestPtr theDigest, const UInt8 *theData, long theNumBytes)
+{
+	long			myNumToCopy;
+
+	if ((theDigest == NULL) || (theNumBytes <= 0) || (theDigest->fResultSize > 0))
+		return;
+
+	theDigest->fNumBytes += theNumBytes;
+
+	if (theDigest->fType == kQTFileTransDigestCRC32) {
+		QTFileTrans_CRC32Update(theDigest, theData, theNumBytes);
+		return;
+	}
+
+	if ((theDigest->fType != kQTFileTransDigestMD5) && (theDigest->fType != kQTFileTransDigestSHA256))
+		return;
+
+	// top up a partial block left over from the last call
+	if (theDigest->fBlockUsed > 0) {
+		myNumToCopy = kDigestBlockSize - theDigest->fBlockUsed;
+		if (myNumToCopy > theNumBytes)
+			myNumToCopy = theNumBytes;
+
+		BlockMoveData(theData, theDigest->fBlock + theDigest->fBlockUsed, myNumToCopy);
+		theDigest->fBlockUsed += myNumToCopy;
+		theData += myNumToCopy;
+		theNumBytes -= myNumToCopy;
+
+		if (theDigest->fBlockUsed < kDigestBlockSize)
+			return;
+
+		if (theDigest->fType == kQTFileTransDigestMD5)
+			QTFileTrans_MD5Block(theDigest->fState, theDigest->fBlock);
+		else
+			QTFileTrans_SHA256Block(theDigest->fState, theDigest->fBlock);
+		theDigest->fBlockUsed = 0L;
+	}
+
+	// digest whole blocks right where they are
+	while (theNumBytes >= kDigestBlockSize) {
+		if (theDigest->fType == kQTFileTransDigestMD5)
+			QTFileTrans_MD5Block(theDigest->fState, theData);
+		else
+			QTFileTrans_SHA256Block(theDigest->fState, theData);
+		theData += kDigestBlockSize;
+		theNumBytes -= kDigestBlockSize;
+	}
+
+	// save whatever's left for next time
+	if (theNumBytes > 0) {
+		BlockMoveData(theData, theDigest->fBlock, theNumBytes);
+		theDigest->fBlockUsed = theNumBytes;
+	}
+}
+
+
+//////////
+//
+// QTFileTrans_DigestFinal
+// Finish the specified digest, leaving the result in its fResult field. Once a digest is finished,
+// QTFileTrans_DigestUpdate ignores any more data.
+//
+//////////
+
+void QTFileTrans_DigestFinal (QTFileTransDigestPtr theDigest)
+{
+	UInt64			myNumBits;
+	UInt32			myValue;
+	short			myIndex;
+
+	if ((theDigest == NULL) || (theDigest->fResultSize > 0))
+		return;
+
+	switch (theDigest->fType) {
+		case kQTFileTransDigestCRC32:
+			myValue = theDigest->fState[0] ^ 0xFFFFFFFFUL;
+			theDigest->fResult[0] = (UInt8)(myValue >> 24);
+			theDigest->fResult[1] = (UInt8)(myValue >> 16);
+			theDigest->fResult[2] = (UInt8)(myValue >> 8);
+			theDigest->fResult[3] = (UInt8)myValue;
+			break;
+
+		case kQTFileTransDigestMD5:
+		case kQTFileTransDigestSHA256:
+			// pad the message with a 1 bit, then 0 bits up to 8 bytes short of a block boundary,
+			// then the length of the message in bits (little-endian for MD5, big-endian for SHA-256)
+			myNumBits = theDigest->fNumBytes * 8;
+
+			theDigest->fBlock[theDigest->fBlockUsed++] = 0x80;
+			if (theDigest->fBlockUsed > kDigestBlockSize - 8) {
+				while (theDigest->fBlockUsed < kDigestBlockSize)
+					theDigest->fBlock[theDigest->fBlockUsed++] = 0;
+				if (theDigest->fType == kQTFileTransDigestMD5)
+					QTFileTrans_MD5Block(theDigest->fState, theDigest->fBlock);
+				else
+					QTFileTrans_SHA256Block(theDigest->fState, theDigest->fBlock);
+				theDigest->fBlockUsed = 0L;
+			}
+
+			while (theDigest->fBlockUsed < kDigestBlockSize - 8)
+				theDigest->fBlock[theDigest->fBlockUsed++] = 0;
+
+			for (myIndex = 0; myIndex < 8; myIndex++) {
+				if (theDigest->fType == kQTFileTransDigestMD5)
+					theDigest->fBlock[kDigestBlockSize - 8 + myIndex] = (UInt8)(myNumBits >> (8 * myIndex));
+				else
+					theDigest->fBlock[kDigestBlockSize - 1 - myIndex] = (UInt8)(myNumBits >> (8 * myIndex));
+			}
+
+			if (theDigest->fType == kQTFileTransDigestMD5) {
+				QTFileTrans_MD5Block(theDigest->fState, theDigest->fBlock);
+				for (myIndex = 0; myIndex < 16; myIndex++)
+					theDigest->fResult[myIndex] = (UInt8)(theDigest->fState[myIndex / 4] >> (8 * (myIndex % 4)));
+			} else {
+				QTFileTrans_SHA256Block(theDigest->fState, theDigest->fBlock);
+				for (myIndex = 0; myIndex < 32; myIndex++)
+					theDigest->fResult[myIndex] = (UInt8)(theDigest->fState[myIndex / 4] >> (24 - 8 * (myIndex % 4)));
+			}
+			break;
+
+		default:
+			break;
+	}
+
+	theDigest->fBlockUsed = 0L;
+	theDigest->fResultSize = QTFileTrans_DigestSize(theDigest->fType);
+}
+
+
+//////////
+//
+// QTFileTrans_CRC32Update
+// Add the specified data to the specified CRC-32. We take care of any bytes before the first 4-byte
+// boundary one at a time, then four bytes at a time, and then any bytes left over one at a time.
+//
+//////////
+
+void QTFileTrans_CRC32Update (QTFileTransDigestPtr theDigest, const UInt8 *theData, long theNumBytes)
+{
+	UInt32			myCRC = theDigest->fState[0];
+
+	while ((theNumBytes > 0) && (((unsigned long)theData & 3) != 0)) {
+		myCRC = (myCRC >> 8) ^ gCRC32Tables[0][(myCRC ^ *theData++) & 0xFF];
+		theNumBytes--;
+	}
+
+	while (theNumBytes >= 4) {
+		// we assemble the word byte by byte, so that this works the same on big- and little-endian processors
+		myCRC ^= (UInt32)theData[0] | ((UInt32)theData[1] << 8) | ((UInt32)theData[2] << 16) | ((UInt32)theData[3] << 24);
+		myCRC = gCRC32Tables[3][myCRC & 0xFF] ^
+				gCRC32Tables[2][(myCRC >> 8) & 0xFF] ^
+				gCRC32Tables[1][(myCRC >> 16) & 0xFF] ^
+				gCRC32Tables[0][(myCRC >> 24) & 0xFF];
+		theData += 4;
+		theNumBytes -= 4;
+	}
+
+	while (theNumBytes > 0) {
+		myCRC = (myCRC >> 8) ^ gCRC32Tables[0][(myCRC ^ *theData++) & 0xFF];
+		theNumBytes--;
+	}
+
+	theDigest->fState[0] = myCRC;
+}
+
+
+//////////
+//
+// QTFileTrans_MD5Block
+// Digest one 64-byte block with MD5 (RFC 1321).
+//
+//////////
+
+void QTFileTrans_MD5Block (UInt32 *theState, const UInt8 *theBlock)
+{
+	UInt32			myWords[16];
+	UInt32			myA = theState[0];
+	UInt32			myB = theState[1];
+	UInt32			myC = theState[2];
+	UInt32			myD = theState[3];
+	UInt32			myF;
+	UInt32			myTemp;
+	short			myIndex;
+	short			myWord;
+
+	// MD5 reads its words least significant byte first
+	for (myIndex = 0; myIndex < 16; myIndex++)
+		myWords[myIndex] = (UInt32)theBlock[4 * myIndex] | ((UInt32)theBlock[4 * myIndex + 1] << 8) |
+							((UInt32)theBlock[4 * myIndex + 2] << 16) | ((UInt32)theBlock[4 * myIndex + 3] << 24);
+
+	for (myIndex = 0; myIndex < 64; myIndex++) {
+		if (myIndex < 16) {
+			myF = (myB & myC) | (~myB & myD);
+			myWord = myIndex;
+		} else if (myIndex < 32) {
+			myF = (myD & myB) | (~myD & myC);
+			myWord = (5 * myIndex + 1) % 16;
+		} else if (myIndex < 48) {
+			myF = myB ^ myC ^ myD;
+			myWord = (3 * myIndex + 5) % 16;
+		} else {
+			myF = myC ^ (myB | ~myD);
+			myWord = (7 * myIndex) % 16;
+		}
+
+		myTemp = myD;
+		myD = myC;
+		myC = myB;
+		myF = myA + myF + kMD5Constants[myIndex] + myWords[myWord];
+		myB = myB + kDigestRotateLeft(myF, kMD5Shifts[myIndex]);
+		myA = myTemp;
+	}
+
+	theState[0] += myA;
+	theState[1] += myB;
+	theState[2] += myC;
+	theState[3] += myD;
+}
+
+
+//////////
+//
+// QTFileTrans_SHA256Block
+// Digest one 64-byte block with SHA-256 (FIPS 180-2).
+//
+//////////
+
+void QTFileTrans_SHA256Block (UInt32 *theState, const UInt8 *theBlock)
+{
+	UInt32			myWords[64];
+	UInt32			myVars[8];
+	UInt32			myS0, myS1;
+	UInt32			myTemp1, myTemp2;
+	short			myIndex;
+
+	// SHA-256 reads its words most significant byte first
+	for (myIndex = 0; myIndex < 16; myIndex++)
+		myWords[myIndex] = ((UInt32)theBlock[4 * myIndex] << 24) | ((UInt32)theBlock[4 * myIndex + 1] << 16) |
+							((UInt32)theBlock[4 * myIndex + 2] << 8) | (UInt32)theBlock[4 * myIndex + 3];
+
+	for (myIndex = 16; myIndex < 64; myIndex++) {
+		myS0 = kDigestRotateRight(myWords[myIndex - 15], 7) ^ kDigestRotateRight(myWords[myIndex - 15], 18) ^ (myWords[myIndex - 15] >> 3);
+		myS1 = kDigestRotateRight(myWords[myIndex - 2], 17) ^ kDigestRotateRight(myWords[myIndex - 2], 19) ^ (myWords[myIndex - 2] >> 10);
+		myWords[myIndex] = myWords[myIndex - 16] + myS0 + myWords[myIndex - 7] + myS1;
+	}
+
+	for (myIndex = 0; myIndex < 8; myIndex++)
+		myVars[myIndex] = theState[myIndex];
+
+	for (myIndex = 0; myIndex < 64; myIndex++) {
+		myS1 = kDigestRotateRight(myVars[4], 6) ^ kDigestRotateRight(myVars[4], 11) ^ kDigestRotateRight(myVars[4], 25);
+		myTemp1 = myVars[7] + myS1 + ((myVars[4] & myVars[5]) ^ (~myVars[4] & myVars[6])) + kSHA256Constants[myIndex] + myWords[myIndex];
+		myS0 = kDigestRotateRight(myVars[0], 2) ^ kDigestRotateRight(myVars[0], 13) ^ kDigestRotateRight(myVars[0], 22);
+		myTemp2 = myS0 + ((myVars[0] & myVars[1]) ^ (myVars[0] & myVars[2]) ^ (myVars[1] & myVars[2]));
+
+		myVars[7] = myVars[6];
+		myVars[6] = myVars[5];
+		myVars[5] = myVars[4];
+		myVars[4] = myVars[3] + myTemp1;
+		myVars[3] = myVars[2];
+		myVars[2] = myVars[1];
+		myVars[1] = myVars[0];
+		myVars[0] = myTemp1 + myTemp2;
+	}
+
+	for (myIndex = 0; myIndex < 8; myIndex++)
+		theState[myIndex] += myVars[myIndex];
+}
@@ -0,0 +1,76 @@
+//////////
+//
+//	File:		QTFileTransferDigest.h
+//
+//	Contains:	Checksums and message digests computed on the data of a transfer as it goes by.
+//
+//	Written by:	Tim Monroe
+//
+//	Copyright:	 1998 by Apple Computer, Inc., all rights reserved.
+//
+//	Change History (most recent first):
+//
+//	   <1>	 	11/11/98	rtm		first file
+//
+//////////
+
+#ifndef __QTFILETRANSFERDIGEST__
+#define __QTFILETRANSFERDIGEST__
+
+#include <Movies.h>
+
+
+//////////
+//
+// constants
+//
+//////////
+
+// the kinds of digests we know how to compute
+enum {
+	kQTFileTransDigestNone		= 0,		// don't compute a digest
+	kQTFileTransDigestCRC32		= 1,		// the CRC-32 used by zip and Ethernet (4 bytes, most significant byte first)
+	kQTFileTransDigestMD5		= 2,		// MD5 (16 bytes)
+	kQTFileTransDigestSHA256	= 3			// SHA-256 (32 bytes)
+};
+
+#define kMaxDigestSize			32			// the size, in bytes, of the largest digest we compute
+#define kDigestBlockSize		64			// the size, in bytes, of the blocks MD5 and SHA-256 work on
+
+// the error a transfer reports when the digest of the data doesn't match the one we were told to expect
+#define kQTFileTransDigestMismatchErr	-32000
+
+
+//////////
+//
+// data types
+//
+//////////
+
+// the running state of a digest
+typedef struct QTFileTransDigestRecord {
+	long						fType;						// the kind of digest (kQTFileTransDigestCRC32, and so on)
+	UInt32						fState[8];					// the chaining variables (only fState[0] is used for CRC-32)
+	UInt64						fNumBytes;					// the number of bytes digested so far
+	UInt8						fBlock[kDigestBlockSize];	// a partial block waiting for more data
+	long						fBlockUsed;					// the number of bytes in fBlock
+	UInt8						fResult[kMaxDigestSize];	// the finished digest
+	long						fResultSize;				// the size, in bytes, of fResult (0 until the digest is finished)
+} QTFileTransDigestRecord, *QTFileTransDigestPtr;
+
+
+//////////
+//
+// function prototypes
+//
+//////////
+
+long							QTFileTrans_DigestSize (long theType);
+OSErr							QTFileTrans_DigestInit (QTFileTransDigestPtr theDigest, long theType);
+void							QTFileTrans_DigestUpdate (QTFileTransDigestPtr theDigest, const UInt8 *theData, long theNumBytes);
+void							QTFileTrans_DigestFinal (QTFileTransDigestPtr theDigest);
+void							QTFileTrans_CRC32Update (QTFileTransDigestPtr theDigest, const UInt8 *theData, long theNumBytes);
+void							QTFileTrans_MD5Block (UInt32 *theState, const UInt8 *theBlock);
+void							QTFileTrans_SHA256Block (UInt32 *theState, const UInt8 *theBlock);
+
+#endif // __QTFILETRANSFERDIGEST__
@@ -0,0 +1,336 @@
+//////////
+//
+//	File:		QTFileTransferPool.c
+//
+//	Contains:	A shared pool of data buffers for file transfers.
+//
+//	Written by:	Tim Monroe
+//
+//	Copyright:	 1998 by Apple Computer, Inc., all rights reserved.
+//
+//	Change History (most recent first):
+//
+//	   <1>	 	11/11/98	rtm		first file
+//
+//	Every transfer needs a ring of data buffers, and a program that runs lots of transfers (one after
+//	another, or many at once) would otherwise spend a good deal of time allocating, clearing, and
+//	disposing of them. So the transfers get their buffers from this pool instead: a buffer that a
+//	transfer gives back is kept on a free list, and handed out again to the next transfer that wants
+//	a buffer of about the same size. Once a program has been running for a while, its transfers don't
+//	allocate any memory at all.
+//
+//	Buffers come in size classes (4K, 8K, 16K, and so on, up to 1M); we round each request up to the
+//	next class, so that any free buffer in a class will do for any request in that class. Buffers
+//	larger than the largest class are allocated and disposed of directly. Every buffer is aligned on
+//	a kPoolBufferAlignment-byte boundary, and none of them is cleared: a transfer always reads into a
+//	buffer before it writes from it.
+//
+//	Each class keeps at most the high watermark's worth of free buffers; any buffer given back beyond
+//	that is disposed of right away. QTFileTrans_TrimPool disposes of free buffers down to a given
+//	number per class (you might call it with the low watermark when memory gets tight, or when your
+//	program has finished a burst of transfers).
+//
+//	Worker threads get their buffers from the same pool, so the pool has a lock. The lock routines, which the
+//	download cache and the alias cache use too, are at the end of this file (see QTFileTrans_SpinLock).
+//
+//////////
+
+#include "QTFileTransferPool.h"
+
+#if TARGET_OS_WIN32
+#include <windows.h>
+#endif
+
+
+//////////
+//
+// global variables
+//
+//////////
+
+QTFileTransPoolHeaderPtr		gPoolFree[kPoolNumClasses];	// the free buffers in each size class
+long							gPoolNumFree[kPoolNumClasses];	// the number of free buffers in each size class
+long							gPoolLowWater = kPoolDefaultLowWater;	// the free buffers per class QTFileTrans_TrimPool keeps, by default
+long							gPoolHighWater = kPoolDefaultHighWater;	// the most free buffers per class we keep
+QTFileTransPoolStatsRecord		gPoolStats;					// statistics about the pool
+volatile long					gPoolLock = 0L;				// nonzero while some thread is using the pool
+
+
+//////////
+//
+// QTFileTrans_PoolSizeClass
+// Return the smallest size class whose buffers can hold theSize bytes, or kPoolOversizeClass if none can.
+//
+//////////
+
+short QTFileTrans_PoolSizeClass (long theSize)
+{
+	long			myClassSize = kPoolMinClassSize;
+	short			myClass;
+
+	for (myClass = 0; myClass < kPoolNumClasses; myClass++) {
+		if (theSize <= myClassSize)
+			return(myClass);
+		myClassSize *= 2;
+	}
+
+	return(kPoolOversizeClass);
+}
+
+
+//////////
+//
+// QTFileTrans_AllocBuffer
+// Get a buffer of at least theSize bytes, from the pool if possible. The buffer is not cleared.
+// Give the buffer back with QTFileTrans_ReleaseBuffer, not DisposePtr.
+//
+//////////
+
+OSErr QTFileTrans_AllocBuffer (long theSize, Ptr *theBuffer)
+{
+	QTFileTransPoolHeaderPtr	myHeader = NULL;
+	Ptr							myBlock = NULL;
+	unsigned long				myAddress;
+	short						myClass;
+	long						mySize;
+	OSErr						myErr = noErr;
+
+	if ((theBuffer == NULL) || (theSize <= 0))
+		return(paramErr);
+
+	*theBuffer = NULL;
+
+	myClass = QTFileTrans_PoolSizeClass(theSize);
+	mySize = (myClass == kPoolOversizeClass) ? theSize : (kPoolMinClassSize << myClass);
+
+	QTFileTrans_SpinLock(&gPoolLock);
+
+	gPoolStats.fNumAllocs++;
+
+	if ((myClass != kPoolOversizeClass) && (gPoolFree[myClass] != NULL)) {
+		// there's a free buffer in this class, so hand it out
+		myHeader = gPoolFree[myClass];
+		gPoolFree[myClass] = myHeader->fNextFree;
+		gPoolNumFree[myClass]--;
+
+		gPoolStats.fNumHits++;
+		gPoolStats.fNumFree--;
+		gPoolStats.fBytesFree -= mySize;
+	} else {
+		// we have to allocate a new buffer; we leave room in front of it for its header, and for aligning it
+		myBlock = NewPtr(mySize + sizeof(QTFileTransPoolHeader) + kPoolBufferAlignment);
+		if (myBlock == NULL) {
+			myErr = MemError();
+			if (myErr == noErr)
+				myErr = memFullErr;
+			goto bail;
+		}
+
+		myAddress = (unsigned long)myBlock + sizeof(QTFileTransPoolHeader);
+		myAddress = (myAddress + kPoolBufferAlignment - 1) & ~((unsigned long)kPoolBufferAlignment - 1);
+
+		myHeader = (QTFileTransPoolHeaderPtr)(myAddress - sizeof(QTFileTransPoolHeader));
+		myHeader->fBlock = myBlock;
+		myHeader->fSize = mySize;
+		myHeader->fClass = myClass;
+
+		gPoolStats.fNumMisses++;
+		if (myClass == kPoolOversizeClass)
+			gPoolStats.fNumOversize++;
+	}
+
+	myHeader->fNextFree = NULL;
+
+	gPoolStats.fNumInUse++;
+	gPoolStats.fBytesInUse += mySize;
+	if (gPoolStats.fBytesInUse > gPoolStats.fPeakBytesInUse)
+		gPoolStats.fPeakBytesInUse = gPoolStats.fBytesInUse;
+
+	*theBuffer = (Ptr)(myHeader + 1);
+
+bail:
+	QTFileTrans_SpinUnlock(&gPoolLock);
+	return(myErr);
+}
+
+
+//////////
+//
+// QTFileTrans_ReleaseBuffer
+// Give back a buffer we got from QTFileTrans_AllocBuffer. We keep it for the next request in its
+// size class, unless that class already has as many free buffers as the high watermark allows.
+//
+//////////
+
+void QTFileTrans_ReleaseBuffer (Ptr theBuffer)
+{
+	QTFileTransPoolHeaderPtr	myHeader = NULL;
+	short						myClass;
+
+	if (theBuffer == NULL)
+		return;
+
+	myHeader = (QTFileTransPoolHeaderPtr)theBuffer - 1;
+	myClass = myHeader->fClass;
+
+	QTFileTrans_SpinLock(&gPoolLock);
+
+	gPoolStats.fNumReleases++;
+	gPoolStats.fNumInUse--;
+	gPoolStats.fBytesInUse -= myHeader->fSize;
+
+	if ((myClass != kPoolOversizeClass) && (gPoolNumFree[myClass] < gPoolHighWater)) {
+		myHeader->fNextFree = gPoolFree[myClass];
+		gPoolFree[myClass] = myHeader;
+		gPoolNumFree[myClass]++;
+
+		gPoolStats.fNumFree++;
+		gPoolStats.fBytesFree += myHeader->fSize;
+		myHeader = NULL;
+	} else {
+		gPoolStats.fNumDisposed++;
+	}
+
+	QTFileTrans_SpinUnlock(&gPoolLock);
+
+	// we don't need the lock to dispose of a buffer nobody else knows about
+	if (myHeader != NULL)
+		DisposePtr(myHeader->fBlock);
+}
+
+
+//////////
+//
+// QTFileTrans_GetBufferSize
+// Return the usable size, in bytes, of a buffer we got from QTFileTrans_AllocBuffer (which may be more
+// than the size that was asked for).
+//
+//////////
+
+long QTFileTrans_GetBufferSize (Ptr theBuffer)
+{
+	if (theBuffer == NULL)
+		return(0L);
+
+	return(((QTFileTransPoolHeaderPtr)theBuffer - 1)->fSize);
+}
+
+
+//////////
+//
+// QTFileTrans_SetPoolWatermarks
+// Set the number of free buffers per size class that QTFileTrans_TrimPool keeps by default (theLowWater)
+// and the most free buffers per size class the pool ever keeps (theHighWater). If the pool already holds
+// more free buffers than the new high watermark, we dispose of the extra ones now.
+//
+//////////
+
+OSErr QTFileTrans_SetPoolWatermarks (long theLowWater, long theHighWater)
+{
+	if ((theLowWater < 0) || (theHighWater < theLowWater))
+		return(paramErr);
+
+	QTFileTrans_SpinLock(&gPoolLock);
+	gPoolLowWater = theLowWater;
+	gPoolHighWater = theHighWater;
+	QTFileTrans_SpinUnlock(&gPoolLock);
+
+	QTFileTrans_TrimPool(theHighWater);
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_GetPoolStats
+// Return the current statistics for the pool.
+//
+//////////
+
+void QTFileTrans_GetPoolStats (QTFileTransPoolStatsPtr theStats)
+{
+	if (theStats == NULL)
+		return;
+
+	QTFileTrans_SpinLock(&gPoolLock);
+	*theStats = gPoolStats;
+	QTFileTrans_SpinUnlock(&gPoolLock);
+}
+
+
+//////////
+//
+// QTFileTrans_TrimPool
+// Dispose of free buffers until no size class has more than theMaxFree of them; pass -1 to trim the
+// pool down to its low watermark, or 0 to empty it.
+//
+//////////
+
+void QTFileTrans_TrimPool (long theMaxFree)
+{
+	QTFileTransPoolHeaderPtr	myHeader = NULL;
+	short						myClass;
+
+	for (myClass = 0; myClass < kPoolNumClasses; myClass++) {
+		for (;;) {
+			QTFileTrans_SpinLock(&gPoolLock);
+
+			myHeader = NULL;
+			if (gPoolNumFree[myClass] > ((theMaxFree < 0) ? gPoolLowWater : theMaxFree)) {
+				myHeader = gPoolFree[myClass];
+				gPoolFree[myClass] = myHeader->fNextFree;
+				gPoolNumFree[myClass]--;
+
+				gPoolStats.fNumFree--;
+				gPoolStats.fBytesFree -= myHeader->fSize;
+				gPoolStats.fNumDisposed++;
+			}
+
+			QTFileTrans_SpinUnlock(&gPoolLock);
+
+			if (myHeader == NULL)
+				break;
+
+			DisposePtr(myHeader->fBlock);
+		}
+	}
+}
+
+
+//////////
+//
+// QTFileTrans_SpinLock
+// Get exclusive use of whatever the specified lock protects (the buffer pool, the download cache, or the
+// alias cache). Worker threads share these with the main thread, so on Windows each of them has a lock;
+// elsewhere, everything happens on the main thread and a lock does nothing. Each lock is held for only a
+// few instructions at a time (nobody copies a file while holding one), so a thread that finds the lock
+// taken just gives up the rest of its time slice and tries again.
+//
+//////////
+
+void QTFileTrans_SpinLock (volatile long *theLock)
+{
+#if TARGET_OS_WIN32
+	while (InterlockedExchange((LONG volatile *)theLock, 1) != 0)
+		Sleep(0);
+#else
+#pragma unused(theLock)
+#endif
+}
+
+
+//////////
+//
+// QTFileTrans_SpinUnlock
+// Give up exclusive use of whatever the specified lock protects.
+//
+//////////
+
+void QTFileTrans_SpinUnlock (volatile long *theLock)
+{
+#if TARGET_OS_WIN32
+	InterlockedExchange((LONG volatile *)theLock, 0);
+#else
+#pragma unused(theLock)
+#endif
+}
@@ -0,0 +1,83 @@
+//////////
+//
+//	File:		QTFileTransferPool.h
+//
+//	Contains:	A shared pool of data buffers for file transfers.
+//
+//	Written by:	Tim Monroe
+//
+//	Copyright:	 1998 by Apple Computer, Inc., all rights reserved.
+//
+//	Change History (most recent first):
+//
+//	   <1>	 	11/11/98	rtm		first file
+//
+//////////
+
+#ifndef __QTFILETRANSFERPOOL__
+#define __QTFILETRANSFERPOOL__
+
+#include <Movies.h>
+
+
+//////////
+//
+// constants
+//
+//////////
+
+#define kPoolMinClassSize		1024*4		// the size, in bytes, of the buffers in the smallest size class
+#define kPoolNumClasses			9			// the number of size classes (4K, 8K, and so on, up to 1M)
+#define kPoolBufferAlignment	32			// the alignment, in bytes, of every buffer we hand out
+#define kPoolDefaultLowWater	0			// the number of free buffers per class we keep when the pool is trimmed
+#define kPoolDefaultHighWater	16			// the most free buffers per class we keep at any time
+#define kPoolOversizeClass		-1			// the "class" of a buffer too big for any size class
+
+
+//////////
+//
+// data types
+//
+//////////
+
+// the header that precedes every buffer we hand out
+typedef struct QTFileTransPoolHeader {
+	Ptr							fBlock;						// the block we got from the Memory Manager
+	long						fSize;						// the usable size, in bytes, of the buffer
+	short						fClass;						// the size class of the buffer, or kPoolOversizeClass
+	struct QTFileTransPoolHeader	*fNextFree;				// the next free buffer in the same class
+} QTFileTransPoolHeader, *QTFileTransPoolHeaderPtr;
+
+// statistics about the pool
+typedef struct QTFileTransPoolStatsRecord {
+	long						fNumAllocs;					// the number of buffers asked for
+	long						fNumHits;					// the number of those we handed out from the pool
+	long						fNumMisses;					// the number of those we had to allocate
+	long						fNumOversize;				// the number of those too big for any size class
+	long						fNumReleases;				// the number of buffers given back
+	long						fNumDisposed;				// the number of buffers we've given back to the Memory Manager
+	long						fNumInUse;					// the number of buffers handed out and not given back yet
+	long						fNumFree;					// the number of buffers waiting in the pool
+	SInt64						fBytesInUse;				// the total size of the buffers in use
+	SInt64						fBytesFree;					// the total size of the buffers waiting in the pool
+	SInt64						fPeakBytesInUse;			// the largest fBytesInUse has ever been
+} QTFileTransPoolStatsRecord, *QTFileTransPoolStatsPtr;
+
+
+//////////
+//
+// function prototypes
+//
+//////////
+
+OSErr							QTFileTrans_AllocBuffer (long theSize, Ptr *theBuffer);
+void							QTFileTrans_ReleaseBuffer (Ptr theBuffer);
+long							QTFileTrans_GetBufferSize (Ptr theBuffer);
+OSErr							QTFileTrans_SetPoolWatermarks (long theLowWater, long theHighWater);
+void							QTFileTrans_GetPoolStats (QTFileTransPoolStatsPtr theStats);
+void							QTFileTrans_TrimPool (long theMaxFree);
+short							QTFileTrans_PoolSizeClass (long theSize);
+void							QTFileTrans_SpinLock (volatile long *theLock);
+void							QTFileTrans_SpinUnlock (volatile long *theLock);
+
+#endif // __QTFILETRANSFERPOOL__
@@ -0,0 +1,315 @@
+//////////
+//
+//	File:		QTFileTransferTrace.c
+//
+//	Contains:	A timeline of the data handler calls made by all transfers, for diagnosing slow transfers.
+//
+//	Written by:	Tim Monroe
+//
+//	Copyright:	 1998 by Apple Computer, Inc., all rights reserved.
+//
+//	Change History (most recent first):
+//
+//	   <1>	 	11/11/98	rtm		first file
+//
+//	The statistics QTFileTrans_GetStats returns tell you that a transfer was slow, and roughly where the time
+//	went; to see why, you need to see the individual calls. Call QTFileTrans_StartTracing, and every transfer
+//	records an event each time it starts and finishes opening its data handlers, calls DataHGetFileSize, issues
+//	a read or a write, sees one complete, and closes its data handlers. Each event carries a timestamp, the
+//	offset and size of the chunk (if there is one), and the result of the call. QTFileTrans_ExportTrace writes
+//	the events out in the Chrome trace event format, so you can load them into chrome://tracing (or any other
+//	viewer that reads that format) and see each transfer as a timeline, with every read and write as a bar.
+//
+//	Tracing is meant to be left on in production: the events go into a ring (which you size when you start
+//	tracing), so a program that runs for days keeps only the most recent events, and recording an event just
+//	claims the next slot in the ring and fills it in. While tracing is off, each trace point costs a single
+//	test of a global variable; define QTFILETRANS_TRACING as 0 to compile the trace points out altogether.
+//
+//	Worker threads record into the same ring; on Windows, they claim slots with InterlockedIncrement, so no
+//	lock is needed. An event recorded while you're exporting the trace might come out garbled, so stop tracing
+//	(or accept that) before exporting. Don't start tracing or dispose of the trace while transfers are running
+//	on worker threads.
+//
+//////////
+
+#include "QTFileTransfer.h"
+
+#if TARGET_OS_WIN32
+#include <windows.h>
+#endif
+
+
+//////////
+//
+// global variables
+//
+//////////
+
+Boolean							gTraceEnabled = false;		// are we recording events?
+QTFileTransTraceEventPtr		gTraceEvents = NULL;		// the ring of events
+unsigned long					gTraceMaxEvents = 0L;		// the number of events the ring holds (a power of 2)
+volatile long					gTraceNumEvents = 0L;		// the number of events recorded since tracing started
+SInt64							gTraceStartTime = 0;		// the time (in microseconds) at which tracing started
+long							gTraceNextID = 1L;			// the trace ID of the next transfer
+
+
+//////////
+//
+// QTFileTrans_StartTracing
+// Start recording events, keeping the most recent theMaxEvents of them (or kTraceDefaultMaxEvents, if theMaxEvents
+// is 0); we round theMaxEvents up to a power of 2. Any events recorded earlier are thrown away.
+//
+//////////
+
+OSErr QTFileTrans_StartTracing (long theMaxEvents)
+{
+	unsigned long				myMaxEvents = 1L;
+
+	if (theMaxEvents < 0L)
+		return(paramErr);
+
+	if (theMaxEvents == 0L)
+		theMaxEvents = kTraceDefaultMaxEvents;
+
+	while ((myMaxEvents < (unsigned long)theMaxEvents) && (myMaxEvents < 0x40000000L))
+		myMaxEvents <<= 1;
+
+	gTraceEnabled = false;
+
+	if ((gTraceEvents == NULL) || (gTraceMaxEvents != myMaxEvents)) {
+		QTFileTrans_DisposeTrace();
+
+		gTraceEvents = (QTFileTransTraceEventPtr)NewPtr(myMaxEvents * sizeof(QTFileTransTraceEventRecord));
+		if (gTraceEvents == NULL)
+			return(memFullErr);
+
+		gTraceMaxEvents = myMaxEvents;
+	}
+
+	gTraceNumEvents = 0L;
+	gTraceStartTime = QTFileTrans_GetMicroseconds64();
+	gTraceEnabled = true;
+
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_StopTracing
+// Stop recording events; the events recorded so far are kept, so that you can export them.
+//
+//////////
+
+void QTFileTrans_StopTracing (void)
+{
+	gTraceEnabled = false;
+}
+
+
+//////////
+//
+// QTFileTrans_DisposeTrace
+// Stop recording events, and throw away the ring.
+//
+//////////
+
+void QTFileTrans_DisposeTrace (void)
+{
+	gTraceEnabled = false;
+
+	if (gTraceEvents != NULL)
+		DisposePtr((Ptr)gTraceEvents);
+
+	gTraceEvents = NULL;
+	gTraceMaxEvents = 0L;
+	gTraceNumEvents = 0L;
+}
+
+
+//////////
+//
+// QTFileTrans_GetTraceCount
+// Return the number of events in the ring. QTFileTrans_ExportTrace needs at most kTraceMaxEventText bytes
+// for each of them, plus kTraceTextOverhead bytes.
+//
+//////////
+
+long QTFileTrans_GetTraceCount (void)
+{
+	if ((unsigned long)gTraceNumEvents > gTraceMaxEvents)
+		return((long)gTraceMaxEvents);
+
+	return(gTraceNumEvents);
+}
+
+
+//////////
+//
+// QTFileTrans_ExportTrace
+// Write the events in the ring, oldest first, into theText as a JSON object in the Chrome trace event format.
+// Each transfer is a thread of its own; opening the data handlers is a duration event, each read and write is
+// an asynchronous event (identified by its transfer and the offset of its chunk), and the rest are instant
+// events. Times are in microseconds since tracing started. Return paramErr if theText isn't big enough.
+//
+//////////
+
+OSErr QTFileTrans_ExportTrace (char *theText, long theTextSize)
+{
+	unsigned long				myFirst;
+	unsigned long				myLast;
+	long						myLength = 0L;
+
+	if ((theText == NULL) || (theTextSize <= 0L))
+		return(paramErr);
+
+	theText[0] = '\0';
+
+	myLast = (unsigned long)gTraceNumEvents;
+	myFirst = (myLast > gTraceMaxEvents) ? myLast - gTraceMaxEvents : 0L;
+
+	QTFileTrans_AppendText(theText, theTextSize, &myLength, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+	for (; myFirst != myLast; myFirst++)
+		QTFileTrans_AppendTraceEvent(theText, theTextSize, &myLength, &gTraceEvents[myFirst & (gTraceMaxEvents - 1)]);
+
+	// replace the comma after the last event with the closing brackets
+	if ((myLength > 0) && (theText[myLength - 1] == ','))
+		theText[--myLength] = '\0';
+	QTFileTrans_AppendText(theText, theTextSize, &myLength, "]}");
+
+	// if the text got cut off, there was no room for the closing brackets
+	if ((myLength < 2) || (theText[myLength - 2] != ']') || (theText[myLength - 1] != '}'))
+		return(paramErr);
+
+	return(noErr);
+}
+
+
+//////////
+//
+// QTFileTrans_NewTraceID
+// Return the trace ID for a new transfer; the IDs are what tell the transfers apart in the timeline.
+//
+//////////
+
+long QTFileTrans_NewTraceID (void)
+{
+	return(gTraceNextID++);
+}
+
+
+//////////
+//
+// QTFileTrans_TraceEvent
+// Record an event in the ring, overwriting the oldest event if the ring is full. Call this through the
+// QTFileTrans_Trace macro, which doesn't call it at all unless we're tracing.
+//
+//////////
+
+void QTFileTrans_TraceEvent (long theTransferID, short theEvent, SInt64 theOffset, SInt64 theSize, OSErr theErr)
+{
+	QTFileTransTraceEventPtr	myEvent = NULL;
+	unsigned long				myIndex;
+
+	if (gTraceEvents == NULL)
+		return;
+
+	// claim the next slot
+#if TARGET_OS_WIN32
+	myIndex = (unsigned long)InterlockedIncrement((LONG volatile *)&gTraceNumEvents) - 1;
+#else
+	myIndex = (unsigned long)gTraceNumEvents++;
+#endif
+
+	myEvent = &gTraceEvents[myIndex & (gTraceMaxEvents - 1)];
+	myEvent->fTime = QTFileTrans_GetMicroseconds64() - gTraceStartTime;
+	myEvent->fTransferID = theTransferID;
+	myEvent->fOffset = theOffset;
+	myEvent->fSize = theSize;
+	myEvent->fEvent = theEvent;
+	myEvent->fErr = theErr;
+}
+
+
+//////////
+//
+// QTFileTrans_AppendTraceEvent
+// Append the specified event to theText as a Chrome trace event, followed by a comma.
+//
+//////////
+
+void QTFileTrans_AppendTraceEvent (char *theText, long theTextSize, long *theLength, QTFileTransTraceEventPtr theEvent)
+{
+	char						*myName = NULL;
+	char						*myCategory = NULL;
+	char						*myPhase = NULL;
+	Boolean						myIsChunk = false;
+
+	switch (theEvent->fEvent) {
+		case kQTFileTransTraceOpenStart:
+			myName = "open"; myCategory = "transfer"; myPhase = "B";
+			break;
+		case kQTFileTransTraceOpenEnd:
+			myName = "open"; myCategory = "transfer"; myPhase = "E";
+			break;
+		case kQTFileTransTraceGetFileSize:
+			myName = "getFileSize"; myCategory = "transfer"; myPhase = "i";
+			break;
+		case kQTFileTransTraceReadIssue:
+			myName = "read"; myCategory = "read"; myPhase = "b"; myIsChunk = true;
+			break;
+		case kQTFileTransTraceReadComplete:
+			myName = "read"; myCategory = "read"; myPhase = "e"; myIsChunk = true;
+			break;
+		case kQTFileTransTraceWriteIssue:
+			myName = "write"; myCategory = "write"; myPhase = "b"; myIsChunk = true;
+			break;
+		case kQTFileTransTraceWriteComplete:
+			myName = "write"; myCategory = "write"; myPhase = "e"; myIsChunk = true;
+			break;
+		case kQTFileTransTraceClose:
+			myName = "close"; myCategory = "transfer"; myPhase = "i";
+			break;
+		default:
+			return;
+	}
+
+	QTFileTrans_AppendText(theText, theTextSize, theLength, "{\"name\":\"");
+	QTFileTrans_AppendText(theText, theTextSize, theLength, myName);
+	QTFileTrans_AppendText(theText, theTextSize, theLength, "\",\"cat\":\"");
+	QTFileTrans_AppendText(theText, theTextSize, theLength, myCategory);
+	QTFileTrans_AppendText(theText, theTextSize, theLength, "\",\"ph\":\"");
+	QTFileTrans_AppendText(theText, theTextSize, theLength, myPhase);
+	QTFileTrans_AppendText(theText, theTextSize, theLength, "\",");
+
+	// an asynchronous event is matched up with its end by its ID, which we make from the transfer and the offset
+	// of the chunk (a chunk has only one read, or write, outstanding at a time): "transfer:offset"
+	if (myIsChunk) {
+		QTFileTrans_AppendText(theText, theTextSize, theLength, "\"id\":\"");
+		QTFileTrans_AppendNumber(theText, theTextSize, theLength, NULL, theEvent->fTransferID);
+		if (theText[*theLength - 1] == ',')
+			theText[*theLength - 1] = ':';
+		QTFileTrans_AppendNumber(theText, theTextSize, theLength, NULL, theEvent->fOffset);
+		if (theText[*theLength - 1] == ',')
+			theText[--(*theLength)] = '\0';
+		QTFileTrans_AppendText(theText, theTextSize, theLength, "\",");
+	}
+
+	// an instant event applies to its thread only
+	if (myPhase[0] == 'i')
+		QTFileTrans_AppendText(theText, theTextSize, theLength, "\"s\":\"t\",");
+
+	QTFileTrans_AppendNumber(theText, theTextSize, theLength, "ts", theEvent->fTime);
+	QTFileTrans_AppendNumber(theText, theTextSize, theLength, "pid", 1);
+	QTFileTrans_AppendNumber(theText, theTextSize, theLength, "tid", theEvent->fTransferID);
+
+	QTFileTrans_AppendText(theText, theTextSize, theLength, "\"args\":{");
+	QTFileTrans_AppendNumber(theText, theTextSize, theLength, "offset", theEvent->fOffset);
+	QTFileTrans_AppendNumber(theText, theTextSize, theLength, "size", theEvent->fSize);
+	QTFileTrans_AppendNumber(theText, theTextSize, theLength, "err", theEvent->fErr);
+
+	// replace the comma after the last argument with the closing braces
+	if (theText[*theLength - 1] == ',')
+		theText[--(*theLength)] = '\0';
+	QTFileTrans_AppendText(theText, theTextSize, theLength, "}},");
+}
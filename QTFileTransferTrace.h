@@ -0,0 +1,107 @@
+//////////
+//
+//	File:		QTFileTransferTrace.h
+//
+//	Contains:	A timeline of the data handler calls made by all transfers, for diagnosing slow transfers.
+//
+//	Written by:	Tim Monroe
+//
+//	Copyright:	 1998 by Apple Computer, Inc., all rights reserved.
+//
+//	Change History (most recent first):
+//
+//	   <1>	 	11/11/98	rtm		first file
+//
+//////////
+
+#ifndef __QTFILETRANSFERTRACE__
+#define __QTFILETRANSFERTRACE__
+
+#include <Movies.h>
+
+
+//////////
+//
+// constants
+//
+//////////
+
+// define this as 0 to compile the trace points out altogether
+#ifndef QTFILETRANS_TRACING
+#define QTFILETRANS_TRACING		1
+#endif
+
+#define kTraceDefaultMaxEvents	8192		// the number of events we keep, by default, before we start overwriting the oldest
+#define kTraceMaxEventText		200			// the most text, in bytes, QTFileTrans_ExportTrace writes for one event
+#define kTraceTextOverhead		64			// the text, in bytes, QTFileTrans_ExportTrace writes around the events
+
+// the kinds of events we record
+enum {
+	kQTFileTransTraceOpenStart		= 1,		// a transfer started opening its data handlers
+	kQTFileTransTraceOpenEnd		= 2,		// the data handlers are open (or the transfer failed to start)
+	kQTFileTransTraceGetFileSize	= 3,		// DataHGetFileSize returned (the size is -1 if it failed)
+	kQTFileTransTraceReadIssue		= 4,		// a read was issued
+	kQTFileTransTraceReadComplete	= 5,		// a read completed
+	kQTFileTransTraceWriteIssue		= 6,		// a write (or a hand-off to a memory or callback sink) was issued
+	kQTFileTransTraceWriteComplete	= 7,		// a write completed
+	kQTFileTransTraceClose			= 8			// a transfer closed its data handlers (the size is the number of bytes transferred)
+};
+
+
+//////////
+//
+// data types
+//
+//////////
+
+// one event in the timeline
+typedef struct QTFileTransTraceEventRecord {
+	SInt64						fTime;						// the time (in microseconds, since tracing started) of the event
+	long						fTransferID;				// the transfer the event belongs to
+	SInt64						fOffset;					// the offset of the chunk, or 0
+	SInt64						fSize;						// the size, in bytes, of the chunk (or of the file), or 0
+	short						fEvent;						// the kind of event
+	OSErr						fErr;						// the result of the call, if it has one
+} QTFileTransTraceEventRecord, *QTFileTransTraceEventPtr;
+
+
+//////////
+//
+// global variables
+//
+//////////
+
+extern Boolean					gTraceEnabled;				// are we recording events?
+
+
+//////////
+//
+// macros
+//
+//////////
+
+// record an event for the specified transfer, if we're tracing; when we aren't, this costs one test of a global
+#if QTFILETRANS_TRACING
+#define QTFileTrans_Trace(theTransfer, theEvent, theOffset, theSize, theErr)		\
+		(gTraceEnabled ? QTFileTrans_TraceEvent((theTransfer)->fTraceID, (theEvent), (theOffset), (theSize), (theErr)) : (void)0)
+#else
+#define QTFileTrans_Trace(theTransfer, theEvent, theOffset, theSize, theErr)		((void)0)
+#endif
+
+
+//////////
+//
+// function prototypes
+//
+//////////
+
+OSErr							QTFileTrans_StartTracing (long theMaxEvents);
+void							QTFileTrans_StopTracing (void);
+void							QTFileTrans_DisposeTrace (void);
+long							QTFileTrans_GetTraceCount (void);
+OSErr							QTFileTrans_ExportTrace (char *theText, long theTextSize);
+long							QTFileTrans_NewTraceID (void);
+void							QTFileTrans_TraceEvent (long theTransferID, short theEvent, SInt64 theOffset, SInt64 theSize, OSErr theErr);
+void							QTFileTrans_AppendTraceEvent (char *theText, long theTextSize, long *theLength, QTFileTransTraceEventPtr theEvent);
+
+#endif // __QTFILETRANSFERTRACE__